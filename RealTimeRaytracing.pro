@@ -40,7 +40,13 @@ QMAKE_CXXFLAGS += -Wno-inconsistent-missing-override
 
 
 OTHER_FILES += \
-    cl_files/raytracing.cl
+    cl_files/raytracing.cl \
+    cl_files/prefix_sum.cl \
+    cl_files/radix_sort.cl \
+    cl_files/denoise.cl \
+    cl_files/instances.cl \
+    cl_files/lbvh.cl \
+    cl_files/grid.cl
 
 RESOURCES += \
     kernels.qrc
@@ -0,0 +1,1000 @@
+#include "benchmark.h"
+
+#include <instancing.h>
+#include <mesh.h>
+#include <scene.h>
+#include <spheregrid.h>
+#include <timer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/rotate_vector.hpp>
+
+static const int PERSISTENT_TILE_SIZES[] = {8, 16, 32, 64};
+
+// Orbit step of the reprojection benchmark, about the rotate mode at 60 FPS
+static const float ORBIT_DEGREES_PER_FRAME = 0.3f;
+
+// Jittered samples per pixel of the image the denoised frames are compared against
+static const int DENOISE_REFERENCE_SAMPLES = 64;
+static const int DENOISE_SAMPLE_COUNTS[] = {1, 2, 4, 8, 16};
+
+// Depth limits of the path termination benchmark, the last one is rarely reached
+static const int PATH_MAX_BOUNCES[] = {2, 6, 16, 64};
+
+// Rings and sides of the benchmark tori, 10k, 100k and 1M triangles
+static const int MESH_TORUS_RESOLUTIONS[][2] = {{100, 50}, {320, 160}, {1000, 500}};
+
+// Instances per side of the instancing benchmark grids, the largest flattens to 2048 spheres
+static const int INSTANCE_GRID_SIZES[] = {4, 8, 16};
+
+// Spheres per side of the cube every grid instance places
+static const int INSTANCE_GROUP_SIDE = 2;
+
+// Random sphere fields of the acceleration benchmark, the linear loop only traces the smaller ones
+static const int ACCELERATION_SPHERE_COUNTS[] = {1024, 16384, 131072, 1048576};
+static const int LINEAR_LOOP_MAX_SPHERES = 16384;
+
+// Rays traced on the host through the sphere grid and the linear loop
+static const int HOST_RAY_COUNT = 4096;
+
+// Float4 frame read back to the host, y axis flipped
+struct HostFrame
+{
+    int width;
+    int height;
+    std::vector<float> rgba;
+
+    HostFrame() : width(0), height(0)
+    {
+
+    }
+};
+
+// Root mean square error over the color channels of two frames, alpha is the material
+static double computeColorRmse(const HostFrame & a, const HostFrame & b)
+{
+    if(a.rgba.empty() || a.rgba.size() != b.rgba.size())
+    {
+        return -1.0;
+    }
+
+    double sum = 0.0;
+    for(size_t i = 0 ; i < a.rgba.size(); i += 4)
+    {
+        for(size_t c = 0 ; c < 3; c++)
+        {
+            double diff = a.rgba[i + c] - b.rgba[i + c];
+            sum += diff * diff;
+        }
+    }
+    return std::sqrt(sum / (3 * (a.rgba.size() / 4)));
+}
+
+// Averages the given number of frames with accumulation and reads the average back
+static HostFrame renderAccumulated(RayTracing & raytracer, int samples)
+{
+    HostFrame frame;
+    raytracer.setReadbackCallback([&frame] (const ReadbackFrame & readback)
+    {
+        // Frames arrive in order, the last one is the full average
+        size_t numPixels = static_cast<size_t>(readback.width) * readback.height;
+        frame.width = readback.width;
+        frame.height = readback.height;
+        frame.rgba.resize(4 * numPixels);
+        for(size_t i = 0 ; i < numPixels; i++)
+        {
+            unpackColor(readback.format, readback.pixels, i, &frame.rgba[4 * i]);
+        }
+    });
+
+    // Restarts the average
+    raytracer.setAccumulationEnabled(true);
+    for(int i = 0 ; i < samples; i++)
+    {
+        raytracer.update();
+    }
+    raytracer.flushReadback();
+    raytracer.setReadbackCallback(nullptr);
+    return frame;
+}
+
+Benchmark::Benchmark(RayTracing & raytracer, int frames) : _raytracer(raytracer), _frames(frames)
+{
+
+}
+
+BenchmarkResult & Benchmark::run(const std::string & group, const std::string & name, std::function<void()> setup, std::function<void()> teardown)
+{
+    if(setup)
+    {
+        setup();
+    }
+
+    BenchmarkResult result;
+    result.group = group;
+    result.name = name;
+    result.milliSec = _raytracer.measureTraceTime(_frames);
+    _results.push_back(result);
+
+    std::cout << group << " / " << name << ": " << result.milliSec << " ms" << std::endl;
+
+    if(teardown)
+    {
+        teardown();
+    }
+    return _results.back();
+}
+
+BenchmarkResult & Benchmark::measure(const std::string & group, const std::string & name, std::function<double()> measurement)
+{
+    BenchmarkResult result;
+    result.group = group;
+    result.name = name;
+    result.milliSec = measurement();
+    _results.push_back(result);
+
+    std::cout << group << " / " << name << ": " << result.milliSec << " ms" << std::endl;
+
+    return _results.back();
+}
+
+int Benchmark::getFrames() const
+{
+    return _frames;
+}
+
+const std::vector<BenchmarkResult> & Benchmark::getResults() const
+{
+    return _results;
+}
+
+std::string Benchmark::getReport() const
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3);
+
+    std::string group;
+    double baseline = 0.0;
+    for(const BenchmarkResult & result : _results)
+    {
+        // The first entry of every group is its baseline
+        if(result.group != group)
+        {
+            group = result.group;
+            baseline = result.milliSec;
+            ss << group << std::endl;
+        }
+
+        ss << "  " << std::left << std::setw(32) << result.name << std::right << std::setw(10) << result.milliSec << " ms";
+        if(baseline > 0.0 && result.milliSec > 0.0)
+        {
+            ss << "  x" << baseline / result.milliSec;
+        }
+        if(!result.note.empty())
+        {
+            ss << "  " << result.note;
+        }
+        ss << std::endl;
+    }
+    return ss.str();
+}
+
+bool Benchmark::exportCSV(const std::string & path) const
+{
+    std::ofstream file(path, std::ios::trunc);
+    if(!file.is_open())
+    {
+        return false;
+    }
+
+    file << "group,name,ms,note" << std::endl;
+    for(const BenchmarkResult & result : _results)
+    {
+        file << result.group << "," << result.name << "," << result.milliSec << ",\"" << result.note << "\"" << std::endl;
+    }
+    return file.good();
+}
+
+RayTracing & Benchmark::getRayTracer()
+{
+    return _raytracer;
+}
+
+// Current scene and the reflection heavy divergent one
+static std::vector<std::pair<std::string, dwg::Scene>> getBenchmarkScenes(const dwg::Scene & originalScene)
+{
+    dwg::Scene divergentScene = originalScene;
+    divergentScene.spheres = getDivergentSceneSpheres();
+
+    return {{"default", originalScene}, {"divergent", divergentScene}};
+}
+
+// Share of SIMD lanes doing useful work in the secondary kernel, assuming a lane
+// group runs as long as its longest ray path
+static double getSimdEfficiency(const std::vector<int> & bounceCounts, size_t simdWidth)
+{
+    if(simdWidth == 0)
+    {
+        return 0.0;
+    }
+
+    unsigned long long used = 0;
+    unsigned long long issued = 0;
+    for(size_t start = 0; start < bounceCounts.size(); start += simdWidth)
+    {
+        size_t end = std::min(bounceCounts.size(), start + simdWidth);
+        int longest = 0;
+        for(size_t i = start; i < end; i++)
+        {
+            used += bounceCounts[i];
+            longest = std::max(longest, bounceCounts[i]);
+        }
+        issued += static_cast<unsigned long long>(longest) * simdWidth;
+    }
+    return issued > 0 ? static_cast<double>(used) / issued : 1.0;
+}
+
+void runDispatchModeBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    dwg::Scene originalScene = raytracer.getScene();
+    RenderConfig originalConfig = raytracer.getRenderConfig();
+
+    for(const auto & scene : getBenchmarkScenes(originalScene))
+    {
+        std::string group = "Dispatch mode (" + scene.first + " scene)";
+        raytracer.setScene(scene.second);
+
+        benchmark.run(group, RenderConfig::getDispatchModeName(DispatchMode::NDRANGE), [&]
+        {
+            raytracer.setDispatchMode(DispatchMode::NDRANGE);
+        });
+
+        for(int tileSize : PERSISTENT_TILE_SIZES)
+        {
+            std::string name = std::string(RenderConfig::getDispatchModeName(DispatchMode::PERSISTENT)) + " " +
+                               std::to_string(tileSize) + "x" + std::to_string(tileSize);
+            benchmark.run(group, name, [&]
+            {
+                raytracer.setDispatchMode(DispatchMode::PERSISTENT);
+                raytracer.setPersistentTileSize(tileSize, tileSize);
+            });
+        }
+    }
+
+    raytracer.setDispatchMode(originalConfig.dispatchMode);
+    raytracer.setPersistentTileSize(originalConfig.persistentTileSizeX, originalConfig.persistentTileSizeY);
+    raytracer.setScene(originalScene);
+}
+
+void runSceneStorageBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    dwg::Scene originalScene = raytracer.getScene();
+
+    for(const auto & scene : getBenchmarkScenes(originalScene))
+    {
+        std::string group = "Scene storage (" + scene.first + " scene)";
+        raytracer.resetSceneStorage();
+        raytracer.setScene(scene.second);
+        SceneStorage automatic = raytracer.getSceneStorage();
+
+        // Global always works, so it is the baseline
+        for(SceneStorage storage : {SceneStorage::GLOBAL, SceneStorage::LOCAL, SceneStorage::CONSTANT, SceneStorage::IMAGE})
+        {
+            if(!raytracer.setSceneStorage(storage))
+            {
+                std::cout << group << " / " << RenderConfig::getSceneStorageName(storage) << ": not supported" << std::endl;
+                continue;
+            }
+
+            BenchmarkResult & result = benchmark.run(group, RenderConfig::getSceneStorageName(storage), nullptr);
+            if(storage == automatic)
+            {
+                result.note = "automatic choice";
+            }
+        }
+    }
+
+    raytracer.resetSceneStorage();
+    raytracer.setScene(originalScene);
+}
+
+void runRaySortingBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    dwg::Scene originalScene = raytracer.getScene();
+    RenderConfig originalConfig = raytracer.getRenderConfig();
+
+    for(const auto & scene : getBenchmarkScenes(originalScene))
+    {
+        std::string group = "Secondary ray order (" + scene.first + " scene)";
+        raytracer.setScene(scene.second);
+
+        benchmark.run(group, "single kernel", [&]
+        {
+            raytracer.setDispatchMode(DispatchMode::NDRANGE);
+        });
+
+        for(bool sorted : {false, true})
+        {
+            BenchmarkResult & result = benchmark.run(group, sorted ? "wavefront sorted" : "wavefront unsorted", [&]
+            {
+                raytracer.setDispatchMode(DispatchMode::WAVEFRONT);
+                raytracer.setSortSecondaryRays(sorted);
+            });
+
+            std::vector<int> bounceCounts;
+            if(raytracer.getSecondaryBounceCounts(bounceCounts))
+            {
+                std::stringstream ss;
+                ss << std::fixed << std::setprecision(1)
+                   << "SIMD efficiency " << 100.0 * getSimdEfficiency(bounceCounts, raytracer.getSecondarySimdWidth()) << "%";
+                result.note = ss.str();
+            }
+        }
+    }
+
+    raytracer.setDispatchMode(originalConfig.dispatchMode);
+    raytracer.setSortSecondaryRays(originalConfig.sortSecondaryRays);
+    raytracer.setScene(originalScene);
+}
+
+void runQueueOverlapBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    bool originalMultiQueue = raytracer.isMultiQueueEnabled();
+    bool originalProfiling = raytracer.isQueueProfilingEnabled();
+    std::string group = "Queues (update with readback)";
+
+    // Overlap is measured with device timestamps
+    raytracer.setQueueProfilingEnabled(true);
+
+    for(bool multiQueue : {false, true})
+    {
+        raytracer.setMultiQueueEnabled(multiQueue);
+        if(raytracer.isMultiQueueEnabled() != multiQueue)
+        {
+            continue;
+        }
+        raytracer.setReadbackCallback([] (const ReadbackFrame &) {});
+        raytracer.resetQueueOverlapStats();
+
+        // Frame time as seen by the host, the readback of the last frame is not waited for
+        BenchmarkResult & result = benchmark.measure(group, multiQueue ? "compute + transfer" : "single queue", [&]
+        {
+            util::Timer timer;
+            for(int i = 0 ; i < benchmark.getFrames(); i++)
+            {
+                raytracer.update();
+            }
+            double milliSec = timer.elapsedMilliSec() / benchmark.getFrames();
+            raytracer.flushReadback();
+            return milliSec;
+        });
+
+        QueueOverlapStats stats = raytracer.getQueueOverlapStats();
+        if(stats.frames > 0)
+        {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(1)
+               << "readback " << stats.transferMilliSec / stats.frames << " ms, "
+               << 100.0 * stats.getOverlapRatio() << "% overlapped with tracing";
+            result.note = ss.str();
+        }
+    }
+
+    raytracer.setReadbackCallback(nullptr);
+    raytracer.setMultiQueueEnabled(originalMultiQueue);
+    raytracer.setQueueProfilingEnabled(originalProfiling);
+}
+
+void runColorFormatBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    bool originalAccumulation = raytracer.isAccumulationEnabled();
+    raytracer.setReadbackCallback([] (const ReadbackFrame &) {});
+
+    for(bool accumulate : {false, true})
+    {
+        raytracer.setAccumulationEnabled(accumulate);
+        raytracer.resetColorFormat();
+        ColorFormat defaultFormat = raytracer.getColorFormat();
+        std::string group = accumulate ? "Color format (accumulating, with readback)" : "Color format (with readback)";
+
+        for(ColorFormat format : {ColorFormat::FLOAT4, ColorFormat::HALF4, ColorFormat::RGBA8, ColorFormat::RGB10A2})
+        {
+            raytracer.setColorFormat(format);
+            if(raytracer.getColorFormat() != format)
+            {
+                continue;
+            }
+
+            BenchmarkResult & result = benchmark.measure(group, getColorFormatName(format), [&]
+            {
+                util::Timer timer;
+                for(int i = 0 ; i < benchmark.getFrames(); i++)
+                {
+                    raytracer.update();
+                }
+                raytracer.flushReadback();
+                return timer.elapsedMilliSec() / benchmark.getFrames();
+            });
+
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(1)
+               << raytracer.getColorBytesPerFrame() / (1024.0 * 1024.0) << " MB of colors per frame";
+            if(format == defaultFormat)
+            {
+                ss << ", default";
+            }
+            result.note = ss.str();
+        }
+    }
+
+    raytracer.setReadbackCallback(nullptr);
+    raytracer.setAccumulationEnabled(originalAccumulation);
+    raytracer.resetColorFormat();
+}
+
+void runPostProcessBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    PostProcessChain originalChain = raytracer.getPostProcessChain();
+
+    PostProcessChain fullChain;
+    fullChain.addStage(PostProcessStage::exposure(0.5f));
+    fullChain.addStage(PostProcessStage::toneMap(ToneMapOperator::ACES));
+    fullChain.addStage(PostProcessStage::gamma(2.2f, GammaMethod::LUT));
+    fullChain.addStage(PostProcessStage::dither());
+
+    // Host frames are Full HD whatever the window size
+    const int hostWidth = 1920;
+    const int hostHeight = 1080;
+    std::vector<float> hostFrame(4 * hostWidth * hostHeight);
+
+    double previousDevice = 0.0;
+    double previousHost = 0.0;
+    for(size_t count = 0 ; count <= fullChain.getStages().size(); count++)
+    {
+        PostProcessChain chain = fullChain.getPrefix(count);
+        std::string name = count == 0 ? "no stages" : "+ " + chain.getStages().back().getName();
+
+        // Results are only valid until the next run, notes are written right away
+        BenchmarkResult & device = benchmark.run("Post process (device, present pass)", name, [&]
+        {
+            raytracer.setPostProcessChain(chain);
+        });
+        if(count > 0)
+        {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(3) << "stage " << device.milliSec - previousDevice << " ms";
+            device.note = ss.str();
+        }
+        previousDevice = device.milliSec;
+
+        BenchmarkResult & host = benchmark.measure("Post process (host loop, 1080p)", name, [&]
+        {
+            util::Timer timer;
+            for(int i = 0 ; i < benchmark.getFrames(); i++)
+            {
+                // Values above one so tone mapping has work
+                std::fill(hostFrame.begin(), hostFrame.end(), 1.5f);
+                chain.apply(hostFrame.data(), hostWidth, hostHeight);
+            }
+            return timer.elapsedMilliSec() / benchmark.getFrames();
+        });
+
+        if(count > 0)
+        {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(3) << "stage " << host.milliSec - previousHost << " ms";
+            host.note = ss.str();
+        }
+        previousHost = host.milliSec;
+    }
+
+    raytracer.setPostProcessChain(originalChain);
+}
+
+void runReprojectionBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    glm::vec3 originalEye = raytracer.getEye();
+    bool originalReprojection = raytracer.isReprojectionEnabled();
+    std::string group = "Reprojection (orbiting camera)";
+
+    for(bool reproject : {false, true})
+    {
+        raytracer.setReprojectionEnabled(reproject);
+        if(raytracer.isReprojectionEnabled() != reproject)
+        {
+            continue;
+        }
+        raytracer.setEye(originalEye);
+        raytracer.resetReprojectionStats();
+
+        BenchmarkResult & result = benchmark.measure(group, reproject ? "reprojected" : "full trace", [&]
+        {
+            return raytracer.measureTraceTime(benchmark.getFrames(), [&] (int)
+            {
+                raytracer.setEye(glm::rotateY(raytracer.getEye(), glm::radians(ORBIT_DEGREES_PER_FRAME)));
+            });
+        });
+
+        ReprojectionStats stats = raytracer.getReprojectionStats();
+        if(reproject && stats.frames > 0)
+        {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(1) << 100.0 * stats.getTracedFraction() << "% of pixels traced";
+            result.note = ss.str();
+        }
+    }
+
+    raytracer.setReprojectionEnabled(originalReprojection);
+    raytracer.setEye(originalEye);
+}
+
+void runDenoiserBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    bool originalAccumulation = raytracer.isAccumulationEnabled();
+    bool originalJitter = raytracer.isJitterEnabled();
+    bool originalDenoise = raytracer.isDenoiseEnabled();
+    bool originalGBuffer = raytracer.isGBufferEnabled();
+
+    raytracer.setDenoiseEnabled(true);
+    if(!raytracer.isDenoiseEnabled())
+    {
+        return;
+    }
+    const DenoiseParams & params = raytracer.getDenoiseParams();
+
+    // Cost of the device filter per traced frame
+    raytracer.setAccumulationEnabled(false);
+    raytracer.setDenoiseEnabled(false);
+    double traceTime = benchmark.run("Denoiser cost", "trace", nullptr).milliSec;
+
+    raytracer.setDenoiseEnabled(true);
+    BenchmarkResult & costResult = benchmark.run("Denoiser cost", "trace + denoise", nullptr);
+    if(traceTime > 0.0 && costResult.milliSec > 0.0)
+    {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(1) << 100.0 * (costResult.milliSec - traceTime) / costResult.milliSec
+           << "% of the frame, " << params.iterations << " passes";
+        costResult.note = ss.str();
+    }
+
+    // Quality against a converged reference. Every average restarts the jitter
+    // sequence, so both filters get the raw average of the same samples: the
+    // device filters it after every accumulated frame, the host once at the end.
+    raytracer.setJitterEnabled(true);
+    raytracer.setDenoiseEnabled(false);
+    HostFrame reference = renderAccumulated(raytracer, DENOISE_REFERENCE_SAMPLES);
+
+    std::string group = "Denoiser (RMSE against " + std::to_string(DENOISE_REFERENCE_SAMPLES) + " samples)";
+    for(int samples : DENOISE_SAMPLE_COUNTS)
+    {
+        std::string prefix = std::to_string(samples) + " spp ";
+
+        HostFrame raw;
+        raytracer.setDenoiseEnabled(false);
+        BenchmarkResult & rawResult = benchmark.measure(group, prefix + "raw", [&]
+        {
+            util::Timer timer;
+            raw = renderAccumulated(raytracer, samples);
+            return timer.elapsedMilliSec() / samples;
+        });
+        rawResult.note = "RMSE " + std::to_string(computeColorRmse(raw, reference));
+
+        // G-buffer of the last sample guides the host filter
+        size_t numPixels = raw.rgba.size() / 4;
+        std::vector<float> depth(numPixels);
+        std::vector<uint32_t> normals(numPixels);
+        bool hasGBuffer = numPixels > 0 &&
+                          raytracer.downloadGBuffer(GBufferChannel::DEPTH, depth.data()) &&
+                          raytracer.downloadGBuffer(GBufferChannel::NORMAL, normals.data());
+
+        HostFrame deviceDenoised;
+        raytracer.setDenoiseEnabled(true);
+        BenchmarkResult & deviceResult = benchmark.measure(group, prefix + "device denoised", [&]
+        {
+            util::Timer timer;
+            deviceDenoised = renderAccumulated(raytracer, samples);
+            return timer.elapsedMilliSec() / samples;
+        });
+        deviceResult.note = "RMSE " + std::to_string(computeColorRmse(deviceDenoised, reference));
+
+        if(!hasGBuffer)
+        {
+            continue;
+        }
+
+        // Scalar loop first as the reference of the vectorized one
+        HostFrame scalarDenoised = raw;
+        BenchmarkResult & scalarResult = benchmark.measure(group, prefix + "host denoised (scalar)", [&]
+        {
+            util::Timer timer;
+            denoiseHost(params, scalarDenoised.rgba.data(), depth.data(), normals.data(), scalarDenoised.width, scalarDenoised.height,
+                        0, false);
+            return timer.elapsedMilliSec();
+        });
+        scalarResult.note = "RMSE " + std::to_string(computeColorRmse(scalarDenoised, reference)) +
+                            ", " + std::to_string(std::thread::hardware_concurrency()) + " threads";
+
+        HostFrame hostDenoised = raw;
+        BenchmarkResult & hostResult = benchmark.measure(group, prefix + "host denoised", [&]
+        {
+            util::Timer timer;
+            denoiseHost(params, hostDenoised.rgba.data(), depth.data(), normals.data(), hostDenoised.width, hostDenoised.height);
+            return timer.elapsedMilliSec();
+        });
+        std::stringstream ss;
+        ss << "RMSE " << std::to_string(computeColorRmse(hostDenoised, reference));
+        if(hostResult.milliSec > 0.0)
+        {
+            ss << ", " << std::fixed << std::setprecision(2) << scalarResult.milliSec / hostResult.milliSec << "x over scalar";
+        }
+        hostResult.note = ss.str();
+    }
+
+    raytracer.setDenoiseEnabled(originalDenoise);
+    raytracer.setGBufferEnabled(originalGBuffer);
+    raytracer.setJitterEnabled(originalJitter);
+    raytracer.setAccumulationEnabled(originalAccumulation);
+}
+
+void runPathTerminationBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+
+    int originalMaxBounces = raytracer.getRenderConfig().maxBounces;
+    bool originalRoulette = raytracer.isRussianRouletteEnabled();
+
+    for(bool roulette : {false, true})
+    {
+        raytracer.setRussianRouletteEnabled(roulette);
+        if(raytracer.isRussianRouletteEnabled() != roulette)
+        {
+            continue;
+        }
+
+        std::string group = roulette ? "Path termination (russian roulette)" : "Path termination (throughput only)";
+        for(int maxBounces : PATH_MAX_BOUNCES)
+        {
+            benchmark.run(group, std::to_string(maxBounces) + " bounces", [&]
+            {
+                raytracer.setMaxBounces(maxBounces);
+            });
+        }
+    }
+
+    raytracer.setRussianRouletteEnabled(originalRoulette);
+    raytracer.setMaxBounces(originalMaxBounces);
+}
+
+// Builds the BVHs of a scene with one mesh added, then traces it
+static void runMeshScene(Benchmark & benchmark, const std::string & name, const dwg::Scene & originalScene, const dwg::Mesh & mesh)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+    const std::string group = "Meshes";
+
+    dwg::Scene scene = originalScene;
+    scene.meshes.push_back(mesh);
+
+    BottomLevels packed;
+    BenchmarkResult & buildResult = benchmark.measure(group, name + " BVH build", [&]
+    {
+        packed = buildBottomLevels(scene);
+        return packed.buildMilliSec;
+    });
+    std::ostringstream buildNote;
+    buildNote << mesh.triangles.size() << " triangles, " << packed.nodes.size() << " nodes, depth " << packed.maxDepth
+              << ", mesh " << mesh.getBytes() / 1024 << " KB, packed with BVH " << packed.getBytes() / 1024 << " KB";
+    buildResult.note = buildNote.str();
+
+    BenchmarkResult & traceResult = benchmark.run(group, name + " trace", [&]
+    {
+        raytracer.setScene(scene);
+    });
+    double pixels = static_cast<double>(raytracer.getTextureWidth()) * raytracer.getTextureHeight();
+    std::ostringstream traceNote;
+    traceNote << std::fixed << std::setprecision(1)
+              << (traceResult.milliSec > 0.0 ? pixels / (traceResult.milliSec * 1e3) : 0.0) << " M primary rays/s";
+    traceResult.note = traceNote.str();
+}
+
+void runMeshBenchmark(Benchmark & benchmark, const std::string & objPath)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+    dwg::Scene originalScene = raytracer.getScene();
+
+    benchmark.run("Meshes", "no mesh trace", [] {});
+
+    for(const auto & resolution : MESH_TORUS_RESOLUTIONS)
+    {
+        dwg::Mesh torus = createTorusMesh(glm::vec3(0.0f, 0.0f, 10.0f), 8.0f, 2.5f, resolution[0], resolution[1],
+                                          glm::vec4(0.9f, 0.6f, 0.2f, 0.0f));
+        runMeshScene(benchmark, "torus " + std::to_string(torus.triangles.size() / 1000) + "k", originalScene, torus);
+    }
+
+    dwg::Mesh model;
+    if(!objPath.empty() && loadObjMesh(objPath, model))
+    {
+        runMeshScene(benchmark, objPath, originalScene, model);
+    }
+
+    raytracer.setScene(originalScene);
+}
+
+// Cube of spheres around the origin, the geometry every grid instance shares
+static dwg::SphereGroup createSphereCube(int side, float spacing)
+{
+    dwg::SphereGroup group;
+    float offset = 0.5f * spacing * (side - 1);
+    for(int z = 0 ; z < side; z++)
+    {
+        for(int y = 0 ; y < side; y++)
+        {
+            for(int x = 0 ; x < side; x++)
+            {
+                dwg::Sphere s;
+                s.position = glm::vec3(x * spacing - offset, y * spacing - offset, z * spacing - offset);
+                s.radius = 0.35f * spacing;
+                s.color = glm::vec4((x + 1.0f) / side, (y + 1.0f) / side, (z + 1.0f) / side, 0.0f);
+                group.spheres.push_back(s);
+            }
+        }
+    }
+    return group;
+}
+
+// Grid of size x size instances in front of the camera, rows shifted by time
+static std::vector<dwg::Instance> getInstanceGrid(int size, float time)
+{
+    std::vector<dwg::Instance> instances;
+    float spacing = 24.0f / size;
+    for(int row = 0 ; row < size; row++)
+    {
+        for(int column = 0 ; column < size; column++)
+        {
+            dwg::Instance instance;
+            instance.type = dwg::GeometryType::SPHERE_GROUP;
+            instance.geometry = 0;
+            glm::vec3 position((column - 0.5f * (size - 1)) * spacing + std::sin(time + row),
+                               (row - 0.5f * (size - 1)) * spacing * 0.5f,
+                               20.0f + row * spacing * 0.5f);
+            instance.transform = glm::translate(glm::mat4(1.0f), position) *
+                                 glm::scale(glm::mat4(1.0f), glm::vec3(0.3f * spacing));
+            instances.push_back(instance);
+        }
+    }
+    return instances;
+}
+
+void runInstancingBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+    dwg::Scene originalScene = raytracer.getScene();
+    const std::string group = "Instancing";
+
+    dwg::SphereGroup cube = createSphereCube(INSTANCE_GROUP_SIDE, 1.0f);
+    for(int size : INSTANCE_GRID_SIZES)
+    {
+        std::vector<dwg::Instance> instances = getInstanceGrid(size, 0.0f);
+        std::string prefix = std::to_string(instances.size()) + " instances ";
+
+        // Every copy written out as a world space sphere, traced by the sphere loop
+        dwg::Scene flattened = originalScene;
+        for(const dwg::Instance & instance : instances)
+        {
+            float scale = glm::length(glm::vec3(instance.transform[0]));
+            for(dwg::Sphere s : cube.spheres)
+            {
+                s.position = glm::vec3(instance.transform * glm::vec4(s.position, 1.0f));
+                s.radius *= scale;
+                flattened.spheres.push_back(s);
+            }
+        }
+        BenchmarkResult & flatResult = benchmark.run(group, prefix + "flattened", [&]
+        {
+            raytracer.setScene(flattened);
+        });
+        flatResult.note = std::to_string(sizeof(dwg::Sphere) * (flattened.spheres.size() - originalScene.spheres.size()) / 1024) +
+                          " KB of spheres";
+
+        dwg::Scene instanced = originalScene;
+        instanced.sphereGroups.push_back(cube);
+        instanced.instances = instances;
+        BenchmarkResult & staticResult = benchmark.run(group, prefix + "static", [&]
+        {
+            raytracer.setScene(instanced);
+        });
+        std::ostringstream staticNote;
+        staticNote << raytracer.getBottomLevels().getBytes() / 1024 << " KB bottom level, "
+                   << raytracer.getTopLevel().getBytes() / 1024 << " KB top level";
+        staticResult.note = staticNote.str();
+
+        // Rows slide every frame, only the top level is rebuilt and uploaded
+        double topLevelMilliSec = 0.0;
+        BenchmarkResult & movingResult = benchmark.measure(group, prefix + "moving", [&]
+        {
+            return raytracer.measureTraceTime(benchmark.getFrames(), [&] (int frame)
+            {
+                raytracer.setInstances(getInstanceGrid(size, 0.1f * (frame + 1)));
+                topLevelMilliSec += raytracer.getTopLevel().buildMilliSec;
+            });
+        });
+        std::ostringstream movingNote;
+        movingNote << std::fixed << std::setprecision(3)
+                   << topLevelMilliSec / std::max(1, benchmark.getFrames()) << " ms top level build per frame";
+        movingResult.note = movingNote.str();
+    }
+
+    raytracer.setScene(originalScene);
+}
+
+// Random rays from the camera into the sphere fields of getRandomSceneSpheres
+static void getHostRays(std::vector<glm::vec3> & origins, std::vector<glm::vec3> & dirs)
+{
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for(int i = 0 ; i < HOST_RAY_COUNT; i++)
+    {
+        glm::vec3 target(-14.0f + 28.0f * unit(generator), -4.0f + 23.0f * unit(generator), 48.0f);
+        origins.push_back(glm::vec3(0.0f, 7.5f, 0.0f));
+        dirs.push_back(glm::normalize(target - origins.back()));
+    }
+}
+
+// Host build and 3D-DDA of the grid against the host linear loop, the
+// benchmark's check that both find the same spheres
+static void runHostSphereGridBenchmark(Benchmark & benchmark, const std::string & group, const std::vector<dwg::Sphere> & spheres)
+{
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> dirs;
+    getHostRays(origins, dirs);
+    const float maxDist = std::numeric_limits<float>::max();
+
+    SphereGrid grid;
+    std::vector<int> gridHits(origins.size());
+    BenchmarkResult & gridResult = benchmark.measure(group, "host grid build + trace", [&]
+    {
+        util::Timer timer;
+        grid = buildSphereGrid(spheres);
+        for(size_t i = 0; i < origins.size(); i++)
+        {
+            float distance;
+            gridHits[i] = traceSphereGrid(grid, spheres, origins[i], dirs[i], maxDist, distance);
+        }
+        return timer.elapsedMilliSec();
+    });
+    std::ostringstream gridNote;
+    gridNote << HOST_RAY_COUNT << " rays, " << grid.params.resolution.x << "x" << grid.params.resolution.y << "x"
+             << grid.params.resolution.z << " cells, " << grid.getBytes() / 1024 << " KB";
+    gridResult.note = gridNote.str();
+
+    if(static_cast<int>(spheres.size()) > LINEAR_LOOP_MAX_SPHERES)
+    {
+        return;
+    }
+
+    int mismatches = 0;
+    BenchmarkResult & linearResult = benchmark.measure(group, "host linear loop trace", [&]
+    {
+        util::Timer timer;
+        mismatches = 0;
+        for(size_t i = 0; i < origins.size(); i++)
+        {
+            float distance;
+            if(traceSpheresLinear(spheres, origins[i], dirs[i], maxDist, distance) != gridHits[i])
+            {
+                mismatches++;
+            }
+        }
+        return timer.elapsedMilliSec();
+    });
+    linearResult.note = std::to_string(HOST_RAY_COUNT) + " rays, " + std::to_string(mismatches) + " hits differ from the grid";
+}
+
+void runSphereAccelerationBenchmark(Benchmark & benchmark)
+{
+    RayTracing & raytracer = benchmark.getRayTracer();
+    dwg::Scene originalScene = raytracer.getScene();
+
+    for(int count : ACCELERATION_SPHERE_COUNTS)
+    {
+        dwg::Scene scene = originalScene;
+        scene.spheres = getRandomSceneSpheres(count);
+        std::string group = "Sphere acceleration (" + std::to_string(count) + " spheres)";
+
+        // Fully dynamic: every frame swaps in a field of other spheres, which
+        // uploads them and rebuilds the structure ahead of the trace
+        dwg::Scene movedScene = scene;
+        movedScene.spheres = getRandomSceneSpheres(count, 2);
+        auto runDynamic = [&] (SphereAcceleration acceleration, const std::string & name)
+        {
+            scene.sphereAcceleration = acceleration;
+            movedScene.sphereAcceleration = acceleration;
+            raytracer.setScene(scene);
+            benchmark.measure(group, name, [&]
+            {
+                return raytracer.measureTraceTime(benchmark.getFrames(), [&] (int frame)
+                {
+                    raytracer.setScene(frame % 2 == 0 ? movedScene : scene);
+                });
+            });
+        };
+
+        if(count <= LINEAR_LOOP_MAX_SPHERES)
+        {
+            scene.sphereAcceleration = SphereAcceleration::NONE;
+            benchmark.run(group, "linear loop trace", [&]
+            {
+                raytracer.setScene(scene);
+            });
+            runDynamic(SphereAcceleration::NONE, "linear loop moving");
+        }
+
+        for(SphereAcceleration acceleration : {SphereAcceleration::LBVH, SphereAcceleration::GRID})
+        {
+            std::string prefix = std::string(RenderConfig::getSphereAccelerationName(acceleration)) + " ";
+            scene.sphereAcceleration = acceleration;
+            raytracer.setScene(scene);
+            if(raytracer.getSphereAcceleration() != acceleration)
+            {
+                continue;
+            }
+
+            benchmark.run(group, prefix + "trace", nullptr);
+
+            BenchmarkResult & buildResult = benchmark.measure(group, prefix + "build", [&]
+            {
+                return raytracer.measureSphereAccelerationBuildTime(benchmark.getFrames());
+            });
+            std::ostringstream buildNote;
+            buildNote << std::fixed << std::setprecision(2) << buildResult.milliSec * 1e6 / count << " ms per million spheres";
+            buildResult.note = buildNote.str();
+
+            runDynamic(acceleration, prefix + "moving");
+        }
+
+        runHostSphereGridBenchmark(benchmark, group, scene.spheres);
+    }
+
+    raytracer.setScene(originalScene);
+}
+
+void runAllBenchmarks(Benchmark & benchmark)
+{
+    runDispatchModeBenchmark(benchmark);
+    runSceneStorageBenchmark(benchmark);
+    runRaySortingBenchmark(benchmark);
+    runQueueOverlapBenchmark(benchmark);
+    runColorFormatBenchmark(benchmark);
+    runPostProcessBenchmark(benchmark);
+    runReprojectionBenchmark(benchmark);
+    runDenoiserBenchmark(benchmark);
+    runPathTerminationBenchmark(benchmark);
+    runMeshBenchmark(benchmark);
+    runInstancingBenchmark(benchmark);
+    runSphereAccelerationBenchmark(benchmark);
+}
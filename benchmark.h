@@ -0,0 +1,95 @@
+#pragma once
+
+#include <raytracing.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct BenchmarkResult
+{
+    std::string group;
+    std::string name;
+    double milliSec;
+
+    // Extra measurements of the configuration, free form
+    std::string note;
+};
+
+// Runs named configurations of a RayTracing instance and collects the average
+// trace time of each one. Every configuration restores the renderer when done.
+class Benchmark
+{
+public:
+    Benchmark(RayTracing & raytracer, int frames = 20);
+
+    // Setup changes the renderer, teardown restores it. Returns the stored result,
+    // valid until the next run.
+    BenchmarkResult & run(const std::string & group, const std::string & name, std::function<void()> setup, std::function<void()> teardown = nullptr);
+
+    // Stores the milliseconds returned by a custom measurement
+    BenchmarkResult & measure(const std::string & group, const std::string & name, std::function<double()> measurement);
+
+    int getFrames() const;
+
+    const std::vector<BenchmarkResult> & getResults() const;
+
+    std::string getReport() const;
+
+    bool exportCSV(const std::string & path) const;
+
+    RayTracing & getRayTracer();
+
+private:
+
+    RayTracing & _raytracer;
+
+    int _frames;
+
+    std::vector<BenchmarkResult> _results;
+};
+
+// NDRange against persistent threads, sweeping the tile size, on the default and a divergent scene
+void runDispatchModeBenchmark(Benchmark & benchmark);
+
+// Constant, local and global scene storage that fit the device, on the default and a divergent scene
+void runSceneStorageBenchmark(Benchmark & benchmark);
+
+// Wavefront tracing with secondary rays in pixel order against coherence sorted order
+void runRaySortingBenchmark(Benchmark & benchmark);
+
+// Full frames with readback, single queue against transfers on their own queue
+void runQueueOverlapBenchmark(Benchmark & benchmark);
+
+// Full frames with readback in every color format, without and with accumulation
+void runColorFormatBenchmark(Benchmark & benchmark);
+
+// Adds the stages of a full post process chain one by one, on the device (fused
+// into the present pass) and as the host loop over a frame, each row notes the stage cost
+void runPostProcessBenchmark(Benchmark & benchmark);
+
+// Orbits the camera by a small angle per frame, full tracing against temporal reprojection
+void runReprojectionBenchmark(Benchmark & benchmark);
+
+// Cost of the denoiser per frame, then the error of jittered frames against a
+// converged reference by samples per pixel: raw, filtered on the device and on the host
+void runDenoiserBenchmark(Benchmark & benchmark);
+
+// Trace time by maximum bounces, stopping on low throughput alone and with russian roulette
+void runPathTerminationBenchmark(Benchmark & benchmark);
+
+// BVH build time, memory and trace rate of procedural tori up to a million
+// triangles added to the current scene, and of an OBJ model when objPath is set
+void runMeshBenchmark(Benchmark & benchmark, const std::string & objPath = std::string());
+
+// Grids of instances of one sphere group against the same spheres flattened into
+// the scene: trace time and memory, then moving instances with a top level rebuild per frame
+void runInstancingBenchmark(Benchmark & benchmark);
+
+// Random sphere fields up to a million spheres: trace time of the linear loop
+// (smaller fields only), of the device built linear BVH and uniform grid and
+// their build times, build plus trace with every sphere moving each frame, and
+// the host grid's 3D-DDA against the host linear loop
+void runSphereAccelerationBenchmark(Benchmark & benchmark);
+
+void runAllBenchmarks(Benchmark & benchmark);
@@ -0,0 +1,247 @@
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+// Smaller requests share the first size class
+static const size_t MIN_CLASS_SIZE = 256;
+
+std::string BufferPoolStats::getSummary() const
+{
+    std::stringstream ss;
+    ss << "Backing: " << backingBuffers << " buffers, " << backingBytes / 1024 << " KB" << std::endl;
+    ss << "Live: " << liveAllocations << " allocations, " << requestedBytes / 1024 << " KB requested, "
+       << reservedBytes / 1024 << " KB reserved (peak " << peakReservedBytes / 1024 << " KB)" << std::endl;
+    ss << "Free lists: " << freeBytes / 1024 << " KB" << std::endl;
+    ss << "Allocations: " << totalAllocations << " (" << reusedAllocations << " reused, "
+       << dedicatedAllocations << " dedicated)";
+    return ss.str();
+}
+
+BufferPool::BufferPool(std::shared_ptr<CLContextWrapper> context, size_t backingSize, BufferType type) :
+    _clContext(context), _backingSize(backingSize), _type(type)
+{
+    _alignment = std::max<size_t>(1, _clContext->getDeviceInfo().memBaseAddrAlign);
+
+    // One class per power of two up to the backing size
+    for(size_t size = _getClassSize(0); size <= _backingSize; size <<= 1)
+    {
+        _freeLists.push_back(std::vector<BufferId>());
+    }
+}
+
+BufferPool::~BufferPool()
+{
+    for(std::vector<BufferId> & freeList : _freeLists)
+    {
+        for(BufferId id : freeList)
+        {
+            _clContext->releaseBuffer(id);
+        }
+    }
+    for(auto & allocation : _allocations)
+    {
+        _clContext->releaseBuffer(allocation.first);
+    }
+    for(const Backing & backing : _backings)
+    {
+        _clContext->releaseBuffer(backing.buffer);
+    }
+}
+
+BufferId BufferPool::allocate(size_t bytesSize)
+{
+    if(bytesSize == 0)
+    {
+        return nullptr;
+    }
+
+    Allocation allocation;
+    allocation.requested = bytesSize;
+    allocation.sizeClass = _getSizeClass(bytesSize);
+
+    BufferId id;
+    if(allocation.sizeClass < 0)
+    {
+        allocation.capacity = bytesSize;
+        id = _clContext->createBuffer(bytesSize, nullptr, _type);
+        _stats.dedicatedAllocations++;
+    }
+    else
+    {
+        allocation.capacity = _getClassSize(allocation.sizeClass);
+
+        std::vector<BufferId> & freeList = _freeLists[allocation.sizeClass];
+        if(!freeList.empty())
+        {
+            id = freeList.back();
+            freeList.pop_back();
+            _stats.freeBytes -= allocation.capacity;
+            _stats.reusedAllocations++;
+        }
+        else
+        {
+            id = _carve(allocation.capacity);
+        }
+    }
+
+    if(!id)
+    {
+        std::cout << "Buffer pool failed to allocate " << bytesSize << " bytes" << std::endl;
+        return nullptr;
+    }
+
+    _allocations[id] = allocation;
+    _clContext->setBufferOwner(id, this);
+
+    _stats.totalAllocations++;
+    _stats.liveAllocations++;
+    _stats.requestedBytes += allocation.requested;
+    _stats.reservedBytes += allocation.capacity;
+    _stats.peakReservedBytes = std::max(_stats.peakReservedBytes, _stats.reservedBytes);
+    return id;
+}
+
+bool BufferPool::release(BufferId id)
+{
+    auto it = _allocations.find(id);
+    if(it == _allocations.end())
+    {
+        std::cout << "Buffer pool does not own the released buffer" << std::endl;
+        return false;
+    }
+
+    const Allocation & allocation = it->second;
+    _stats.liveAllocations--;
+    _stats.requestedBytes -= allocation.requested;
+    _stats.reservedBytes -= allocation.capacity;
+
+    if(allocation.sizeClass < 0)
+    {
+        _clContext->releaseBuffer(id);
+    }
+    else
+    {
+        _freeLists[allocation.sizeClass].push_back(id);
+        _stats.freeBytes += allocation.capacity;
+    }
+
+    _allocations.erase(it);
+    return true;
+}
+
+size_t BufferPool::getCapacity(BufferId id) const
+{
+    auto it = _allocations.find(id);
+    return it != _allocations.end() ? it->second.capacity : 0;
+}
+
+void BufferPool::trim()
+{
+    for(std::vector<BufferId> & freeList : _freeLists)
+    {
+        for(BufferId id : freeList)
+        {
+            _releaseSubBuffer(id);
+        }
+        freeList.clear();
+    }
+    _stats.freeBytes = 0;
+
+    // Sub buffers still allocated keep their whole backing buffer
+    for(size_t i = _backings.size(); i-- > 0;)
+    {
+        if(_backings[i].subBuffers == 0)
+        {
+            _clContext->releaseBuffer(_backings[i].buffer);
+            _backings.erase(_backings.begin() + i);
+
+            _stats.backingBuffers--;
+            _stats.backingBytes -= _backingSize;
+        }
+    }
+}
+
+const BufferPoolStats & BufferPool::getStats() const
+{
+    return _stats;
+}
+
+int BufferPool::_getSizeClass(size_t bytesSize) const
+{
+    int sizeClass = 0;
+    for(size_t size = _getClassSize(0); size <= _backingSize; size <<= 1, sizeClass++)
+    {
+        if(bytesSize <= size)
+        {
+            return sizeClass;
+        }
+    }
+    return -1;
+}
+
+size_t BufferPool::_getClassSize(int sizeClass) const
+{
+    // Every class is a multiple of the alignment, so carved offsets stay aligned
+    size_t base = MIN_CLASS_SIZE;
+    while(base < _alignment)
+    {
+        base <<= 1;
+    }
+    return base << sizeClass;
+}
+
+BufferId BufferPool::_carve(size_t bytesSize)
+{
+    // Free regions are reclaimed a whole backing buffer at a time, before adding one
+    if(_backings.empty() || _backings.back().offset + bytesSize > _backingSize)
+    {
+        trim();
+    }
+
+    if(_backings.empty() || _backings.back().offset + bytesSize > _backingSize)
+    {
+        Backing backing;
+        backing.buffer = _clContext->createBuffer(_backingSize, nullptr, _type);
+        backing.offset = 0;
+        backing.subBuffers = 0;
+        if(!backing.buffer)
+        {
+            return nullptr;
+        }
+        _backings.push_back(backing);
+
+        _stats.backingBuffers++;
+        _stats.backingBytes += _backingSize;
+    }
+
+    // Offsets are sums of class sizes, which are multiples of the alignment
+    Backing & backing = _backings.back();
+    BufferId id = _clContext->createSubBuffer(backing.buffer, backing.offset, bytesSize, _type);
+    if(id)
+    {
+        backing.offset += bytesSize;
+        backing.subBuffers++;
+        _subBufferBackings[id] = backing.buffer;
+    }
+    return id;
+}
+
+void BufferPool::_releaseSubBuffer(BufferId id)
+{
+    auto it = _subBufferBackings.find(id);
+    if(it != _subBufferBackings.end())
+    {
+        for(Backing & backing : _backings)
+        {
+            if(backing.buffer == it->second)
+            {
+                backing.subBuffers--;
+                break;
+            }
+        }
+        _subBufferBackings.erase(it);
+    }
+    _clContext->releaseBuffer(id);
+}
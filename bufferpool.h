@@ -0,0 +1,105 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct BufferPoolStats
+{
+    size_t backingBuffers;
+    size_t backingBytes;
+
+    size_t liveAllocations;
+    size_t requestedBytes;  // what callers asked for
+    size_t reservedBytes;   // rounded up to the size classes
+    size_t freeBytes;       // sitting in free lists
+    size_t peakReservedBytes;
+
+    size_t totalAllocations;
+    size_t reusedAllocations;
+    size_t dedicatedAllocations; // too big for a backing buffer
+
+    BufferPoolStats() : backingBuffers(0), backingBytes(0), liveAllocations(0), requestedBytes(0), reservedBytes(0),
+                        freeBytes(0), peakReservedBytes(0), totalAllocations(0), reusedAllocations(0), dedicatedAllocations(0)
+    {
+
+    }
+
+    std::string getSummary() const;
+};
+
+// Sub-allocates device buffers from large backing buffers. Sizes are rounded up
+// to power of two classes (at least the device base address alignment) and
+// released sub buffers wait in a free list per class for the next request.
+// A backing buffer goes back to the context once none of its regions is
+// allocated, trimmed automatically before another backing buffer is created.
+class BufferPool
+{
+public:
+    BufferPool(std::shared_ptr<CLContextWrapper> context, size_t backingSize = 16 << 20, BufferType type = BufferType::READ_AND_WRITE);
+
+    ~BufferPool();
+
+    BufferId allocate(size_t bytesSize);
+
+    template <typename T>
+    BufferId allocateArray(size_t count)
+    {
+        return allocate(sizeof(T) * count);
+    }
+
+    bool release(BufferId id);
+
+    // Usable bytes of an allocation, at least what was requested
+    size_t getCapacity(BufferId id) const;
+
+    // Gives the free lists back to the context, then every backing buffer
+    // left without sub buffers
+    void trim();
+
+    const BufferPoolStats & getStats() const;
+
+private:
+
+    struct Allocation
+    {
+        int sizeClass;  // -1 for dedicated buffers
+        size_t requested;
+        size_t capacity;
+    };
+
+    struct Backing
+    {
+        BufferId buffer;
+        size_t offset;      // bump pointer
+        size_t subBuffers;  // carved and not yet trimmed, allocated or in a free list
+    };
+
+    int _getSizeClass(size_t bytesSize) const;
+
+    size_t _getClassSize(int sizeClass) const;
+
+    BufferId _carve(size_t bytesSize);
+
+    // Releases a sub buffer object and counts it off its backing buffer
+    void _releaseSubBuffer(BufferId id);
+
+private:
+
+    std::shared_ptr<CLContextWrapper> _clContext;
+
+    size_t _backingSize;
+    BufferType _type;
+    size_t _alignment;
+
+    std::vector<Backing> _backings;
+    std::unordered_map<BufferId, BufferId> _subBufferBackings;
+
+    std::vector<std::vector<BufferId>> _freeLists;
+    std::unordered_map<BufferId, Allocation> _allocations;
+
+    BufferPoolStats _stats;
+};
@@ -0,0 +1,182 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+// Centroid bins per axis tried for every split
+static const int SAH_BINS = 16;
+
+// Nodes with this many primitives or fewer are never split
+static const uint32_t MIN_SPLIT_COUNT = 4;
+
+// Cost of visiting a node relative to one primitive test
+static const float TRAVERSAL_COST = 1.0f;
+
+struct SplitCandidate
+{
+    int axis;
+    int bin; // primitives in bins below go left
+    float cost;
+};
+
+static int getBin(float centroid, float binMin, float binScale)
+{
+    return std::min(SAH_BINS - 1, static_cast<int>((centroid - binMin) * binScale));
+}
+
+// Cheapest bin boundary on all three axes, axis -1 when every centroid lies in one bin
+static SplitCandidate findSplit(const std::vector<BVHBounds> & primitives, const std::vector<glm::vec3> & centroids,
+                                const uint32_t * order, uint32_t count, const BVHBounds & centroidBounds)
+{
+    SplitCandidate best;
+    best.axis = -1;
+    best.bin = 0;
+    best.cost = std::numeric_limits<float>::max();
+
+    for(int axis = 0 ; axis < 3; axis++)
+    {
+        float binMin = centroidBounds.boundsMin[axis];
+        float extent = centroidBounds.boundsMax[axis] - binMin;
+        if(extent <= 0.0f)
+        {
+            continue;
+        }
+        float binScale = SAH_BINS / extent;
+
+        BVHBounds bins[SAH_BINS];
+        uint32_t binCounts[SAH_BINS] = {};
+        for(uint32_t i = 0 ; i < count; i++)
+        {
+            int bin = getBin(centroids[order[i]][axis], binMin, binScale);
+            bins[bin].grow(primitives[order[i]]);
+            binCounts[bin]++;
+        }
+
+        // Right side areas and counts swept from the top, left side from the bottom
+        float rightAreas[SAH_BINS];
+        uint32_t rightCounts[SAH_BINS];
+        BVHBounds right;
+        uint32_t rightCount = 0;
+        for(int bin = SAH_BINS - 1 ; bin > 0; bin--)
+        {
+            right.grow(bins[bin]);
+            rightCount += binCounts[bin];
+            rightAreas[bin] = right.getArea();
+            rightCounts[bin] = rightCount;
+        }
+
+        BVHBounds left;
+        uint32_t leftCount = 0;
+        for(int bin = 1 ; bin < SAH_BINS; bin++)
+        {
+            left.grow(bins[bin - 1]);
+            leftCount += binCounts[bin - 1];
+            if(leftCount == 0 || rightCounts[bin] == 0)
+            {
+                continue;
+            }
+
+            float cost = left.getArea() * leftCount + rightAreas[bin] * rightCounts[bin];
+            if(cost < best.cost)
+            {
+                best.axis = axis;
+                best.bin = bin;
+                best.cost = cost;
+            }
+        }
+    }
+    return best;
+}
+
+BVH buildBVH(const std::vector<BVHBounds> & primitives, uint32_t maxLeafCount)
+{
+    BVH bvh;
+
+    uint32_t numPrimitives = static_cast<uint32_t>(primitives.size());
+    if(numPrimitives == 0)
+    {
+        return bvh;
+    }
+
+    std::vector<glm::vec3> centroids(numPrimitives);
+    bvh.primitiveOrder.resize(numPrimitives);
+    for(uint32_t i = 0 ; i < numPrimitives; i++)
+    {
+        centroids[i] = primitives[i].getCenter();
+        bvh.primitiveOrder[i] = i;
+    }
+
+    // A binary tree with at least one primitive per leaf
+    bvh.nodes.reserve(2 * static_cast<size_t>(numPrimitives) - 1);
+
+    BVHNode root;
+    root.leftOrFirst = 0;
+    root.count = numPrimitives;
+    bvh.nodes.push_back(root);
+
+    struct PendingNode
+    {
+        uint32_t index;
+        int depth;
+    };
+    std::vector<PendingNode> pending;
+    pending.push_back({0, 1});
+
+    while(!pending.empty())
+    {
+        PendingNode current = pending.back();
+        pending.pop_back();
+        bvh.depth = std::max(bvh.depth, current.depth);
+
+        uint32_t first = bvh.nodes[current.index].leftOrFirst;
+        uint32_t count = bvh.nodes[current.index].count;
+        uint32_t * order = bvh.primitiveOrder.data() + first;
+
+        BVHBounds bounds, centroidBounds;
+        for(uint32_t i = 0 ; i < count; i++)
+        {
+            bounds.grow(primitives[order[i]]);
+            centroidBounds.grow(centroids[order[i]]);
+        }
+        bvh.nodes[current.index].boundsMin = bounds.boundsMin;
+        bvh.nodes[current.index].boundsMax = bounds.boundsMax;
+
+        if(count <= MIN_SPLIT_COUNT || current.depth >= BVH_MAX_DEPTH)
+        {
+            continue;
+        }
+
+        SplitCandidate split = findSplit(primitives, centroids, order, count, centroidBounds);
+        float leafCost = bounds.getArea() * count;
+        float splitCost = bounds.getArea() * TRAVERSAL_COST + split.cost;
+        if(split.axis < 0 || (splitCost >= leafCost && count <= maxLeafCount))
+        {
+            continue;
+        }
+
+        float binMin = centroidBounds.boundsMin[split.axis];
+        float binScale = SAH_BINS / (centroidBounds.boundsMax[split.axis] - binMin);
+        uint32_t * middle = std::partition(order, order + count, [&](uint32_t primitive)
+        {
+            return getBin(centroids[primitive][split.axis], binMin, binScale) < split.bin;
+        });
+        uint32_t leftCount = static_cast<uint32_t>(middle - order);
+
+        BVHNode left, right;
+        left.leftOrFirst = first;
+        left.count = leftCount;
+        right.leftOrFirst = first + leftCount;
+        right.count = count - leftCount;
+
+        uint32_t leftIndex = static_cast<uint32_t>(bvh.nodes.size());
+        bvh.nodes.push_back(left);
+        bvh.nodes.push_back(right);
+        bvh.nodes[current.index].leftOrFirst = leftIndex;
+        bvh.nodes[current.index].count = 0;
+
+        pending.push_back({leftIndex + 1, current.depth + 1});
+        pending.push_back({leftIndex, current.depth + 1});
+    }
+
+    bvh.nodes.shrink_to_fit();
+    return bvh;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Axis aligned box, empty (min above max) until it grows
+struct BVHBounds
+{
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    BVHBounds() : boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max())
+    {
+
+    }
+
+    void grow(const glm::vec3 & p)
+    {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+
+    void grow(const BVHBounds & b)
+    {
+        boundsMin = glm::min(boundsMin, b.boundsMin);
+        boundsMax = glm::max(boundsMax, b.boundsMax);
+    }
+
+    // Box around the eight corners moved by an affine transform
+    BVHBounds getTransformed(const glm::mat4 & transform) const
+    {
+        BVHBounds result;
+        for(int corner = 0 ; corner < 8; corner++)
+        {
+            glm::vec3 p((corner & 1) ? boundsMax.x : boundsMin.x,
+                        (corner & 2) ? boundsMax.y : boundsMin.y,
+                        (corner & 4) ? boundsMax.z : boundsMin.z);
+            glm::vec4 moved = transform * glm::vec4(p, 1.0f);
+            result.grow(glm::vec3(moved.x, moved.y, moved.z));
+        }
+        return result;
+    }
+
+    bool isEmpty() const
+    {
+        return boundsMin.x > boundsMax.x;
+    }
+
+    glm::vec3 getCenter() const
+    {
+        return (boundsMin + boundsMax) * 0.5f;
+    }
+
+    // Half the surface area, zero while empty
+    float getArea() const
+    {
+        if(isEmpty())
+        {
+            return 0.0f;
+        }
+        glm::vec3 e = boundsMax - boundsMin;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+// Node as read by instances.cl. Inner nodes have count 0 and their two
+// children side by side at leftOrFirst, leaves hold count primitives from
+// leftOrFirst on in primitive order.
+struct BVHNode
+{
+    glm::vec3 boundsMin;
+    uint32_t leftOrFirst;
+    glm::vec3 boundsMax;
+    uint32_t count;
+};
+
+struct BVH
+{
+    std::vector<BVHNode> nodes; // root first
+    std::vector<uint32_t> primitiveOrder; // primitive of every leaf slot
+    int depth;
+
+    BVH() : depth(0)
+    {
+
+    }
+
+    size_t getBytes() const
+    {
+        return sizeof(BVHNode) * nodes.size() + sizeof(uint32_t) * primitiveOrder.size();
+    }
+};
+
+// Deepest level the builder splits to, the kernels size their traversal stacks from it
+static const int BVH_MAX_DEPTH = 64;
+
+// Binned SAH build over the boxes of the primitives, leaves hold at most
+// maxLeafCount primitives unless they cannot be told apart
+BVH buildBVH(const std::vector<BVHBounds> & primitives, uint32_t maxLeafCount = 16);
@@ -0,0 +1,27 @@
+#include "camera.h"
+
+#include <cmath>
+
+CameraConstants computeCameraConstants(const Camera & camera, int width, int height)
+{
+    glm::vec3 forward = glm::normalize(camera.target - camera.eye);
+    glm::vec3 right = glm::normalize(glm::cross(camera.up, forward));
+    glm::vec3 up = glm::cross(forward, right);
+
+    // Image plane one unit in front of the eye
+    float halfHeight = std::tan(glm::radians(camera.verticalFov) * 0.5f);
+    float pixelSize = 2.0f * halfHeight / static_cast<float>(height);
+
+    glm::vec3 deltaX = right * pixelSize;
+    glm::vec3 deltaY = up * -pixelSize;
+
+    // Through the center of the top left pixel
+    glm::vec3 firstPixel = forward + deltaX * (0.5f - 0.5f * width) + deltaY * (0.5f - 0.5f * height);
+
+    CameraConstants constants;
+    constants.eye = glm::vec4(camera.eye, 0.0f);
+    constants.firstPixelDir = glm::vec4(firstPixel, 0.0f);
+    constants.pixelDeltaX = glm::vec4(deltaX, 0.0f);
+    constants.pixelDeltaY = glm::vec4(deltaY, 0.0f);
+    return constants;
+}
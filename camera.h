@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Vertical field of view of the former fixed projection (pixels one unit apart,
+// 1000 units in front of the eye) on the 480 rows of the default window
+static const float DEFAULT_VERTICAL_FOV = 27.0f;
+
+// Pinhole camera looking from eye at target
+struct Camera
+{
+    glm::vec3 eye;
+    glm::vec3 target;
+    glm::vec3 up;
+    float verticalFov; // degrees
+
+    Camera() : eye(0.0f, 0.0f, -40.0f), target(0.0f, 0.0f, 0.0f), up(0.0f, 1.0f, 0.0f), verticalFov(DEFAULT_VERTICAL_FOV)
+    {
+
+    }
+};
+
+// Layout of Camera in raytracing.cl, passed by value to the tracing kernels.
+// The ray of pixel (x, y) starts at eye with direction
+// normalize(firstPixelDir + x * pixelDeltaX + y * pixelDeltaY). eye.w is the subpixel
+// jitter seed of the frame (zero for pixel centers), firstPixelDir.w the seed of the
+// per pixel random sequences. The other w components are unused.
+struct CameraConstants
+{
+    glm::vec4 eye;
+    glm::vec4 firstPixelDir;
+    glm::vec4 pixelDeltaX;
+    glm::vec4 pixelDeltaY;
+};
+
+static_assert(sizeof(CameraConstants) == 16 * sizeof(float), "CameraConstants must match the OpenCL float4 layout");
+
+// Basis and pixel steps for a width x height image, rows go top to bottom
+CameraConstants computeCameraConstants(const Camera & camera, int width, int height);
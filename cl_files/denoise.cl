@@ -0,0 +1,111 @@
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the
+// G-buffer. Colors and the float4 temporaries use the layout of the tracing
+// kernels (rows flipped), depth and normals are indexed y * width + x.
+// Alpha carries the material and is passed through unfiltered.
+
+// B3 spline, indexed by the tap distance in steps
+__constant float ATROUS_WEIGHTS[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+// Inverse of encodeNormal
+static float3 decodeNormal(uint encoded)
+{
+    const float2 p = convert_float2(as_short2(encoded)) * (1.0f / 32767.0f);
+    float3 n = (float3)(p, 1.0f - fabs(p.x) - fabs(p.y));
+    if(n.z < 0.0f)
+    {
+        n.xy = (1.0f - fabs(p.yx)) * select((float2)(-1.0f), (float2)(1.0f), isgreaterequal(p, (float2)(0.0f)));
+    }
+    return normalize(n);
+}
+
+// Colors in the format of the program to float4 for the first pass
+__kernel void denoiseLoadKernel(__global const COLOR_T * colors,
+                                __global float * output,
+                                const int width,
+                                const int height)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if(x >= width || y >= height)
+    {
+        return;
+    }
+
+    int idx = y * width + x;
+    vstore4(loadColor(idx, colors), idx, output);
+}
+
+// One pass over 5x5 taps stepWidth pixels apart. Color differences are
+// weighted by invColorVariance, depth differences relative to the center depth
+// per pixel of tap distance by invDepthScale, normals by the cosine to normalPower.
+__kernel void denoiseAtrousKernel(__global const float * input,
+                                  __global float * output,
+                                  __global const float * depth,
+                                  __global const uint * normals,
+                                  const int width,
+                                  const int height,
+                                  const int stepWidth,
+                                  const float invColorVariance,
+                                  const float invDepthScale,
+                                  const float normalPower)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if(x >= width || y >= height)
+    {
+        return;
+    }
+
+    const int colorIdx = (height - 1 - y) * width + x;
+    const float4 center = vload4(colorIdx, input);
+    const float centerDepth = depth[y * width + x];
+    const float3 centerNormal = decodeNormal(normals[y * width + x]);
+    const bool centerHit = isless(centerDepth, MAXFLOAT);
+
+    float3 sum = (float3)(0.0f);
+    float weightSum = 0.0f;
+    for(int dy = -2 ; dy <= 2; dy++)
+    {
+        const int ty = y + dy * stepWidth;
+        if(ty < 0 || ty >= height)
+        {
+            continue;
+        }
+
+        for(int dx = -2 ; dx <= 2; dx++)
+        {
+            const int tx = x + dx * stepWidth;
+            if(tx < 0 || tx >= width)
+            {
+                continue;
+            }
+
+            // Hits and background never mix
+            const float tapDepth = depth[ty * width + tx];
+            if(centerHit != isless(tapDepth, MAXFLOAT))
+            {
+                continue;
+            }
+
+            const float3 color = vload4((height - 1 - ty) * width + tx, input).xyz;
+            const float3 diff = color - center.xyz;
+
+            float weight = ATROUS_WEIGHTS[abs(dx)] * ATROUS_WEIGHTS[abs(dy)];
+            weight *= native_exp(-dot(diff, diff) * invColorVariance);
+            if(centerHit)
+            {
+                const float taps = (float)max(max(abs(dx), abs(dy)), 1u);
+                weight *= native_exp(-fabs(centerDepth - tapDepth) / (centerDepth * taps) * invDepthScale);
+                weight *= powr(max(dot(centerNormal, decodeNormal(normals[ty * width + tx])), 0.0f), normalPower);
+            }
+
+            sum += color * weight;
+            weightSum += weight;
+        }
+    }
+
+    // The center tap always has a positive weight
+    vstore4((float4)(sum / weightSum, center.w), colorIdx, output);
+}
@@ -0,0 +1,123 @@
+// Uniform grid over the scene spheres built on the device with a counting
+// sort: gridClearKernel, gridCountKernel, an exclusive scan of the counts
+// (prefix_sum.cl) and gridScatterKernel, nothing is read back. Cells are
+// cubes at least as large as the biggest sphere, so a sphere lands in eight
+// cells at most. The spheres of cell c are sphereIndices[cellStarts[c]] up to
+// cellStarts[c + 1], cells are x major (c = (z * resY + y) * resX + x).
+// gridParams is float8, (gridMin, cellSize), (resolution bits, cell count bits).
+
+typedef struct
+{
+    float3 gridMin;
+    float cellSize;
+    int3 resolution;
+} GridParams;
+
+static GridParams loadGridParams(__global const float * gridParams)
+{
+    const float8 p = vload8(0, gridParams);
+    GridParams params;
+    params.gridMin = p.s012;
+    params.cellSize = p.s3;
+    params.resolution = as_int3(p.s456);
+    return params;
+}
+
+static int3 getGridCell(const GridParams * params, float3 p)
+{
+    return clamp(convert_int3_rtn((p - params->gridMin) / params->cellSize), (int3)(0), params->resolution - 1);
+}
+
+static int getGridCellIndex(const GridParams * params, int3 cell)
+{
+    return (cell.z * params->resolution.y + cell.y) * params->resolution.x + cell.x;
+}
+
+// Zeroes the numCells + 1 counts (the last one makes the scan end in the total)
+// and stores the parameters the other kernels and the tracing kernels read
+__kernel void gridClearKernel(__global int * counts,
+                              __global float * gridParams,
+                              const float gridMinX,
+                              const float gridMinY,
+                              const float gridMinZ,
+                              const float cellSize,
+                              const int resolutionX,
+                              const int resolutionY,
+                              const int resolutionZ)
+{
+    const int i = get_global_id(0);
+    const int numCells = resolutionX * resolutionY * resolutionZ;
+    if(i > numCells)
+    {
+        return;
+    }
+
+    counts[i] = 0;
+    if(i == 0)
+    {
+        vstore8((float8)(gridMinX, gridMinY, gridMinZ, cellSize,
+                         as_float(resolutionX), as_float(resolutionY), as_float(resolutionZ), as_float(numCells)),
+                0, gridParams);
+    }
+}
+
+// Adds every sphere to the count of each cell its box overlaps
+__kernel void gridCountKernel(__global const float * spheres,
+                              __global const float * gridParams,
+                              __global int * counts,
+                              const int numSpheres)
+{
+    const int i = get_global_id(0);
+    if(i >= numSpheres)
+    {
+        return;
+    }
+
+    const GridParams params = loadGridParams(gridParams);
+    const float4 sphere = vload4(2 * i, spheres);
+    const int3 first = getGridCell(&params, sphere.xyz - sphere.w);
+    const int3 last = getGridCell(&params, sphere.xyz + sphere.w);
+    for(int z = first.z ; z <= last.z; z++)
+    {
+        for(int y = first.y ; y <= last.y; y++)
+        {
+            for(int x = first.x ; x <= last.x; x++)
+            {
+                atomic_inc(&counts[getGridCellIndex(&params, (int3)(x, y, z))]);
+            }
+        }
+    }
+}
+
+// Writes every sphere into the cells it was counted in. The counts serve as
+// cursors counting down from the end of each cell's range, so the order of the
+// spheres inside a cell is arbitrary.
+__kernel void gridScatterKernel(__global const float * spheres,
+                                __global const float * gridParams,
+                                __global const int * cellStarts,
+                                __global int * counts,
+                                __global int * sphereIndices,
+                                const int numSpheres)
+{
+    const int i = get_global_id(0);
+    if(i >= numSpheres)
+    {
+        return;
+    }
+
+    const GridParams params = loadGridParams(gridParams);
+    const float4 sphere = vload4(2 * i, spheres);
+    const int3 first = getGridCell(&params, sphere.xyz - sphere.w);
+    const int3 last = getGridCell(&params, sphere.xyz + sphere.w);
+    for(int z = first.z ; z <= last.z; z++)
+    {
+        for(int y = first.y ; y <= last.y; y++)
+        {
+            for(int x = first.x ; x <= last.x; x++)
+            {
+                const int cell = getGridCellIndex(&params, (int3)(x, y, z));
+                sphereIndices[cellStarts[cell] + atomic_dec(&counts[cell]) - 1] = i;
+            }
+        }
+    }
+}
@@ -0,0 +1,359 @@
+// Two level acceleration structure built on the host (instancing.h). The top
+// level BVH is over instances, each instance points at a bottom level BVH over
+// triangles or spheres in object space, shared by every instance of it.
+// With INSTANCES the tracing kernels and helpers take INSTANCE_ARGS after
+// their last argument and hand them on with INSTANCE_PASS:
+// topNodes      float8 per top level node, leaves index instances
+// instances     float16 per instance, three rows of the world to object transform,
+//               then bottom level and scene instance id bits
+// bottomNodes   float8 per node of all bottom levels
+// bottomInfos   float8 per bottom level, color, then root node, type and primitive count bits
+// meshVertices  packed float3
+// meshTriangles packed uint3 of vertex indices, in leaf order
+// groupSpheres  float8 per sphere as in the scene, in leaf order
+// Nodes are (boundsMin, leftOrFirst bits), (boundsMax, count bits).
+#if defined(INSTANCES)
+#define INSTANCE_ARGS , __global const float * topNodes, \
+                        __global const float * instances, \
+                        __global const float * bottomNodes, \
+                        __global const float * bottomInfos, \
+                        __global const float * meshVertices, \
+                        __global const uint * meshTriangles, \
+                        __global const float * groupSpheres
+#define INSTANCE_PASS , topNodes, instances, bottomNodes, bottomInfos, meshVertices, meshTriangles, groupSpheres
+
+// Matches BVH_MAX_DEPTH, one far child is pushed per level at most
+#define BVH_STACK_SIZE 64
+
+// Bottom level types, as BottomLevelType
+#define BOTTOM_LEVEL_TRIANGLES 0u
+#define BOTTOM_LEVEL_SPHERES 1u
+
+__constant float INSTANCE_MIN_DISTANCE = 1e-6f;
+
+typedef struct
+{
+    float distance; // ray parameter
+    int instanceIdx; // in leaf order
+    int primitiveIdx; // global, in leaf order
+} InstanceHit;
+
+// Ray parameter where the ray enters the node box, MAXFLOAT when it misses or enters past tMax
+static float intersectBounds(float8 node, float3 origin, float3 invDir, float tMax)
+{
+    const float3 t0 = (node.lo.xyz - origin) * invDir;
+    const float3 t1 = (node.hi.xyz - origin) * invDir;
+    const float3 tNear = fmin(t0, t1);
+    const float3 tFar = fmax(t0, t1);
+    const float enter = fmax(fmax(tNear.x, tNear.y), fmax(tNear.z, 0.0f));
+    const float exit = fmin(fmin(tFar.x, tFar.y), fmin(tFar.z, tMax));
+    return enter <= exit ? enter : MAXFLOAT;
+}
+
+// Moller-Trumbore, ray parameter of the hit or MAXFLOAT. Both sides are hit.
+static float intersectTriangle(float3 origin, float3 dir, float3 v0, float3 v1, float3 v2)
+{
+    const float3 e1 = v1 - v0;
+    const float3 e2 = v2 - v0;
+    const float3 p = cross(dir, e2);
+    const float det = dot(e1, p);
+    if(fabs(det) < 1e-12f)
+    {
+        return MAXFLOAT;
+    }
+
+    const float invDet = 1.0f / det;
+    const float3 s = origin - v0;
+    const float u = dot(s, p) * invDet;
+    if(u < 0.0f || u > 1.0f)
+    {
+        return MAXFLOAT;
+    }
+
+    const float3 q = cross(s, e1);
+    const float v = dot(dir, q) * invDet;
+    if(v < 0.0f || u + v > 1.0f)
+    {
+        return MAXFLOAT;
+    }
+
+    const float t = dot(e2, q) * invDet;
+    return t > INSTANCE_MIN_DISTANCE ? t : MAXFLOAT;
+}
+
+// Nearest ray parameter on a sphere (center, radius), dir need not be normalized
+static float intersectGroupSphere(float3 origin, float3 dir, float4 sphere)
+{
+    const float3 L = origin - sphere.xyz;
+    const float a = dot(dir, dir);
+    const float b = dot(L, dir);
+    const float c = dot(L, L) - sphere.w * sphere.w;
+    const float discr = b * b - a * c;
+    if(discr < 0.0f)
+    {
+        return MAXFLOAT;
+    }
+
+    const float root = sqrt(discr);
+    float t = (-b - root) / a;
+    if(t <= INSTANCE_MIN_DISTANCE)
+    {
+        t = (-b + root) / a;
+    }
+    return t > INSTANCE_MIN_DISTANCE ? t : MAXFLOAT;
+}
+
+static float3 transformPoint(float16 m, float3 p)
+{
+    return (float3)(dot(m.s012, p) + m.s3, dot(m.s456, p) + m.s7, dot(m.s89a, p) + m.sb);
+}
+
+static float3 transformDirection(float16 m, float3 d)
+{
+    return (float3)(dot(m.s012, d), dot(m.s456, d), dot(m.s89a, d));
+}
+
+// Object space normal to world space, by the transpose of the world to object rows
+static float3 transformNormal(float16 m, float3 n)
+{
+    return normalize(m.s012 * n.x + m.s456 * n.y + m.s89a * n.z);
+}
+
+// Inner node at the top of a traversal: returns the nearer child the ray enters
+// before closest and pushes the other one, -1 when neither is entered
+static int enterChildren(__global const float * nodes,
+                         uint left,
+                         float3 origin,
+                         float3 invDir,
+                         float closest,
+                         int * stack,
+                         float * stackDistances,
+                         int * stackSize)
+{
+    int nearIdx = (int)left;
+    int farIdx = nearIdx + 1;
+    float nearDistance = intersectBounds(vload8(nearIdx, nodes), origin, invDir, closest);
+    float farDistance = intersectBounds(vload8(farIdx, nodes), origin, invDir, closest);
+    if(farDistance < nearDistance)
+    {
+        const float distance = nearDistance;
+        nearDistance = farDistance;
+        farDistance = distance;
+        nearIdx = farIdx;
+        farIdx = (int)left;
+    }
+
+    if(nearDistance == MAXFLOAT)
+    {
+        return -1;
+    }
+    if(farDistance < MAXFLOAT)
+    {
+        stack[*stackSize] = farIdx;
+        stackDistances[*stackSize] = farDistance;
+        (*stackSize)++;
+    }
+    return nearIdx;
+}
+
+// Next pushed node the ray entered before closest, -1 when there is none
+static int popNode(const int * stack, const float * stackDistances, int * stackSize, float closest)
+{
+    while(*stackSize > 0)
+    {
+        (*stackSize)--;
+        if(stackDistances[*stackSize] < closest)
+        {
+            return stack[*stackSize];
+        }
+    }
+    return -1;
+}
+
+// Walks one bottom level in object space. Hits before *closest lower it and
+// set *primitiveIdx, anyHit returns at the first one.
+static bool traverseBottomLevel(__global const float * bottomNodes,
+                                __global const float * meshVertices,
+                                __global const uint * meshTriangles,
+                                __global const float * groupSpheres,
+                                int root,
+                                uint type,
+                                float3 origin,
+                                float3 dir,
+                                bool anyHit,
+                                float * closest,
+                                int * primitiveIdx)
+{
+    const float3 invDir = 1.0f / dir;
+    if(intersectBounds(vload8(root, bottomNodes), origin, invDir, *closest) == MAXFLOAT)
+    {
+        return false;
+    }
+
+    int stack[BVH_STACK_SIZE];
+    float stackDistances[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    bool hasHit = false;
+    int nodeIdx = root;
+    while(nodeIdx >= 0)
+    {
+        const float8 node = vload8(nodeIdx, bottomNodes);
+        const uint leftOrFirst = as_uint(node.s3);
+        const uint count = as_uint(node.s7);
+
+        if(count == 0)
+        {
+            nodeIdx = enterChildren(bottomNodes, leftOrFirst, origin, invDir, *closest, stack, stackDistances, &stackSize);
+            if(nodeIdx >= 0)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            for(uint i = leftOrFirst ; i < leftOrFirst + count; i++)
+            {
+                float distance;
+                if(type == BOTTOM_LEVEL_TRIANGLES)
+                {
+                    const uint3 t = vload3(i, meshTriangles);
+                    distance = intersectTriangle(origin, dir,
+                                                 vload3(t.x, meshVertices),
+                                                 vload3(t.y, meshVertices),
+                                                 vload3(t.z, meshVertices));
+                }
+                else
+                {
+                    distance = intersectGroupSphere(origin, dir, vload4(2 * i, groupSpheres));
+                }
+
+                if(distance < *closest)
+                {
+                    *closest = distance;
+                    *primitiveIdx = (int)i;
+                    hasHit = true;
+                    if(anyHit)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+
+        nodeIdx = popNode(stack, stackDistances, &stackSize, *closest);
+    }
+    return hasHit;
+}
+
+// Walks the top level and the bottom level of every instance the ray reaches
+static bool traverseInstances(float3 origin, float3 dir, bool anyHit, InstanceHit * hit INSTANCE_ARGS)
+{
+    const float3 invDir = 1.0f / dir;
+    if(intersectBounds(vload8(0, topNodes), origin, invDir, hit->distance) == MAXFLOAT)
+    {
+        return false;
+    }
+
+    int stack[BVH_STACK_SIZE];
+    float stackDistances[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    bool hasHit = false;
+    int nodeIdx = 0;
+    while(nodeIdx >= 0)
+    {
+        const float8 node = vload8(nodeIdx, topNodes);
+        const uint leftOrFirst = as_uint(node.s3);
+        const uint count = as_uint(node.s7);
+
+        if(count == 0)
+        {
+            nodeIdx = enterChildren(topNodes, leftOrFirst, origin, invDir, hit->distance, stack, stackDistances, &stackSize);
+            if(nodeIdx >= 0)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            for(uint i = leftOrFirst ; i < leftOrFirst + count; i++)
+            {
+                // The transformed direction keeps ray parameters comparable across instances
+                const float16 instance = vload16(i, instances);
+                const float4 info = vload4(2 * as_uint(instance.sc) + 1, bottomInfos);
+                if(traverseBottomLevel(bottomNodes, meshVertices, meshTriangles, groupSpheres,
+                                       (int)as_uint(info.x), as_uint(info.y),
+                                       transformPoint(instance, origin), transformDirection(instance, dir),
+                                       anyHit, &hit->distance, &hit->primitiveIdx))
+                {
+                    hit->instanceIdx = (int)i;
+                    hasHit = true;
+                    if(anyHit)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+
+        nodeIdx = popNode(stack, stackDistances, &stackSize, hit->distance);
+    }
+    return hasHit;
+}
+
+// Closest primitive of all instances with a ray parameter below tMax
+static bool intersectInstances(float3 origin, float3 dir, float tMax, InstanceHit * hit INSTANCE_ARGS)
+{
+    hit->distance = tMax;
+    hit->instanceIdx = -1;
+    hit->primitiveIdx = -1;
+    return traverseInstances(origin, dir, false, hit INSTANCE_PASS);
+}
+
+// True when any primitive lies on the ray before tMax, for shadow rays
+static bool isOccludedByInstances(float3 origin, float3 dir, float tMax INSTANCE_ARGS)
+{
+    InstanceHit hit;
+    hit.distance = tMax;
+    hit.instanceIdx = -1;
+    hit.primitiveIdx = -1;
+    return traverseInstances(origin, dir, true, &hit INSTANCE_PASS);
+}
+
+// World space normal and color of a hit along origin + t * dir. Triangle
+// normals face the ray, sphere normals point outwards like scene spheres.
+static void getInstanceSurface(const InstanceHit * hit, float3 origin, float3 dir, float3 * normal, float4 * color INSTANCE_ARGS)
+{
+    const float16 instance = vload16(hit->instanceIdx, instances);
+    const uint bottomLevel = as_uint(instance.sc);
+
+    if(as_uint(vload4(2 * bottomLevel + 1, bottomInfos).y) == BOTTOM_LEVEL_TRIANGLES)
+    {
+        const uint3 t = vload3(hit->primitiveIdx, meshTriangles);
+        const float3 v0 = vload3(t.x, meshVertices);
+        *normal = transformNormal(instance, cross(vload3(t.y, meshVertices) - v0, vload3(t.z, meshVertices) - v0));
+        if(dot(*normal, dir) > 0.0f)
+        {
+            *normal = -*normal;
+        }
+        *color = vload4(2 * bottomLevel, bottomInfos);
+    }
+    else
+    {
+        const float8 sphere = vload8(hit->primitiveIdx, groupSpheres);
+        const float3 p = transformPoint(instance, origin) + transformDirection(instance, dir) * hit->distance;
+        *normal = transformNormal(instance, p - sphere.s012);
+        *color = sphere.hi;
+    }
+}
+
+// Index of the hit instance in the scene's instance list (getSceneInstances)
+static int getInstanceId(const InstanceHit * hit INSTANCE_ARGS)
+{
+    return (int)as_uint(vload16(hit->instanceIdx, instances).sd);
+}
+#else
+#define INSTANCE_ARGS
+#define INSTANCE_PASS
+#endif
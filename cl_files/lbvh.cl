@@ -0,0 +1,191 @@
+// Linear BVH over the scene spheres built on the device, after Karras,
+// "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees".
+// A build is lbvhMortonKernel, a radix sort of the codes (radix_sort.cl),
+// lbvhHierarchyKernel and lbvhFitBoundsKernel, nothing is read back.
+// The n - 1 inner nodes come first with the root at 0, sorted sphere i is leaf
+// node n - 1 + i (a single sphere is the root itself). Nodes are float8,
+// (boundsMin, left child bits), (boundsMax, right child bits), leaves hold
+// their sphere index in place of the left child.
+
+// Spreads the lower 10 bits of v so there are two zero bits between each
+static uint expandBits(uint v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30 bit Morton code of a point in the unit cube
+static uint getMortonCode(float3 p)
+{
+    uint x = (uint)clamp(p.x * 1024.0f, 0.0f, 1023.0f);
+    uint y = (uint)clamp(p.y * 1024.0f, 0.0f, 1023.0f);
+    uint z = (uint)clamp(p.z * 1024.0f, 0.0f, 1023.0f);
+    return expandBits(x) * 4 + expandBits(y) * 2 + expandBits(z);
+}
+
+// Morton code of every sphere center within the box given by its min corner
+// and inverse extent, values are the sphere indices the sort moves along
+__kernel void lbvhMortonKernel(__global const float * spheres,
+                               __global uint * keys,
+                               __global int * values,
+                               const int numSpheres,
+                               const float boundsMinX,
+                               const float boundsMinY,
+                               const float boundsMinZ,
+                               const float invExtentX,
+                               const float invExtentY,
+                               const float invExtentZ)
+{
+    const int i = get_global_id(0);
+    if(i >= numSpheres)
+    {
+        return;
+    }
+
+    const float3 center = vload4(2 * i, spheres).xyz;
+    const float3 boundsMin = (float3)(boundsMinX, boundsMinY, boundsMinZ);
+    const float3 invExtent = (float3)(invExtentX, invExtentY, invExtentZ);
+    keys[i] = getMortonCode((center - boundsMin) * invExtent);
+    values[i] = i;
+}
+
+// Length of the common prefix of sorted keys i and j, -1 when j is out of range.
+// Equal keys are told apart by their indices.
+static int getCommonPrefix(__global const uint * keys, int numKeys, int i, int j)
+{
+    if(j < 0 || j >= numKeys)
+    {
+        return -1;
+    }
+
+    const uint a = keys[i];
+    const uint b = keys[j];
+    return a != b ? (int)clz(a ^ b) : 32 + (int)clz((uint)(i ^ j));
+}
+
+// One work item per inner node: finds the range of sorted keys it covers and
+// the split inside it, links both children and resets the node's fit flag
+__kernel void lbvhHierarchyKernel(__global const uint * keys,
+                                  __global float * nodes,
+                                  __global int * parents,
+                                  __global int * flags,
+                                  const int numSpheres)
+{
+    const int i = get_global_id(0);
+    if(i >= numSpheres - 1)
+    {
+        return;
+    }
+
+    // The range extends towards the neighbour sharing the longer prefix
+    const int d = getCommonPrefix(keys, numSpheres, i, i + 1) > getCommonPrefix(keys, numSpheres, i, i - 1) ? 1 : -1;
+
+    // Grow an upper bound of the range length, then search the other end below it
+    const int minPrefix = getCommonPrefix(keys, numSpheres, i, i - d);
+    int maxLength = 2;
+    while(getCommonPrefix(keys, numSpheres, i, i + maxLength * d) > minPrefix)
+    {
+        maxLength *= 2;
+    }
+
+    int length = 0;
+    for(int t = maxLength / 2 ; t >= 1; t /= 2)
+    {
+        if(getCommonPrefix(keys, numSpheres, i, i + (length + t) * d) > minPrefix)
+        {
+            length += t;
+        }
+    }
+    const int j = i + length * d;
+
+    // Split at the last key sharing more than the range's common prefix with i
+    const int nodePrefix = getCommonPrefix(keys, numSpheres, i, j);
+    int split = 0;
+    int divisor = 2;
+    int t;
+    do
+    {
+        t = (length + divisor - 1) / divisor;
+        if(getCommonPrefix(keys, numSpheres, i, i + (split + t) * d) > nodePrefix)
+        {
+            split += t;
+        }
+        divisor *= 2;
+    }
+    while(t > 1);
+    const int gamma = i + split * d + min(d, 0);
+
+    // Ranges of one key are leaves
+    const int left = min(i, j) == gamma ? numSpheres - 1 + gamma : gamma;
+    const int right = max(i, j) == gamma + 1 ? numSpheres + gamma : gamma + 1;
+
+    nodes[8 * i + 3] = as_float(left);
+    nodes[8 * i + 7] = as_float(right);
+    parents[left] = i;
+    parents[right] = i;
+    flags[i] = 0;
+}
+
+static float3 loadNodeMin(volatile __global const float * nodes, int node)
+{
+    return (float3)(nodes[8 * node], nodes[8 * node + 1], nodes[8 * node + 2]);
+}
+
+static float3 loadNodeMax(volatile __global const float * nodes, int node)
+{
+    return (float3)(nodes[8 * node + 4], nodes[8 * node + 5], nodes[8 * node + 6]);
+}
+
+static void storeNodeBounds(volatile __global float * nodes, int node, float3 boundsMin, float3 boundsMax)
+{
+    nodes[8 * node]     = boundsMin.x;
+    nodes[8 * node + 1] = boundsMin.y;
+    nodes[8 * node + 2] = boundsMin.z;
+    nodes[8 * node + 4] = boundsMax.x;
+    nodes[8 * node + 5] = boundsMax.y;
+    nodes[8 * node + 6] = boundsMax.z;
+}
+
+// One work item per sorted sphere: fills its leaf, then walks up. The first
+// child to reach a parent stops there, the second one sees both children
+// fitted and fits the parent, so every inner node is fitted exactly once.
+// Nodes are volatile so the sibling's bounds are read from memory.
+__kernel void lbvhFitBoundsKernel(__global const float * spheres,
+                                  __global const int * values,
+                                  volatile __global float * nodes,
+                                  __global const int * parents,
+                                  __global int * flags,
+                                  const int numSpheres)
+{
+    const int i = get_global_id(0);
+    if(i >= numSpheres)
+    {
+        return;
+    }
+
+    const int sphereIdx = values[i];
+    const float4 sphere = vload4(2 * sphereIdx, spheres);
+    int nodeIdx = numSpheres - 1 + i;
+    storeNodeBounds(nodes, nodeIdx, sphere.xyz - sphere.w, sphere.xyz + sphere.w);
+    nodes[8 * nodeIdx + 3] = as_float(sphereIdx);
+    nodes[8 * nodeIdx + 7] = as_float(0);
+
+    while(nodeIdx != 0)
+    {
+        nodeIdx = parents[nodeIdx];
+        mem_fence(CLK_GLOBAL_MEM_FENCE);
+        if(atomic_inc(&flags[nodeIdx]) == 0)
+        {
+            return;
+        }
+
+        const int left = as_int(nodes[8 * nodeIdx + 3]);
+        const int right = as_int(nodes[8 * nodeIdx + 7]);
+        storeNodeBounds(nodes, nodeIdx,
+                        fmin(loadNodeMin(nodes, left), loadNodeMin(nodes, right)),
+                        fmax(loadNodeMax(nodes, left), loadNodeMax(nodes, right)));
+    }
+}
@@ -1,113 +1,104 @@
-
-// Naive Scan
-#if 0
-static int _prefixSum(__local int *temp,
-                       int  n)
+// Work efficient exclusive scan (up sweep and down sweep) of n = 2 * local size
+// elements in local memory. Returns the total of the block, every work item of
+// the group must call it.
+// Reference: http://http.developer.nvidia.com/GPUGems3/gpugems3_ch39.html
+static int workGroupExclusiveScan(__local int * temp, int n)
 {
-    int thid = get_local_id(0);
+    const int thid = get_local_id(0);
+    int offset = 1;
 
-    for (int offset = 1; offset < n; offset *= 2)
+    // Up sweep, builds partial sums in place
+    for(int d = n >> 1; d > 0; d >>= 1)
     {
-    if (thid >= offset)
-    {
-        temp[thid] += temp[n+thid - offset];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if(thid < d)
+        {
+            int ai = offset * (2 * thid + 1) - 1;
+            int bi = offset * (2 * thid + 2) - 1;
+            temp[bi] += temp[ai];
+        }
+        offset <<= 1;
     }
-    else
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const int total = temp[n - 1];
+    barrier(CLK_LOCAL_MEM_FENCE); // everybody read the total before it is cleared
+    if(thid == 0)
     {
-        temp[thid] = temp[n+thid];
+        temp[n - 1] = 0;
     }
+
+    // Down sweep
+    for(int d = 1; d < n; d <<= 1)
+    {
+        offset >>= 1;
         barrier(CLK_LOCAL_MEM_FENCE);
-        temp[n+thid] = temp[thid];
+        if(thid < d)
+        {
+            int ai = offset * (2 * thid + 1) - 1;
+            int bi = offset * (2 * thid + 2) - 1;
+            int t = temp[ai];
+            temp[ai] = temp[bi];
+            temp[bi] += t;
+        }
     }
-    return temp[thid];
-}
-
-
-__kernel void prefixSum(__global int * input,
-                         __global int * output,
-                         __local  int * temp,
-                         int n)
-{
-   int globalId = get_global_id(0);
-   int localId = get_local_id(0);
-
-   temp[localId] =  localId > 0 ? input[globalId-1] :0;
-   temp[n + localId] = temp[localId];
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-   barrier(CLK_LOCAL_MEM_FENCE);
-
-   output[globalId] = _prefixSum(temp,n);
+    return total;
 }
 
-#else
-
-// My own implementation (not efficient) of prefix sum
-// Reference: http://http.developer.nvidia.com/GPUGems3/gpugems3_ch39.html
-__kernel void prefixSum(__global int * input,
-                         __global int * output,
-                         __local  int * temp,
-                         int n)
+// Exclusive scan of n elements. Every group scans 2 * local size of them
+// (local size must be a power of two) and writes its total to blockSums,
+// the host scans those and adds them back with addBlockSumsKernel.
+// Input and output may be the same buffer.
+__kernel void prefixSum(__global const int * input,
+                        __global int * output,
+                        __global int * blockSums,
+                        __local  int * temp,
+                        const int n)
 {
-    int thid = get_global_id(0);
-    int lthid = get_local_id(0);
-    int pout = 0, pin = 1;
+    const int lid = get_local_id(0);
+    const int localSize = get_local_size(0);
+    const int blockStart = get_group_id(0) * localSize * 2;
 
-//    temp[pout * n + thid] = (thid > 0) ? input[thid-1] : 0;
-    temp[lthid] = input[thid];
+    const int ai = blockStart + lid;
+    const int bi = ai + localSize;
 
-    int offset = 1;
-    for (int d = 1; d < n<<1 ; d <<= 1)
-    {
-        barrier(CLK_LOCAL_MEM_FENCE);
-        // swap double buffer indices
-        pout = 1 - pout;
-        pin  = 1 - pout;
-        // offset     = 2 ^ d
-        // offset * 2 = 2 ^ (d + 1)
+    temp[lid]             = ai < n ? input[ai] : 0;
+    temp[lid + localSize] = bi < n ? input[bi] : 0;
 
-        // x[k + 2 ^ (d+1) - 1] = x [k + 2^d-1] + x[k+2^d +1-1];
+    const int total = workGroupExclusiveScan(temp, localSize * 2);
 
-        if((lthid + 1) % (offset * 2) == 0)
-        {
-            temp[(pout*n + lthid) ] = temp[(pin*n + lthid)] + temp[(pin*n + lthid) - offset];
-        }
-        else
-        {
-            temp[(pout*n + lthid)] = temp[pin * n + lthid]; // repass
-        }
-        offset <<= 1; // ~= d++
+    if(ai < n)
+    {
+        output[ai] = temp[lid];
     }
-    if(lthid == n-1)
+    if(bi < n)
     {
-        temp[(pout*n + lthid) ] = 0;
+        output[bi] = temp[lid + localSize];
     }
-    offset = n;
-    for (int d = 1; d < n <<1 ; d <<= 1)
+    if(lid == 0)
     {
-        barrier(CLK_LOCAL_MEM_FENCE);
-        pout = 1 - pout;
-        pin  = 1 - pout;
+        blockSums[get_group_id(0)] = total;
+    }
+}
 
-        if((lthid + 1) % (offset) == 0)
-        {
-            int t  = temp[(pin*n + lthid)];
-            int t2 = temp[(pin*n + lthid) - offset/2];
+// Same layout as prefixSum, adds the scanned total of the previous blocks
+__kernel void addBlockSumsKernel(__global int * data,
+                                 __global const int * blockSums,
+                                 const int n)
+{
+    const int localSize = get_local_size(0);
+    const int ai = get_group_id(0) * localSize * 2 + get_local_id(0);
+    const int bi = ai + localSize;
+    const int sum = blockSums[get_group_id(0)];
 
-            temp[(pout*n + lthid)]            = t + t2;
-            temp[(pout*n + lthid) - offset/2] = t;
-        }
-        else if((lthid + 1) % (offset/2) == 0)
-        {
-        	// Ugly
-        }
-        else
-        {
-            temp[(pout*n + lthid)] = temp[pin * n + lthid]; // repass
-        }
-        offset >>= 1;
+    if(ai < n)
+    {
+        data[ai] += sum;
+    }
+    if(bi < n)
+    {
+        data[bi] += sum;
     }
-
-    output[thid] = temp[pout*n + lthid]; // write output
 }
-
-#endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+// Least significant digit radix sort of uint keys with int values, 4 bits per
+// pass. A pass is radixHistogramKernel, prefixSum over the histogram and
+// radixScatterKernel, all launched with the same 1D local size (at least RADIX).
+
+#define RADIX_BITS 4
+#define RADIX      16
+#define RADIX_MASK 15u
+
+static uint getRadixDigit(uint key, int shift)
+{
+    return (key >> shift) & RADIX_MASK;
+}
+
+// Digit counts of every block of local size keys, stored digit major
+// (histogram[digit * numGroups + group]) so one exclusive scan gives the
+// output offset of every digit of every block
+__kernel void radixHistogramKernel(__global const uint * keys,
+                                   __global int * histogram,
+                                   const int n,
+                                   const int shift)
+{
+    __local int counts[RADIX];
+
+    const int gid = get_global_id(0);
+    const int lid = get_local_id(0);
+
+    if(lid < RADIX)
+    {
+        counts[lid] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(gid < n)
+    {
+        atomic_inc(&counts[getRadixDigit(keys[gid], shift)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(lid < RADIX)
+    {
+        histogram[lid * get_num_groups(0) + get_group_id(0)] = counts[lid];
+    }
+}
+
+// Stable scatter, a key lands after the keys with the same digit in earlier
+// blocks (scanned histogram) and before it in its own block
+__kernel void radixScatterKernel(__global const uint * keysIn,
+                                 __global const int * valuesIn,
+                                 __global uint * keysOut,
+                                 __global int * valuesOut,
+                                 __global const int * offsets,
+                                 __local uint * digits,
+                                 const int n,
+                                 const int shift)
+{
+    const int gid = get_global_id(0);
+    const int lid = get_local_id(0);
+
+    const uint key = gid < n ? keysIn[gid] : 0;
+    const uint digit = getRadixDigit(key, shift);
+
+    // Padding never matches a digit
+    digits[lid] = gid < n ? digit : RADIX;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(gid >= n)
+    {
+        return;
+    }
+
+    int rank = 0;
+    for(int j = 0; j < lid; j++)
+    {
+        rank += digits[j] == digit ? 1 : 0;
+    }
+
+    const int dst = offsets[digit * get_num_groups(0) + get_group_id(0)] + rank;
+    keysOut[dst] = key;
+    valuesOut[dst] = valuesIn[gid];
+}
@@ -2,6 +2,153 @@ __constant float MINIMUM_INTERSECT_DISTANCE = 1e-7f;
 
 __constant float BIAS_OFFSET = 1e-3f;
 
+// Bounces stop once no channel of the path throughput reaches this
+__constant float MIN_THROUGHPUT = 1e-3f;
+
+// With RUSSIAN_ROULETTE, bounces after this many survive with a probability
+// following their throughput, survivors are scaled up to stay unbiased
+__constant int RUSSIAN_ROULETTE_DEPTH = 2;
+__constant float RUSSIAN_ROULETTE_MAX_SURVIVAL = 0.95f;
+
+// Scene storage is chosen on the host from the device capabilities.
+// SCENE_ARG is the address space of the scene kernel arguments.
+// SETUP_SCENE declares sceneLights inside a tracing kernel, and sceneSpheres
+// and scenePlanes unless the storage reads the arguments directly. All work
+// items of the group must reach it. Kernels pass the scene on as SCENE_SPHERES,
+// SCENE_PLANES and sceneLights.
+// Spheres and planes are typed SPHERES_ARG/PLANES_ARG in kernels, SPHERES_T/PLANES_T
+// in helpers and read with LOAD_SPHERE/LOAD_PLANE. Image storage fetches them through
+// the texture cache.
+#if defined(SCENE_STORAGE_IMAGE)
+#define SCENE_ARG __global
+#define SCENE_MEM __global
+#define SPHERES_ARG __read_only image2d_t
+#define PLANES_ARG __read_only image2d_t
+#define SPHERES_T __read_only image2d_t
+#define PLANES_T __read_only image2d_t
+#define LOAD_SPHERE(spheres, i) loadSphereTexels(spheres, i)
+#define LOAD_PLANE(planes, i) loadPlaneTexels(planes, i)
+// Images can only be function arguments, so the kernel arguments are used directly
+#define SCENE_SPHERES spheres
+#define SCENE_PLANES planes
+#define SETUP_SCENE(localIdx, localCount) \
+    SCENE_MEM const float * sceneLights  = lights;
+#elif defined(SCENE_STORAGE_CONSTANT)
+#define SCENE_ARG __constant
+#define SCENE_MEM __constant
+#define SETUP_SCENE(localIdx, localCount) \
+    SCENE_MEM const float * sceneSpheres = spheres; \
+    SCENE_MEM const float * scenePlanes  = planes; \
+    SCENE_MEM const float * sceneLights  = lights;
+#elif defined(SCENE_STORAGE_GLOBAL)
+#define SCENE_ARG __global
+#define SCENE_MEM __global
+#define SETUP_SCENE(localIdx, localCount) \
+    SCENE_MEM const float * sceneSpheres = spheres; \
+    SCENE_MEM const float * scenePlanes  = planes; \
+    SCENE_MEM const float * sceneLights  = lights;
+#else
+#define SCENE_ARG __global
+#define SCENE_MEM __local
+#define SETUP_SCENE(localIdx, localCount) \
+    loadSceneToLocal(localIdx, localCount, spheres, numSpheres, planes, numPlanes, lights, numLights, temp, temp2); \
+    SCENE_MEM const float * sceneSpheres = temp; \
+    SCENE_MEM const float * scenePlanes  = temp + getSphereSlots(numSpheres) * 16; \
+    SCENE_MEM const float * sceneLights  = temp2;
+#endif
+
+#if !defined(SCENE_STORAGE_IMAGE)
+#define SCENE_SPHERES sceneSpheres
+#define SCENE_PLANES scenePlanes
+#define SPHERES_ARG SCENE_ARG const float *
+#define PLANES_ARG SCENE_ARG const float *
+#define SPHERES_T SCENE_MEM const float *
+#define PLANES_T SCENE_MEM const float *
+#define LOAD_SPHERE(spheres, i) vload8(i, spheres)
+#define LOAD_PLANE(planes, i) vload16(i, planes)
+#else
+// float4 texels, rows are a multiple of 4 texels wide so no record crosses a row
+// SCENE_SAMPLER_FLAGS comes from the scene images' TextureParams (getSceneTextureParams)
+__constant sampler_t SCENE_SAMPLER = SCENE_SAMPLER_FLAGS;
+
+static int2 getSceneTexel(__read_only image2d_t image, int texel)
+{
+    const int width = get_image_width(image);
+    return (int2)(texel % width, texel / width);
+}
+
+static float8 loadSphereTexels(__read_only image2d_t spheres, int i)
+{
+    const int2 coord = getSceneTexel(spheres, 2 * i);
+    return (float8)(read_imagef(spheres, SCENE_SAMPLER, coord),
+                    read_imagef(spheres, SCENE_SAMPLER, coord + (int2)(1, 0)));
+}
+
+static float16 loadPlaneTexels(__read_only image2d_t planes, int i)
+{
+    const int2 coord = getSceneTexel(planes, 4 * i);
+    return (float16)(read_imagef(planes, SCENE_SAMPLER, coord),
+                     read_imagef(planes, SCENE_SAMPLER, coord + (int2)(1, 0)),
+                     read_imagef(planes, SCENE_SAMPLER, coord + (int2)(2, 0)),
+                     read_imagef(planes, SCENE_SAMPLER, coord + (int2)(3, 0)));
+}
+#endif
+
+// Traced colors are stored in the format chosen on the host, COLOR_T is the
+// element type of the color buffers and pixel the float4 index.
+#if defined(COLOR_FORMAT_HALF4)
+#define COLOR_T half
+
+static void storeColor(float4 color, int pixel, __global COLOR_T * colors)
+{
+    vstore_half4_rte(color, pixel, colors);
+}
+
+static float4 loadColor(int pixel, __global const COLOR_T * colors)
+{
+    return vload_half4(pixel, colors);
+}
+#elif defined(COLOR_FORMAT_RGBA8)
+#define COLOR_T uchar
+
+static void storeColor(float4 color, int pixel, __global COLOR_T * colors)
+{
+    vstore4(convert_uchar4_sat_rte(color * 255.0f), pixel, colors);
+}
+
+static float4 loadColor(int pixel, __global const COLOR_T * colors)
+{
+    return convert_float4(vload4(pixel, colors)) * (1.0f / 255.0f);
+}
+#elif defined(COLOR_FORMAT_RGB10A2)
+#define COLOR_T uint
+
+static void storeColor(float4 color, int pixel, __global COLOR_T * colors)
+{
+    const uint4 c = convert_uint4_sat_rte(clamp(color, 0.0f, 1.0f) * (float4)(1023.0f, 1023.0f, 1023.0f, 3.0f));
+    colors[pixel] = c.x | (c.y << 10) | (c.z << 20) | (c.w << 30);
+}
+
+static float4 loadColor(int pixel, __global const COLOR_T * colors)
+{
+    const uint c = colors[pixel];
+    return convert_float4((uint4)(c & 0x3ffu, (c >> 10) & 0x3ffu, (c >> 20) & 0x3ffu, c >> 30)) *
+           (float4)(1.0f / 1023.0f, 1.0f / 1023.0f, 1.0f / 1023.0f, 1.0f / 3.0f);
+}
+#else
+#define COLOR_T float
+
+static void storeColor(float4 color, int pixel, __global COLOR_T * colors)
+{
+    vstore4(color, pixel, colors);
+}
+
+static float4 loadColor(int pixel, __global const COLOR_T * colors)
+{
+    return vload4(pixel, colors);
+}
+#endif
+
 static void swap(float * a, float * b)
 {
     float temp = *a;
@@ -193,20 +340,217 @@ static float4 phong(float3 viewDir, float3 position, float3 normal, float4 diffu
     return outColor;
 }
 
+// Spheres are tested one by one in traceRay unless the scene chose an
+// acceleration structure. SPHERE_ACCELERATION_ARGS follow INSTANCE_ARGS in the
+// tracing kernels and helpers, handed on with SPHERE_ACCELERATION_PASS.
+// traverseSpheres(spheres, numSpheres, origin, dir, skipIdx, maxDist, anyHit, touchPoint)
+// returns the sphere other than skipIdx whose hit lies closest to origin and
+// nearer than maxDist, -1 for none. anyHit returns the first one found.
+#if defined(SPHERE_ACCELERATION_LBVH)
+#define SPHERE_ACCELERATION
+#define traverseSpheres traverseSphereBVH
+
+// Nodes of the device built linear BVH, laid out as in lbvh.cl
+#define SPHERE_ACCELERATION_ARGS , __global const float * sphereNodes
+#define SPHERE_ACCELERATION_PASS , sphereNodes
+
+// Karras trees over 30 bit codes and 32 bit index ties are at most 62 levels deep
+#define SPHERE_BVH_STACK_SIZE 64
+
+// True when the ray enters the node box before ray parameter tMax
+static bool hitsSphereNode(float8 node, float3 origin, float3 invDir, float tMax)
+{
+    const float3 t0 = (node.lo.xyz - origin) * invDir;
+    const float3 t1 = (node.hi.xyz - origin) * invDir;
+    const float3 tNear = fmin(t0, t1);
+    const float3 tFar = fmax(t0, t1);
+    const float enter = fmax(fmax(tNear.x, tNear.y), fmax(tNear.z, 0.0f));
+    const float exit = fmin(fmin(tFar.x, tFar.y), fmin(tFar.z, tMax));
+    return enter <= exit;
+}
+
+static int traverseSphereBVH(SPHERES_T spheres,
+                             int numSpheres,
+                             float3 origin,
+                             float3 dir,
+                             int skipIdx,
+                             float maxDist,
+                             bool anyHit,
+                             float3 * touchPoint
+                             SPHERE_ACCELERATION_ARGS)
+{
+    const float dirLength = length(dir);
+    if(numSpheres == 0 || isequal(dirLength, 0.0f))
+    {
+        return -1;
+    }
+
+    const float3 invDir = 1.0f / dir;
+    const int firstLeaf = numSpheres - 1;
+    float closest = maxDist;
+    int closestIdx = -1;
+
+    int stack[SPHERE_BVH_STACK_SIZE];
+    int stackSize = 0;
+    int nodeIdx = 0;
+    while(nodeIdx >= 0)
+    {
+        const float8 node = vload8(nodeIdx, sphereNodes);
+        if(nodeIdx >= firstLeaf)
+        {
+            const int sphereIdx = as_int(node.s3);
+            float3 point;
+            if(sphereIdx != skipIdx && hasInterceptedSphere(LOAD_SPHERE(spheres, sphereIdx), dir, origin, &point))
+            {
+                const float dist = fast_distance(point, origin);
+                if(dist < closest)
+                {
+                    closest = dist;
+                    closestIdx = sphereIdx;
+                    *touchPoint = point;
+                    if(anyHit)
+                    {
+                        return closestIdx;
+                    }
+                }
+            }
+        }
+        else if(hitsSphereNode(node, origin, invDir, closest / dirLength))
+        {
+            stack[stackSize++] = as_int(node.s7);
+            nodeIdx = as_int(node.s3);
+            continue;
+        }
+
+        nodeIdx = stackSize > 0 ? stack[--stackSize] : -1;
+    }
+    return closestIdx;
+}
+#elif defined(SPHERE_ACCELERATION_GRID)
+#define SPHERE_ACCELERATION
+#define traverseSpheres traverseSphereGrid
+
+// Uniform grid built on the device, laid out as in grid.cl
+#define SPHERE_ACCELERATION_ARGS , __global const float * gridParams, \
+                                   __global const int * gridCellStarts, \
+                                   __global const int * gridSphereIndices
+#define SPHERE_ACCELERATION_PASS , gridParams, gridCellStarts, gridSphereIndices
+
+// 3D-DDA, visits the cells along the ray in order and stops in the first cell
+// holding a hit that lies inside it. Spheres spanning several cells may be tested
+// more than once.
+static int traverseSphereGrid(SPHERES_T spheres,
+                              int numSpheres,
+                              float3 origin,
+                              float3 dir,
+                              int skipIdx,
+                              float maxDist,
+                              bool anyHit,
+                              float3 * touchPoint
+                              SPHERE_ACCELERATION_ARGS)
+{
+    const float dirLength = length(dir);
+    if(numSpheres == 0 || isequal(dirLength, 0.0f))
+    {
+        return -1;
+    }
+
+    // Clip the ray to the grid box, ray parameters are in units of dir
+    const GridParams params = loadGridParams(gridParams);
+    const float3 gridMax = params.gridMin + convert_float3(params.resolution) * params.cellSize;
+    const float3 invDir = 1.0f / dir;
+    const float3 t0 = (params.gridMin - origin) * invDir;
+    const float3 t1 = (gridMax - origin) * invDir;
+    const float3 tNear = fmin(t0, t1);
+    const float3 tFar = fmax(t0, t1);
+    const float tEnter = fmax(fmax(tNear.x, tNear.y), fmax(tNear.z, 0.0f));
+    const float tExit = fmin(fmin(tFar.x, tFar.y), fmin(tFar.z, maxDist / dirLength));
+    if(tEnter > tExit)
+    {
+        return -1;
+    }
+
+    // Ray parameter of the next cell boundary on every axis and between boundaries
+    int3 cell = getGridCell(&params, origin + dir * tEnter);
+    const int3 step = select((int3)(-1), (int3)(1), isgreaterequal(dir, (float3)(0.0f)));
+    const float3 nextBoundary = params.gridMin + convert_float3(cell + max(step, 0)) * params.cellSize;
+    float3 tNext = select((nextBoundary - origin) * invDir, (float3)(MAXFLOAT), isequal(dir, (float3)(0.0f)));
+    const float3 tDelta = fabs(params.cellSize * invDir);
+
+    float closest = maxDist;
+    int closestIdx = -1;
+    for(;;)
+    {
+        const int cellIdx = getGridCellIndex(&params, cell);
+        const int last = gridCellStarts[cellIdx + 1];
+        for(int i = gridCellStarts[cellIdx] ; i < last; i++)
+        {
+            const int sphereIdx = gridSphereIndices[i];
+            float3 point;
+            if(sphereIdx != skipIdx && hasInterceptedSphere(LOAD_SPHERE(spheres, sphereIdx), dir, origin, &point))
+            {
+                const float dist = fast_distance(point, origin);
+                if(dist < closest)
+                {
+                    closest = dist;
+                    closestIdx = sphereIdx;
+                    *touchPoint = point;
+                    if(anyHit)
+                    {
+                        return closestIdx;
+                    }
+                }
+            }
+        }
+
+        // Later cells only hold hits past this cell's exit
+        const float cellExit = fmin(tNext.x, fmin(tNext.y, tNext.z));
+        if(cellExit > tExit || (closestIdx >= 0 && closest <= cellExit * dirLength))
+        {
+            break;
+        }
+
+        if(tNext.x <= tNext.y && tNext.x <= tNext.z)
+        {
+            cell.x += step.x;
+            tNext.x += tDelta.x;
+        }
+        else if(tNext.y <= tNext.z)
+        {
+            cell.y += step.y;
+            tNext.y += tDelta.y;
+        }
+        else
+        {
+            cell.z += step.z;
+            tNext.z += tDelta.z;
+        }
+        if(any(cell < 0) || any(cell >= params.resolution))
+        {
+            break;
+        }
+    }
+    return closestIdx;
+}
+#else
+#define SPHERE_ACCELERATION_ARGS
+#define SPHERE_ACCELERATION_PASS
+#endif
+
 static float4 traceRay(float3 eye,
                        float3 ray,
-                       __global const float * spheres,
+                       SPHERES_T spheres,
                        int numSpheres,
-                       __global const float * planes,
+                       PLANES_T planes,
                        int numPlanes,
-                       __global const float * lights,
+                       SCENE_MEM const float * lights,
                        int numLights,
-                       __local float * temp,
-                       __local float * temp2,
                        float3 * newRay,
                        float3 * touchPos,
                        int    * lastSphereIdx,
-                       int    * lastPlaneIdx)
+                       int    * lastPlaneIdx,
+                       int2   * lastInstanceHit
+                       INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
 {
     float4 outColor = (float4)(0.0f,0.0f,0.0f,1.0f);
     bool hasHit = false;
@@ -217,8 +561,6 @@ static float4 traceRay(float3 eye,
     float4 objectColor;
 
 
-    int sphereOffset = numSpheres % 2 == 0 ? (numSpheres/2) : ((numSpheres+1)/2 );
-
     // Check for planes intersection
     int currentPlaneIdx = -1;
     for(int i = 0 ; i < numPlanes ; i++)
@@ -228,7 +570,7 @@ static float4 traceRay(float3 eye,
             break;
         }
 
-        float16 plane = vload16(i+sphereOffset, temp);
+        float16 plane = LOAD_PLANE(planes, i);
         if(hasInterceptedPlane(plane.lo, ray, eye, &touchPoint))
         {
             float dist = fast_distance(touchPoint, eye);
@@ -265,6 +607,19 @@ static float4 traceRay(float3 eye,
     // Check for spheres intersection
     bool hasHitSphere = false;
     int currentSphereIdx = -1;
+#if defined(SPHERE_ACCELERATION)
+    currentSphereIdx = traverseSpheres(spheres, numSpheres, eye, ray, *lastSphereIdx, minDist, false, &touchPoint SPHERE_ACCELERATION_PASS);
+    if(currentSphereIdx >= 0)
+    {
+        float8 sphere = LOAD_SPHERE(spheres, currentSphereIdx);
+        minDist = fast_distance(touchPoint, eye);
+        closestPoint = touchPoint;
+        objectColor = sphere.hi;
+        normal = getNormalFromSphere(sphere, touchPoint);
+        hasHit = true;
+        hasHitSphere = true;
+    }
+#else
     for(int i = 0 ; i < numSpheres ; i++)
     {
         if(isequal(length(ray) , 0.0f) )
@@ -275,7 +630,7 @@ static float4 traceRay(float3 eye,
         {
             continue;
         }
-        float8 sphere = vload8(i, temp);
+        float8 sphere = LOAD_SPHERE(spheres, i);
 
         if(hasInterceptedSphere(sphere, ray, eye, &touchPoint))
         {
@@ -292,6 +647,7 @@ static float4 traceRay(float3 eye,
             }
         }
     }
+#endif
     if(!hasHitSphere)
     {
         *lastSphereIdx = -1;
@@ -302,6 +658,23 @@ static float4 traceRay(float3 eye,
         *lastPlaneIdx = -1;
     }
 
+    // Instanced triangles and spheres closer than the spheres and planes, through the two level BVH
+    *lastInstanceHit = (int2)(-1);
+#if defined(INSTANCES)
+    const float rayLength = length(ray);
+    InstanceHit instanceHit;
+    if(isnotequal(rayLength, 0.0f) && intersectInstances(eye, ray, minDist / rayLength, &instanceHit INSTANCE_PASS))
+    {
+        closestPoint = eye + ray * instanceHit.distance;
+        getInstanceSurface(&instanceHit, eye, ray, &normal, &objectColor INSTANCE_PASS);
+
+        hasHit = true;
+        *lastSphereIdx = -1;
+        *lastPlaneIdx = -1;
+        *lastInstanceHit = (int2)(instanceHit.instanceIdx, instanceHit.primitiveIdx);
+    }
+#endif
+
     // Calculate color
     if(hasHit)
     {
@@ -338,17 +711,29 @@ static float4 traceRay(float3 eye,
         // Calculate illumination for all lights
         for(int i = 0 ; i < numLights; i++)
         {
-            float8 light = vload8(i, temp2);
+            float8 light = vload8(i, lights);
             float3 lightPos = light.lo.xyz;
             float4 lightColor = light.hi;
 
-            // Check if point is occluded (shadow) only for spheres
+            // Check if point is occluded (shadow) by spheres and instances
             float3 lightDir = normalize(closestPoint - lightPos );
             bool isInShadow = false;
+#if defined(INSTANCES)
+            isInShadow = isOccludedByInstances(lightPos, lightDir, distance(lightPos, closestPoint) - BIAS_OFFSET INSTANCE_PASS);
+#endif
 
-            for(int j = 0 ; j < numSpheres ; j++)
+#if defined(SPHERE_ACCELERATION)
+            if(!isInShadow)
             {
-                float8 sphere = vload8(j, temp);
+                float3 occludedPoint;
+                isInShadow = traverseSpheres(spheres, numSpheres, lightPos, lightDir, *lastSphereIdx,
+                                             fast_distance(lightPos, closestPoint) - BIAS_OFFSET, true,
+                                             &occludedPoint SPHERE_ACCELERATION_PASS) >= 0;
+            }
+#else
+            for(int j = 0 ; j < numSpheres && !isInShadow; j++)
+            {
+                float8 sphere = LOAD_SPHERE(spheres, j);
                 float3 occludedPoint;
 
                 if(j != *lastSphereIdx)
@@ -363,6 +748,7 @@ static float4 traceRay(float3 eye,
                     }
                 }
             }
+#endif
 
             // Calculate phong color if point is not in shadow
             if(!isInShadow)
@@ -374,66 +760,293 @@ static float4 traceRay(float3 eye,
             }
         }
     }
+    else
+    {
+        // Nothing to follow
+        *newRay = (float3)(0.0f);
+    }
 
     return outColor;
 }
 
 
+// postProcess(float4 color, int x, int y) is generated on the host from the
+// PostProcessChain and prepended to the program. It turns the linear color of
+// pixel (x, y) into the presented one (exposure, tone map, gamma, dither). Rows
+// of the color buffers are flipped, y is the traced pixel's.
 __kernel void drawToTextureKernel(__write_only image2d_t glTexture,
-                            __global float * texture)
+                            __global const COLOR_T * texture,
+                            const int width,
+                            const int height)
 {
     int x = get_global_id(0);
     int y = get_global_id(1);
 
-    int idx = x * get_global_size(1) + y;
-    float4 color = vload4(idx, texture);
-    write_imagef(glTexture, (int2)(x, y), color);
+    // Global size is padded to the local size
+    if(x >= width || y >= height)
+    {
+        return;
+    }
+
+    int idx = y * width + x;
+    float4 color = loadColor(idx, texture);
+    write_imagef(glTexture, (int2)(x, y), postProcess(color, x, height - 1 - y));
 }
 
-static float4 blendColor(float4 a, float4 b)
+// Same for float4 colors, the accumulated average or the denoiser's output
+__kernel void drawFloatsToTextureKernel(__write_only image2d_t glTexture,
+                                        __global const float * colors,
+                                        const int width,
+                                        const int height)
 {
-    if(isgreater(a.w, 0.0f))
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if(x >= width || y >= height)
     {
-        return (a + b) /2.0f;
+        return;
     }
-    else
+
+    float4 color = vload4(y * width + x, colors);
+    write_imagef(glTexture, (int2)(x, y), postProcess(color, x, height - 1 - y));
+}
+
+// Running average of the traced frames, kept linear at full precision in
+// accumulation and presented unless present is 0 (the denoiser filters it first).
+// Weight is 1 / frames, the first frame overwrites the average.
+__kernel void accumulateKernel(__write_only image2d_t glTexture,
+                               __global float * accumulation,
+                               __global const COLOR_T * texture,
+                               const int width,
+                               const int height,
+                               const float weight,
+                               const int present)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if(x >= width || y >= height)
+    {
+        return;
+    }
+
+    int idx = y * width + x;
+    float4 color = loadColor(idx, texture);
+    if(isless(weight, 1.0f))
+    {
+        color = mix(vload4(idx, accumulation), color, weight);
+    }
+    vstore4(color, idx, accumulation);
+    if(present)
+    {
+        write_imagef(glTexture, (int2)(x, y), postProcess(color, x, height - 1 - y));
+    }
+}
+
+// Spheres are float8, planes start at the next float16 after them
+static int getSphereSlots(int numSpheres)
+{
+    return numSpheres % 2 == 0 ? (numSpheres/2) : ((numSpheres+1)/2 );
+}
+
+// Copies the scene to local memory, every work item of the group must call it
+static void loadSceneToLocal(int localIdx,
+                             int localCount,
+                             __global const float * spheres,
+                             int numSpheres,
+                             __global const float * planes,
+                             int numPlanes,
+                             __global const float * lights,
+                             int numLights,
+                             __local float * temp,
+                             __local float * temp2)
+{
+    int sphereOffset = getSphereSlots(numSpheres);
+    for(int i = localIdx; i < numSpheres; i += localCount)
+    {
+        vstore8(vload8(i, spheres), i, temp);
+    }
+    for(int i = localIdx; i < numPlanes; i += localCount)
+    {
+        vstore16(vload16(i, planes), i + sphereOffset, temp);
+    }
+    for(int i = localIdx; i < numLights; i += localCount)
     {
-        return a * b;
+        vstore8(vload8(i, lights), i, temp2);
     }
+    barrier(CLK_LOCAL_MEM_FENCE); // wait for loading data
 }
 
+// Computed once per frame on the host (CameraConstants in camera.h). eye.w is
+// the jitter seed of the frame, zero for rays through the pixel centers.
+// firstPixelDir.w seeds the random sequences of the pixels (Russian roulette).
+typedef struct
+{
+    float4 eye;
+    float4 firstPixelDir;
+    float4 pixelDeltaX;
+    float4 pixelDeltaY;
+} Camera;
+
+// Integer hash, also the step of the per pixel random sequences
+static uint hashUint(uint h)
+{
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
 
-// This is the first kernel, when we generate the primary rays
-__kernel void rayTracingKernel(__global float * texture,
-                               __global const float * spheres,
-                               const int numSpheres,
-                               __global const float * planes,
-                               const int numPlanes,
-                               __global const float * lights,
-                               const int numLights,
-                               __local float * temp,
-                               __local float * temp2,
-                               int iterations,
-                               const float eyeX, const float eyeY, const float eyeZ)
+// Random state of pixel (x, y) for the frame's seed
+static uint getPixelSeed(int x, int y, uint frameSeed)
 {
-    // Ray Setup
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
+    return hashUint(((uint)x * 0x8da6b343u) ^ ((uint)y * 0xd8163841u) ^ (frameSeed * 0xcb1ab31fu));
+}
 
-    const int width = get_global_size(0);
-    const int height = get_global_size(1);
+// Offset in [-0.5, 0.5) pixels for pixel (x, y)
+static float2 getPixelJitter(int x, int y, uint frameSeed)
+{
+    const uint h = getPixelSeed(x, y, frameSeed);
+    return convert_float2((uint2)(h & 0xffffu, h >> 16)) * (1.0f / 65536.0f) - 0.5f;
+}
 
-    const float3 eye    = (float3)(eyeX, eyeY, eyeZ);
-    const float3 center = (float3)(0, 0.0f, 0);
-    const float3 up     = (float3)(0, 1.0f, 0);
+// Camera ray through the center of a pixel, or a jittered point of it
+static float3 getPrimaryRay(int x, int y, const Camera * camera)
+{
+    float2 p = (float2)((float)x, (float)y);
+    if(isgreater(camera->eye.w, 0.0f))
+    {
+        p += getPixelJitter(x, y, (uint)camera->eye.w);
+    }
+    return normalize(camera->firstPixelDir.xyz + p.x * camera->pixelDeltaX.xyz + p.y * camera->pixelDeltaY.xyz);
+}
 
-    const float3 dir   = normalize(center - eye) ;
-    const float3 right = normalize(cross(up, dir));
+// Follows the bounces after the primary hit and returns the linear color of the
+// path. Every surface adds its color weighted by the throughput of the surfaces
+// before it: reflective ones keep half of their own color and pass half on,
+// refractive ones filter what they transmit, the last one adds all of it.
+// At most maxBounces rays are traced, bounces gets the number traced.
+// seed drives Russian roulette.
+static float4 traceBounces(float4 color,
+                           float3 newRay,
+                           float3 touchPos,
+                           int currentSphereIdx,
+                           int currentPlaneIdx,
+                           SPHERES_T sceneSpheres,
+                           int numSpheres,
+                           PLANES_T scenePlanes,
+                           int numPlanes,
+                           SCENE_MEM const float * sceneLights,
+                           int numLights,
+                           int maxBounces,
+                           uint seed,
+                           int * bounces
+                           INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
+{
+    float3 radiance = (float3)(0.0f);
+    float3 throughput = (float3)(1.0f);
+    float4 surface = color;
+    int2 instanceHit;
 
-    const float3 origin = eye - (dir * 1000.0f) ;
+    for(int depth = 0 ; ; depth++)
+    {
+        if(isequal(fast_length(newRay), 0.0f) || depth >= maxBounces)
+        {
+            radiance += throughput * surface.xyz;
+            break;
+        }
 
-    const float3 pixelPos = eye + (x-width/2) * right + (height/2-y) * up;
-    const float3 ray = normalize(pixelPos - origin) ;
+        if(isgreater(surface.w, 0.0f)) // Reflection
+        {
+            radiance += 0.5f * throughput * surface.xyz;
+            throughput *= 0.5f;
+        }
+        else // Refraction
+        {
+            throughput *= surface.xyz;
+        }
+
+        const float maxThroughput = fmax(throughput.x, fmax(throughput.y, throughput.z));
+        if(maxThroughput < MIN_THROUGHPUT)
+        {
+            break;
+        }
+#if defined(RUSSIAN_ROULETTE)
+        if(depth >= RUSSIAN_ROULETTE_DEPTH)
+        {
+            seed = hashUint(seed);
+            const float survival = fmin(maxThroughput, RUSSIAN_ROULETTE_MAX_SURVIVAL);
+            if((float)(seed >> 8) * (1.0f / 16777216.0f) >= survival)
+            {
+                break;
+            }
+            throughput /= survival;
+        }
+#endif
+
+        surface = traceRay(touchPos,
+                           newRay,
+                           sceneSpheres,
+                           numSpheres,
+                           scenePlanes,
+                           numPlanes,
+                           sceneLights,
+                           numLights,
+                           &newRay,
+                           &touchPos,
+                           &currentSphereIdx,
+                           &currentPlaneIdx,
+                           &instanceHit
+                           INSTANCE_PASS SPHERE_ACCELERATION_PASS);
+        (*bounces)++;
+    }
+
+    // Alpha stays the material of the primary hit
+    return (float4)(radiance, color.w);
+}
+
+// First surface seen through a pixel, all indices are -1 when the ray missed
+typedef struct
+{
+    float3 position;
+    int sphereIdx;
+    int planeIdx;
+    int instanceIdx;
+    int primitiveIdx;
+} PrimaryHit;
+
+static bool hasPrimaryHit(const PrimaryHit * hit)
+{
+    return hit->sphereIdx >= 0 || hit->planeIdx >= 0 || hit->instanceIdx >= 0;
+}
+
+static void setPrimaryHit(PrimaryHit * hit, float3 position, int sphereIdx, int planeIdx, int2 instanceHit)
+{
+    hit->position = position;
+    hit->sphereIdx = sphereIdx;
+    hit->planeIdx = planeIdx;
+    hit->instanceIdx = instanceHit.x;
+    hit->primitiveIdx = instanceHit.y;
+}
+
+// Traces the primary ray of a pixel and its bounces, returns the linear color.
+// primaryHit gets the first surface.
+static float4 shadePixel(int x,
+                         int y,
+                         const Camera * camera,
+                         SPHERES_T sceneSpheres,
+                         int numSpheres,
+                         PLANES_T scenePlanes,
+                         int numPlanes,
+                         SCENE_MEM const float * sceneLights,
+                         int numLights,
+                         int maxBounces,
+                         PrimaryHit * primaryHit
+                         INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
+{
+    const float3 ray = getPrimaryRay(x, y, camera);
 
     // Raytracing!
     float3 newRay = (float3)(0.0f);
@@ -441,133 +1054,597 @@ __kernel void rayTracingKernel(__global float * texture,
 
     int currentSphereIdx = -1;
     int currentPlaneIdx  = -1;
+    int2 instanceHit;
 
-    // Local index to load local memory
-    int lx = get_local_id(0);
-    int ly = get_local_id(1);
-    int localIdx = lx * get_local_size(1) + ly;
+    float4 color = traceRay(camera->eye.xyz,
+                            ray,
+                            sceneSpheres,
+                            numSpheres,
+                            scenePlanes,
+                            numPlanes,
+                            sceneLights,
+                            numLights,
+                            &newRay,
+                            &touchPos,
+                            &currentSphereIdx,
+                            &currentPlaneIdx,
+                            &instanceHit
+                            INSTANCE_PASS SPHERE_ACCELERATION_PASS);
+
+    setPrimaryHit(primaryHit, touchPos, currentSphereIdx, currentPlaneIdx, instanceHit);
+
+    int bounces = 0;
+    color = traceBounces(color, newRay, touchPos, currentSphereIdx, currentPlaneIdx,
+                         sceneSpheres, numSpheres,
+                         scenePlanes, numPlanes,
+                         sceneLights, numLights,
+                         maxBounces, getPixelSeed(x, y, (uint)camera->firstPixelDir.w), &bounces
+                         INSTANCE_PASS SPHERE_ACCELERATION_PASS);
+    return color;
+}
+
+static void storePixel(__global COLOR_T * texture, int x, int y, int width, int height, float4 color)
+{
+    storeColor(color, (height - 1 - y) * width + x, texture);
+}
 
-    // Load scene data to local memory
-    int sphereOffset = numSpheres % 2 == 0 ? (numSpheres/2) : ((numSpheres+1)/2 );
-    if(localIdx < numSpheres)
+// Octahedral mapping of a unit normal to two snorm16, x in the low half
+static uint encodeNormal(float3 n)
+{
+    float2 p = n.xy / (fabs(n.x) + fabs(n.y) + fabs(n.z));
+    if(n.z < 0.0f)
     {
-        float8 tempSphere = vload8(localIdx, spheres);
-        vstore8(tempSphere, localIdx, temp);
+        p = (1.0f - fabs(p.yx)) * select((float2)(-1.0f), (float2)(1.0f), isgreaterequal(p, (float2)(0.0f)));
     }
-    else if( localIdx  > numSpheres && localIdx < (sphereOffset*2+numPlanes))
+    return as_uint(convert_short2_sat_rte(p * 32767.0f));
+}
+
+// With GBUFFER the primary pass kernels take four more arguments after their
+// last one and store the attributes of the primary hit, indexed y * width + x:
+// distance from the eye, encoded normal, object id (spheres first, then planes,
+// then instances, -1 for none) and albedo with the material value in w as half4.
+#if defined(GBUFFER)
+#define GBUFFER_ARGS , __global float * gbufferDepth, \
+                       __global uint * gbufferNormals, \
+                       __global int * gbufferIds, \
+                       __global half * gbufferMaterials
+#define STORE_GBUFFER(x, y, hit) \
+    storeGBuffer((y) * width + (x), &(hit), camera.eye.xyz, SCENE_SPHERES, numSpheres, SCENE_PLANES, numPlanes, \
+                 gbufferDepth, gbufferNormals, gbufferIds, gbufferMaterials INSTANCE_PASS);
+
+static void storeGBuffer(int pixel,
+                         const PrimaryHit * hit,
+                         float3 eye,
+                         SPHERES_T spheres,
+                         int numSpheres,
+                         PLANES_T planes,
+                         int numPlanes,
+                         __global float * gbufferDepth,
+                         __global uint * gbufferNormals,
+                         __global int * gbufferIds,
+                         __global half * gbufferMaterials
+                         INSTANCE_ARGS)
+{
+    if(!hasPrimaryHit(hit))
     {
-        float16 tempPlane = vload16(localIdx - sphereOffset* 2, planes);
-        vstore16(tempPlane, localIdx - sphereOffset, temp);
+        gbufferDepth[pixel] = MAXFLOAT;
+        gbufferNormals[pixel] = 0;
+        gbufferIds[pixel] = -1;
+        vstore_half4((float4)(0.0f), pixel, gbufferMaterials);
+        return;
     }
-    if(localIdx < numLights)
+
+    float3 normal;
+    float4 albedo;
+    int id;
+    if(hit->sphereIdx >= 0)
     {
-        float8 tempLight = vload8(localIdx, lights);
-        vstore8(tempLight, localIdx, temp2);
+        const float8 sphere = LOAD_SPHERE(spheres, hit->sphereIdx);
+        normal = getNormalFromSphere(sphere, hit->position);
+        albedo = sphere.hi;
+        id = hit->sphereIdx;
     }
-    barrier(CLK_LOCAL_MEM_FENCE); // wait for loading data
+#if defined(INSTANCES)
+    else if(hit->instanceIdx >= 0)
+    {
+        // The hit lies at ray parameter one from the eye
+        InstanceHit instanceHit;
+        instanceHit.distance = 1.0f;
+        instanceHit.instanceIdx = hit->instanceIdx;
+        instanceHit.primitiveIdx = hit->primitiveIdx;
+        getInstanceSurface(&instanceHit, eye, hit->position - eye, &normal, &albedo INSTANCE_PASS);
+        id = numSpheres + numPlanes + getInstanceId(&instanceHit INSTANCE_PASS);
+    }
+#endif
+    else
+    {
+        const float16 plane = LOAD_PLANE(planes, hit->planeIdx);
+        normal = getNormalFromPlane(plane.lo);
+        albedo = isnotequal(plane.lo.lo.w, 0.0f) ? getColorFromPlane(plane, hit->position) : plane.hi.lo;
+        id = numSpheres + hit->planeIdx;
+    }
+
+    gbufferDepth[pixel] = distance(eye, hit->position);
+    gbufferNormals[pixel] = encodeNormal(normal);
+    gbufferIds[pixel] = id;
+    vstore_half4(albedo, pixel, gbufferMaterials);
+}
+#else
+#define GBUFFER_ARGS
+#define STORE_GBUFFER(x, y, hit)
+#endif
+
+// This is the first kernel, when we generate the primary rays
+// Width and height are the full image size, a dispatch may cover only a band of
+// rows through its global offset and is padded to the local size.
+// Output is row major with the y axis flipped.
+__kernel void rayTracingKernel(__global COLOR_T * texture,
+                               const int width,
+                               const int height,
+                               SPHERES_ARG spheres,
+                               const int numSpheres,
+                               PLANES_ARG planes,
+                               const int numPlanes,
+                               SCENE_ARG const float * lights,
+                               const int numLights,
+                               __local float * temp,
+                               __local float * temp2,
+                               int maxBounces,
+                               const Camera camera
+                               GBUFFER_ARGS
+                               INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    const int localIdx = get_local_id(0) * get_local_size(1) + get_local_id(1);
+    const int localCount = get_local_size(0) * get_local_size(1);
+
+    SETUP_SCENE(localIdx, localCount)
 
+    // Padding work items only help loading the scene
+    if(x >= width || y >= height)
+    {
+        return;
+    }
+
+    PrimaryHit primaryHit;
 
-    // This is very
-    float16 colorStack;
+    float4 color = shadePixel(x, y, &camera,
+                              SCENE_SPHERES, numSpheres,
+                              SCENE_PLANES, numPlanes,
+                              sceneLights, numLights,
+                              maxBounces, &primaryHit
+                              INSTANCE_PASS SPHERE_ACCELERATION_PASS);
 
+    storePixel(texture, x, y, width, height, color);
+    STORE_GBUFFER(x, y, primaryHit)
+}
+
+// Persistent threads variant, launched 1D with about one work group per compute unit.
+// Groups pull tiles from tileCounter (zeroed by the host every frame) until the
+// frame is done, so groups that got cheap tiles take over the remaining work.
+__kernel void rayTracingPersistentKernel(__global COLOR_T * texture,
+                                         const int width,
+                                         const int height,
+                                         SPHERES_ARG spheres,
+                                         const int numSpheres,
+                                         PLANES_ARG planes,
+                                         const int numPlanes,
+                                         SCENE_ARG const float * lights,
+                                         const int numLights,
+                                         __local float * temp,
+                                         __local float * temp2,
+                                         int maxBounces,
+                                         const Camera camera,
+                                         __global int * tileCounter,
+                                         const int tileSizeX,
+                                         const int tileSizeY
+                                         GBUFFER_ARGS
+                                         INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
+{
+    __local int currentTile;
 
-    float4 color = traceRay(eye,
+    const int localIdx = get_local_id(0);
+    const int localCount = get_local_size(0);
+
+    SETUP_SCENE(localIdx, localCount)
+
+    const int tilesX = (width + tileSizeX - 1) / tileSizeX;
+    const int tilesY = (height + tileSizeY - 1) / tileSizeY;
+    const int numTiles = tilesX * tilesY;
+    const int tilePixels = tileSizeX * tileSizeY;
+
+    while(true)
+    {
+        if(localIdx == 0)
+        {
+            currentTile = atomic_inc(tileCounter);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        const int tile = currentTile;
+        barrier(CLK_LOCAL_MEM_FENCE); // everybody read it before it is replaced
+
+        // Same value for the whole group
+        if(tile >= numTiles)
+        {
+            break;
+        }
+
+        const int tileX = (tile % tilesX) * tileSizeX;
+        const int tileY = (tile / tilesX) * tileSizeY;
+
+        for(int i = localIdx; i < tilePixels; i += localCount)
+        {
+            const int x = tileX + i % tileSizeX;
+            const int y = tileY + i / tileSizeX;
+            if(x < width && y < height)
+            {
+                PrimaryHit primaryHit;
+                float4 color = shadePixel(x, y, &camera,
+                                          SCENE_SPHERES, numSpheres,
+                                          SCENE_PLANES, numPlanes,
+                                          sceneLights, numLights,
+                                          maxBounces, &primaryHit
+                                          INSTANCE_PASS SPHERE_ACCELERATION_PASS);
+                storePixel(texture, x, y, width, height, color);
+                STORE_GBUFFER(x, y, primaryHit)
+            }
+        }
+    }
+}
+
+// Secondary rays that sort after every real ray, their pixel is already final
+#define NO_RAY_KEY 0xFFFFFFFFu
+
+// Direction octant in bits 21-23 and the top 21 bits of the origin Morton code
+// (lbvh.cl) below. Keys fit RAY_KEY_BITS (24, six radix passes) of raytracing.cpp,
+// the bits above stay clear so no ray collides with NO_RAY_KEY.
+static uint getRayKey(float3 origin, float3 dir, float3 sceneMin, float3 sceneInvExtent)
+{
+    uint octant = (dir.x < 0.0f ? 4u : 0u) | (dir.y < 0.0f ? 2u : 0u) | (dir.z < 0.0f ? 1u : 0u);
+    uint morton = getMortonCode((origin - sceneMin) * sceneInvExtent);
+    return (octant << 21) | (morton >> 9);
+}
+
+// Wavefront path, first stage. Traces the camera rays and queues the first
+// secondary ray of every pixel (indexed by pixel) with a coherence key.
+// The host may sort keys and indices before rayTracingSecondaryKernel.
+// The primary color of a queued pixel waits in primaryColors at full precision,
+// the compact color formats would clamp it and quantize the material in .w.
+__kernel void rayTracingPrimaryKernel(__global COLOR_T * texture,
+                                      const int width,
+                                      const int height,
+                                      SPHERES_ARG spheres,
+                                      const int numSpheres,
+                                      PLANES_ARG planes,
+                                      const int numPlanes,
+                                      SCENE_ARG const float * lights,
+                                      const int numLights,
+                                      __local float * temp,
+                                      __local float * temp2,
+                                      const Camera camera,
+                                      __global float * rays,
+                                      __global float * primaryColors,
+                                      __global uint * rayKeys,
+                                      __global int * rayIndices,
+                                      const float sceneMinX, const float sceneMinY, const float sceneMinZ,
+                                      const float sceneInvExtentX, const float sceneInvExtentY, const float sceneInvExtentZ
+                                      GBUFFER_ARGS
+                                      INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    const int localIdx = get_local_id(0) * get_local_size(1) + get_local_id(1);
+    const int localCount = get_local_size(0) * get_local_size(1);
+
+    SETUP_SCENE(localIdx, localCount)
+
+    if(x >= width || y >= height)
+    {
+        return;
+    }
+
+    const float3 ray = getPrimaryRay(x, y, &camera);
+
+    float3 newRay = (float3)(0.0f);
+    float3 touchPos = (float3)(0.0f);
+    int currentSphereIdx = -1;
+    int currentPlaneIdx  = -1;
+    int2 instanceHit;
+
+    float4 color = traceRay(camera.eye.xyz,
                             ray,
-                            spheres,
+                            SCENE_SPHERES,
                             numSpheres,
-                            planes,
+                            SCENE_PLANES,
                             numPlanes,
-                            lights,
+                            sceneLights,
                             numLights,
-                            temp,
-                            temp2,
                             &newRay,
                             &touchPos,
                             &currentSphereIdx,
-                            &currentPlaneIdx);
+                            &currentPlaneIdx,
+                            &instanceHit
+                            INSTANCE_PASS SPHERE_ACCELERATION_PASS);
 
-    int stackSize = 0;
+    const int pixel = y * width + x;
+    rayIndices[pixel] = pixel;
+
+    PrimaryHit primaryHit;
+    setPrimaryHit(&primaryHit, touchPos, currentSphereIdx, currentPlaneIdx, instanceHit);
+    STORE_GBUFFER(x, y, primaryHit)
 
-    float4 newColor = color;
-    for(int i = 0 ; i < iterations; i++)
+    if(isequal(fast_length(newRay), 0.0f))
     {
-        if(!isequal(fast_length(newRay), 0.0f))
-        {
-            newColor = traceRay(touchPos,
-                                    newRay,
-                                    spheres,
-                                    numSpheres,
-                                    planes,
-                                    numPlanes,
-                                    lights,
-                                    numLights,
-                                    temp,
-                                    temp2,
-                                    &newRay,
-                                    &touchPos,
-                                    &currentSphereIdx,
-                                    &currentPlaneIdx);
-            switch(stackSize)
-            {
-            case 0:
-                colorStack.lo.lo = newColor;
-                stackSize++;
-                break;
-            case 1:
-                colorStack.lo.hi = newColor;
-                stackSize++;
-                break;
-            case 2:
-                colorStack.hi.lo = newColor;
-                stackSize++;
-                break;
-            case 3:
-                colorStack.hi.hi = newColor;
-                stackSize++;
-                break;
-            default:
-                colorStack.hi.hi = newColor * colorStack.hi.hi;
-                break;
-            }
+        storePixel(texture, x, y, width, height, color);
+        rayKeys[pixel] = NO_RAY_KEY;
+        return;
+    }
 
-        }
+    // The bounces are blended into the primary color by the second stage
+    vstore4(color, pixel, primaryColors);
+    vstore8((float8)(touchPos, (float)currentSphereIdx, newRay, (float)currentPlaneIdx), pixel, rays);
+    rayKeys[pixel] = getRayKey(touchPos, newRay,
+                               (float3)(sceneMinX, sceneMinY, sceneMinZ),
+                               (float3)(sceneInvExtentX, sceneInvExtentY, sceneInvExtentZ));
+}
+
+// Wavefront path, second stage. Launched 1D over the (maybe sorted) queue,
+// neighbouring work items follow rays with similar origin and direction.
+// bounceCounts receives the traced rays per queue entry for SIMD statistics.
+// frameSeed is the random seed of the frame's camera (firstPixelDir.w).
+__kernel void rayTracingSecondaryKernel(__global COLOR_T * texture,
+                                        const int width,
+                                        const int height,
+                                        SPHERES_ARG spheres,
+                                        const int numSpheres,
+                                        PLANES_ARG planes,
+                                        const int numPlanes,
+                                        SCENE_ARG const float * lights,
+                                        const int numLights,
+                                        __local float * temp,
+                                        __local float * temp2,
+                                        int maxBounces,
+                                        __global const float * rays,
+                                        __global const float * primaryColors,
+                                        __global const uint * rayKeys,
+                                        __global const int * rayIndices,
+                                        __global int * bounceCounts,
+                                        const int numRays,
+                                        const uint frameSeed
+                                        INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
+{
+    const int idx = get_global_id(0);
+
+    const int localIdx = get_local_id(0);
+    const int localCount = get_local_size(0);
+
+    SETUP_SCENE(localIdx, localCount)
+
+    if(idx >= numRays)
+    {
+        return;
+    }
+    if(rayKeys[idx] == NO_RAY_KEY)
+    {
+        bounceCounts[idx] = 0;
+        return;
     }
-    newColor = color;
 
-    // Now calculate color based on stack of colors
-    if(stackSize > 4)
+    const int pixel = rayIndices[idx];
+    const int x = pixel % width;
+    const int y = pixel / width;
+
+    const float8 state = vload8(pixel, rays);
+    const float4 color = vload4(pixel, primaryColors);
+
+    int bounces = 0;
+    float4 finalColor = traceBounces(color, state.s012, state.s456, (int)state.s3, (int)state.s7,
+                                     SCENE_SPHERES, numSpheres,
+                                     SCENE_PLANES, numPlanes,
+                                     sceneLights, numLights,
+                                     maxBounces, getPixelSeed(x, y, frameSeed), &bounces
+                                     INSTANCE_PASS SPHERE_ACCELERATION_PASS);
+
+    storePixel(texture, x, y, width, height, finalColor);
+    bounceCounts[idx] = bounces;
+}
+
+// Temporal reprojection. Every pixel keeps its primary hit (xyz, w age in frames
+// or -1 for none) and final color. The hits of the previous frame are splatted
+// into the current view, nearest hit wins, and pixels without a fresh enough
+// source are queued for tracing. Pixel buffers are y * width + x, not flipped.
+
+// Inverse of getPrimaryRay, false when p is behind the eye or off screen
+static bool projectToPixel(float3 p, const Camera * camera, int width, int height, int * pixelX, int * pixelY, float * depth)
+{
+    const float3 deltaX = camera->pixelDeltaX.xyz;
+    const float3 deltaY = camera->pixelDeltaY.xyz;
+    const float3 forward = camera->firstPixelDir.xyz - deltaX * (0.5f - 0.5f * width) - deltaY * (0.5f - 0.5f * height);
+
+    const float3 toPoint = p - camera->eye.xyz;
+    const float along = dot(toPoint, forward);
+    if(along <= 0.0f)
     {
-        newColor = blendColor(colorStack.hi.lo, colorStack.hi.hi);
-        newColor = blendColor(colorStack.lo.hi, newColor);
-        newColor = blendColor(colorStack.lo.lo, newColor);
-        newColor = blendColor(color, newColor);
+        return false;
     }
-    else if(stackSize > 3)
+
+    const float3 onPlane = toPoint / along - camera->firstPixelDir.xyz;
+    const int x = convert_int_rte(dot(onPlane, deltaX) / dot(deltaX, deltaX));
+    const int y = convert_int_rte(dot(onPlane, deltaY) / dot(deltaY, deltaY));
+    if(x < 0 || y < 0 || x >= width || y >= height)
     {
-        newColor = blendColor(colorStack.lo.hi, colorStack.hi.lo);
-        newColor = blendColor(colorStack.lo.lo, newColor);
-        newColor = blendColor(color, newColor);
+        return false;
+    }
+
+    *pixelX = x;
+    *pixelY = y;
+    *depth = length(toPoint);
+    return true;
+}
+
+// Resets the splat targets, depth to the farthest value and no source
+__kernel void reprojectClearKernel(__global uint * depth,
+                                   __global int * source,
+                                   const int numPixels)
+{
+    const int pixel = get_global_id(0);
+    if(pixel >= numPixels)
+    {
+        return;
+    }
+    depth[pixel] = UINT_MAX;
+    source[pixel] = -1;
+}
+
+// Positive float bits sort like the floats, so atomic_min keeps the nearest hit
+__kernel void reprojectDepthKernel(__global const float * previousHits,
+                                   __global uint * depth,
+                                   const int width,
+                                   const int height,
+                                   const Camera camera)
+{
+    const int pixel = get_global_id(0);
+    if(pixel >= width * height)
+    {
+        return;
+    }
+
+    const float4 hit = vload4(pixel, previousHits);
+    int x, y;
+    float distance;
+    if(hit.w < 0.0f || !projectToPixel(hit.xyz, &camera, width, height, &x, &y, &distance))
+    {
+        return;
+    }
+    atomic_min(&depth[y * width + x], as_uint(distance));
+}
+
+// Second splat pass, the pixel that won the depth test becomes the source
+__kernel void reprojectSourceKernel(__global const float * previousHits,
+                                    __global const uint * depth,
+                                    __global int * source,
+                                    const int width,
+                                    const int height,
+                                    const Camera camera)
+{
+    const int pixel = get_global_id(0);
+    if(pixel >= width * height)
+    {
+        return;
     }
-    else if(stackSize > 1)
+
+    const float4 hit = vload4(pixel, previousHits);
+    int x, y;
+    float distance;
+    if(hit.w < 0.0f || !projectToPixel(hit.xyz, &camera, width, height, &x, &y, &distance))
     {
-        newColor = blendColor(colorStack.lo.lo, colorStack.lo.hi);
-        newColor = blendColor(color, newColor);
+        return;
     }
-    else if(stackSize > 0)
+
+    // Equal depths from several pixels are interchangeable
+    const int target = y * width + x;
+    if(depth[target] == as_uint(distance))
     {
-        newColor = blendColor(newColor, colorStack.lo.lo);
+        source[target] = pixel;
     }
+}
 
-    color = newColor;
+// Reuses the source of every pixel that has one younger than maxAge and is not
+// in this frame's refresh slice, queues the others in tracePixels
+__kernel void reprojectResolveKernel(__global COLOR_T * texture,
+                                     const int width,
+                                     const int height,
+                                     __global const float * previousHits,
+                                     __global const float * previousColors,
+                                     __global const int * source,
+                                     __global float * hits,
+                                     __global float * colors,
+                                     __global int * tracePixels,
+                                     __global int * traceCount,
+                                     const int maxAge,
+                                     const int refreshPeriod,
+                                     const int refreshPhase)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    if(x >= width || y >= height)
+    {
+        return;
+    }
 
+    const int pixel = y * width + x;
+    const int from = source[pixel];
 
-    // Gamma correction
-    float3 gamma = (float3)(1.0f/2.2f, 1.0f/2.2f, 1.0f/2.2f);
-    color = (float4)( pow(color.x, gamma.x),
-                      pow(color.y, gamma.y),
-                      pow(color.z, gamma.z),
-                      color.w);
+    // Diagonal slices so the refreshed pixels spread over the image
+    const bool refresh = refreshPeriod > 0 && (x + y * 3 + refreshPhase) % refreshPeriod == 0;
 
-    vstore4(color, x * get_global_size(1) + (height-y), texture);
+    if(from >= 0 && !refresh)
+    {
+        const float4 hit = vload4(from, previousHits);
+        if(hit.w < maxAge)
+        {
+            const float4 color = vload4(from, previousColors);
+            vstore4((float4)(hit.xyz, hit.w + 1.0f), pixel, hits);
+            vstore4(color, pixel, colors);
+            storePixel(texture, x, y, width, height, color);
+            return;
+        }
+    }
+
+    tracePixels[atomic_inc(traceCount)] = pixel;
 }
 
+// Traces the queued pixels, launched 1D over at least traceCount work items
+__kernel void rayTracingListKernel(__global COLOR_T * texture,
+                                   const int width,
+                                   const int height,
+                                   SPHERES_ARG spheres,
+                                   const int numSpheres,
+                                   PLANES_ARG planes,
+                                   const int numPlanes,
+                                   SCENE_ARG const float * lights,
+                                   const int numLights,
+                                   __local float * temp,
+                                   __local float * temp2,
+                                   int maxBounces,
+                                   const Camera camera,
+                                   __global const int * tracePixels,
+                                   __global const int * traceCount,
+                                   __global float * hits,
+                                   __global float * colors
+                                   GBUFFER_ARGS
+                                   INSTANCE_ARGS SPHERE_ACCELERATION_ARGS)
+{
+    const int idx = get_global_id(0);
+
+    const int localIdx = get_local_id(0);
+    const int localCount = get_local_size(0);
+
+    SETUP_SCENE(localIdx, localCount)
+
+    if(idx >= *traceCount)
+    {
+        return;
+    }
+
+    const int pixel = tracePixels[idx];
+    const int x = pixel % width;
+    const int y = pixel / width;
+
+    PrimaryHit primaryHit;
+    float4 color = shadePixel(x, y, &camera,
+                              SCENE_SPHERES, numSpheres,
+                              SCENE_PLANES, numPlanes,
+                              sceneLights, numLights,
+                              maxBounces, &primaryHit
+                              INSTANCE_PASS SPHERE_ACCELERATION_PASS);
+
+    // Missed rays are never reprojected, hits start at age 0
+    vstore4((float4)(primaryHit.position, hasPrimaryHit(&primaryHit) ? 0.0f : -1.0f), pixel, hits);
+    STORE_GBUFFER(x, y, primaryHit)
+    vstore4(color, pixel, colors);
+    storePixel(texture, x, y, width, height, color);
+}
@@ -1,8 +1,9 @@
 #include "clcontextwrapper.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <unordered_map>
-#include <unordered_set>
 #include <sstream>
 
 
@@ -39,36 +40,303 @@ static clGetGLContextInfoKHR_fn clGetGLContextInfoKHR;
 static std::string getError(cl_int error);
 static inline void logError(const std::string & error, const std::string & errorDetail );
 
+// Last value handed to clSetKernelArg for one argument
+struct KernelArgValue
+{
+    std::vector<unsigned char> bytes; // empty for __local arguments, the handle for buffers
+    size_t byteSize;
+    bool isSet;
+    bool isLocal;
+    bool isBuffer;
+
+    KernelArgValue() : byteSize(0), isSet(false), isLocal(false), isBuffer(false)
+    {
+
+    }
+};
+
+struct CLContextWrapperPrivate;
+
 struct KernelInfo
 {
+    CLContextWrapperPrivate * owner;
+    std::string     name;
     cl_kernel       kernel;
     size_t          workGroupSize;
+    size_t          preferredWorkGroupSizeMultiple;
     unsigned long   localMemSize;
+
+    std::vector<KernelArgValue> args;
+
+    KernelInfo() : owner(nullptr), kernel(nullptr), workGroupSize(0), preferredWorkGroupSizeMultiple(1), localMemSize(0)
+    {
+
+    }
+};
+
+static std::vector<cl_platform_id> getPlatformIds()
+{
+    cl_uint numPlatforms = 0;
+    clGetPlatformIDs(0, nullptr, &numPlatforms);
+
+    std::vector<cl_platform_id> platforms(numPlatforms);
+    if(numPlatforms > 0 && clGetPlatformIDs(numPlatforms, platforms.data(), nullptr) != CL_SUCCESS)
+    {
+        platforms.clear();
+    }
+    return platforms;
+}
+
+static std::vector<cl_device_id> getDeviceIds(cl_platform_id platform)
+{
+    cl_uint numDevices = 0;
+    clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices);
+
+    std::vector<cl_device_id> devices(numDevices);
+    if(numDevices > 0 && clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, numDevices, devices.data(), nullptr) != CL_SUCCESS)
+    {
+        devices.clear();
+    }
+    return devices;
+}
+
+static std::string getPlatformString(cl_platform_id platform, cl_platform_info param)
+{
+    size_t length = 0;
+    if(clGetPlatformInfo(platform, param, 0, nullptr, &length) != CL_SUCCESS || length == 0)
+    {
+        return std::string();
+    }
+    std::vector<char> value(length, 0);
+    clGetPlatformInfo(platform, param, length, value.data(), nullptr);
+    return std::string(value.data());
+}
+
+static std::string getDeviceString(cl_device_id device, cl_device_info param)
+{
+    size_t length = 0;
+    if(clGetDeviceInfo(device, param, 0, nullptr, &length) != CL_SUCCESS || length == 0)
+    {
+        return std::string();
+    }
+    std::vector<char> value(length, 0);
+    clGetDeviceInfo(device, param, length, value.data(), nullptr);
+    return std::string(value.data());
+}
+
+template <typename T>
+static T getDeviceValue(cl_device_id device, cl_device_info param)
+{
+    T value = T();
+    clGetDeviceInfo(device, param, sizeof(T), &value, nullptr);
+    return value;
+}
+
+static DeviceInfo queryDeviceInfo(cl_device_id device, DeviceLocation location)
+{
+    DeviceInfo info;
+    info.location = location;
+
+    cl_device_type type = getDeviceValue<cl_device_type>(device, CL_DEVICE_TYPE);
+    if(type & CL_DEVICE_TYPE_GPU)
+    {
+        info.type = DeviceType::GPU_DEVICE;
+    }
+    else if(type & CL_DEVICE_TYPE_CPU)
+    {
+        info.type = DeviceType::CPU_DEVICE;
+    }
+
+    info.name           = getDeviceString(device, CL_DEVICE_NAME);
+    info.vendor         = getDeviceString(device, CL_DEVICE_VENDOR);
+    info.version        = getDeviceString(device, CL_DEVICE_VERSION);
+    info.driverVersion  = getDeviceString(device, CL_DRIVER_VERSION);
+
+    info.computeUnits           = getDeviceValue<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS);
+    info.maxClockFrequency      = getDeviceValue<cl_uint>(device, CL_DEVICE_MAX_CLOCK_FREQUENCY);
+    info.maxWorkGroupSize       = getDeviceValue<size_t>(device, CL_DEVICE_MAX_WORK_GROUP_SIZE);
+    clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(info.maxWorkItemSizes), info.maxWorkItemSizes, nullptr);
+
+    info.globalMemSize          = getDeviceValue<cl_ulong>(device, CL_DEVICE_GLOBAL_MEM_SIZE);
+    info.maxMemAllocSize        = getDeviceValue<cl_ulong>(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE);
+    info.localMemSize           = getDeviceValue<cl_ulong>(device, CL_DEVICE_LOCAL_MEM_SIZE);
+    info.maxConstantBufferSize  = getDeviceValue<cl_ulong>(device, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE);
+    info.maxConstantArgs        = getDeviceValue<cl_uint>(device, CL_DEVICE_MAX_CONSTANT_ARGS);
+    info.memBaseAddrAlign       = getDeviceValue<cl_uint>(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN) / 8; // Reported in bits
+
+    info.hasDedicatedLocalMem   = getDeviceValue<cl_device_local_mem_type>(device, CL_DEVICE_LOCAL_MEM_TYPE) == CL_LOCAL;
+    info.imageSupport           = getDeviceValue<cl_bool>(device, CL_DEVICE_IMAGE_SUPPORT) == CL_TRUE;
+    info.image2dMaxWidth        = getDeviceValue<size_t>(device, CL_DEVICE_IMAGE2D_MAX_WIDTH);
+    info.image2dMaxHeight       = getDeviceValue<size_t>(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT);
+
+    std::istringstream extensions(getDeviceString(device, CL_DEVICE_EXTENSIONS));
+    for(std::string extension; extensions >> extension;)
+    {
+        info.extensions.push_back(extension);
+    }
+
+    return info;
+}
+
+static DeviceLocation findDeviceLocation(cl_device_id device)
+{
+    std::vector<cl_platform_id> platforms = getPlatformIds();
+    for(size_t i = 0 ; i < platforms.size(); i++)
+    {
+        std::vector<cl_device_id> devices = getDeviceIds(platforms[i]);
+        for(size_t j = 0 ; j < devices.size(); j++)
+        {
+            if(devices[j] == device)
+            {
+                DeviceLocation location;
+                location.platformIndex = static_cast<unsigned int>(i);
+                location.deviceIndex = static_cast<unsigned int>(j);
+                return location;
+            }
+        }
+    }
+    return DeviceLocation();
+}
+
+struct BufferRecord
+{
+    cl_mem mem;
+    BufferInfo info;
+
+    BufferRecord() : mem(nullptr)
+    {
+
+    }
 };
 
 struct CLContextWrapperPrivate
 {
     cl_context          context;
-    cl_command_queue    commandQueue;
+    cl_command_queue    commandQueue;  // compute
+    cl_command_queue    transferQueue; // uploads and readbacks that may overlap compute
     cl_device_id        deviceId;
     cl_program          computeProgram;
 
     size_t              maxWorkGroupSize;
+    bool                profilingEnabled;
+
+    DeviceInfo          deviceInfo;
 
     std::unordered_map<std::string, KernelInfo> kernels;
-    std::unordered_set<cl_mem> buffers;
+    HandleTable<BufferRecord, BufferTag> buffers;
+    std::vector<cl_mem> glObjects; // scratch for acquiring shared textures
+
+    CLContextWrapperPrivate() : context(nullptr), commandQueue(nullptr), transferQueue(nullptr), deviceId(nullptr), computeProgram(nullptr),
+                                maxWorkGroupSize(0), profilingEnabled(false)
+    {
+
+    }
+
+    // Both queues are in order, ordering between them is only through events
+    bool createQueues(cl_context newContext, cl_device_id computeDeviceId)
+    {
+        cl_int err = CL_SUCCESS;
+        cl_command_queue_properties properties = profilingEnabled ? CL_QUEUE_PROFILING_ENABLE : 0;
+
+        cl_command_queue newCommandQueue = clCreateCommandQueue(newContext, computeDeviceId, properties, &err);
+        if (!newCommandQueue)
+        {
+            logError("Error: Failed to create a command ComputeCommands!", getError(err));
+            return false;
+        }
+
+        cl_command_queue newTransferQueue = clCreateCommandQueue(newContext, computeDeviceId, properties, &err);
+        if (!newTransferQueue)
+        {
+            logError("Error: Failed to create a transfer command queue!", getError(err));
+            clReleaseCommandQueue(newCommandQueue);
+            return false;
+        }
+
+        commandQueue = newCommandQueue;
+        transferQueue = newTransferQueue;
+        return true;
+    }
+
+    cl_command_queue getQueue(QueueType queue) const
+    {
+        return queue == QueueType::TRANSFER ? transferQueue : commandQueue;
+    }
 
-    bool setKernelArg(cl_kernel kernel, KernelArg arg, int index)
+    // nullptr (and a log line naming the caller) for stale handles
+    BufferRecord * findBuffer(BufferId id, const char * operation)
     {
-        cl_uint uindex = static_cast<cl_uint>(index);
+        BufferRecord * record = buffers.get(id);
+        if(!record)
+        {
+            std::cout << "Error: " << operation << " with an invalid buffer handle (index " << id.getIndex()
+                      << ", generation " << id.getGeneration() << ")" << std::endl;
+        }
+        return record;
+    }
+
+    BufferId addBuffer(cl_mem mem, size_t byteSize, BufferType type)
+    {
+        BufferRecord record;
+        record.mem = mem;
+        record.info.byteSize = byteSize;
+        record.info.type = type;
+
+        BufferId id = buffers.insert(record);
+        if(!id)
+        {
+            std::cout << "Error: Buffer table is full" << std::endl;
+            clReleaseMemObject(mem);
+        }
+        return id;
+    }
+
+    bool createContextOnDevice(cl_device_id computeDeviceId)
+    {
+        cl_int err = CL_SUCCESS;
+
+        size_t returnedSize = 0;
+        size_t deviceMaxWorkGroupSize = 0;
+        err = clGetDeviceInfo(computeDeviceId, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &deviceMaxWorkGroupSize, &returnedSize);
+        if (err != CL_SUCCESS)
+        {
+            logError("Error: Failed to retrieve device info!", getError(err));
+            return false;
+        }
 
-        int err = clSetKernelArg(kernel, uindex, arg.byteSize, arg.data);
+        cl_char vendorName[1024] = {0};
+        cl_char deviceName[1024] = {0};
+        err = clGetDeviceInfo(computeDeviceId, CL_DEVICE_VENDOR, sizeof(vendorName), vendorName, &returnedSize);
+        err|= clGetDeviceInfo(computeDeviceId, CL_DEVICE_NAME, sizeof(deviceName), deviceName, &returnedSize);
+        if (err != CL_SUCCESS)
+        {
+            logError("Error: Failed to retrieve device info!", getError(err));
+            return false;
+        }
+
+        std::cout << "Connecting to " <<  vendorName << " - " << deviceName << "..." << std::endl;
+
+        // Create Context
+        cl_context newContext = clCreateContext(0, 1, &computeDeviceId, NULL, NULL, &err);
+        if (!newContext || err)
+        {
+            logError("Error: Failed to create a compute ComputeContext!", getError(err));
+            return false;
+        }
 
-        if(err)
+        // Create Command Queues
+        if (!createQueues(newContext, computeDeviceId))
         {
-            logError("Error: Failed to set kernel arg!", getError(err));
+            clReleaseContext(newContext);
             return false;
         }
+
+        deviceId = computeDeviceId;
+        context = newContext;
+        maxWorkGroupSize = deviceMaxWorkGroupSize;
+        deviceInfo = queryDeviceInfo(computeDeviceId, findDeviceLocation(computeDeviceId));
+
+        std::cout << "Successfully created OpenCL context " << std::endl;
         return true;
     }
 };
@@ -168,11 +436,152 @@ static inline void logError(const std::string & error, const std::string & error
     std::cout << errorDetail << std::endl;
 }
 
+bool BoundKernel::isValid() const
+{
+    return _info && _info->kernel;
+}
+
+bool BoundKernel::setArg(unsigned int index, const void * data, size_t byteSize)
+{
+    if(!isValid() || index >= _info->args.size())
+    {
+        std::cout << "Error: Invalid kernel arg index " << index << std::endl;
+        return false;
+    }
+
+    return _setCachedArg(index, data, byteSize, data, byteSize, false);
+}
+
+bool BoundKernel::setArg(unsigned int index, BufferId buffer)
+{
+    if(!isValid() || index >= _info->args.size())
+    {
+        std::cout << "Error: Invalid kernel arg index " << index << std::endl;
+        return false;
+    }
+
+    // A null handle binds a NULL cl_mem, legal for arguments the kernel does not read
+    if(!buffer)
+    {
+        cl_mem nullMem = nullptr;
+        return _setCachedArg(index, &buffer, sizeof(BufferId), &nullMem, sizeof(cl_mem), true);
+    }
+
+    BufferRecord * record = _info->owner->findBuffer(buffer, "Setting a kernel arg");
+    if(!record)
+    {
+        return false;
+    }
+
+    // Cached by handle, a released and recreated buffer never compares equal
+    return _setCachedArg(index, &buffer, sizeof(BufferId), &record->mem, sizeof(cl_mem), true);
+}
+
+bool BoundKernel::_setCachedArg(unsigned int index, const void * key, size_t keySize, const void * data, size_t byteSize, bool isBuffer)
+{
+    KernelArgValue & arg = _info->args[index];
+    const unsigned char * keyBytes = static_cast<const unsigned char *>(key);
+    if(arg.isSet && !arg.isLocal && arg.isBuffer == isBuffer && arg.byteSize == keySize &&
+       std::equal(keyBytes, keyBytes + keySize, arg.bytes.begin()))
+    {
+        return true;
+    }
+
+    cl_int err = clSetKernelArg(_info->kernel, index, byteSize, data);
+    if(err)
+    {
+        arg.isSet = false;
+        logError("Error: Failed to set kernel arg!", getError(err));
+        return false;
+    }
+
+    // Only grows, so steady state updates do not allocate
+    if(arg.bytes.size() < keySize)
+    {
+        arg.bytes.resize(keySize);
+    }
+    std::copy(keyBytes, keyBytes + keySize, arg.bytes.begin());
+    arg.byteSize = keySize;
+    arg.isSet = true;
+    arg.isLocal = false;
+    arg.isBuffer = isBuffer;
+    return true;
+}
+
+bool BoundKernel::setLocalArg(unsigned int index, size_t byteSize)
+{
+    if(!isValid() || index >= _info->args.size())
+    {
+        std::cout << "Error: Invalid kernel arg index " << index << std::endl;
+        return false;
+    }
+
+    KernelArgValue & arg = _info->args[index];
+    if(arg.isSet && arg.isLocal && arg.byteSize == byteSize)
+    {
+        return true;
+    }
+
+    cl_int err = clSetKernelArg(_info->kernel, index, byteSize, nullptr);
+    if(err)
+    {
+        arg.isSet = false;
+        logError("Error: Failed to set kernel arg!", getError(err));
+        return false;
+    }
+
+    arg.byteSize = byteSize;
+    arg.isSet = true;
+    arg.isLocal = true;
+    arg.isBuffer = false;
+    return true;
+}
+
+size_t BoundKernel::getWorkGroupSize() const
+{
+    return _info ? _info->workGroupSize : 0;
+}
+
+size_t BoundKernel::getPreferredWorkGroupSizeMultiple() const
+{
+    return _info ? _info->preferredWorkGroupSizeMultiple : 0;
+}
+
 CLContextWrapper::CLContextWrapper() : _hasCreatedContext(false), _deviceType(DeviceType::NONE)
 {
     _this = new CLContextWrapperPrivate;
 }
 
+void CLContextWrapper::setProfilingEnabled(bool enabled)
+{
+    if(enabled == _this->profilingEnabled)
+    {
+        return;
+    }
+    _this->profilingEnabled = enabled;
+
+    // Queue properties are fixed at creation
+    if(!_this->commandQueue)
+    {
+        return;
+    }
+    finish();
+    cl_command_queue oldCommandQueue = _this->commandQueue;
+    cl_command_queue oldTransferQueue = _this->transferQueue;
+    if(!_this->createQueues(_this->context, _this->deviceId))
+    {
+        _this->profilingEnabled = !enabled;
+        return;
+    }
+    clReleaseCommandQueue(oldTransferQueue);
+    clReleaseCommandQueue(oldCommandQueue);
+}
+
+bool CLContextWrapper::isProfilingEnabled() const
+{
+    return _this->profilingEnabled;
+}
+
 CLContextWrapper::~CLContextWrapper()
 {
     for(auto it : _this->kernels)
@@ -180,11 +589,19 @@ CLContextWrapper::~CLContextWrapper()
         clReleaseKernel(it.second.kernel);
     }
 
-    for(auto mem : _this->buffers)
+    _this->buffers.forEach([] (BufferRecord & record)
     {
-        clReleaseMemObject(mem);
-    }
+        clReleaseMemObject(record.mem);
+    });
 
+    if(_this->computeProgram)
+    {
+        clReleaseProgram(_this->computeProgram);
+    }
+    if(_this->transferQueue)
+    {
+        clReleaseCommandQueue(_this->transferQueue);
+    }
     if(_this->commandQueue)
     {
         clReleaseCommandQueue(_this->commandQueue);
@@ -236,58 +653,57 @@ bool CLContextWrapper::createContext(DeviceType deviceType)
         return false;
     }
 
-    size_t returnedSize = 0;
-    size_t maxWorkGroupSize = 0;
-    err = clGetDeviceInfo(computeDeviceId, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, &returnedSize);
-    if (err != CL_SUCCESS)
+    if(!_this->createContextOnDevice(computeDeviceId))
     {
-        logError("Error: Failed to retrieve device info!", getError(err));
         return false;
     }
 
-    cl_char vendorName[1024] = {0};
-    cl_char deviceName[1024] = {0};
-    err = clGetDeviceInfo(computeDeviceId, CL_DEVICE_VENDOR, sizeof(vendorName), vendorName, &returnedSize);
-    err|= clGetDeviceInfo(computeDeviceId, CL_DEVICE_NAME, sizeof(deviceName), deviceName, &returnedSize);
-    if (err != CL_SUCCESS)
+    _hasCreatedContext = true;
+    _deviceType = deviceType;
+
+    return true;
+}
+
+bool CLContextWrapper::createContext(const DeviceLocation & location)
+{
+    // Check if has already created a context
+    if(_hasCreatedContext)
     {
-        logError("Error: Failed to retrieve device info!", getError(err));
         return false;
     }
 
-    std::cout << "Connecting to " <<  vendorName << " - " << deviceName << "..." << std::endl;
-
-    // Create Context
-    cl_context context = clCreateContext(0, 1, &computeDeviceId, NULL, NULL, &err);
-    if (!_this->context || err)
+    std::vector<cl_platform_id> platforms = getPlatformIds();
+    if(location.platformIndex >= platforms.size())
     {
-        logError("Error: Failed to create a compute ComputeContext!", getError(err));
+        logError("Error: Invalid platform index", std::to_string(location.platformIndex));
         return false;
     }
 
-    // Create Command Queue
-    cl_command_queue commandQueue = clCreateCommandQueue(context, computeDeviceId, 0, &err);
-    if (!_this->commandQueue)
+    std::vector<cl_device_id> devices = getDeviceIds(platforms[location.platformIndex]);
+    if(location.deviceIndex >= devices.size())
     {
-        logError("Error: Failed to create a command ComputeCommands!", getError(err));
+        logError("Error: Invalid device index", std::to_string(location.deviceIndex));
         return false;
     }
 
+    cl_device_id computeDeviceId = devices[location.deviceIndex];
 
-    _this->deviceId = computeDeviceId;
-    _this->context = context;
-    _this->commandQueue = commandQueue;
-
-    _this->maxWorkGroupSize = maxWorkGroupSize;
-
-    std::cout << "Successfully created OpenCL context " << std::endl;
+    if(!_this->createContextOnDevice(computeDeviceId))
+    {
+        return false;
+    }
 
     _hasCreatedContext = true;
-    _deviceType = deviceType;
+    _deviceType = _this->deviceInfo.type;
 
     return true;
 }
 
+bool CLContextWrapper::createContext(const DeviceInfo & device)
+{
+    return createContext(device.location);
+}
+
 #if __APPLE__
 
 bool CLContextWrapper::createContextWithOpengl()
@@ -337,18 +753,17 @@ bool CLContextWrapper::createContextWithOpengl()
         return false;
     }
 
-    // Create Command Queue
-    auto commandQueue = clCreateCommandQueue(context, computeDeviceId, 0, &err);
-    if (!commandQueue)
+    // Create Command Queues
+    if (!_this->createQueues(context, computeDeviceId))
     {
-        logError("Error: Failed to create a command ComputeCommands with shared Opengl!", getError(err));
+        logError("Error: Failed to create command queues with shared Opengl!");
         return false;
     }
 
     _this->context = context;
     _this->deviceId = computeDeviceId;
-    _this->commandQueue = commandQueue;
     _this->maxWorkGroupSize = maxWorkGroupSize;
+    _this->deviceInfo = queryDeviceInfo(computeDeviceId, findDeviceLocation(computeDeviceId));
 
     _hasCreatedContext = true;
     _deviceType = DeviceType::GPU_DEVICE;
@@ -424,18 +839,17 @@ bool CLContextWrapper::createContextWithOpengl()
         return false;
     }
 
-    // Create Command Queue
-    auto commandQueue = clCreateCommandQueue(context, computeDeviceId, 0, &err);
-    if (!commandQueue)
+    // Create Command Queues
+    if (!_this->createQueues(context, computeDeviceId))
     {
-        logError("Error: Failed to create a command ComputeCommands with shared Opengl!", getError(err));
+        logError("Error: Failed to create command queues with shared Opengl!");
         return false;
     }
 
     _this->deviceId = computeDeviceId;
     _this->context = context;
-    _this->commandQueue = commandQueue;
     _this->maxWorkGroupSize = maxWorkGroupSize;
+    _this->deviceInfo = queryDeviceInfo(computeDeviceId, findDeviceLocation(computeDeviceId));
 
     _hasCreatedContext = true;
     _deviceType = DeviceType::GPU_DEVICE;
@@ -460,10 +874,22 @@ size_t CLContextWrapper::getMaxWorkGroupSize() const
     return _this->maxWorkGroupSize;
 }
 
-bool CLContextWrapper::createProgramFromSource(const std::string & source)
+const DeviceInfo & CLContextWrapper::getDeviceInfo() const
+{
+    return _this->deviceInfo;
+}
+
+bool CLContextWrapper::createProgramFromSource(const std::string & source, const std::string & buildOptions)
 {
     cl_int err = 0;
 
+    // Rebuilding replaces the program, prepared kernels keep their own reference
+    if(_this->computeProgram)
+    {
+        clReleaseProgram(_this->computeProgram);
+        _this->computeProgram = nullptr;
+    }
+
     // Create program
     const char * sourcePtr = source.c_str();
 
@@ -479,7 +905,7 @@ bool CLContextWrapper::createProgramFromSource(const std::string & source)
 
     // Build the program executable
     const cl_device_id const_device_id = _this->deviceId;
-    err = clBuildProgram(_this->computeProgram, 1,&const_device_id, NULL, NULL, NULL);
+    err = clBuildProgram(_this->computeProgram, 1,&const_device_id, buildOptions.c_str(), NULL, NULL);
 
     size_t length = 0;
 
@@ -504,7 +930,7 @@ bool CLContextWrapper::createProgramFromSource(const std::string & source)
 }
 
 
-KernelId CLContextWrapper::prepareKernel(const std::string & kernelName)
+BoundKernel CLContextWrapper::prepareKernel(const std::string & kernelName)
 {
     cl_int err;
 
@@ -515,7 +941,7 @@ KernelId CLContextWrapper::prepareKernel(const std::string & kernelName)
     {
         std::cout << "Error: Failed to create compute kernel!" << std::endl;
         std::cout << getError(err) << std::endl;
-        return newKernel;
+        return BoundKernel();
     }
 
     // Get workgroup size
@@ -525,7 +951,8 @@ KernelId CLContextWrapper::prepareKernel(const std::string & kernelName)
     {
         std::cout << "Error: Failed to get kernel work group size" << std::endl;
         std::cout << getError(err) << std::endl;
-        return newKernel;
+        clReleaseKernel(newKernel);
+        return BoundKernel();
     }
 
     unsigned long lmemSize;
@@ -534,22 +961,59 @@ KernelId CLContextWrapper::prepareKernel(const std::string & kernelName)
     {
         std::cout << "Error: Failed to get kernel local memory size" << std::endl;
         std::cout << getError(err) << std::endl;
-        return newKernel;
+        clReleaseKernel(newKernel);
+        return BoundKernel();
+    }
+
+    cl_uint numArgs = 0;
+    err = clGetKernelInfo(newKernel, CL_KERNEL_NUM_ARGS, sizeof(cl_uint), &numArgs, NULL);
+    if(err)
+    {
+        std::cout << "Error: Failed to get kernel arg count" << std::endl;
+        std::cout << getError(err) << std::endl;
+        clReleaseKernel(newKernel);
+        return BoundKernel();
     }
 
-    KernelInfo info;
+    size_t wgMultiple = 1;
+    err = clGetKernelWorkGroupInfo(newKernel, _this->deviceId, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &wgMultiple, NULL);
+    if(err)
+    {
+        wgMultiple = 1; // Only a hint
+    }
+
+    // Preparing again (e.g. after a rebuild) replaces the old kernel in place, so
+    // handles stay valid. The new kernel has no arguments set yet.
+    KernelInfo & info = _this->kernels[kernelName];
+    if(info.kernel)
+    {
+        clReleaseKernel(info.kernel);
+    }
+    info.owner = _this;
+    info.name = kernelName;
     info.kernel = newKernel;
     info.workGroupSize = wgSize;
+    info.preferredWorkGroupSizeMultiple = wgMultiple;
     info.localMemSize = lmemSize;
-
-    _this->kernels[kernelName] = info;
+    info.args.assign(numArgs, KernelArgValue());
 
     std::cout << "Succesfully prepared kernel '" << kernelName << "'" << std::endl;
     std::cout << "Work group size :" << wgSize << std::endl;
+    std::cout << "Preferred work group size multiple :" << wgMultiple << std::endl;
     std::cout << "Local Memory size :" << lmemSize << std::endl;
 
 
-   return newKernel;
+   return BoundKernel(&info);
+}
+
+BoundKernel CLContextWrapper::getKernel(const std::string & kernelName)
+{
+    auto it = _this->kernels.find(kernelName);
+    if(it == _this->kernels.end())
+    {
+        return BoundKernel();
+    }
+    return BoundKernel(&it->second);
 }
 
 size_t CLContextWrapper::getWorkGroupSizeForKernel(const std::string & kernelName) const
@@ -562,17 +1026,23 @@ size_t CLContextWrapper::getWorkGroupSizeForKernel(const std::string & kernelNam
     return 0;
 }
 
+size_t CLContextWrapper::getPreferredWorkGroupSizeMultiple(const std::string & kernelName) const
+{
+    auto it =_this->kernels.find(kernelName);
+    if(it != _this->kernels.end())
+    {
+        return it->second.preferredWorkGroupSizeMultiple;
+    }
+    return 0;
+}
+
 bool CLContextWrapper::dispatchKernel(const std::string& kernelName, NDRange range)
 {
     return dispatchKernel(kernelName, range, std::vector<KernelArg>());
 }
 
-bool CLContextWrapper::dispatchKernel(const std::string& kernelName, NDRange range,const std::vector<KernelArg>& args)
+bool CLContextWrapper::dispatchKernel(const std::string& kernelName, NDRange range,const std::vector<KernelArg>& args, EventId * completion)
 {
-    cl_int err = 0;
-
-    // TODO: check if global size and local size are evenly
-
     auto it =_this->kernels.find(kernelName);
     if(it == _this->kernels.end())
     {
@@ -580,14 +1050,23 @@ bool CLContextWrapper::dispatchKernel(const std::string& kernelName, NDRange ran
         return false;
     }
 
-    cl_kernel kernel = it->second.kernel;
+    BoundKernel kernel(&it->second);
 
     if(!args.empty())
     {
         bool allOk = true;
         for(decltype(args.size()) i = 0; i < args.size() ; i++)
         {
-            bool ok =_this->setKernelArg(kernel, args[i], static_cast<int>(i));
+            unsigned int index = static_cast<unsigned int>(i);
+            bool ok = false;
+            if(args[i].isBuffer)
+            {
+                ok = kernel.setArg(index, *static_cast<BufferId *>(args[i].data));
+            }
+            else
+            {
+                ok = args[i].data ? kernel.setArg(index, args[i].data, args[i].byteSize) : kernel.setLocalArg(index, args[i].byteSize);
+            }
             if(!ok)
             {
                 std::cout << "Failed to setup arg for index " << i << std::endl;
@@ -600,13 +1079,32 @@ bool CLContextWrapper::dispatchKernel(const std::string& kernelName, NDRange ran
         }
     }
 
+    return dispatchKernel(kernel, range, completion);
+}
+
+bool CLContextWrapper::dispatchKernel(const BoundKernel & kernel, const NDRange & range, EventId * completion)
+{
+    cl_int err = 0;
+
+    if(!kernel.isValid())
+    {
+        std::cout << "Error: Failed to find kernel to dispatch" << std::endl;
+        return false;
+    }
+
+    if(!range.isEvenlyDivided())
+    {
+        std::cout << "Error: Global size of '" << kernel._info->name << "' is not a multiple of the local size, use NDRange::padGlobalSize" << std::endl;
+        return false;
+    }
+
     err = clEnqueueNDRangeKernel(_this->commandQueue,
-                                 kernel,
+                                 kernel._info->kernel,
                                  range.workDim,
                                  range.globalOffset,
                                  range.globalSize,
                                  range.localSize,
-                                 0, nullptr, nullptr );
+                                 0, nullptr, reinterpret_cast<cl_event*>(completion));
 
 
     if(err)
@@ -627,12 +1125,114 @@ bool CLContextWrapper::setKernelArg(const std::string & kernelName, KernelArg ar
         return false;
     }
 
-    return _this->setKernelArg(it->second.kernel, arg, index);
+    // Through the handle, so its cache matches the kernel
+    BoundKernel kernel(&it->second);
+    unsigned int uindex = static_cast<unsigned int>(index);
+    if(arg.isBuffer)
+    {
+        return kernel.setArg(uindex, *static_cast<BufferId *>(arg.data));
+    }
+    return arg.data ? kernel.setArg(uindex, arg.data, arg.byteSize) : kernel.setLocalArg(uindex, arg.byteSize);
 }
 
 void CLContextWrapper::finish()
 {
     clFinish(_this->commandQueue);
+    clFinish(_this->transferQueue);
+}
+
+void CLContextWrapper::finish(QueueType queue)
+{
+    clFinish(_this->getQueue(queue));
+}
+
+void CLContextWrapper::flush()
+{
+    clFlush(_this->commandQueue);
+    clFlush(_this->transferQueue);
+}
+
+bool CLContextWrapper::enqueueWaitForEvents(QueueType queue, const EventId * events, unsigned int count)
+{
+    if(count == 0)
+    {
+        return true;
+    }
+
+    cl_int err = clEnqueueBarrierWithWaitList(_this->getQueue(queue), count, reinterpret_cast<const cl_event*>(events), nullptr);
+    if(err)
+    {
+        logError("Error: Failed to enqueue wait for events", getError(err));
+        return false;
+    }
+    return true;
+}
+
+EventId CLContextWrapper::enqueueMarker(QueueType queue)
+{
+    cl_event event = nullptr;
+    cl_int err = clEnqueueMarkerWithWaitList(_this->getQueue(queue), 0, nullptr, &event);
+    if(err)
+    {
+        logError("Error: Failed to enqueue marker", getError(err));
+        return nullptr;
+    }
+    return event;
+}
+
+bool CLContextWrapper::getEventTimes(EventId event, EventTimes & times) const
+{
+    cl_event clEvent = static_cast<cl_event>(event);
+    cl_ulong queued = 0, submitted = 0, started = 0, ended = 0;
+
+    cl_int err = clGetEventProfilingInfo(clEvent, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, nullptr);
+    err |= clGetEventProfilingInfo(clEvent, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submitted, nullptr);
+    err |= clGetEventProfilingInfo(clEvent, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &started, nullptr);
+    err |= clGetEventProfilingInfo(clEvent, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ended, nullptr);
+    if(err)
+    {
+        // Not complete yet or profiling is off
+        return false;
+    }
+
+    times.queued = queued;
+    times.submitted = submitted;
+    times.started = started;
+    times.ended = ended;
+    return true;
+}
+
+bool CLContextWrapper::isEventComplete(EventId event) const
+{
+    cl_int status = CL_COMPLETE;
+    cl_int err = clGetEventInfo(static_cast<cl_event>(event), CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+    if(err != CL_SUCCESS)
+    {
+        logError("Error: Failed to query event", getError(err));
+        return true;
+    }
+    // Negative status means the command failed, it will not complete any further
+    return status == CL_COMPLETE || status < 0;
+}
+
+bool CLContextWrapper::waitForEvent(EventId event)
+{
+    cl_event clEvent = static_cast<cl_event>(event);
+    cl_int err = clWaitForEvents(1, &clEvent);
+    if(err != CL_SUCCESS)
+    {
+        logError("Error: Failed to wait for event", getError(err));
+        return false;
+    }
+    return true;
+}
+
+void CLContextWrapper::releaseEvent(EventId event)
+{
+    if(event)
+    {
+        clReleaseEvent(static_cast<cl_event>(event));
+    }
 }
 
 
@@ -651,35 +1251,235 @@ BufferId CLContextWrapper::createBuffer(size_t bytesSize, void * hostData, Buffe
     {
         std::cout << "Error: Failed to allocate buffer" << std::endl;
         std::cout << getError(err) << std::endl;
-        return 0;
+        return BufferId();
+    }
+
+    return _this->addBuffer(buffer, bytesSize, type);
+}
+
+BufferId CLContextWrapper::createSubBuffer(BufferId parent, size_t offset, size_t bytesSize, BufferType type)
+{
+    cl_int err = 0;
+
+    BufferRecord * parentRecord = _this->findBuffer(parent, "Creating a sub buffer");
+    if(!parentRecord)
+    {
+        return BufferId();
+    }
+
+    cl_buffer_region region;
+    region.origin = offset;
+    region.size = bytesSize;
+
+    cl_mem buffer = clCreateSubBuffer(parentRecord->mem, getMemFlags(type), CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+    if(!buffer)
+    {
+        std::cout << "Error: Failed to create sub buffer" << std::endl;
+        std::cout << getError(err) << std::endl;
+        return BufferId();
+    }
+
+    BufferId id = _this->addBuffer(buffer, bytesSize, type);
+    if(id)
+    {
+        _this->buffers.get(id)->info.parent = parent;
+    }
+    return id;
+}
+
+bool CLContextWrapper::releaseBuffer(BufferId id)
+{
+    BufferRecord * record = _this->findBuffer(id, "Releasing a buffer");
+    if(!record)
+    {
+        return false;
+    }
+
+    clReleaseMemObject(record->mem);
+    _this->buffers.remove(id);
+    return true;
+}
+
+BufferId CLContextWrapper::createPinnedBuffer(size_t bytesSize, BufferType type)
+{
+    cl_int err;
+    cl_mem buffer = clCreateBuffer(_this->context, getMemFlags(type) | CL_MEM_ALLOC_HOST_PTR, bytesSize, nullptr, &err);
+    if(!buffer)
+    {
+        std::cout << "Error: Failed to allocate pinned buffer" << std::endl;
+        std::cout << getError(err) << std::endl;
+        return BufferId();
     }
 
-    _this->buffers.insert(buffer);
-    return buffer;
+    BufferId id = _this->addBuffer(buffer, bytesSize, type);
+    if(id)
+    {
+        _this->buffers.get(id)->info.pinned = true;
+    }
+    return id;
 }
 
-bool CLContextWrapper::uploadToBuffer(BufferId id, size_t bytesSize, void * data, size_t offset,  const bool blocking)
+BufferId CLContextWrapper::createImage2D(size_t width, size_t height, const TextureParams & params, const float * rgbaData, BufferType type)
 {
     cl_int err = 0;
 
-    auto it = _this->buffers.find(static_cast<cl_mem>(id));
-    if(it == _this->buffers.end())
+    cl_image_format format;
+    format.image_channel_order = CL_RGBA;
+    format.image_channel_data_type = CL_FLOAT;
+
+    cl_image_desc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+    desc.image_width = width;
+    desc.image_height = height;
+
+    cl_mem_flags flags = getMemFlags(type);
+    if(rgbaData)
+    {
+        flags |= CL_MEM_COPY_HOST_PTR;
+    }
+
+    cl_mem image = clCreateImage(_this->context, flags, &format, &desc, const_cast<float *>(rgbaData), &err);
+    if(!image || err)
+    {
+        logError("Error: Failed to create image", getError(err));
+        return BufferId();
+    }
+
+    BufferId id = _this->addBuffer(image, 4 * sizeof(float) * width * height, type);
+    if(id)
+    {
+        BufferInfo & info = _this->buffers.get(id)->info;
+        info.isImage = true;
+        info.imageWidth = width;
+        info.imageHeight = height;
+        info.textureParams = params;
+    }
+    return id;
+}
+
+bool CLContextWrapper::uploadToImage2D(BufferId id, const float * rgbaData, const bool blocking, QueueType queue)
+{
+    BufferRecord * record = _this->findBuffer(id, "Uploading an image");
+    if(!record)
+    {
+        return false;
+    }
+    if(!record->info.isImage)
+    {
+        std::cout << "Error: Buffer " << record->info.name << " is not an image" << std::endl;
+        return false;
+    }
+
+    size_t origin[3] = {0, 0, 0};
+    size_t region[3] = {record->info.imageWidth, record->info.imageHeight, 1};
+    cl_int err = clEnqueueWriteImage(_this->getQueue(queue), record->mem, blocking ? CL_TRUE : CL_FALSE,
+                                     origin, region, 0, 0, rgbaData, 0, nullptr, nullptr);
+    if(err)
+    {
+        logError("Error: Failed to upload image", getError(err));
+        return false;
+    }
+    return true;
+}
+
+bool CLContextWrapper::isValidBuffer(BufferId id) const
+{
+    return _this->buffers.isValid(id);
+}
+
+const BufferInfo * CLContextWrapper::getBufferInfo(BufferId id) const
+{
+    const BufferRecord * record = _this->buffers.get(id);
+    return record ? &record->info : nullptr;
+}
+
+bool CLContextWrapper::setBufferName(BufferId id, const std::string & name)
+{
+    BufferRecord * record = _this->findBuffer(id, "Naming a buffer");
+    if(!record)
+    {
+        return false;
+    }
+    record->info.name = name;
+    return true;
+}
+
+bool CLContextWrapper::setBufferOwner(BufferId id, const void * owner)
+{
+    BufferRecord * record = _this->findBuffer(id, "Setting a buffer owner");
+    if(!record)
     {
-        std::cout << "Error: Buffer Id not created" << std::endl;
         return false;
     }
+    record->info.owner = owner;
+    return true;
+}
+
+size_t CLContextWrapper::getLiveBufferCount() const
+{
+    return _this->buffers.size();
+}
+
+void * CLContextWrapper::mapBuffer(BufferId id, size_t offset, size_t bytesSize)
+{
+    cl_int err = 0;
 
-    err = clEnqueueWriteBuffer(_this->commandQueue,
-                               static_cast<cl_mem>(id),
+    BufferRecord * record = _this->findBuffer(id, "Mapping a buffer");
+    if(!record)
+    {
+        return nullptr;
+    }
+
+    void * mapped = clEnqueueMapBuffer(_this->commandQueue, record->mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                       offset, bytesSize, 0, nullptr, nullptr, &err);
+    if(err)
+    {
+        logError("Error: Failed to map buffer", getError(err));
+        return nullptr;
+    }
+    return mapped;
+}
+
+bool CLContextWrapper::unmapBuffer(BufferId id, void * mapped)
+{
+    BufferRecord * record = _this->findBuffer(id, "Unmapping a buffer");
+    if(!record)
+    {
+        return false;
+    }
+
+    cl_int err = clEnqueueUnmapMemObject(_this->commandQueue, record->mem, mapped, 0, nullptr, nullptr);
+    if(err)
+    {
+        logError("Error: Failed to unmap buffer", getError(err));
+        return false;
+    }
+    return true;
+}
+
+bool CLContextWrapper::uploadToBuffer(BufferId id, size_t bytesSize, void * data, size_t offset,  const bool blocking, EventId * completion,
+                                      QueueType queue)
+{
+    cl_int err = 0;
+
+    BufferRecord * record = _this->findBuffer(id, "Uploading");
+    if(!record)
+    {
+        return false;
+    }
+
+    err = clEnqueueWriteBuffer(_this->getQueue(queue),
+                               record->mem,
                                blocking ? CL_TRUE : CL_FALSE,
                                offset,
                                bytesSize,
                                data,
-                               0, NULL, NULL);
+                               0, NULL, reinterpret_cast<cl_event*>(completion));
 
     if(err)
     {
-        std::cout << "Error: Failed to upload data to buffer" << std::endl;
+        std::cout << "Error: Failed to upload data to buffer " << record->info.name << std::endl;
         std::cout << getError(err) << std::endl;
         return false;
     }
@@ -687,28 +1487,28 @@ bool CLContextWrapper::uploadToBuffer(BufferId id, size_t bytesSize, void * data
 }
 
 
-bool CLContextWrapper::dowloadFromBuffer(BufferId id, size_t bytesSize, void * data, size_t offset , const bool blocking)
+bool CLContextWrapper::dowloadFromBuffer(BufferId id, size_t bytesSize, void * data, size_t offset , const bool blocking, EventId * completion,
+                                         QueueType queue)
 {
     cl_int err = 0;
 
-    auto it = _this->buffers.find(static_cast<cl_mem>(id));
-    if(it == _this->buffers.end())
+    BufferRecord * record = _this->findBuffer(id, "Downloading");
+    if(!record)
     {
-        std::cout << "Error: Buffer Id not created" << std::endl;
         return false;
     }
 
-    err = clEnqueueReadBuffer(_this->commandQueue,
-                              static_cast<cl_mem>(id),
+    err = clEnqueueReadBuffer(_this->getQueue(queue),
+                              record->mem,
                               blocking ? CL_TRUE : CL_FALSE,
                               offset,
                               bytesSize,
                               data,
-                              0, NULL, NULL);
+                              0, NULL, reinterpret_cast<cl_event*>(completion));
 
     if(err)
     {
-        std::cout << "Error: Failed to download data from buffer" << std::endl;
+        std::cout << "Error: Failed to download data from buffer " << record->info.name << std::endl;
         std::cout << getError(err) << std::endl;
         return false;
     }
@@ -726,55 +1526,103 @@ BufferId CLContextWrapper::shareGLTexture(const GLTextureId textureId, BufferTyp
     if(err || !mem)
     {
         logError("Error: Failed to share texture with Opengl.", getError(err));
-        return 0;
+        return BufferId();
     }
 
-    _this->buffers.insert(mem);
-
-    return mem;
+    BufferId id = _this->addBuffer(mem, 0, type);
+    if(id)
+    {
+        _this->buffers.get(id)->info.glShared = true;
+    }
+    return id;
 
 }
 
 void CLContextWrapper::executeSafeAndSyncronized(BufferId * textureToLock, unsigned int count, std::function<void()> exec)
 {
-    clEnqueueAcquireGLObjects(_this->commandQueue, count, reinterpret_cast<cl_mem*>(textureToLock), 0, nullptr, nullptr);
+    _this->glObjects.clear();
+    for(unsigned int i = 0 ; i < count; i++)
+    {
+        BufferRecord * record = _this->findBuffer(textureToLock[i], "Acquiring a GL object");
+        if(record)
+        {
+            _this->glObjects.push_back(record->mem);
+        }
+    }
+    cl_uint objectCount = static_cast<cl_uint>(_this->glObjects.size());
+
+    clEnqueueAcquireGLObjects(_this->commandQueue, objectCount, _this->glObjects.data(), 0, nullptr, nullptr);
 
     exec();
 
-    clEnqueueReleaseGLObjects(_this->commandQueue, count, reinterpret_cast<cl_mem*>(textureToLock), 0, nullptr, nullptr);
+    clEnqueueReleaseGLObjects(_this->commandQueue, objectCount, _this->glObjects.data(), 0, nullptr, nullptr);
 
     clFinish(_this->commandQueue);
 }
 
-std::vector<std::string> CLContextWrapper::listAvailablePlatforms()
+std::vector<DeviceLocation> CLContextWrapper::listAllDevices()
 {
-    cl_int err = 0;
-    cl_uint numPlatforms = 0;
-    err = clGetPlatformIDs(0, nullptr, &numPlatforms);
+    std::vector<DeviceLocation> locations;
 
-    if(numPlatforms ==0)
+    std::vector<cl_platform_id> platforms = getPlatformIds();
+    for(size_t i = 0 ; i < platforms.size(); i++)
     {
-        return std::vector<std::string>();
+        std::vector<cl_device_id> devices = getDeviceIds(platforms[i]);
+        for(size_t j = 0 ; j < devices.size(); j++)
+        {
+            DeviceLocation location;
+            location.platformIndex = static_cast<unsigned int>(i);
+            location.deviceIndex = static_cast<unsigned int>(j);
+            locations.push_back(location);
+        }
     }
+    return locations;
+}
 
-    std::vector<std::string> platformList;
-    for(cl_uint i =0; i < numPlatforms ; i++)
+std::string CLContextWrapper::getSamplerBuildOption(const std::string & name, const TextureParams & params)
+{
+    std::string flags = params.wrapMode == TextureWrapMode::REPEAT ? "CLK_NORMALIZED_COORDS_TRUE|CLK_ADDRESS_REPEAT" :
+                                                                     "CLK_NORMALIZED_COORDS_FALSE|CLK_ADDRESS_CLAMP_TO_EDGE";
+    flags += params.filterMode == TextureFilterMode::LINEAR ? "|CLK_FILTER_LINEAR" : "|CLK_FILTER_NEAREST";
+    return " -D " + name + "=" + flags;
+}
+
+std::vector<PlatformInfo> CLContextWrapper::enumeratePlatforms()
+{
+    std::vector<PlatformInfo> platformList;
+
+    std::vector<cl_platform_id> platforms = getPlatformIds();
+    for(size_t i = 0 ; i < platforms.size(); i++)
     {
-        cl_platform_id* platforms = new cl_platform_id[numPlatforms];
-        err = clGetPlatformIDs(numPlatforms, platforms, nullptr);
-        for (unsigned i = 0; i < numPlatforms; ++i)
+        PlatformInfo platformInfo;
+        platformInfo.name    = getPlatformString(platforms[i], CL_PLATFORM_NAME);
+        platformInfo.vendor  = getPlatformString(platforms[i], CL_PLATFORM_VENDOR);
+        platformInfo.version = getPlatformString(platforms[i], CL_PLATFORM_VERSION);
+
+        std::vector<cl_device_id> devices = getDeviceIds(platforms[i]);
+        for(size_t j = 0 ; j < devices.size(); j++)
         {
-            char platformName[100];
-            err = clGetPlatformInfo(platforms[i],
-                                       CL_PLATFORM_VENDOR,
-                                       sizeof(platformName),
-                                       platformName,
-                                       nullptr);
-            platformList.push_back(platformName);
+            DeviceLocation location;
+            location.platformIndex = static_cast<unsigned int>(i);
+            location.deviceIndex = static_cast<unsigned int>(j);
+            platformInfo.devices.push_back(queryDeviceInfo(devices[j], location));
         }
+        platformList.push_back(platformInfo);
     }
     return platformList;
-
 }
 
+std::vector<std::string> CLContextWrapper::listAvailablePlatforms()
+{
+    std::vector<std::string> platformList;
+    for(cl_platform_id platform : getPlatformIds())
+    {
+        platformList.push_back(getPlatformString(platform, CL_PLATFORM_VENDOR));
+    }
+    return platformList;
+}
 
+bool DeviceInfo::hasExtension(const std::string & extension) const
+{
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
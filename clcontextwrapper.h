@@ -1,5 +1,6 @@
 #pragma once
 
+#include <handletable.h>
 
 #include <functional>
 #include <string>
@@ -15,6 +16,27 @@ enum class DeviceType
     NONE
 };
 
+// Commands on one queue run in order, across queues only events order them
+enum class QueueType
+{
+    COMPUTE,
+    TRANSFER
+};
+
+// Device timestamps of a command in ns, needs profiling enabled
+struct EventTimes
+{
+    unsigned long long queued;
+    unsigned long long submitted;
+    unsigned long long started;
+    unsigned long long ended;
+
+    EventTimes() : queued(0), submitted(0), started(0), ended(0)
+    {
+
+    }
+};
+
 enum class BufferType
 {
     READ_ONLY,
@@ -22,6 +44,67 @@ enum class BufferType
     READ_AND_WRITE
 };
 
+// Position of a device in the platform/device enumeration order
+struct DeviceLocation
+{
+    unsigned int platformIndex;
+    unsigned int deviceIndex;
+
+    DeviceLocation() : platformIndex(0), deviceIndex(0)
+    {
+
+    }
+};
+
+struct DeviceInfo
+{
+    DeviceLocation location;
+    DeviceType type;
+
+    std::string name;
+    std::string vendor;
+    std::string version;
+    std::string driverVersion;
+
+    unsigned int computeUnits;
+    unsigned int maxClockFrequency; // MHz
+    size_t maxWorkGroupSize;
+    size_t maxWorkItemSizes[3];
+
+    unsigned long long globalMemSize;
+    unsigned long long maxMemAllocSize;
+    unsigned long long localMemSize;
+    unsigned long long maxConstantBufferSize;
+    unsigned int maxConstantArgs;
+    unsigned int memBaseAddrAlign; // bytes
+
+    bool hasDedicatedLocalMem;
+    bool imageSupport;
+    size_t image2dMaxWidth;
+    size_t image2dMaxHeight;
+
+    std::vector<std::string> extensions;
+
+    DeviceInfo() : type(DeviceType::NONE), computeUnits(0), maxClockFrequency(0), maxWorkGroupSize(0),
+                   globalMemSize(0), maxMemAllocSize(0), localMemSize(0), maxConstantBufferSize(0),
+                   maxConstantArgs(0), memBaseAddrAlign(0), hasDedicatedLocalMem(false), imageSupport(false),
+                   image2dMaxWidth(0), image2dMaxHeight(0)
+    {
+        maxWorkItemSizes[0] = maxWorkItemSizes[1] = maxWorkItemSizes[2] = 0;
+    }
+
+    bool hasExtension(const std::string & extension) const;
+};
+
+struct PlatformInfo
+{
+    std::string name;
+    std::string vendor;
+    std::string version;
+
+    std::vector<DeviceInfo> devices;
+};
+
 struct NDRange
 {
     unsigned int workDim;
@@ -36,6 +119,31 @@ struct NDRange
         localSize[0] = localSize[1] = localSize[2] = 0;
         globalOffset[0] = globalOffset[1] = globalOffset[2] = 0;
     }
+
+    // Round the global size up to a multiple of the local size. Kernels
+    // dispatched like this must bounds check against the real size.
+    void padGlobalSize()
+    {
+        for(unsigned int i = 0 ; i < workDim; i++)
+        {
+            if(localSize[i] > 0)
+            {
+                globalSize[i] = ((globalSize[i] + localSize[i] - 1) / localSize[i]) * localSize[i];
+            }
+        }
+    }
+
+    bool isEvenlyDivided() const
+    {
+        for(unsigned int i = 0 ; i < workDim; i++)
+        {
+            if(localSize[i] > 0 && globalSize[i] % localSize[i] != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
 };
 
 enum class TextureWrapMode
@@ -50,26 +158,41 @@ enum class TextureFilterMode
     NEAREST
 };
 
-
+// Sampling of an image, kernels get it as a sampler built from getSamplerBuildOption
 struct TextureParams
 {
     TextureWrapMode wrapMode;
     TextureFilterMode filterMode;
 
+    TextureParams() : wrapMode(TextureWrapMode::CLAMP), filterMode(TextureFilterMode::NEAREST)
+    {
+
+    }
 };
 
+struct BufferTag;
+
+// Generation checked index into the context's buffer table, not a cl_mem
+typedef Handle<BufferTag> BufferId;
+
 struct KernelArg
 {
     size_t        byteSize;
     void          *data;
+    bool          isBuffer; // data points to a BufferId
 
     template <typename T>
-    KernelArg(T* aData) : byteSize(sizeof(T)), data(aData)
+    KernelArg(T* aData) : byteSize(sizeof(T)), data(aData), isBuffer(false)
     {
 
     }
 
-    KernelArg(void* aData, size_t size) : byteSize(size), data(aData)
+    KernelArg(BufferId* aData) : byteSize(sizeof(BufferId)), data(aData), isBuffer(true)
+    {
+
+    }
+
+    KernelArg(void* aData, size_t size) : byteSize(size), data(aData), isBuffer(false)
     {
 
     }
@@ -80,13 +203,83 @@ struct KernelArg
     }
 };
 
+// Metadata kept next to every buffer in the table
+struct BufferInfo
+{
+    size_t byteSize;
+    BufferType type;
+    bool pinned;
+    bool glShared;
+    BufferId parent; // sub buffers only
+
+    // float4 texels for images, byteSize covers width * height of them
+    bool isImage;
+    size_t imageWidth;
+    size_t imageHeight;
+    TextureParams textureParams;
+
+    std::string name; // for error messages, empty unless set
+    const void * owner; // pool that handed the buffer out, if any
+
+    BufferInfo() : byteSize(0), type(BufferType::READ_AND_WRITE), pinned(false), glShared(false),
+                   isImage(false), imageWidth(0), imageHeight(0), owner(nullptr)
+    {
 
+    }
+};
 
-//typedef int BufferId; // TODO: Make an assert to ensure cl_mem = void *
-typedef void * BufferId;
 typedef void * KernelId; // TODO: Make an assert to ensure cl_kernel = void *
+typedef void * EventId; // cl_event, owned by the caller until releaseEvent
 typedef unsigned int GLTextureId;
 
+struct KernelInfo;
+
+// Handle to a prepared kernel. Arguments are compared with the last value set and
+// only changed ones reach the driver, dispatching through it does not allocate.
+// Preparing the same kernel again (after a rebuild) refreshes every handle to it.
+class BoundKernel
+{
+public:
+    BoundKernel() : _info(nullptr)
+    {
+
+    }
+
+    bool isValid() const;
+
+    // Buffers are passed by their BufferId
+    template <typename T>
+    bool setArg(unsigned int index, const T & value)
+    {
+        return setArg(index, &value, sizeof(T));
+    }
+
+    bool setArg(unsigned int index, const void * data, size_t byteSize);
+
+    // Resolved to the buffer's cl_mem, stale handles fail. Null handles bind NULL.
+    bool setArg(unsigned int index, BufferId buffer);
+
+    // __local memory of byteSize bytes
+    bool setLocalArg(unsigned int index, size_t byteSize);
+
+    size_t getWorkGroupSize() const;
+
+    size_t getPreferredWorkGroupSizeMultiple() const;
+
+private:
+    friend class CLContextWrapper;
+
+    explicit BoundKernel(KernelInfo * info) : _info(info)
+    {
+
+    }
+
+    // Key is what the cache compares, data what the kernel receives
+    bool _setCachedArg(unsigned int index, const void * key, size_t keySize, const void * data, size_t byteSize, bool isBuffer);
+
+    KernelInfo * _info; // owned by the context
+};
+
 class CLContextWrapper
 {
 public:
@@ -96,8 +289,18 @@ public:
 
     // Context Creation
 
+    // Device timestamps on both queues, off by default as it slows every command.
+    // A created context finishes its queues and replaces them.
+    void setProfilingEnabled(bool enabled);
+
+    bool isProfilingEnabled() const;
+
     bool createContext(DeviceType deviceType = DeviceType::CPU_DEVICE);
 
+    bool createContext(const DeviceLocation & location);
+
+    bool createContext(const DeviceInfo & device);
+
     bool createContextWithOpengl();
 
     // Context status
@@ -108,24 +311,54 @@ public:
 
     size_t getMaxWorkGroupSize() const;
 
+    const DeviceInfo & getDeviceInfo() const;
+
     // Kernel
 
-    bool createProgramFromSource(const std::string & source);
+    bool createProgramFromSource(const std::string & source, const std::string & buildOptions = "");
 
-    KernelId prepareKernel(const std::string & kernelName);
+    BoundKernel prepareKernel(const std::string & kernelName);
 
-    KernelId getKernel(const std::string & kernelName);
+    // Handle of a prepared kernel, invalid if it was never prepared
+    BoundKernel getKernel(const std::string & kernelName);
 
     size_t getWorkGroupSizeForKernel(const std::string & kernelName) const;
 
+    size_t getPreferredWorkGroupSizeMultiple(const std::string & kernelName) const;
+
     bool dispatchKernel(const std::string& kernelName, NDRange range);
 
-    bool dispatchKernel(const std::string& kernelName, NDRange range, const std::vector<KernelArg>& args);
+    bool dispatchKernel(const std::string& kernelName, NDRange range, const std::vector<KernelArg>& args, EventId * completion = nullptr);
+
+    // Enqueues with the arguments already set on the handle
+    bool dispatchKernel(const BoundKernel & kernel, const NDRange & range, EventId * completion = nullptr);
 
     bool setKernelArg(const std::string & kernelName, KernelArg args, int index);
 
+    // All queues
     void finish();
 
+    void finish(QueueType queue);
+
+    // Submits queued commands without waiting for them
+    void flush();
+
+    // Events
+
+    // Later commands on queue wait for the events
+    bool enqueueWaitForEvents(QueueType queue, const EventId * events, unsigned int count);
+
+    // Completes when everything enqueued before on queue did, nullptr on failure
+    EventId enqueueMarker(QueueType queue);
+
+    bool getEventTimes(EventId event, EventTimes & times) const;
+
+    bool isEventComplete(EventId event) const;
+
+    bool waitForEvent(EventId event);
+
+    void releaseEvent(EventId event);
+
     // OpenCL Buffers
 
     template <typename T>
@@ -136,21 +369,62 @@ public:
 
     BufferId createBuffer(size_t bytesSize, void * hostData = nullptr, BufferType type = BufferType::READ_AND_WRITE);
 
+    // Region of parent, offset must be a multiple of DeviceInfo::memBaseAddrAlign
+    BufferId createSubBuffer(BufferId parent, size_t offset, size_t bytesSize, BufferType type = BufferType::READ_AND_WRITE);
+
+    // The id is invalid afterwards, sub buffers keep their parent alive until released
+    bool releaseBuffer(BufferId id);
+
+    // Host memory the device can transfer from and to directly (CL_MEM_ALLOC_HOST_PTR), use with mapBuffer
+    BufferId createPinnedBuffer(size_t bytesSize, BufferType type = BufferType::READ_AND_WRITE);
+
+    // Images live in the buffer table and are released with releaseBuffer
+
+    // RGBA float image2d_t of width * height texels sampled with params, rgbaData may be nullptr
+    BufferId createImage2D(size_t width, size_t height, const TextureParams & params, const float * rgbaData = nullptr,
+                           BufferType type = BufferType::READ_ONLY);
+
+    // Replaces every texel
+    bool uploadToImage2D(BufferId id, const float * rgbaData, const bool blocking = true, QueueType queue = QueueType::COMPUTE);
+
+    // False for null, released and foreign handles
+    bool isValidBuffer(BufferId id) const;
+
+    // nullptr for invalid handles, valid until the buffer is released
+    const BufferInfo * getBufferInfo(BufferId id) const;
+
+    bool setBufferName(BufferId id, const std::string & name);
+
+    bool setBufferOwner(BufferId id, const void * owner);
+
+    size_t getLiveBufferCount() const;
+
+    // Offsets are in bytes. A completion event, when requested, must be released by the caller.
+
     template <typename T>
-    bool uploadArrayToBuffer(BufferId id, size_t count, T * data, size_t offset = 0,  const bool blocking = true)
+    bool uploadArrayToBuffer(BufferId id, size_t count, T * data, size_t offset = 0,  const bool blocking = true, EventId * completion = nullptr,
+                             QueueType queue = QueueType::COMPUTE)
     {
-        return uploadToBuffer(id, sizeof(T) * count, data, offset, blocking);
+        return uploadToBuffer(id, sizeof(T) * count, data, offset, blocking, completion, queue);
     }
 
-    bool uploadToBuffer(BufferId id, size_t bytesSize, void * data, size_t offset = 0, const bool blocking = true);
+    bool uploadToBuffer(BufferId id, size_t bytesSize, void * data, size_t offset = 0, const bool blocking = true, EventId * completion = nullptr,
+                        QueueType queue = QueueType::COMPUTE);
 
     template <typename T>
-    bool dowloadArrayFromBuffer(BufferId id, size_t count, T * data, size_t offset = 0, const bool blocking = true)
+    bool dowloadArrayFromBuffer(BufferId id, size_t count, T * data, size_t offset = 0, const bool blocking = true, EventId * completion = nullptr,
+                                QueueType queue = QueueType::COMPUTE)
     {
-        return dowloadFromBuffer(id, sizeof(T)* count, data, offset, blocking);
+        return dowloadFromBuffer(id, sizeof(T)* count, data, offset, blocking, completion, queue);
     }
 
-    bool dowloadFromBuffer(BufferId id, size_t bytesSize, void * data, size_t offset = 0, const bool blocking = true);
+    bool dowloadFromBuffer(BufferId id, size_t bytesSize, void * data, size_t offset = 0, const bool blocking = true, EventId * completion = nullptr,
+                           QueueType queue = QueueType::COMPUTE);
+
+    // Blocking map for host reads and writes, nullptr on failure
+    void * mapBuffer(BufferId id, size_t offset, size_t bytesSize);
+
+    bool unmapBuffer(BufferId id, void * mapped);
 
     // OpenGL
 
@@ -160,8 +434,17 @@ public:
 
 
     // Static util
+
+    // " -D name=<flags>" for a __constant sampler_t name = name in the program.
+    // REPEAT reads normalized coordinates, CLAMP texel coordinates.
+    static std::string getSamplerBuildOption(const std::string & name, const TextureParams & params);
+
     static std::vector<std::string> listAvailablePlatforms();
 
+    static std::vector<DeviceLocation> listAllDevices();
+
+    static std::vector<PlatformInfo> enumeratePlatforms();
+
 private:
     CLContextWrapperPrivate * _this;
     bool _hasCreatedContext;
@@ -0,0 +1,113 @@
+#include "colorformat.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+static float halfToFloat(uint16_t half)
+{
+    int sign = (half >> 15) & 0x1;
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+
+    float value = 0.0f;
+    if(exponent == 0)
+    {
+        value = std::ldexp(static_cast<float>(mantissa), -24);
+    }
+    else if(exponent == 31)
+    {
+        value = mantissa ? NAN : INFINITY;
+    }
+    else
+    {
+        value = std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+    }
+    return sign ? -value : value;
+}
+
+size_t getColorFormatBytes(ColorFormat format)
+{
+    switch (format)
+    {
+    case ColorFormat::HALF4:
+        return 4 * sizeof(uint16_t);
+    case ColorFormat::RGBA8:
+    case ColorFormat::RGB10A2:
+        return sizeof(uint32_t);
+    case ColorFormat::FLOAT4:
+    default:
+        return 4 * sizeof(float);
+    }
+}
+
+const char * getColorFormatName(ColorFormat format)
+{
+    switch (format)
+    {
+    case ColorFormat::FLOAT4:
+        return "float4";
+    case ColorFormat::HALF4:
+        return "half4";
+    case ColorFormat::RGBA8:
+        return "rgba8";
+    case ColorFormat::RGB10A2:
+        return "rgb10a2";
+    default:
+        return "unknown";
+    }
+}
+
+const char * getColorFormatBuildOption(ColorFormat format)
+{
+    switch (format)
+    {
+    case ColorFormat::HALF4:
+        return " -D COLOR_FORMAT_HALF4";
+    case ColorFormat::RGBA8:
+        return " -D COLOR_FORMAT_RGBA8";
+    case ColorFormat::RGB10A2:
+        return " -D COLOR_FORMAT_RGB10A2";
+    case ColorFormat::FLOAT4:
+    default:
+        return " -D COLOR_FORMAT_FLOAT4";
+    }
+}
+
+void unpackColor(ColorFormat format, const void * pixels, size_t index, float * rgba)
+{
+    switch (format)
+    {
+    case ColorFormat::HALF4:
+    {
+        const uint16_t * halves = static_cast<const uint16_t *>(pixels) + 4 * index;
+        for(int i = 0 ; i < 4; i++)
+        {
+            rgba[i] = halfToFloat(halves[i]);
+        }
+        break;
+    }
+    case ColorFormat::RGBA8:
+    {
+        const unsigned char * bytes = static_cast<const unsigned char *>(pixels) + 4 * index;
+        for(int i = 0 ; i < 4; i++)
+        {
+            rgba[i] = bytes[i] / 255.0f;
+        }
+        break;
+    }
+    case ColorFormat::RGB10A2:
+    {
+        uint32_t packed = static_cast<const uint32_t *>(pixels)[index];
+        rgba[0] = (packed & 0x3ff) / 1023.0f;
+        rgba[1] = ((packed >> 10) & 0x3ff) / 1023.0f;
+        rgba[2] = ((packed >> 20) & 0x3ff) / 1023.0f;
+        rgba[3] = (packed >> 30) / 3.0f;
+        break;
+    }
+    case ColorFormat::FLOAT4:
+    default:
+        std::memcpy(rgba, static_cast<const float *>(pixels) + 4 * index, 4 * sizeof(float));
+        break;
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+// Per pixel layout of the traced colors, selected at program build time
+enum class ColorFormat
+{
+    FLOAT4,  // 16 bytes, exact
+    HALF4,   // 8 bytes, written with vstore_half4, keeps values above one
+    RGBA8,   // 4 bytes, unorm channels clamped to [0, 1]
+    RGB10A2  // 4 bytes, 10 bit unorm color and 2 bit alpha packed low to high
+};
+
+size_t getColorFormatBytes(ColorFormat format);
+
+const char * getColorFormatName(ColorFormat format);
+
+// Build option selecting the matching storeColor/loadColor in raytracing.cl
+const char * getColorFormatBuildOption(ColorFormat format);
+
+// Decodes pixel index of a frame in the given format into rgba
+void unpackColor(ColorFormat format, const void * pixels, size_t index, float * rgba);
@@ -0,0 +1,447 @@
+#include "denoiser.h"
+
+#include <gbuffer.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// B3 spline, indexed by the tap distance in steps, as ATROUS_WEIGHTS in denoise.cl
+static const float ATROUS_WEIGHTS[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+// Per pass constants shared by the kernel and the host loop
+struct AtrousPass
+{
+    int stepWidth;
+    float invColorVariance;
+    float invDepthScale;
+};
+
+static AtrousPass getAtrousPass(const DenoiseParams & params, int iteration)
+{
+    AtrousPass pass;
+    pass.stepWidth = 1 << iteration;
+    float sigmaColor = params.sigmaColor / static_cast<float>(pass.stepWidth);
+    pass.invColorVariance = 1.0f / std::max(sigmaColor * sigmaColor, 1e-12f);
+    pass.invDepthScale = 1.0f / std::max(params.sigmaDepth, 1e-6f);
+    return pass;
+}
+
+Denoiser::Denoiser(std::shared_ptr<CLContextWrapper> context) : _clContext(context), _capacity(0), _outputBufferId(nullptr)
+{
+    _tempBufferIds[0] = _tempBufferIds[1] = nullptr;
+}
+
+bool Denoiser::prepareKernels()
+{
+    _loadKernel = _clContext->prepareKernel("denoiseLoadKernel");
+    _atrousKernel = _clContext->prepareKernel("denoiseAtrousKernel");
+    return _loadKernel.isValid() && _atrousKernel.isValid();
+}
+
+bool Denoiser::reserve(size_t numPixels)
+{
+    if(numPixels <= _capacity)
+    {
+        return true;
+    }
+
+    for(BufferId & bufferId : _tempBufferIds)
+    {
+        if(bufferId)
+        {
+            _clContext->releaseBuffer(bufferId);
+        }
+        bufferId = _clContext->createBuffer(4*sizeof(float) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+        if(!bufferId)
+        {
+            std::cout << "Failed to create denoiser buffers" << std::endl;
+            _capacity = 0;
+            return false;
+        }
+    }
+    _clContext->setBufferName(_tempBufferIds[0], "denoise 0");
+    _clContext->setBufferName(_tempBufferIds[1], "denoise 1");
+
+    _capacity = numPixels;
+    return true;
+}
+
+bool Denoiser::denoise(BufferId colors, ColorFormat format, BufferId depth, BufferId normals, int width, int height,
+                       const NDRange & range, const DenoiseParams & params)
+{
+    _outputBufferId = nullptr;
+    if(params.iterations <= 0)
+    {
+        return true;
+    }
+    if(!_loadKernel.isValid() || !_atrousKernel.isValid() || !reserve(static_cast<size_t>(width) * height))
+    {
+        return false;
+    }
+
+    // Float4 input is read by the first pass as it is, pass i writes temporary i % 2
+    bool ok = true;
+    BufferId input = colors;
+    if(format != ColorFormat::FLOAT4)
+    {
+        input = _tempBufferIds[1];
+        ok &= _loadKernel.setArg(0, colors);
+        ok &= _loadKernel.setArg(1, input);
+        ok &= _loadKernel.setArg(2, width);
+        ok &= _loadKernel.setArg(3, height);
+        ok = ok && _clContext->dispatchKernel(_loadKernel, range);
+    }
+
+    for(int i = 0 ; i < params.iterations && ok; i++)
+    {
+        AtrousPass pass = getAtrousPass(params, i);
+
+        ok &= _atrousKernel.setArg(0, input);
+        ok &= _atrousKernel.setArg(1, _tempBufferIds[i % 2]);
+        ok &= _atrousKernel.setArg(2, depth);
+        ok &= _atrousKernel.setArg(3, normals);
+        ok &= _atrousKernel.setArg(4, width);
+        ok &= _atrousKernel.setArg(5, height);
+        ok &= _atrousKernel.setArg(6, pass.stepWidth);
+        ok &= _atrousKernel.setArg(7, pass.invColorVariance);
+        ok &= _atrousKernel.setArg(8, pass.invDepthScale);
+        ok &= _atrousKernel.setArg(9, params.normalPower);
+        ok = ok && _clContext->dispatchKernel(_atrousKernel, range);
+
+        input = _tempBufferIds[i % 2];
+    }
+
+    if(!ok)
+    {
+        std::cout << "Denoising failed" << std::endl;
+        return false;
+    }
+    _outputBufferId = input;
+    return true;
+}
+
+BufferId Denoiser::getOutput() const
+{
+    return _outputBufferId;
+}
+
+// Rows [rowBegin, rowEnd) of one pass, rows counted top to bottom like the G-buffer
+static void denoiseRows(const AtrousPass & pass, float normalPower, const float * input, float * output,
+                        const float * depth, const glm::vec3 * normals, int width, int height, int rowBegin, int rowEnd)
+{
+    const int step = pass.stepWidth;
+    for(int y = rowBegin ; y < rowEnd; y++)
+    {
+        for(int x = 0 ; x < width; x++)
+        {
+            const float * center = input + 4 * (static_cast<size_t>(height - 1 - y) * width + x);
+            const float centerDepth = depth[y * width + x];
+            const glm::vec3 & centerNormal = normals[y * width + x];
+            const bool centerHit = centerDepth < FLT_MAX;
+
+            // Weighted color sum, the weight sum goes in the fourth channel
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for(int dy = -2 ; dy <= 2; dy++)
+            {
+                const int ty = y + dy * step;
+                if(ty < 0 || ty >= height)
+                {
+                    continue;
+                }
+
+                for(int dx = -2 ; dx <= 2; dx++)
+                {
+                    const int tx = x + dx * step;
+                    if(tx < 0 || tx >= width)
+                    {
+                        continue;
+                    }
+
+                    const float tapDepth = depth[ty * width + tx];
+                    if(centerHit != (tapDepth < FLT_MAX))
+                    {
+                        continue;
+                    }
+
+                    const float * color = input + 4 * (static_cast<size_t>(height - 1 - ty) * width + tx);
+                    float distance2 = 0.0f;
+                    for(int c = 0 ; c < 3; c++)
+                    {
+                        float diff = color[c] - center[c];
+                        distance2 += diff * diff;
+                    }
+
+                    float weight = ATROUS_WEIGHTS[std::abs(dx)] * ATROUS_WEIGHTS[std::abs(dy)];
+                    weight *= std::exp(-distance2 * pass.invColorVariance);
+                    if(centerHit)
+                    {
+                        const float taps = static_cast<float>(std::max(std::max(std::abs(dx), std::abs(dy)), 1));
+                        weight *= std::exp(-std::fabs(centerDepth - tapDepth) / (centerDepth * taps) * pass.invDepthScale);
+                        weight *= std::pow(std::max(glm::dot(centerNormal, normals[ty * width + tx]), 0.0f), normalPower);
+                    }
+
+                    for(int c = 0 ; c < 3; c++)
+                    {
+                        sum[c] += color[c] * weight;
+                    }
+                    sum[3] += weight;
+                }
+            }
+
+            float * result = output + 4 * (static_cast<size_t>(height - 1 - y) * width + x);
+            for(int c = 0 ; c < 3; c++)
+            {
+                result[c] = sum[c] / sum[3];
+            }
+            result[3] = center[3];
+        }
+    }
+}
+
+#if defined(__GNUC__)
+
+// One SSE or NEON register of floats, GCC and Clang apply arithmetic and comparisons
+// per lane. Comparisons give an IntLanes mask with every bit of a lane set or clear.
+typedef float FloatLanes __attribute__((vector_size(16)));
+typedef int32_t IntLanes __attribute__((vector_size(16)));
+
+// Pixels of a row filtered side by side by denoiseRowsVectorized
+static const int DENOISE_LANES = sizeof(FloatLanes) / sizeof(float);
+static_assert(DENOISE_LANES == 4, "The tap loads fill four lanes");
+
+static const float LOG2E = 1.44269504f;
+
+static inline FloatLanes splat(float value)
+{
+    FloatLanes lanes = {};
+    return lanes + value;
+}
+
+static inline FloatLanes select(IntLanes mask, FloatLanes a, FloatLanes b)
+{
+    return (FloatLanes)((mask & (IntLanes)a) | (~mask & (IntLanes)b));
+}
+
+static inline FloatLanes minLanes(FloatLanes a, FloatLanes b)
+{
+    return select(a < b, a, b);
+}
+
+static inline FloatLanes maxLanes(FloatLanes a, FloatLanes b)
+{
+    return select(a > b, a, b);
+}
+
+// Polynomial 2^x, relative error below 1e-6. Flushes to 0 below 2^-126 like std::exp
+// does, clamped weights would make the products slow denormals.
+static inline FloatLanes exp2Lanes(FloatLanes x)
+{
+    const IntLanes underflow = x < -126.0f;
+    x = maxLanes(minLanes(x, splat(126.0f)), splat(-126.0f));
+
+    // 2^x = 2^i * 2^f with i the nearest integer, the offset keeps the truncation a rounding
+    IntLanes i = __builtin_convertvector(x + 127.5f, IntLanes);
+    FloatLanes f = x - __builtin_convertvector(i - 127, FloatLanes);
+    FloatLanes p = 1.0f + f * (0.693147181f + f * (0.240226507f + f * (0.0555041087f +
+                   f * (0.00961812911f + f * (0.00133335581f + f * 0.000154035304f)))));
+    return select(underflow, splat(0.0f), (FloatLanes)(i << 23) * p);
+}
+
+// Polynomial log2 of positive normal floats, absolute error below 1e-7
+static inline FloatLanes log2Lanes(FloatLanes x)
+{
+    // x = m * 2^e with m in [sqrt(1/2), sqrt(2))
+    IntLanes bits = (IntLanes)x;
+    IntLanes e = ((bits >> 23) & 0xff) - 127;
+    FloatLanes m = (FloatLanes)((bits & 0x007fffff) | 0x3f800000);
+    IntLanes high = m > 1.41421356f;
+    m = select(high, m * 0.5f, m);
+    e -= high;
+
+    // log2(m) = 2 / ln(2) * atanh(u)
+    FloatLanes u = (m - 1.0f) / (m + 1.0f);
+    FloatLanes u2 = u * u;
+    return __builtin_convertvector(e, FloatLanes) + u * (2.88539008f + u2 * (0.961796694f + u2 * (0.577078016f + u2 * 0.412198583f)));
+}
+
+// Same as denoiseRows for DENOISE_LANES pixels at a time. Taps outside the frame or
+// across the hit / background edge get a zero weight instead of a branch, and both
+// exp and pow become one exp2Lanes of the summed exponents.
+static void denoiseRowsVectorized(const AtrousPass & pass, float normalPower, const float * input, float * output,
+                                  const float * depth, const glm::vec3 * normals, int width, int height, int rowBegin, int rowEnd)
+{
+    const int step = pass.stepWidth;
+    const float colorScale = -pass.invColorVariance * LOG2E;
+    const float depthScale = -pass.invDepthScale * LOG2E;
+
+    for(int y = rowBegin ; y < rowEnd; y++)
+    {
+        for(int x0 = 0 ; x0 < width; x0 += DENOISE_LANES)
+        {
+            // Lanes past the end of the row repeat its last pixel and are not stored
+            FloatLanes centerR, centerG, centerB, centerDepth, centerNX, centerNY, centerNZ;
+            for(int l = 0 ; l < DENOISE_LANES; l++)
+            {
+                const int x = std::min(x0 + l, width - 1);
+                const float * center = input + 4 * (static_cast<size_t>(height - 1 - y) * width + x);
+                centerR[l] = center[0];
+                centerG[l] = center[1];
+                centerB[l] = center[2];
+                centerDepth[l] = depth[y * width + x];
+                centerNX[l] = normals[y * width + x].x;
+                centerNY[l] = normals[y * width + x].y;
+                centerNZ[l] = normals[y * width + x].z;
+            }
+            const IntLanes centerHit = centerDepth < FLT_MAX;
+
+            FloatLanes sumR = {}, sumG = {}, sumB = {}, sumWeight = {};
+            for(int dy = -2 ; dy <= 2; dy++)
+            {
+                const int ty = y + dy * step;
+                if(ty < 0 || ty >= height)
+                {
+                    continue;
+                }
+                const float * colorRow = input + 4 * static_cast<size_t>(height - 1 - ty) * width;
+                const float * depthRow = depth + ty * width;
+                const glm::vec3 * normalRow = normals + ty * width;
+
+                for(int dx = -2 ; dx <= 2; dx++)
+                {
+                    const int offset = dx * step;
+                    if(x0 + offset + DENOISE_LANES <= 0 || x0 + offset >= width)
+                    {
+                        continue;
+                    }
+
+                    // Taps are clamped into the row, inside masks the lanes that were moved
+                    int tx[DENOISE_LANES];
+                    IntLanes inside;
+                    for(int l = 0 ; l < DENOISE_LANES; l++)
+                    {
+                        const int unclamped = x0 + l + offset;
+                        tx[l] = std::min(std::max(unclamped, 0), width - 1);
+                        inside[l] = unclamped == tx[l] ? -1 : 0;
+                    }
+
+                    const float * c0 = colorRow + 4 * tx[0];
+                    const float * c1 = colorRow + 4 * tx[1];
+                    const float * c2 = colorRow + 4 * tx[2];
+                    const float * c3 = colorRow + 4 * tx[3];
+                    const FloatLanes tapR = {c0[0], c1[0], c2[0], c3[0]};
+                    const FloatLanes tapG = {c0[1], c1[1], c2[1], c3[1]};
+                    const FloatLanes tapB = {c0[2], c1[2], c2[2], c3[2]};
+                    const FloatLanes tapDepth = {depthRow[tx[0]], depthRow[tx[1]], depthRow[tx[2]], depthRow[tx[3]]};
+                    const FloatLanes tapNX = {normalRow[tx[0]].x, normalRow[tx[1]].x, normalRow[tx[2]].x, normalRow[tx[3]].x};
+                    const FloatLanes tapNY = {normalRow[tx[0]].y, normalRow[tx[1]].y, normalRow[tx[2]].y, normalRow[tx[3]].y};
+                    const FloatLanes tapNZ = {normalRow[tx[0]].z, normalRow[tx[1]].z, normalRow[tx[2]].z, normalRow[tx[3]].z};
+
+                    const FloatLanes diffR = tapR - centerR;
+                    const FloatLanes diffG = tapG - centerG;
+                    const FloatLanes diffB = tapB - centerB;
+                    FloatLanes exponent = (diffR * diffR + diffG * diffG + diffB * diffB) * colorScale;
+
+                    const float taps = static_cast<float>(std::max(std::max(std::abs(dx), std::abs(dy)), 1));
+                    const FloatLanes cosine = centerNX * tapNX + centerNY * tapNY + centerNZ * tapNZ;
+                    const FloatLanes depthDiff = centerDepth - tapDepth;
+                    const FloatLanes depthTerm = maxLanes(depthDiff, -depthDiff) / centerDepth * (depthScale / taps);
+                    const FloatLanes normalTerm = normalPower * log2Lanes(maxLanes(cosine, splat(FLT_MIN)));
+                    exponent += select(centerHit, depthTerm + normalTerm, splat(0.0f));
+
+                    const IntLanes used = inside & (centerHit == (tapDepth < FLT_MAX)) & (~centerHit | (cosine > 0.0f));
+                    const float spatialWeight = ATROUS_WEIGHTS[std::abs(dx)] * ATROUS_WEIGHTS[std::abs(dy)];
+                    const FloatLanes weight = select(used, spatialWeight * exp2Lanes(exponent), splat(0.0f));
+                    sumR += tapR * weight;
+                    sumG += tapG * weight;
+                    sumB += tapB * weight;
+                    sumWeight += weight;
+                }
+            }
+
+            sumR /= sumWeight;
+            sumG /= sumWeight;
+            sumB /= sumWeight;
+            for(int l = 0 ; l < DENOISE_LANES && x0 + l < width; l++)
+            {
+                const size_t index = 4 * (static_cast<size_t>(height - 1 - y) * width + x0 + l);
+                output[index + 0] = sumR[l];
+                output[index + 1] = sumG[l];
+                output[index + 2] = sumB[l];
+                output[index + 3] = input[index + 3];
+            }
+        }
+    }
+}
+
+#endif
+
+void denoiseHost(const DenoiseParams & params, float * rgba, const float * depth, const uint32_t * normals,
+                 int width, int height, int numThreads, bool vectorized)
+{
+    if(params.iterations <= 0 || width <= 0 || height <= 0)
+    {
+        return;
+    }
+    if(numThreads <= 0)
+    {
+        numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    numThreads = std::min(numThreads, height);
+
+    size_t numPixels = static_cast<size_t>(width) * height;
+
+    // Decoded once instead of once per tap
+    std::vector<glm::vec3> decodedNormals(numPixels);
+    for(size_t i = 0 ; i < numPixels; i++)
+    {
+        decodedNormals[i] = decodeGBufferNormal(normals[i]);
+    }
+
+#if defined(__GNUC__)
+    auto filterRows = vectorized ? denoiseRowsVectorized : denoiseRows;
+#else
+    // No vector extensions, the scalar loop is all there is
+    static_cast<void>(vectorized);
+    auto filterRows = denoiseRows;
+#endif
+
+    std::vector<float> temp(4 * numPixels);
+    for(int i = 0 ; i < params.iterations; i++)
+    {
+        AtrousPass pass = getAtrousPass(params, i);
+
+        // Even passes read the frame, the result ends up back in it
+        const float * input = i % 2 == 0 ? rgba : temp.data();
+        float * output = i % 2 == 0 ? temp.data() : rgba;
+
+        // Every pass reads the whole previous one, threads join in between
+        std::vector<std::thread> workers;
+        int rowsPerThread = (height + numThreads - 1) / numThreads;
+        for(int t = 1 ; t < numThreads; t++)
+        {
+            int rowBegin = t * rowsPerThread;
+            int rowEnd = std::min(height, rowBegin + rowsPerThread);
+            workers.push_back(std::thread([=, &params, &decodedNormals]
+            {
+                filterRows(pass, params.normalPower, input, output, depth, decodedNormals.data(), width, height, rowBegin, rowEnd);
+            }));
+        }
+        filterRows(pass, params.normalPower, input, output, depth, decodedNormals.data(), width, height, 0, std::min(height, rowsPerThread));
+
+        for(auto & worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    if(params.iterations % 2 == 1)
+    {
+        std::copy(temp.begin(), temp.end(), rgba);
+    }
+}
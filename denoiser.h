@@ -0,0 +1,72 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+#include <colorformat.h>
+
+#include <cstdint>
+#include <memory>
+
+struct DenoiseParams
+{
+    // Passes of the a-trous filter, pass i reads 5x5 taps 2^i pixels apart
+    int iterations;
+
+    // Color difference that weighs e^-1 in the first pass, halved every pass
+    float sigmaColor;
+
+    // Depth difference relative to the center depth per pixel of tap distance that weighs e^-1
+    float sigmaDepth;
+
+    // Exponent of the cosine between the normals
+    float normalPower;
+
+    DenoiseParams() : iterations(3), sigmaColor(0.3f), sigmaDepth(0.02f), normalPower(64.0f)
+    {
+
+    }
+};
+
+// Edge avoiding a-trous denoiser guided by the depth and normal G-buffer
+// channels. The kernels live in denoise.cl, which must be part of the program
+// built on the context after raytracing.cl.
+class Denoiser
+{
+public:
+    Denoiser(std::shared_ptr<CLContextWrapper> context);
+
+    // Call after every program build
+    bool prepareKernels();
+
+    // Float4 temporaries for frames of up to numPixels
+    bool reserve(size_t numPixels);
+
+    // Filters linear colors in the layout of the tracing kernels into getOutput(),
+    // colors are left as they are. Format is FLOAT4 (e.g. the accumulated average)
+    // or the color format of the program. Range is the padded 2D frame range.
+    bool denoise(BufferId colors, ColorFormat format, BufferId depth, BufferId normals, int width, int height,
+                 const NDRange & range, const DenoiseParams & params);
+
+    // Float4 result of the last denoise, in the layout of the tracing kernels.
+    // Nullptr when it ran no pass.
+    BufferId getOutput() const;
+
+private:
+
+    std::shared_ptr<CLContextWrapper> _clContext;
+
+    BoundKernel _loadKernel;
+    BoundKernel _atrousKernel;
+
+    size_t _capacity;
+    BufferId _tempBufferIds[2];
+    BufferId _outputBufferId;
+};
+
+// Same filter on the host over float4 pixels in the kernel layout (y axis flipped),
+// with depth and normals as downloaded from the G-buffer. Rows are split across
+// numThreads threads, 0 uses every hardware thread. Vectorized threads filter 4
+// pixels of a row at once in SSE or NEON registers with a polynomial exp2 and log2
+// (GCC and Clang only), otherwise one pixel at a time with std::exp and std::pow,
+// the reference the benchmark compares against.
+void denoiseHost(const DenoiseParams & params, float * rgba, const float * depth, const uint32_t * normals,
+                 int width, int height, int numThreads = 0, bool vectorized = true);
@@ -0,0 +1,260 @@
+#include <framemetrics.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace util
+{
+    static const uint64_t SUB_BUCKET_BITS = 7;
+    static const uint64_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const uint64_t SUB_BUCKET_HALF_COUNT = SUB_BUCKET_COUNT / 2;
+
+    static inline uint64_t toMicroSec(double milliSec)
+    {
+        if(!(milliSec > 0.0))
+        {
+            return 0;
+        }
+        return static_cast<uint64_t>(std::llround(milliSec * 1e3));
+    }
+
+    static inline unsigned int log2Floor(uint64_t value)
+    {
+        unsigned int result = 0;
+        while(value >>= 1)
+        {
+            result++;
+        }
+        return result;
+    }
+
+    //----------------------------------------------------------------------------------------------------------------------------------------------------------
+    // LatencyHistogram:public
+    //----------------------------------------------------------------------------------------------------------------------------------------------------------
+
+    LatencyHistogram::LatencyHistogram(double highestTrackableMilliSec)
+    {
+        _highestTrackableValue = std::max<uint64_t>(toMicroSec(highestTrackableMilliSec), SUB_BUCKET_COUNT);
+        _buckets.resize(_indexForValue(_highestTrackableValue) + 1, 0);
+        reset();
+    }
+
+    void LatencyHistogram::record(double milliSec)
+    {
+        uint64_t value = std::min(toMicroSec(milliSec), _highestTrackableValue);
+
+        _buckets[_indexForValue(value)]++;
+        _count++;
+        _min = std::min(_min, value);
+        _max = std::max(_max, value);
+        _sum += static_cast<double>(value);
+    }
+
+    void LatencyHistogram::reset()
+    {
+        std::fill(_buckets.begin(), _buckets.end(), 0);
+        _count = 0;
+        _min = std::numeric_limits<uint64_t>::max();
+        _max = 0;
+        _sum = 0.0;
+    }
+
+    uint64_t LatencyHistogram::getCount() const
+    {
+        return _count;
+    }
+
+    double LatencyHistogram::getMin() const
+    {
+        return _count > 0 ? static_cast<double>(_min) * 1e-3 : 0.0;
+    }
+
+    double LatencyHistogram::getMax() const
+    {
+        return static_cast<double>(_max) * 1e-3;
+    }
+
+    double LatencyHistogram::getMean() const
+    {
+        return _count > 0 ? (_sum / static_cast<double>(_count)) * 1e-3 : 0.0;
+    }
+
+    double LatencyHistogram::getPercentile(double percentile) const
+    {
+        if(_count == 0)
+        {
+            return 0.0;
+        }
+
+        percentile = std::min(std::max(percentile, 0.0), 100.0);
+        uint64_t target = static_cast<uint64_t>(std::ceil((percentile / 100.0) * static_cast<double>(_count)));
+        target = std::max<uint64_t>(target, 1);
+
+        uint64_t accumulated = 0;
+        for(size_t i = 0 ; i < _buckets.size(); i++)
+        {
+            accumulated += _buckets[i];
+            if(accumulated >= target)
+            {
+                // Never report more than what was actually recorded
+                return static_cast<double>(std::min(_highestValueForIndex(i), _max)) * 1e-3;
+            }
+        }
+        return getMax();
+    }
+
+    //----------------------------------------------------------------------------------------------------------------------------------------------------------
+    // LatencyHistogram:private
+    //----------------------------------------------------------------------------------------------------------------------------------------------------------
+
+    size_t LatencyHistogram::_indexForValue(uint64_t value) const
+    {
+        if(value < SUB_BUCKET_COUNT)
+        {
+            return static_cast<size_t>(value);
+        }
+        uint64_t shift = log2Floor(value) - (SUB_BUCKET_BITS - 1);
+        uint64_t subBucket = (value >> shift) - SUB_BUCKET_HALF_COUNT;
+        return static_cast<size_t>(SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF_COUNT + subBucket);
+    }
+
+    uint64_t LatencyHistogram::_highestValueForIndex(size_t index) const
+    {
+        if(index < SUB_BUCKET_COUNT)
+        {
+            return index;
+        }
+        uint64_t shift = (index - SUB_BUCKET_COUNT) / SUB_BUCKET_HALF_COUNT + 1;
+        uint64_t subBucket = (index - SUB_BUCKET_COUNT) % SUB_BUCKET_HALF_COUNT + SUB_BUCKET_HALF_COUNT;
+        return ((subBucket + 1) << shift) - 1;
+    }
+
+    //----------------------------------------------------------------------------------------------------------------------------------------------------------
+    // FrameMetrics:public
+    //----------------------------------------------------------------------------------------------------------------------------------------------------------
+
+    static const size_t STAGE_COUNT = static_cast<size_t>(FrameStage::COUNT);
+
+    FrameMetrics::FrameMetrics() : _histograms(STAGE_COUNT), _current(STAGE_COUNT, -1.0), _last(STAGE_COUNT, 0.0), _frameCount(0)
+    {
+
+    }
+
+    void FrameMetrics::record(FrameStage stage, double milliSec)
+    {
+        size_t idx = static_cast<size_t>(stage);
+        // A stage may be entered more than once per frame
+        _current[idx] = std::max(_current[idx], 0.0) + milliSec;
+    }
+
+    void FrameMetrics::endFrame()
+    {
+        for(size_t i = 0 ; i < STAGE_COUNT; i++)
+        {
+            if(_current[i] >= 0.0)
+            {
+                _histograms[i].record(_current[i]);
+                _last[i] = _current[i];
+            }
+            _current[i] = -1.0;
+        }
+        _frameCount++;
+    }
+
+    void FrameMetrics::reset()
+    {
+        for(auto & histogram : _histograms)
+        {
+            histogram.reset();
+        }
+        std::fill(_current.begin(), _current.end(), -1.0);
+        std::fill(_last.begin(), _last.end(), 0.0);
+        _frameCount = 0;
+    }
+
+    uint64_t FrameMetrics::getFrameCount() const
+    {
+        return _frameCount;
+    }
+
+    double FrameMetrics::getLast(FrameStage stage) const
+    {
+        return _last[static_cast<size_t>(stage)];
+    }
+
+    const LatencyHistogram & FrameMetrics::getHistogram(FrameStage stage) const
+    {
+        return _histograms[static_cast<size_t>(stage)];
+    }
+
+    std::string FrameMetrics::getSummary() const
+    {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2);
+        ss << "Frames: " << _frameCount << "   (ms)  p50 / p95 / p99 / max" << std::endl;
+
+        for(size_t i = 0 ; i < STAGE_COUNT; i++)
+        {
+            const LatencyHistogram & h = _histograms[i];
+            if(h.getCount() == 0)
+            {
+                continue;
+            }
+            ss << getStageName(static_cast<FrameStage>(i)) << ": "
+               << h.getPercentile(50.0) << " / "
+               << h.getPercentile(95.0) << " / "
+               << h.getPercentile(99.0) << " / "
+               << h.getMax() << std::endl;
+        }
+        return ss.str();
+    }
+
+    bool FrameMetrics::exportCSV(const std::string & path) const
+    {
+        std::ofstream file(path);
+        if(!file.is_open())
+        {
+            return false;
+        }
+
+        file << std::fixed << std::setprecision(3);
+        file << "stage,count,min_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms" << std::endl;
+
+        for(size_t i = 0 ; i < STAGE_COUNT; i++)
+        {
+            const LatencyHistogram & h = _histograms[i];
+            file << getStageName(static_cast<FrameStage>(i)) << ","
+                 << h.getCount() << ","
+                 << h.getMin() << ","
+                 << h.getMean() << ","
+                 << h.getPercentile(50.0) << ","
+                 << h.getPercentile(95.0) << ","
+                 << h.getPercentile(99.0) << ","
+                 << h.getMax() << std::endl;
+        }
+        return file.good();
+    }
+
+    const char * FrameMetrics::getStageName(FrameStage stage)
+    {
+        switch (stage)
+        {
+        case FrameStage::CPU_SUBMIT:
+            return "cpu_submit";
+        case FrameStage::DEVICE_TRACE:
+            return "device_trace";
+        case FrameStage::INTEROP_ACQUIRE:
+            return "interop_acquire";
+        case FrameStage::PRESENT:
+            return "present";
+        case FrameStage::TOTAL:
+            return "total";
+        default:
+            return "unknown";
+        }
+    }
+}
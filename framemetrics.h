@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace util
+{
+    // Log-linear (HDR style) histogram of latencies recorded in microseconds.
+    // Values below SUB_BUCKET_COUNT are exact, above that each power of two
+    // range is split in SUB_BUCKET_COUNT/2 buckets. Percentiles report the highest
+    // value of their bucket, at most 1/64 (about 1.6%) above the recorded one.
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram(double highestTrackableMilliSec = 60000.0);
+
+        void record(double milliSec);
+
+        void reset();
+
+        uint64_t getCount() const;
+
+        double getMin() const;
+
+        double getMax() const;
+
+        double getMean() const;
+
+        double getPercentile(double percentile) const;
+
+    private:
+        size_t _indexForValue(uint64_t value) const;
+
+        uint64_t _highestValueForIndex(size_t index) const;
+
+    private:
+        std::vector<uint64_t> _buckets;
+        uint64_t _highestTrackableValue;
+        uint64_t _count;
+        uint64_t _min;
+        uint64_t _max;
+        double   _sum;
+    };
+
+    enum class FrameStage
+    {
+        CPU_SUBMIT,
+        DEVICE_TRACE,
+        INTEROP_ACQUIRE,
+        PRESENT,
+        TOTAL,
+        COUNT
+    };
+
+    class FrameMetrics
+    {
+    public:
+        FrameMetrics();
+
+        void record(FrameStage stage, double milliSec);
+
+        void endFrame();
+
+        void reset();
+
+        uint64_t getFrameCount() const;
+
+        double getLast(FrameStage stage) const;
+
+        const LatencyHistogram & getHistogram(FrameStage stage) const;
+
+        std::string getSummary() const;
+
+        bool exportCSV(const std::string & path) const;
+
+        static const char * getStageName(FrameStage stage);
+
+    private:
+        std::vector<LatencyHistogram> _histograms;
+        std::vector<double> _current;
+        std::vector<double> _last;
+        uint64_t _frameCount;
+    };
+}
@@ -0,0 +1,54 @@
+#include "gbuffer.h"
+
+#include <cmath>
+
+size_t getGBufferChannelBytes(GBufferChannel channel)
+{
+    switch (channel)
+    {
+    case GBufferChannel::DEPTH:
+        return sizeof(float);
+    case GBufferChannel::NORMAL:
+        return sizeof(uint32_t);
+    case GBufferChannel::OBJECT_ID:
+        return sizeof(int32_t);
+    case GBufferChannel::MATERIAL:
+        return 4 * sizeof(uint16_t);
+    default:
+        return 0;
+    }
+}
+
+const char * getGBufferChannelName(GBufferChannel channel)
+{
+    switch (channel)
+    {
+    case GBufferChannel::DEPTH:
+        return "depth";
+    case GBufferChannel::NORMAL:
+        return "normal";
+    case GBufferChannel::OBJECT_ID:
+        return "object id";
+    case GBufferChannel::MATERIAL:
+        return "material";
+    default:
+        return "unknown";
+    }
+}
+
+glm::vec3 decodeGBufferNormal(uint32_t encoded)
+{
+    float x = static_cast<int16_t>(encoded & 0xffff) / 32767.0f;
+    float y = static_cast<int16_t>(encoded >> 16) / 32767.0f;
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+
+    // Lower hemisphere was folded over the diagonals
+    if(z < 0.0f)
+    {
+        float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    return glm::normalize(glm::vec3(x, y, z));
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Attributes of the primary hit the tracing kernels store per pixel when the
+// G-buffer is enabled. Pixels are indexed y * width + x, rows top to bottom.
+enum class GBufferChannel
+{
+    DEPTH,     // float distance from the eye, FLT_MAX for no hit
+    NORMAL,    // uint, octahedral normal as two snorm16
+    OBJECT_ID, // int, spheres first, then planes, then instances (getSceneInstances), GBUFFER_NO_OBJECT for no hit
+    MATERIAL,  // half4 albedo, w is the material value of the scene (> 0 reflective, < 0 refractive)
+    COUNT
+};
+
+static const int GBUFFER_NO_OBJECT = -1;
+
+size_t getGBufferChannelBytes(GBufferChannel channel);
+
+const char * getGBufferChannelName(GBufferChannel channel);
+
+// Inverse of encodeNormal in raytracing.cl, pixels without a hit decode to +z
+// and are told apart by their object id
+glm::vec3 decodeGBufferNormal(uint32_t encoded);
@@ -7,9 +7,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <QPainter>
+
 #include <iostream>
+#include <sstream>
+#include <vector>
 
-GLView::GLView(int textureWidth, int textureHeight, std::function<void(GLView *)> initCallback) : QOpenGLWidget(), _textureWidth(textureWidth), _textureHeight(textureHeight)
+GLView::GLView(int textureWidth, int textureHeight, std::function<void(GLView *)> initCallback) : QOpenGLWidget(), _textureWidth(textureWidth), _textureHeight(textureHeight), _overlayEnabled(false)
 {
 #if __APPLE__
     QSurfaceFormat glFormat;
@@ -52,6 +56,21 @@ GLuint GLView::getBaseTexture() const
     return _glTexture;
 }
 
+void GLView::setOverlayEnabled(bool enabled)
+{
+    _overlayEnabled = enabled;
+}
+
+bool GLView::isOverlayEnabled() const
+{
+    return _overlayEnabled;
+}
+
+void GLView::setOverlayText(const std::string & text)
+{
+    _overlayText = text;
+}
+
 void GLView::paintGL()
 {
     _checkErrors("before draw");
@@ -83,6 +102,11 @@ void GLView::paintGL()
 
     glDisable(GL_TEXTURE_2D);
     _checkErrors("after draw");
+
+    if(_overlayEnabled && !_overlayText.empty())
+    {
+        _drawOverlay();
+    }
 }
 
 void GLView::initializeGL()
@@ -150,6 +174,31 @@ void GLView::initializeGL()
     _checkErrors("After initializeGL");
 }
 
+void GLView::_drawOverlay()
+{
+    static const int lineHeight = 14;
+    static const int margin = 6;
+
+    std::vector<std::string> lines;
+    std::istringstream ss(_overlayText);
+    for(std::string line; std::getline(ss, line);)
+    {
+        lines.push_back(line);
+    }
+
+    // QPainter restores its own state, the legacy pipeline above is already done
+    QPainter painter(this);
+    painter.fillRect(QRect(0, 0, width(), static_cast<int>(lines.size()) * lineHeight + margin * 2), QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.setFont(QFont("Courier", 9));
+
+    for(size_t i = 0 ; i < lines.size(); i++)
+    {
+        painter.drawText(margin, margin + static_cast<int>(i + 1) * lineHeight - 3, QString::fromStdString(lines[i]));
+    }
+    painter.end();
+}
+
 void GLView::_checkErrors(const std::string & snippet = "")
 {
     for(GLenum currError = glGetError(); currError != GL_NO_ERROR; currError = glGetError())
@@ -8,6 +8,7 @@
 #include <QGLWidget>
 
 #include <functional>
+#include <string>
 
 #if __APPLE__
 class GLView : public QOpenGLWidget , public QOpenGLFunctions
@@ -26,6 +27,12 @@ public:
 
     GLuint getBaseTexture() const;
 
+    void setOverlayEnabled(bool enabled);
+
+    bool isOverlayEnabled() const;
+
+    void setOverlayText(const std::string & text);
+
 protected:
 
     void paintGL();
@@ -35,6 +42,8 @@ protected:
 private:
     void _checkErrors(const std::string & snippet);
 
+    void _drawOverlay();
+
 private:
 
     GLuint _glTexture;
@@ -47,5 +56,9 @@ private:
 
     std::function<void(GLView*)> _paintCallback;
 
+    bool _overlayEnabled;
+
+    std::string _overlayText;
+
 };
 
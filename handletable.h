@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// 32 bit handle, slot index in the low bits and the slot generation in the high bits.
+// The tag keeps handles of different tables apart. The zero value is the null handle.
+template <typename Tag>
+struct Handle
+{
+    static const unsigned int INDEX_BITS = 20;
+    static const unsigned int INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static const unsigned int GENERATION_MASK = (1u << (32 - INDEX_BITS)) - 1;
+
+    unsigned int value;
+
+    Handle() : value(0)
+    {
+
+    }
+
+    Handle(std::nullptr_t) : value(0)
+    {
+
+    }
+
+    Handle(unsigned int index, unsigned int generation) : value((generation << INDEX_BITS) | (index & INDEX_MASK))
+    {
+
+    }
+
+    unsigned int getIndex() const
+    {
+        return value & INDEX_MASK;
+    }
+
+    unsigned int getGeneration() const
+    {
+        return value >> INDEX_BITS;
+    }
+
+    explicit operator bool() const
+    {
+        return value != 0;
+    }
+
+    friend bool operator==(Handle a, Handle b)
+    {
+        return a.value == b.value;
+    }
+
+    friend bool operator!=(Handle a, Handle b)
+    {
+        return a.value != b.value;
+    }
+};
+
+namespace std
+{
+    template <typename Tag>
+    struct hash<Handle<Tag>>
+    {
+        size_t operator()(const Handle<Tag> & handle) const
+        {
+            return hash<unsigned int>()(handle.value);
+        }
+    };
+}
+
+// Dense slots addressed by Handle. Removing bumps the slot generation, so a
+// stale handle fails lookup in O(1) even after its slot was reused.
+template <typename T, typename Tag>
+class HandleTable
+{
+public:
+    typedef Handle<Tag> HandleType;
+
+    HandleTable() : _liveCount(0)
+    {
+
+    }
+
+    // Null handle when every index is taken
+    HandleType insert(const T & item)
+    {
+        unsigned int index = 0;
+        if(!_freeIndices.empty())
+        {
+            index = _freeIndices.back();
+            _freeIndices.pop_back();
+        }
+        else if(_slots.size() <= HandleType::INDEX_MASK)
+        {
+            index = static_cast<unsigned int>(_slots.size());
+            _slots.push_back(Slot());
+        }
+        else
+        {
+            return HandleType();
+        }
+
+        Slot & slot = _slots[index];
+        slot.item = item;
+        slot.alive = true;
+        _liveCount++;
+        return HandleType(index, slot.generation);
+    }
+
+    bool remove(HandleType handle)
+    {
+        if(!isValid(handle))
+        {
+            return false;
+        }
+
+        Slot & slot = _slots[handle.getIndex()];
+        slot.item = T();
+        slot.alive = false;
+
+        // Generation 0 is skipped so no live handle is ever null
+        slot.generation = (slot.generation + 1) & HandleType::GENERATION_MASK;
+        if(slot.generation == 0)
+        {
+            slot.generation = 1;
+        }
+
+        _freeIndices.push_back(handle.getIndex());
+        _liveCount--;
+        return true;
+    }
+
+    // nullptr for null and stale handles
+    T * get(HandleType handle)
+    {
+        return isValid(handle) ? &_slots[handle.getIndex()].item : nullptr;
+    }
+
+    const T * get(HandleType handle) const
+    {
+        return isValid(handle) ? &_slots[handle.getIndex()].item : nullptr;
+    }
+
+    bool isValid(HandleType handle) const
+    {
+        unsigned int index = handle.getIndex();
+        return handle && index < _slots.size() && _slots[index].alive && _slots[index].generation == handle.getGeneration();
+    }
+
+    size_t size() const
+    {
+        return _liveCount;
+    }
+
+    // Visits every live item
+    void forEach(std::function<void(T &)> visit)
+    {
+        for(Slot & slot : _slots)
+        {
+            if(slot.alive)
+            {
+                visit(slot.item);
+            }
+        }
+    }
+
+private:
+
+    struct Slot
+    {
+        T item;
+        unsigned int generation;
+        bool alive;
+
+        Slot() : item(), generation(1), alive(false)
+        {
+
+        }
+    };
+
+    std::vector<Slot> _slots;
+    std::vector<unsigned int> _freeIndices;
+    size_t _liveCount;
+};
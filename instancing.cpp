@@ -0,0 +1,179 @@
+#include "instancing.h"
+
+#include <timer.h>
+
+#include <algorithm>
+#include <iostream>
+
+// Adds one BVH's nodes with their indices moved past the nodes and primitives already packed
+static void appendNodes(const BVH & bvh, uint32_t primitiveOffset, BottomLevels & levels)
+{
+    uint32_t nodeOffset = static_cast<uint32_t>(levels.nodes.size());
+    for(BVHNode node : bvh.nodes)
+    {
+        node.leftOrFirst += node.count > 0 ? primitiveOffset : nodeOffset;
+        levels.nodes.push_back(node);
+    }
+}
+
+static void appendInfo(const BVH & bvh, BottomLevelType type, const glm::vec4 & color, uint32_t rootNode,
+                       const BVHBounds & bounds, BottomLevels & levels)
+{
+    BottomLevelInfo info;
+    info.color = color;
+    info.rootNode = rootNode;
+    info.type = static_cast<uint32_t>(type);
+    info.numPrimitives = static_cast<uint32_t>(bvh.primitiveOrder.size());
+    info.dummy = 0;
+    levels.infos.push_back(info);
+    levels.bounds.push_back(bounds);
+    levels.maxDepth = std::max(levels.maxDepth, bvh.depth);
+}
+
+static int addMesh(const dwg::Mesh & mesh, BottomLevels & levels)
+{
+    std::vector<BVHBounds> primitives(mesh.triangles.size());
+    for(size_t i = 0 ; i < mesh.triangles.size(); i++)
+    {
+        const glm::uvec3 & t = mesh.triangles[i];
+        primitives[i].grow(mesh.vertices[t.x]);
+        primitives[i].grow(mesh.vertices[t.y]);
+        primitives[i].grow(mesh.vertices[t.z]);
+    }
+
+    BVH bvh = buildBVH(primitives);
+    if(bvh.nodes.empty())
+    {
+        std::cout << "Skipping a mesh without triangles" << std::endl;
+        return -1;
+    }
+
+    uint32_t rootNode = static_cast<uint32_t>(levels.nodes.size());
+    uint32_t vertexOffset = static_cast<uint32_t>(levels.vertices.size());
+    appendNodes(bvh, static_cast<uint32_t>(levels.triangles.size()), levels);
+    for(uint32_t triangle : bvh.primitiveOrder)
+    {
+        const glm::uvec3 & t = mesh.triangles[triangle];
+        levels.triangles.push_back(glm::uvec3(t.x + vertexOffset, t.y + vertexOffset, t.z + vertexOffset));
+    }
+    levels.vertices.insert(levels.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+
+    const BVHNode & root = bvh.nodes.front();
+    BVHBounds bounds;
+    bounds.boundsMin = root.boundsMin;
+    bounds.boundsMax = root.boundsMax;
+    appendInfo(bvh, BottomLevelType::TRIANGLES, mesh.color, rootNode, bounds, levels);
+    return static_cast<int>(levels.infos.size()) - 1;
+}
+
+static int addSphereGroup(const dwg::SphereGroup & group, BottomLevels & levels)
+{
+    std::vector<BVHBounds> primitives(group.spheres.size());
+    for(size_t i = 0 ; i < group.spheres.size(); i++)
+    {
+        const dwg::Sphere & s = group.spheres[i];
+        primitives[i].grow(s.position - glm::vec3(s.radius));
+        primitives[i].grow(s.position + glm::vec3(s.radius));
+    }
+
+    BVH bvh = buildBVH(primitives, 4);
+    if(bvh.nodes.empty())
+    {
+        std::cout << "Skipping an empty sphere group" << std::endl;
+        return -1;
+    }
+
+    uint32_t rootNode = static_cast<uint32_t>(levels.nodes.size());
+    appendNodes(bvh, static_cast<uint32_t>(levels.spheres.size()), levels);
+    for(uint32_t sphere : bvh.primitiveOrder)
+    {
+        levels.spheres.push_back(group.spheres[sphere]);
+    }
+
+    const BVHNode & root = bvh.nodes.front();
+    BVHBounds bounds;
+    bounds.boundsMin = root.boundsMin;
+    bounds.boundsMax = root.boundsMax;
+    appendInfo(bvh, BottomLevelType::SPHERES, glm::vec4(0.0f), rootNode, bounds, levels);
+    return static_cast<int>(levels.infos.size()) - 1;
+}
+
+BottomLevels buildBottomLevels(const dwg::Scene & scene)
+{
+    util::Timer timer;
+    BottomLevels levels;
+
+    for(const dwg::Mesh & mesh : scene.meshes)
+    {
+        levels.meshLevels.push_back(addMesh(mesh, levels));
+    }
+    for(const dwg::SphereGroup & group : scene.sphereGroups)
+    {
+        levels.groupLevels.push_back(addSphereGroup(group, levels));
+    }
+
+    // A scene of only meshes still passes a sphere array and the other way round
+    if(levels.vertices.empty())
+    {
+        levels.vertices.push_back(glm::vec3(0.0f));
+        levels.triangles.push_back(glm::uvec3(0));
+    }
+    if(levels.spheres.empty())
+    {
+        levels.spheres.push_back(dwg::Sphere());
+    }
+
+    levels.buildMilliSec = timer.elapsedMilliSec();
+    return levels;
+}
+
+// Rows of the world to object transform, glm stores columns
+static void setWorldToObject(const glm::mat4 & transform, InstanceRecord & record)
+{
+    glm::mat4 inverse = glm::inverse(transform);
+    for(int row = 0 ; row < 3; row++)
+    {
+        record.worldToObject[row] = glm::vec4(inverse[0][row], inverse[1][row], inverse[2][row], inverse[3][row]);
+    }
+}
+
+TopLevel buildTopLevel(const std::vector<dwg::Instance> & instances, const BottomLevels & bottomLevels)
+{
+    util::Timer timer;
+    TopLevel topLevel;
+
+    std::vector<InstanceRecord> records;
+    std::vector<BVHBounds> primitives;
+    for(size_t i = 0 ; i < instances.size(); i++)
+    {
+        const dwg::Instance & instance = instances[i];
+        const std::vector<int> & levels = instance.type == dwg::GeometryType::MESH ? bottomLevels.meshLevels
+                                                                                   : bottomLevels.groupLevels;
+        if(instance.geometry < 0 || instance.geometry >= static_cast<int>(levels.size()) ||
+           levels[instance.geometry] < 0)
+        {
+            continue;
+        }
+
+        InstanceRecord record;
+        setWorldToObject(instance.transform, record);
+        record.bottomLevel = static_cast<uint32_t>(levels[instance.geometry]);
+        record.instanceId = static_cast<uint32_t>(i);
+        record.dummy[0] = record.dummy[1] = 0;
+        records.push_back(record);
+
+        primitives.push_back(bottomLevels.bounds[record.bottomLevel].getTransformed(instance.transform));
+    }
+
+    BVH bvh = buildBVH(primitives, 4);
+    topLevel.nodes = bvh.nodes;
+    topLevel.depth = bvh.depth;
+    topLevel.instances.reserve(records.size());
+    for(uint32_t record : bvh.primitiveOrder)
+    {
+        topLevel.instances.push_back(records[record]);
+    }
+
+    topLevel.buildMilliSec = timer.elapsedMilliSec();
+    return topLevel;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <bvh.h>
+#include <scene.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Primitives of a bottom level, as BOTTOM_LEVEL_* in instances.cl
+enum class BottomLevelType : uint32_t
+{
+    TRIANGLES = 0,
+    SPHERES = 1
+};
+
+// Per bottom level record of the kernels, as read by instances.cl
+struct BottomLevelInfo
+{
+    glm::vec4 color; // triangles only, spheres carry their own
+    uint32_t rootNode;
+    uint32_t type;
+    uint32_t numPrimitives;
+    uint32_t dummy; // padding to align memory
+};
+
+// Per instance record of the kernels, as read by instances.cl
+struct InstanceRecord
+{
+    glm::vec4 worldToObject[3]; // rows of the inverse transform
+    uint32_t bottomLevel;
+    uint32_t instanceId; // index in getSceneInstances
+    uint32_t dummy[2]; // padding to align memory
+};
+
+// One BVH per mesh and sphere group of a scene, in object space, in the arrays
+// the kernels read. Node indices and leaf ranges are global, triangles and
+// spheres are stored in leaf order and triangles point at the global vertex
+// array. No array is left empty so each one can always be a kernel argument.
+struct BottomLevels
+{
+    std::vector<BVHNode> nodes;
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::uvec3> triangles;
+    std::vector<dwg::Sphere> spheres;
+    std::vector<BottomLevelInfo> infos;
+
+    std::vector<BVHBounds> bounds; // object space box of every bottom level
+    std::vector<int> meshLevels; // bottom level of every mesh, -1 when it has no triangles
+    std::vector<int> groupLevels; // bottom level of every sphere group, -1 when it is empty
+
+    int maxDepth;
+    double buildMilliSec;
+
+    BottomLevels() : maxDepth(0), buildMilliSec(0.0)
+    {
+
+    }
+
+    size_t getBytes() const
+    {
+        return sizeof(BVHNode) * nodes.size() + sizeof(glm::vec3) * vertices.size() +
+               sizeof(glm::uvec3) * triangles.size() + sizeof(dwg::Sphere) * spheres.size() +
+               sizeof(BottomLevelInfo) * infos.size();
+    }
+};
+
+BottomLevels buildBottomLevels(const dwg::Scene & scene);
+
+// BVH over the world space boxes of the instances. It is cheap enough to
+// rebuild every frame instances move, the bottom levels stay as they are.
+struct TopLevel
+{
+    std::vector<BVHNode> nodes;
+    std::vector<InstanceRecord> instances; // in leaf order
+    int depth;
+    double buildMilliSec;
+
+    TopLevel() : depth(0), buildMilliSec(0.0)
+    {
+
+    }
+
+    size_t getBytes() const
+    {
+        return sizeof(BVHNode) * nodes.size() + sizeof(InstanceRecord) * instances.size();
+    }
+};
+
+// Instances pointing at missing or empty geometry are left out
+TopLevel buildTopLevel(const std::vector<dwg::Instance> & instances, const BottomLevels & bottomLevels);
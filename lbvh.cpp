@@ -0,0 +1,139 @@
+#include "lbvh.h"
+
+#include <algorithm>
+#include <iostream>
+
+// One dimensional groups of the build kernels at most
+static const size_t MAX_LOCAL_SIZE = 256;
+
+// Morton codes interleave 10 bits per axis
+static const int MORTON_BITS = 30;
+
+LinearBVHBuilder::LinearBVHBuilder(std::shared_ptr<CLContextWrapper> context, std::shared_ptr<RadixSorter> sorter) :
+    _clContext(context), _radixSorter(sorter), _localSize(0), _capacity(0), _nodesBufferId(nullptr),
+    _keysBufferId(nullptr), _valuesBufferId(nullptr), _parentsBufferId(nullptr), _flagsBufferId(nullptr)
+{
+
+}
+
+bool LinearBVHBuilder::prepareKernels()
+{
+    _mortonKernel = _clContext->prepareKernel("lbvhMortonKernel");
+    _hierarchyKernel = _clContext->prepareKernel("lbvhHierarchyKernel");
+    _fitBoundsKernel = _clContext->prepareKernel("lbvhFitBoundsKernel");
+
+    _localSize = std::min(MAX_LOCAL_SIZE, _clContext->getDeviceInfo().maxWorkGroupSize);
+    for(const BoundKernel * kernel : {&_mortonKernel, &_hierarchyKernel, &_fitBoundsKernel})
+    {
+        if(!kernel->isValid())
+        {
+            _localSize = 0;
+            return false;
+        }
+        _localSize = std::min(_localSize, kernel->getWorkGroupSize());
+    }
+    return _localSize > 0;
+}
+
+bool LinearBVHBuilder::reserve(size_t maxSpheres)
+{
+    maxSpheres = std::max<size_t>(maxSpheres, 1);
+    if(maxSpheres <= _capacity)
+    {
+        return true;
+    }
+
+    for(BufferId * bufferId : {&_nodesBufferId, &_keysBufferId, &_valuesBufferId, &_parentsBufferId, &_flagsBufferId})
+    {
+        if(*bufferId)
+        {
+            _clContext->releaseBuffer(*bufferId);
+            *bufferId = nullptr;
+        }
+    }
+
+    size_t numNodes = 2 * maxSpheres - 1;
+    _nodesBufferId   = _clContext->createBuffer(sizeof(float) * 8 * numNodes, nullptr, BufferType::READ_AND_WRITE);
+    _keysBufferId    = _clContext->createBuffer(sizeof(unsigned int) * maxSpheres, nullptr, BufferType::READ_AND_WRITE);
+    _valuesBufferId  = _clContext->createBuffer(sizeof(int) * maxSpheres, nullptr, BufferType::READ_AND_WRITE);
+    _parentsBufferId = _clContext->createBuffer(sizeof(int) * numNodes, nullptr, BufferType::READ_AND_WRITE);
+    _flagsBufferId   = _clContext->createBuffer(sizeof(int) * maxSpheres, nullptr, BufferType::READ_AND_WRITE);
+
+    if(!_nodesBufferId || !_keysBufferId || !_valuesBufferId || !_parentsBufferId || !_flagsBufferId)
+    {
+        std::cout << "Failed to create linear BVH buffers" << std::endl;
+        _capacity = 0;
+        return false;
+    }
+
+    _capacity = maxSpheres;
+    return true;
+}
+
+bool LinearBVHBuilder::build(BufferId spheres, int numSpheres, const glm::vec3 & boundsMin, const glm::vec3 & boundsMax)
+{
+    if(_localSize == 0 || !reserve(static_cast<size_t>(std::max(numSpheres, 1))))
+    {
+        return false;
+    }
+    if(numSpheres == 0)
+    {
+        return true;
+    }
+
+    glm::vec3 invExtent = glm::vec3(1.0f) / glm::max(boundsMax - boundsMin, glm::vec3(1e-3f));
+
+    bool ok = _mortonKernel.setArg(0, spheres);
+    ok &= _mortonKernel.setArg(1, _keysBufferId);
+    ok &= _mortonKernel.setArg(2, _valuesBufferId);
+    ok &= _mortonKernel.setArg(3, numSpheres);
+    ok &= _mortonKernel.setArg(4, boundsMin.x);
+    ok &= _mortonKernel.setArg(5, boundsMin.y);
+    ok &= _mortonKernel.setArg(6, boundsMin.z);
+    ok &= _mortonKernel.setArg(7, invExtent.x);
+    ok &= _mortonKernel.setArg(8, invExtent.y);
+    ok &= _mortonKernel.setArg(9, invExtent.z);
+    ok = ok && _clContext->dispatchKernel(_mortonKernel, _getRange(numSpheres));
+
+    ok = ok && _radixSorter->sort(_keysBufferId, _valuesBufferId, static_cast<size_t>(numSpheres), MORTON_BITS);
+
+    // A single sphere is its own root and needs no inner node
+    if(ok && numSpheres > 1)
+    {
+        ok &= _hierarchyKernel.setArg(0, _keysBufferId);
+        ok &= _hierarchyKernel.setArg(1, _nodesBufferId);
+        ok &= _hierarchyKernel.setArg(2, _parentsBufferId);
+        ok &= _hierarchyKernel.setArg(3, _flagsBufferId);
+        ok &= _hierarchyKernel.setArg(4, numSpheres);
+        ok = ok && _clContext->dispatchKernel(_hierarchyKernel, _getRange(numSpheres - 1));
+    }
+
+    ok &= _fitBoundsKernel.setArg(0, spheres);
+    ok &= _fitBoundsKernel.setArg(1, _valuesBufferId);
+    ok &= _fitBoundsKernel.setArg(2, _nodesBufferId);
+    ok &= _fitBoundsKernel.setArg(3, _parentsBufferId);
+    ok &= _fitBoundsKernel.setArg(4, _flagsBufferId);
+    ok &= _fitBoundsKernel.setArg(5, numSpheres);
+    ok = ok && _clContext->dispatchKernel(_fitBoundsKernel, _getRange(numSpheres));
+
+    if(!ok)
+    {
+        std::cout << "Linear BVH build failed" << std::endl;
+    }
+    return ok;
+}
+
+BufferId LinearBVHBuilder::getNodes() const
+{
+    return _nodesBufferId;
+}
+
+NDRange LinearBVHBuilder::_getRange(int count) const
+{
+    NDRange range;
+    range.workDim = 1;
+    range.globalSize[0] = static_cast<size_t>(count);
+    range.localSize[0] = _localSize;
+    range.padGlobalSize();
+    return range;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+#include <radixsort.h>
+
+#include <glm/glm.hpp>
+
+#include <memory>
+
+// Linear BVH over spheres built on the device: Morton codes of the centers,
+// a radix sort of them and a Karras hierarchy fitted bottom up, without any
+// host round trip. The kernels live in lbvh.cl, which must be part of the
+// program built on the context together with the sorter's kernels.
+class LinearBVHBuilder
+{
+public:
+    LinearBVHBuilder(std::shared_ptr<CLContextWrapper> context, std::shared_ptr<RadixSorter> sorter);
+
+    // Call after every program build, after the sorter's
+    bool prepareKernels();
+
+    // Node and scratch buffers for trees of up to maxSpheres
+    bool reserve(size_t maxSpheres);
+
+    // Builds the tree of numSpheres float8 spheres (as uploaded for the scene) on
+    // the compute queue. Centers are quantized within boundsMin to boundsMax.
+    bool build(BufferId spheres, int numSpheres, const glm::vec3 & boundsMin, const glm::vec3 & boundsMax);
+
+    // 2 * n - 1 float8 nodes of the last build, at least one node once reserved
+    BufferId getNodes() const;
+
+private:
+
+    NDRange _getRange(int count) const;
+
+private:
+
+    std::shared_ptr<CLContextWrapper> _clContext;
+    std::shared_ptr<RadixSorter> _radixSorter;
+
+    BoundKernel _mortonKernel;
+    BoundKernel _hierarchyKernel;
+    BoundKernel _fitBoundsKernel;
+
+    size_t _localSize;
+
+    size_t _capacity;
+    BufferId _nodesBufferId;
+    BufferId _keysBufferId;
+    BufferId _valuesBufferId;
+    BufferId _parentsBufferId;
+    BufferId _flagsBufferId;
+};
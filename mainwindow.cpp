@@ -1,15 +1,22 @@
 #include "mainwindow.h"
 
+#include <benchmark.h>
 #include <glview.h>
 #include <drawables.hpp>
+#include <mesh.h>
 #include <scene.h>
 
 #include <QBoxLayout>
 #include <QFile>
+#include <QFileDialog>
+#include <QImage>
 #include <QPushButton>
 #include <QTextStream>
 
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <vector>
 
 #include <glm/gtx/rotate_vector.hpp>
 
@@ -20,6 +27,38 @@ static const glm::vec3 ORIGINAL_EYE(0,0,-40);
 
 static const float ROTATION_SPEED = 0.1f;
 
+static const float FIELDS_OF_VIEW[] = {DEFAULT_VERTICAL_FOV, 45.0f, 60.0f, 90.0f};
+
+// Read back frames are linear rows with the y axis flipped, the chain is the presented one
+static bool saveFrame(const ReadbackFrame & frame, const PostProcessChain & chain, const QString & path)
+{
+    size_t numPixels = static_cast<size_t>(frame.width) * frame.height;
+    std::vector<float> colors(4 * numPixels);
+    for(size_t i = 0 ; i < numPixels; i++)
+    {
+        unpackColor(frame.format, frame.pixels, i, &colors[4 * i]);
+    }
+    chain.apply(colors.data(), frame.width, frame.height);
+
+    QImage image(frame.width, frame.height, QImage::Format_RGBA8888);
+    for(int y = 0 ; y < frame.height; y++)
+    {
+        const float * row = &colors[4 * static_cast<size_t>(frame.height - 1 - y) * frame.width];
+        unsigned char * line = image.scanLine(y);
+        for(int x = 0 ; x < frame.width; x++)
+        {
+            const float * rgba = row + 4 * x;
+            for(int i = 0 ; i < 3; i++)
+            {
+                line[4 * x + i] = static_cast<unsigned char>(std::min(std::max(rgba[i], 0.0f), 1.0f) * 255.0f);
+            }
+            // Alpha holds the material, the capture is opaque
+            line[4 * x + 3] = 255;
+        }
+    }
+    return image.save(path);
+}
+
 
 MainWindow::MainWindow(QWidget *parent)
     : QWidget(parent)
@@ -35,8 +74,9 @@ MainWindow::MainWindow(QWidget *parent)
         defaultScene.lights = getDefaultSceneLights();
 
         // Initialize Raytracer
-        _raytracer = std::make_shared<RayTracing>(defaultScene, newGlView->getBaseTexture(), textureWidth, textureWidth);
+        _raytracer = std::make_shared<RayTracing>(defaultScene, newGlView->getBaseTexture(), textureWidth, textureHeight);
         _raytracer->setEye(ORIGINAL_EYE);
+        _raytracer->setFrameMetrics(&_frameMetrics);
     });
     _glView->setFixedSize(textureWidth, textureHeight);
 
@@ -75,6 +115,228 @@ MainWindow::MainWindow(QWidget *parent)
         }
     });
 
+    QPushButton *multiDeviceButton = new QPushButton("Multi-Device");
+    multiDeviceButton->setCheckable(true);
+    QObject::connect(multiDeviceButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _glView->makeCurrent();
+        _raytracer->setMultiDeviceEnabled(checked);
+        _glView->doneCurrent();
+        multiDeviceButton->setChecked(_raytracer->isMultiDeviceEnabled());
+    });
+
+    QPushButton *multiQueueButton = new QPushButton("Multi-Queue");
+    multiQueueButton->setCheckable(true);
+    QObject::connect(multiQueueButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _glView->makeCurrent();
+        _raytracer->setMultiQueueEnabled(checked);
+        _glView->doneCurrent();
+        multiQueueButton->setChecked(_raytracer->isMultiQueueEnabled());
+    });
+
+    QPushButton *reprojectButton = new QPushButton("Reproject");
+    reprojectButton->setCheckable(true);
+    QObject::connect(reprojectButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _glView->makeCurrent();
+        _raytracer->setReprojectionEnabled(checked);
+        _raytracer->resetReprojectionStats();
+        _glView->doneCurrent();
+        reprojectButton->setChecked(_raytracer->isReprojectionEnabled());
+    });
+
+    QPushButton *gbufferButton = new QPushButton("G-Buffer");
+    gbufferButton->setCheckable(true);
+    QObject::connect(gbufferButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _glView->makeCurrent();
+        _raytracer->setGBufferEnabled(checked);
+        _glView->doneCurrent();
+        gbufferButton->setChecked(_raytracer->isGBufferEnabled());
+    });
+
+    QPushButton *jitterButton = new QPushButton("Jitter");
+    jitterButton->setCheckable(true);
+    QObject::connect(jitterButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _raytracer->setJitterEnabled(checked);
+    });
+
+    QPushButton *denoiseButton = new QPushButton("Denoise");
+    denoiseButton->setCheckable(true);
+    QObject::connect(denoiseButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _glView->makeCurrent();
+        _raytracer->setDenoiseEnabled(checked);
+        _glView->doneCurrent();
+        denoiseButton->setChecked(_raytracer->isDenoiseEnabled());
+        gbufferButton->setChecked(_raytracer->isGBufferEnabled());
+    });
+    // Turning the G-buffer off also stops denoising
+    QObject::connect(gbufferButton, &QPushButton::toggled,[=] (bool)
+    {
+        denoiseButton->setChecked(_raytracer->isDenoiseEnabled());
+    });
+
+    QPushButton *accumulateButton = new QPushButton("Accumulate");
+    accumulateButton->setCheckable(true);
+    QObject::connect(accumulateButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _glView->makeCurrent();
+        _raytracer->setAccumulationEnabled(checked);
+        _glView->doneCurrent();
+        accumulateButton->setChecked(_raytracer->isAccumulationEnabled());
+    });
+
+    // Cycles through the default and every forced format, starting after the current one
+    QPushButton *colorFormatButton = new QPushButton("Colors: default");
+    QObject::connect(colorFormatButton, &QPushButton::clicked,[=]
+    {
+        static const ColorFormat formats[] = {ColorFormat::FLOAT4, ColorFormat::HALF4, ColorFormat::RGBA8, ColorFormat::RGB10A2};
+
+        int next = 0;
+        if(_raytracer->isColorFormatForced())
+        {
+            next = std::find(std::begin(formats), std::end(formats), _raytracer->getRenderConfig().colorFormat) - std::begin(formats) + 1;
+        }
+
+        _glView->makeCurrent();
+        if(next < 4)
+        {
+            _raytracer->setColorFormat(formats[next]);
+        }
+        else
+        {
+            _raytracer->resetColorFormat();
+        }
+        _glView->doneCurrent();
+
+        colorFormatButton->setText(_raytracer->isColorFormatForced() ?
+                                   QString("Colors: ") + getColorFormatName(_raytracer->getRenderConfig().colorFormat) :
+                                   QString("Colors: default"));
+    });
+
+    QPushButton *fovButton = new QPushButton(QString("FOV: ") + QString::number(DEFAULT_VERTICAL_FOV));
+    QObject::connect(fovButton, &QPushButton::clicked,[=]
+    {
+        Camera camera = _raytracer->getCamera();
+        const size_t count = sizeof(FIELDS_OF_VIEW) / sizeof(FIELDS_OF_VIEW[0]);
+        size_t next = 0;
+        for(size_t i = 0 ; i < count; i++)
+        {
+            if(FIELDS_OF_VIEW[i] == camera.verticalFov)
+            {
+                next = (i + 1) % count;
+            }
+        }
+        camera.verticalFov = FIELDS_OF_VIEW[next];
+        _raytracer->setCamera(camera);
+        fovButton->setText(QString("FOV: ") + QString::number(camera.verticalFov));
+        _updateScene();
+    });
+
+    QPushButton *overlayButton = new QPushButton("Overlay");
+    overlayButton->setCheckable(true);
+    QObject::connect(overlayButton, &QPushButton::toggled,[=] (bool checked)
+    {
+        _glView->setOverlayEnabled(checked);
+        _glView->repaint();
+    });
+
+    QPushButton *exportMetricsButton = new QPushButton("Export Metrics");
+    QObject::connect(exportMetricsButton, &QPushButton::clicked,[=]
+    {
+        QString path = QFileDialog::getSaveFileName(this, "Export frame metrics", "frame_metrics.csv", "CSV (*.csv)");
+        if(path.isEmpty())
+        {
+            return;
+        }
+        if(!_frameMetrics.exportCSV(path.toStdString()))
+        {
+            std::cout << "Failed to export frame metrics to " << path.toStdString() << std::endl;
+        }
+    });
+
+    QPushButton *dispatchModeButton = new QPushButton("Mode: ndrange");
+    QObject::connect(dispatchModeButton, &QPushButton::clicked,[=]
+    {
+        DispatchMode mode = _raytracer->getDispatchMode();
+        switch (mode)
+        {
+        case DispatchMode::NDRANGE:
+            mode = DispatchMode::PERSISTENT;
+            break;
+        case DispatchMode::PERSISTENT:
+            mode = DispatchMode::WAVEFRONT;
+            break;
+        case DispatchMode::WAVEFRONT:
+        default:
+            mode = DispatchMode::NDRANGE;
+            break;
+        }
+        _raytracer->setDispatchMode(mode);
+        dispatchModeButton->setText(QString("Mode: ") + RenderConfig::getDispatchModeName(mode));
+    });
+
+    QPushButton *benchmarkButton = new QPushButton("Benchmark");
+    QObject::connect(benchmarkButton, &QPushButton::clicked,[=]
+    {
+        _glView->makeCurrent();
+        Benchmark benchmark(*_raytracer);
+        runAllBenchmarks(benchmark);
+        _glView->doneCurrent();
+
+        std::cout << benchmark.getReport() << std::endl;
+        std::cout << "Scene buffer pool" << std::endl << _raytracer->getBufferPoolStats().getSummary() << std::endl;
+    });
+
+    QPushButton *loadObjButton = new QPushButton("Load OBJ");
+    QObject::connect(loadObjButton, &QPushButton::clicked,[=]
+    {
+        QString path = QFileDialog::getOpenFileName(this, "Load mesh", QString(), "Wavefront OBJ (*.obj)");
+        if(path.isEmpty())
+        {
+            return;
+        }
+
+        dwg::Mesh mesh;
+        if(!loadObjMesh(path.toStdString(), mesh))
+        {
+            return;
+        }
+
+        // Replaces the meshes loaded before
+        dwg::Scene scene = _raytracer->getScene();
+        scene.meshes.assign(1, mesh);
+        _glView->makeCurrent();
+        _raytracer->setScene(scene);
+        _glView->doneCurrent();
+        _updateScene();
+    });
+
+    QPushButton *captureButton = new QPushButton("Capture");
+    QObject::connect(captureButton, &QPushButton::clicked,[=]
+    {
+        QString path = QFileDialog::getSaveFileName(this, "Capture frame", "frame.png", "PNG (*.png)");
+        if(path.isEmpty())
+        {
+            return;
+        }
+
+        // Renders one frame with readback on, then waits for it
+        _raytracer->setReadbackCallback([=] (const ReadbackFrame & frame)
+        {
+            if(!saveFrame(frame, _raytracer->getPostProcessChain(), path))
+            {
+                std::cout << "Failed to save frame to " << path.toStdString() << std::endl;
+            }
+            _raytracer->setReadbackCallback(nullptr);
+        });
+        _updateScene();
+        _raytracer->flushReadback();
+    });
+
     // Populate view
     QVBoxLayout * vlayout = new QVBoxLayout();
 
@@ -83,6 +345,21 @@ MainWindow::MainWindow(QWidget *parent)
     QHBoxLayout * hLayout = new QHBoxLayout();
     hLayout->addWidget(drawButton);
     hLayout->addWidget(rotateButton);
+    hLayout->addWidget(multiDeviceButton);
+    hLayout->addWidget(multiQueueButton);
+    hLayout->addWidget(reprojectButton);
+    hLayout->addWidget(gbufferButton);
+    hLayout->addWidget(jitterButton);
+    hLayout->addWidget(denoiseButton);
+    hLayout->addWidget(accumulateButton);
+    hLayout->addWidget(colorFormatButton);
+    hLayout->addWidget(dispatchModeButton);
+    hLayout->addWidget(fovButton);
+    hLayout->addWidget(overlayButton);
+    hLayout->addWidget(exportMetricsButton);
+    hLayout->addWidget(loadObjButton);
+    hLayout->addWidget(benchmarkButton);
+    hLayout->addWidget(captureButton);
 
     vlayout->addLayout(hLayout);
     setLayout(vlayout);
@@ -102,9 +379,22 @@ void MainWindow::_updateScene()
     _glView->doneCurrent();
 
     // Redraw
+    util::Timer presentTimer;
     _glView->repaint();
+    _frameMetrics.record(util::FrameStage::PRESENT, presentTimer.elapsedMilliSec());
 
     float elapsedTime = t.elapsedMilliSec();
+    _frameMetrics.record(util::FrameStage::TOTAL, elapsedTime);
+    _frameMetrics.endFrame();
+
+    // Shown on the next repaint
+    std::string overlay = _frameMetrics.getSummary();
+    if(_raytracer->isReprojectionEnabled())
+    {
+        overlay += "\nReprojection: " + std::to_string(static_cast<int>(100.0 * _raytracer->getReprojectionStats().lastTracedFraction + 0.5)) + "% of pixels traced";
+    }
+    _glView->setOverlayText(overlay);
+
     setWindowTitle(QString::fromStdString("Rendered: ") + QString::fromStdString(std::to_string(elapsedTime)) + QString(" ms") +
                    QString(" (") + QString::fromStdString(std::to_string((1.0f/elapsedTime)*1e3f)) + QString(" FPS)"));
 }
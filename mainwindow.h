@@ -14,6 +14,7 @@
 
 #include <QTimer>
 
+#include <framemetrics.h>
 #include <timer.h>
 
 
@@ -35,6 +36,7 @@ private:
     std::shared_ptr<RayTracing> _raytracer;
 
     util::Timer _updateTimer;
+    util::FrameMetrics _frameMetrics;
     QPointer<GLView> _glView;
     QPointer<QTimer> _qtimer;
 };
@@ -0,0 +1,160 @@
+#include "mesh.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+// Vertex index of a face corner ("i", "i/t", "i//n" or "i/t/n"), negative
+// indices count back from the last vertex. False when malformed or out of range.
+static bool parseFaceIndex(const char * & cursor, size_t numVertices, uint32_t & index)
+{
+    char * end = nullptr;
+    long value = std::strtol(cursor, &end, 10);
+    if(end == cursor)
+    {
+        return false;
+    }
+
+    // Skip the texture coordinate and normal indices
+    cursor = end;
+    while(*cursor != '\0' && *cursor != ' ' && *cursor != '\t' && *cursor != '\r')
+    {
+        cursor++;
+    }
+
+    long resolved = value > 0 ? value - 1 : static_cast<long>(numVertices) + value;
+    if(value == 0 || resolved < 0 || resolved >= static_cast<long>(numVertices))
+    {
+        return false;
+    }
+    index = static_cast<uint32_t>(resolved);
+    return true;
+}
+
+static const char * skipSpaces(const char * cursor)
+{
+    while(*cursor == ' ' || *cursor == '\t')
+    {
+        cursor++;
+    }
+    return cursor;
+}
+
+bool loadObjMesh(const std::string & path, dwg::Mesh & mesh, float scale, const glm::vec3 & offset)
+{
+    std::ifstream file(path);
+    if(!file.is_open())
+    {
+        std::cout << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    mesh.vertices.clear();
+    mesh.triangles.clear();
+
+    size_t lineNumber = 0;
+    size_t skippedFaces = 0;
+    std::string line;
+    std::vector<uint32_t> corners;
+    while(std::getline(file, line))
+    {
+        lineNumber++;
+        const char * cursor = skipSpaces(line.c_str());
+
+        if(cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            cursor += 2;
+            glm::vec3 position;
+            char * end = nullptr;
+            for(int i = 0 ; i < 3; i++)
+            {
+                position[i] = std::strtof(cursor, &end);
+                if(end == cursor)
+                {
+                    std::cout << path << ":" << lineNumber << ": bad vertex" << std::endl;
+                    return false;
+                }
+                cursor = end;
+            }
+            mesh.vertices.push_back(position * scale + offset);
+        }
+        else if(cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            cursor = skipSpaces(cursor + 2);
+            corners.clear();
+
+            bool valid = true;
+            while(*cursor != '\0' && *cursor != '\r')
+            {
+                uint32_t index = 0;
+                if(!parseFaceIndex(cursor, mesh.vertices.size(), index))
+                {
+                    valid = false;
+                    break;
+                }
+                corners.push_back(index);
+                cursor = skipSpaces(cursor);
+            }
+
+            if(!valid || corners.size() < 3)
+            {
+                skippedFaces++;
+                continue;
+            }
+            for(size_t i = 2 ; i < corners.size(); i++)
+            {
+                mesh.triangles.push_back(glm::uvec3(corners[0], corners[i - 1], corners[i]));
+            }
+        }
+    }
+
+    if(skippedFaces > 0)
+    {
+        std::cout << path << ": skipped " << skippedFaces << " malformed faces" << std::endl;
+    }
+    std::cout << "Loaded " << path << ": " << mesh.vertices.size() << " vertices, "
+              << mesh.triangles.size() << " triangles" << std::endl;
+    return !mesh.triangles.empty();
+}
+
+dwg::Mesh createTorusMesh(const glm::vec3 & center, float majorRadius, float minorRadius, int rings, int sides, const glm::vec4 & color)
+{
+    dwg::Mesh mesh;
+    mesh.color = color;
+
+    rings = std::max(3, rings);
+    sides = std::max(3, sides);
+    mesh.vertices.reserve(static_cast<size_t>(rings) * sides);
+    mesh.triangles.reserve(2 * static_cast<size_t>(rings) * sides);
+
+    for(int i = 0 ; i < rings; i++)
+    {
+        float u = glm::two_pi<float>() * i / rings;
+        glm::vec3 ringCenter(std::cos(u) * majorRadius, 0.0f, std::sin(u) * majorRadius);
+        glm::vec3 outward = glm::normalize(ringCenter);
+        for(int j = 0 ; j < sides; j++)
+        {
+            float v = glm::two_pi<float>() * j / sides;
+            glm::vec3 offset = (outward * std::cos(v) + glm::vec3(0.0f, std::sin(v), 0.0f)) * minorRadius;
+            mesh.vertices.push_back(center + ringCenter + offset);
+        }
+    }
+
+    for(int i = 0 ; i < rings; i++)
+    {
+        uint32_t ring = static_cast<uint32_t>(i * sides);
+        uint32_t nextRing = static_cast<uint32_t>(((i + 1) % rings) * sides);
+        for(int j = 0 ; j < sides; j++)
+        {
+            uint32_t side = static_cast<uint32_t>(j);
+            uint32_t nextSide = static_cast<uint32_t>((j + 1) % sides);
+            mesh.triangles.push_back(glm::uvec3(ring + side, ring + nextSide, nextRing + side));
+            mesh.triangles.push_back(glm::uvec3(nextRing + side, ring + nextSide, nextRing + nextSide));
+        }
+    }
+    return mesh;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dwg
+{
+
+// Indexed triangle mesh in world space
+struct Mesh
+{
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::uvec3> triangles; // indices into vertices, counter clockwise seen from the front
+    glm::vec4 color; // w is the material, as for spheres
+
+    Mesh() : color(0.8f, 0.8f, 0.8f, 0.0f)
+    {
+
+    }
+
+    size_t getBytes() const
+    {
+        return sizeof(glm::vec3) * vertices.size() + sizeof(glm::uvec3) * triangles.size();
+    }
+};
+
+}
+
+// Reads the vertices and faces of an OBJ file line by line, faces with more
+// than three corners become fans. Normals, texture coordinates, groups and
+// materials are skipped. Vertices are scaled and then moved by offset.
+bool loadObjMesh(const std::string & path, dwg::Mesh & mesh, float scale = 1.0f, const glm::vec3 & offset = glm::vec3(0.0f));
+
+// Closed torus around the y axis with 2 * rings * sides triangles
+dwg::Mesh createTorusMesh(const glm::vec3 & center, float majorRadius, float minorRadius, int rings, int sides, const glm::vec4 & color);
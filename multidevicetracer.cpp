@@ -0,0 +1,234 @@
+#include "multidevicetracer.h"
+
+#include <timer.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+// Weight of the newest measurement when updating the device speed
+static const double BALANCE_SMOOTHING = 0.3;
+
+MultiDeviceTracer::MultiDeviceTracer(const dwg::Scene & scene, const std::string & kernelSource, const RenderConfig & config,
+                                     int width, int height) :
+    _numSpheres(static_cast<int>(scene.spheres.size())),
+    _numPlanes(static_cast<int>(scene.planes.size())),
+    _numLights(static_cast<int>(scene.lights.size())),
+    _scene(scene),
+    _width(width),
+    _height(height),
+    _rowGranularity(16)
+{
+    std::vector<DeviceLocation> locations = CLContextWrapper::listAllDevices();
+
+    for(const DeviceLocation & location : locations)
+    {
+        DeviceSlot slot;
+        slot.context = std::make_shared<CLContextWrapper>();
+
+        if(!slot.context->createContext(location))
+        {
+            std::cout << "Skipping device " << location.platformIndex << ":" << location.deviceIndex << std::endl;
+            continue;
+        }
+
+        const DeviceInfo & device = slot.context->getDeviceInfo();
+        slot.config = config;
+        slot.config.sceneStorage = chooseSceneStorage(device, scene);
+        slot.config.colorFormat = ColorFormat::FLOAT4; // read back as host float4
+        slot.config.dispatchMode = DispatchMode::NDRANGE;
+        slot.config.gbuffer = false;
+
+        if(!slot.context->createProgramFromSource(kernelSource, slot.config.getBuildOptions()))
+        {
+            continue;
+        }
+
+        slot.kernel = slot.context->prepareKernel("rayTracingKernel");
+        if(!slot.kernel.isValid())
+        {
+            continue;
+        }
+
+        chooseLocalSize(device, slot.kernel.getWorkGroupSize(), slot.config.localSizeX, slot.config.localSizeY);
+
+        dwg::Scene sceneCopy = scene;
+        slot.spheresBufferId = slot.context->createBufferFromArray(sceneCopy.spheres.size(), sceneCopy.spheres.data(), BufferType::READ_ONLY);
+        slot.planesBufferId  = slot.context->createBufferFromArray(sceneCopy.planes.size(),  sceneCopy.planes.data(),  BufferType::READ_ONLY);
+        slot.lightsBufferId  = slot.context->createBufferFromArray(sceneCopy.lights.size(),  sceneCopy.lights.data(),  BufferType::READ_ONLY);
+
+        // Full frame per device so every band keeps the kernel's global indexing
+        slot.colorsBufferId  = slot.context->createBuffer(4*sizeof(float) * _width*_height, nullptr, BufferType::WRITE_ONLY);
+
+        slot.rowStart = 0;
+        slot.rowCount = 0;
+        slot.lastTime = 0.0;
+        slot.rowsPerMilliSec = 1.0;
+        slot.ok = true;
+
+        _slots.push_back(slot);
+    }
+
+    // Start with an even split
+    _rebalance();
+
+    std::cout << "Multi device tracer using " << _slots.size() << " device(s)" << std::endl;
+}
+
+bool MultiDeviceTracer::isValid() const
+{
+    return !_slots.empty();
+}
+
+size_t MultiDeviceTracer::getDeviceCount() const
+{
+    return _slots.size();
+}
+
+bool MultiDeviceTracer::trace(const CameraConstants & camera, float * output)
+{
+    if(_slots.empty())
+    {
+        return false;
+    }
+
+    // One host thread per device, each one blocks on its own queue
+    std::vector<std::thread> workers;
+    for(size_t i = 1 ; i < _slots.size(); i++)
+    {
+        DeviceSlot & slot = _slots[i];
+        workers.push_back(std::thread([this, &slot, &camera, output]
+        {
+            slot.ok = _traceBand(slot, camera, output);
+        }));
+    }
+    _slots[0].ok = _traceBand(_slots[0], camera, output);
+
+    for(auto & worker : workers)
+    {
+        worker.join();
+    }
+
+    bool allOk = true;
+    for(const DeviceSlot & slot : _slots)
+    {
+        allOk &= slot.ok;
+    }
+
+    _rebalance();
+
+    return allOk;
+}
+
+std::string MultiDeviceTracer::getBalanceDescription() const
+{
+    std::stringstream ss;
+    for(size_t i = 0 ; i < _slots.size(); i++)
+    {
+        const DeviceSlot & slot = _slots[i];
+        ss << "[" << i << "] " << slot.rowCount << " rows " << slot.lastTime << " ms ";
+    }
+    return ss.str();
+}
+
+bool MultiDeviceTracer::_traceBand(DeviceSlot & slot, const CameraConstants & camera, float * output)
+{
+    if(slot.rowCount <= 0)
+    {
+        slot.lastTime = 0.0;
+        return true;
+    }
+
+    util::Timer timer;
+
+    NDRange range;
+    range.workDim = 2;
+    range.globalOffset[0] = 0;
+    range.globalOffset[1] = slot.rowStart;
+    range.globalSize[0] = _width;
+    range.globalSize[1] = slot.rowCount;
+    range.localSize[0] = slot.config.localSizeX;
+    range.localSize[1] = slot.config.localSizeY;
+
+    // Padded rows past the band belong to the next band and are not read back
+    range.padGlobalSize();
+
+    // Empty arrays still get one element, a zero local size is invalid
+    bool stageScene = slot.config.sceneStorage == SceneStorage::LOCAL;
+    size_t localTempSize  = stageScene ? std::max(getLocalSceneBytes(_scene), sizeof(float)*16) : sizeof(float)*16;
+    size_t localLightSize = stageScene ? std::max(getLocalLightBytes(_scene), sizeof(float)*8) : sizeof(float)*8;
+
+    BoundKernel & kernel = slot.kernel;
+    bool ok = kernel.setArg(0, slot.colorsBufferId);
+    ok &= kernel.setArg(1, _width);
+    ok &= kernel.setArg(2, _height);
+    ok &= kernel.setArg(3, slot.spheresBufferId);
+    ok &= kernel.setArg(4, _numSpheres);
+    ok &= kernel.setArg(5, slot.planesBufferId);
+    ok &= kernel.setArg(6, _numPlanes);
+    ok &= kernel.setArg(7, slot.lightsBufferId);
+    ok &= kernel.setArg(8, _numLights);
+    ok &= kernel.setLocalArg(9, localTempSize);
+    ok &= kernel.setLocalArg(10, localLightSize);
+    ok &= kernel.setArg(11, slot.config.maxBounces);
+    ok &= kernel.setArg(12, camera);
+    ok = ok && slot.context->dispatchKernel(kernel, range);
+
+    // Output rows are flipped, the band is still contiguous
+    size_t rowBytes = 4*sizeof(float) * _width;
+    size_t firstOutputRow = static_cast<size_t>(_height - (slot.rowStart + slot.rowCount));
+    size_t offset = firstOutputRow * rowBytes;
+
+    ok = ok && slot.context->dowloadFromBuffer(slot.colorsBufferId, rowBytes * slot.rowCount,
+                                               reinterpret_cast<char*>(output) + offset, offset, true);
+
+    slot.lastTime = timer.elapsedMilliSec();
+    return ok;
+}
+
+void MultiDeviceTracer::_rebalance()
+{
+    if(_slots.empty())
+    {
+        return;
+    }
+
+    const int granularity = _rowGranularity;
+
+    // Update the speed estimate of every device that worked last frame
+    double totalSpeed = 0.0;
+    for(DeviceSlot & slot : _slots)
+    {
+        if(slot.rowCount > 0 && slot.lastTime > 0.0 && slot.ok)
+        {
+            double speed = slot.rowCount / slot.lastTime;
+            slot.rowsPerMilliSec = BALANCE_SMOOTHING * speed + (1.0 - BALANCE_SMOOTHING) * slot.rowsPerMilliSec;
+        }
+        totalSpeed += slot.rowsPerMilliSec;
+    }
+
+    // Split rows proportionally, keeping at least one work group row per device so it is still measured
+    int rowStart = 0;
+    int remainingRows = _height;
+    for(size_t i = 0 ; i < _slots.size(); i++)
+    {
+        DeviceSlot & slot = _slots[i];
+
+        int rows = remainingRows;
+        if(i + 1 < _slots.size())
+        {
+            double share = slot.rowsPerMilliSec / totalSpeed;
+            rows = static_cast<int>(share * _height / granularity + 0.5) * granularity;
+            int reserved = static_cast<int>(_slots.size() - i - 1) * granularity;
+            rows = std::max(granularity, std::min(rows, remainingRows - reserved));
+            rows = std::max(0, std::min(rows, remainingRows));
+        }
+
+        slot.rowStart = rowStart;
+        slot.rowCount = rows;
+
+        rowStart += rows;
+        remainingRows -= rows;
+    }
+}
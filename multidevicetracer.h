@@ -0,0 +1,73 @@
+#pragma once
+
+#include <camera.h>
+#include <clcontextwrapper.h>
+#include <renderconfig.h>
+#include <scene.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Traces one frame across every OpenCL device found. Each device owns a
+// context and renders a band of rows, band sizes follow the measured speed.
+class MultiDeviceTracer
+{
+public:
+    // Devices build the kernel with the given config, only scene storage, local size and
+    // color format are chosen per device. The G-buffer is not traced.
+    MultiDeviceTracer(const dwg::Scene & scene, const std::string & kernelSource, const RenderConfig & config,
+                      int width, int height);
+
+    bool isValid() const;
+
+    size_t getDeviceCount() const;
+
+    // Output is width*height float4 in the same layout as rayTracingKernel
+    bool trace(const CameraConstants & camera, float * output);
+
+    std::string getBalanceDescription() const;
+
+private:
+
+    struct DeviceSlot
+    {
+        std::shared_ptr<CLContextWrapper> context;
+
+        BufferId spheresBufferId;
+        BufferId planesBufferId;
+        BufferId lightsBufferId;
+        BufferId colorsBufferId;
+        BoundKernel kernel;
+
+        RenderConfig config;
+
+        int rowStart;
+        int rowCount;
+
+        double lastTime;
+        double rowsPerMilliSec;
+
+        bool ok;
+    };
+
+    bool _traceBand(DeviceSlot & slot, const CameraConstants & camera, float * output);
+
+    void _rebalance();
+
+private:
+
+    std::vector<DeviceSlot> _slots;
+
+    int _numSpheres;
+    int _numPlanes;
+    int _numLights;
+
+    dwg::Scene _scene;
+
+    int _width;
+    int _height;
+
+    // Band heights are multiples of this to keep padding waste low, the last band takes the rest
+    int _rowGranularity;
+};
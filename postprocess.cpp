@@ -0,0 +1,322 @@
+#include "postprocess.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+static const int GAMMA_LUT_SIZE = 256;
+
+// 4x4 Bayer matrix, thresholds are (value + 0.5) / 16
+static const int BAYER_4X4[16] = { 0,  8,  2, 10,
+                                  12,  4, 14,  6,
+                                   3, 11,  1,  9,
+                                  15,  7, 13,  5};
+
+// OpenCL float literal that round trips
+static std::string formatFloat(float value)
+{
+    std::stringstream ss;
+    ss << std::scientific << std::setprecision(9) << value << "f";
+    return ss.str();
+}
+
+static std::vector<float> getGammaLut(float gamma)
+{
+    std::vector<float> lut(GAMMA_LUT_SIZE + 1);
+    for(int i = 0 ; i <= GAMMA_LUT_SIZE; i++)
+    {
+        lut[i] = std::pow(static_cast<float>(i) / GAMMA_LUT_SIZE, 1.0f / gamma);
+    }
+    return lut;
+}
+
+static float lookupGamma(const std::vector<float> & lut, float value)
+{
+    float position = std::min(std::max(value, 0.0f), 1.0f) * GAMMA_LUT_SIZE;
+    int index = std::min(static_cast<int>(position), GAMMA_LUT_SIZE - 1);
+    float fraction = position - index;
+    return lut[index] + (lut[index + 1] - lut[index]) * fraction;
+}
+
+static float toneMapChannel(ToneMapOperator op, float value)
+{
+    if(op == ToneMapOperator::ACES)
+    {
+        float mapped = (value * (2.51f * value + 0.03f)) / (value * (2.43f * value + 0.59f) + 0.14f);
+        return std::min(std::max(mapped, 0.0f), 1.0f);
+    }
+    return value / (1.0f + value);
+}
+
+PostProcessStage PostProcessStage::exposure(float stops)
+{
+    PostProcessStage stage;
+    stage.type = PostProcessStageType::EXPOSURE;
+    stage.value = stops;
+    return stage;
+}
+
+PostProcessStage PostProcessStage::toneMap(ToneMapOperator op)
+{
+    PostProcessStage stage;
+    stage.type = PostProcessStageType::TONE_MAP;
+    stage.value = 0.0f;
+    stage.toneMapOperator = op;
+    return stage;
+}
+
+PostProcessStage PostProcessStage::gamma(float gamma, GammaMethod method)
+{
+    PostProcessStage stage;
+    stage.type = PostProcessStageType::GAMMA;
+    stage.value = gamma;
+    stage.gammaMethod = method;
+    return stage;
+}
+
+PostProcessStage PostProcessStage::dither(float levels)
+{
+    PostProcessStage stage;
+    stage.type = PostProcessStageType::DITHER;
+    stage.value = levels;
+    return stage;
+}
+
+std::string PostProcessStage::getName() const
+{
+    std::stringstream ss;
+    switch (type)
+    {
+    case PostProcessStageType::EXPOSURE:
+        ss << "exposure " << std::showpos << value;
+        break;
+    case PostProcessStageType::TONE_MAP:
+        ss << "tone map " << (toneMapOperator == ToneMapOperator::ACES ? "aces" : "reinhard");
+        break;
+    case PostProcessStageType::GAMMA:
+        ss << "gamma " << value << " (" << (gammaMethod == GammaMethod::LUT ? "lut" : gammaMethod == GammaMethod::FAST ? "fast" : "exact") << ")";
+        break;
+    case PostProcessStageType::DITHER:
+        ss << "dither " << value << " levels";
+        break;
+    }
+    return ss.str();
+}
+
+PostProcessChain::PostProcessChain()
+{
+
+}
+
+PostProcessChain PostProcessChain::getDefault()
+{
+    PostProcessChain chain;
+    chain.addStage(PostProcessStage::gamma(2.2f));
+    return chain;
+}
+
+void PostProcessChain::addStage(const PostProcessStage & stage)
+{
+    _stages.push_back(stage);
+}
+
+void PostProcessChain::clear()
+{
+    _stages.clear();
+}
+
+const std::vector<PostProcessStage> & PostProcessChain::getStages() const
+{
+    return _stages;
+}
+
+PostProcessChain PostProcessChain::getPrefix(size_t count) const
+{
+    PostProcessChain chain;
+    for(size_t i = 0 ; i < count && i < _stages.size(); i++)
+    {
+        chain.addStage(_stages[i]);
+    }
+    return chain;
+}
+
+std::string PostProcessChain::generateSource() const
+{
+    std::stringstream tables;
+    std::stringstream body;
+
+    bool hasLut = false;
+    bool hasDither = false;
+
+    for(size_t i = 0 ; i < _stages.size(); i++)
+    {
+        const PostProcessStage & stage = _stages[i];
+        body << "    // " << stage.getName() << "\n";
+
+        switch (stage.type)
+        {
+        case PostProcessStageType::EXPOSURE:
+            body << "    c *= " << formatFloat(std::exp2(stage.value)) << ";\n";
+            break;
+        case PostProcessStageType::TONE_MAP:
+            if(stage.toneMapOperator == ToneMapOperator::ACES)
+            {
+                body << "    c = clamp((c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f), 0.0f, 1.0f);\n";
+            }
+            else
+            {
+                body << "    c = c / (1.0f + c);\n";
+            }
+            break;
+        case PostProcessStageType::GAMMA:
+            if(stage.gammaMethod == GammaMethod::LUT)
+            {
+                std::vector<float> lut = getGammaLut(stage.value);
+                tables << "__constant float POST_GAMMA_LUT_" << i << "[" << lut.size() << "] = {";
+                for(size_t j = 0 ; j < lut.size(); j++)
+                {
+                    tables << (j % 8 == 0 ? "\n    " : " ") << formatFloat(lut[j]) << (j + 1 < lut.size() ? "," : "");
+                }
+                tables << "\n};\n\n";
+
+                body << "    c = postProcessLut(POST_GAMMA_LUT_" << i << ", c);\n";
+                hasLut = true;
+            }
+            else
+            {
+                body << "    c = " << (stage.gammaMethod == GammaMethod::FAST ? "native_powr" : "pow")
+                     << "(max(c, 0.0f), (float3)(" << formatFloat(1.0f / stage.value) << "));\n";
+            }
+            break;
+        case PostProcessStageType::DITHER:
+            body << "    c += (POST_BAYER[(y & 3) * 4 + (x & 3)] - 0.5f) * " << formatFloat(1.0f / stage.value) << ";\n";
+            hasDither = true;
+            break;
+        }
+    }
+
+    std::stringstream source;
+    source << "// Generated from the post process chain: " << getDescription() << "\n\n";
+    source << tables.str();
+
+    if(hasDither)
+    {
+        source << "__constant float POST_BAYER[16] = {";
+        for(int i = 0 ; i < 16; i++)
+        {
+            source << (i % 4 == 0 ? "\n    " : " ") << formatFloat((BAYER_4X4[i] + 0.5f) / 16.0f) << (i < 15 ? "," : "");
+        }
+        source << "\n};\n\n";
+    }
+
+    if(hasLut)
+    {
+        source << "static float3 postProcessLut(__constant const float * lut, float3 c)\n"
+               << "{\n"
+               << "    const float3 p = clamp(c, 0.0f, 1.0f) * " << GAMMA_LUT_SIZE << ".0f;\n"
+               << "    const int3 i = min(convert_int3(p), " << GAMMA_LUT_SIZE - 1 << ");\n"
+               << "    const float3 f = p - convert_float3(i);\n"
+               << "    return (float3)(mix(lut[i.x], lut[i.x + 1], f.x),\n"
+               << "                    mix(lut[i.y], lut[i.y + 1], f.y),\n"
+               << "                    mix(lut[i.z], lut[i.z + 1], f.z));\n"
+               << "}\n\n";
+    }
+
+    source << "static float4 postProcess(float4 color, int x, int y)\n"
+           << "{\n"
+           << "    float3 c = color.xyz;\n"
+           << body.str()
+           << "    return (float4)(c, color.w);\n"
+           << "}\n\n";
+    return source.str();
+}
+
+void PostProcessChain::apply(float * rgba, int width, int height) const
+{
+    if(_stages.empty())
+    {
+        return;
+    }
+
+    // Tables are built once per call, the loop below is the single pass
+    std::vector<std::vector<float>> luts(_stages.size());
+    for(size_t i = 0 ; i < _stages.size(); i++)
+    {
+        if(_stages[i].type == PostProcessStageType::GAMMA && _stages[i].gammaMethod == GammaMethod::LUT)
+        {
+            luts[i] = getGammaLut(_stages[i].value);
+        }
+    }
+
+    for(int row = 0 ; row < height; row++)
+    {
+        // Rows are flipped, dithering follows the kernel's pixel coordinates
+        int y = height - 1 - row;
+        for(int x = 0 ; x < width; x++)
+        {
+            float * pixel = rgba + 4 * (static_cast<size_t>(row) * width + x);
+            for(size_t i = 0 ; i < _stages.size(); i++)
+            {
+                const PostProcessStage & stage = _stages[i];
+                for(int channel = 0 ; channel < 3; channel++)
+                {
+                    float & c = pixel[channel];
+                    switch (stage.type)
+                    {
+                    case PostProcessStageType::EXPOSURE:
+                        c *= std::exp2(stage.value);
+                        break;
+                    case PostProcessStageType::TONE_MAP:
+                        c = toneMapChannel(stage.toneMapOperator, c);
+                        break;
+                    case PostProcessStageType::GAMMA:
+                        c = stage.gammaMethod == GammaMethod::LUT ? lookupGamma(luts[i], c) : std::pow(std::max(c, 0.0f), 1.0f / stage.value);
+                        break;
+                    case PostProcessStageType::DITHER:
+                        c += ((BAYER_4X4[(y & 3) * 4 + (x & 3)] + 0.5f) / 16.0f - 0.5f) / stage.value;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+std::string PostProcessChain::getDescription() const
+{
+    if(_stages.empty())
+    {
+        return "none";
+    }
+
+    std::stringstream ss;
+    for(size_t i = 0 ; i < _stages.size(); i++)
+    {
+        ss << (i > 0 ? ", " : "") << _stages[i].getName();
+    }
+    return ss.str();
+}
+
+bool PostProcessChain::operator==(const PostProcessChain & other) const
+{
+    if(_stages.size() != other._stages.size())
+    {
+        return false;
+    }
+    for(size_t i = 0 ; i < _stages.size(); i++)
+    {
+        const PostProcessStage & a = _stages[i];
+        const PostProcessStage & b = other._stages[i];
+        if(a.type != b.type || a.value != b.value || a.toneMapOperator != b.toneMapOperator || a.gammaMethod != b.gammaMethod)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PostProcessChain::operator!=(const PostProcessChain & other) const
+{
+    return !(*this == other);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+enum class PostProcessStageType
+{
+    EXPOSURE, // Scales by 2^value
+    TONE_MAP, // Maps [0, inf) to [0, 1)
+    GAMMA,    // Encodes with 1 / value
+    DITHER    // Ordered 4x4 Bayer dither to value levels
+};
+
+enum class ToneMapOperator
+{
+    REINHARD,
+    ACES // Narkowicz fit of the ACES filmic curve
+};
+
+enum class GammaMethod
+{
+    EXACT, // pow per channel
+    LUT,   // Linear interpolation in a 256 entry table, clamps to [0, 1]
+    FAST   // native_powr on the device, pow on the host
+};
+
+struct PostProcessStage
+{
+    PostProcessStageType type;
+    float value;
+    ToneMapOperator toneMapOperator;
+    GammaMethod gammaMethod;
+
+    PostProcessStage() : type(PostProcessStageType::GAMMA), value(2.2f), toneMapOperator(ToneMapOperator::REINHARD), gammaMethod(GammaMethod::EXACT)
+    {
+
+    }
+
+    static PostProcessStage exposure(float stops);
+
+    static PostProcessStage toneMap(ToneMapOperator op);
+
+    static PostProcessStage gamma(float gamma, GammaMethod method = GammaMethod::EXACT);
+
+    static PostProcessStage dither(float levels = 255.0f);
+
+    std::string getName() const;
+};
+
+// Ordered list of stages applied to the traced colors in one pass. On the device
+// the chain becomes postProcess(color, x, y), generated OpenCL prepended to the
+// program and called by the present kernels once the frame is accumulated, the
+// color buffers stay linear. Alpha carries the material and is never changed.
+class PostProcessChain
+{
+public:
+    PostProcessChain();
+
+    // Gamma 2.2, what the tracing kernels used to apply
+    static PostProcessChain getDefault();
+
+    void addStage(const PostProcessStage & stage);
+
+    void clear();
+
+    const std::vector<PostProcessStage> & getStages() const;
+
+    // The first count stages
+    PostProcessChain getPrefix(size_t count) const;
+
+    // Defines postProcess with every constant baked in
+    std::string generateSource() const;
+
+    // Same chain over a host frame of float4 pixels in the kernel layout (y axis flipped),
+    // e.g. a frame read back linear
+    void apply(float * rgba, int width, int height) const;
+
+    std::string getDescription() const;
+
+    bool operator==(const PostProcessChain & other) const;
+
+    bool operator!=(const PostProcessChain & other) const;
+
+private:
+
+    std::vector<PostProcessStage> _stages;
+};
@@ -0,0 +1,231 @@
+#include "radixsort.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+static const int RADIX_BITS = 4;
+static const size_t RADIX = 1 << RADIX_BITS;
+
+// Ranking in the scatter kernel is linear in the local size
+static const size_t MAX_LOCAL_SIZE = 256;
+
+RadixSorter::RadixSorter(std::shared_ptr<CLContextWrapper> context) : _clContext(context), _localSize(0), _capacity(0),
+    _tempKeysBufferId(nullptr), _tempValuesBufferId(nullptr), _histogramBufferId(nullptr)
+{
+
+}
+
+bool RadixSorter::prepareKernels()
+{
+    _prefixSumKernel = _clContext->prepareKernel("prefixSum");
+    _addBlockSumsKernel = _clContext->prepareKernel("addBlockSumsKernel");
+    _histogramKernel = _clContext->prepareKernel("radixHistogramKernel");
+    _scatterKernel = _clContext->prepareKernel("radixScatterKernel");
+
+    size_t maxItems = std::min(MAX_LOCAL_SIZE, _clContext->getDeviceInfo().maxWorkGroupSize);
+    for(const BoundKernel * kernel : {&_prefixSumKernel, &_addBlockSumsKernel, &_histogramKernel, &_scatterKernel})
+    {
+        if(!kernel->isValid())
+        {
+            _localSize = 0;
+            return false;
+        }
+        maxItems = std::min(maxItems, kernel->getWorkGroupSize());
+    }
+
+    size_t localSize = RADIX;
+    while(localSize * 2 <= maxItems)
+    {
+        localSize *= 2;
+    }
+
+    if(localSize > maxItems)
+    {
+        std::cout << "Radix sort needs work groups of at least " << RADIX << " items" << std::endl;
+        _localSize = 0;
+        return false;
+    }
+
+    // Histogram size depends on the local size
+    if(localSize != _localSize)
+    {
+        _capacity = 0;
+    }
+    _localSize = localSize;
+    return true;
+}
+
+bool RadixSorter::reserve(size_t maxCount)
+{
+    if(_localSize == 0)
+    {
+        return false;
+    }
+    if(maxCount <= _capacity)
+    {
+        return true;
+    }
+
+    size_t groups = (maxCount + _localSize - 1) / _localSize;
+
+    for(BufferId * bufferId : {&_tempKeysBufferId, &_tempValuesBufferId, &_histogramBufferId})
+    {
+        if(*bufferId)
+        {
+            _clContext->releaseBuffer(*bufferId);
+            *bufferId = nullptr;
+        }
+    }
+
+    _tempKeysBufferId   = _clContext->createBuffer(sizeof(unsigned int) * maxCount, nullptr, BufferType::READ_AND_WRITE);
+    _tempValuesBufferId = _clContext->createBuffer(sizeof(int) * maxCount, nullptr, BufferType::READ_AND_WRITE);
+    _histogramBufferId  = _clContext->createBuffer(sizeof(int) * RADIX * groups, nullptr, BufferType::READ_AND_WRITE);
+
+    if(!_tempKeysBufferId || !_tempValuesBufferId || !_histogramBufferId)
+    {
+        std::cout << "Failed to create radix sort buffers" << std::endl;
+        _capacity = 0;
+        return false;
+    }
+
+    _capacity = maxCount;
+    return true;
+}
+
+bool RadixSorter::sort(BufferId keys, BufferId values, size_t count, int keyBits)
+{
+    if(count <= 1)
+    {
+        return true;
+    }
+    if(!reserve(count))
+    {
+        return false;
+    }
+
+    // An even number of passes leaves the result in the input buffers
+    int passes = (keyBits + RADIX_BITS - 1) / RADIX_BITS;
+    passes += passes % 2;
+
+    size_t groups = (count + _localSize - 1) / _localSize;
+    NDRange range = _getRange(groups);
+
+    BufferId srcKeys = keys;
+    BufferId srcValues = values;
+    BufferId dstKeys = _tempKeysBufferId;
+    BufferId dstValues = _tempValuesBufferId;
+
+    int n = static_cast<int>(count);
+
+    bool ok = true;
+    for(int pass = 0; pass < passes && ok; pass++)
+    {
+        int shift = pass * RADIX_BITS;
+
+        ok &= _histogramKernel.setArg(0, srcKeys);
+        ok &= _histogramKernel.setArg(1, _histogramBufferId);
+        ok &= _histogramKernel.setArg(2, n);
+        ok &= _histogramKernel.setArg(3, shift);
+        ok &= _clContext->dispatchKernel(_histogramKernel, range);
+
+        ok &= exclusiveScan(_histogramBufferId, _histogramBufferId, RADIX * groups);
+
+        ok &= _scatterKernel.setArg(0, srcKeys);
+        ok &= _scatterKernel.setArg(1, srcValues);
+        ok &= _scatterKernel.setArg(2, dstKeys);
+        ok &= _scatterKernel.setArg(3, dstValues);
+        ok &= _scatterKernel.setArg(4, _histogramBufferId);
+        ok &= _scatterKernel.setLocalArg(5, sizeof(unsigned int) * _localSize);
+        ok &= _scatterKernel.setArg(6, n);
+        ok &= _scatterKernel.setArg(7, shift);
+        ok &= _clContext->dispatchKernel(_scatterKernel, range);
+        std::swap(srcKeys, dstKeys);
+        std::swap(srcValues, dstValues);
+    }
+
+    if(!ok)
+    {
+        std::cout << "Radix sort failed" << std::endl;
+    }
+    return ok;
+}
+
+bool RadixSorter::exclusiveScan(BufferId input, BufferId output, size_t count)
+{
+    if(_localSize == 0)
+    {
+        return false;
+    }
+    return _scanLevel(input, output, count, 0);
+}
+
+size_t RadixSorter::getLocalSize() const
+{
+    return _localSize;
+}
+
+bool RadixSorter::_scanLevel(BufferId input, BufferId output, size_t count, size_t level)
+{
+    size_t blockElements = _localSize * 2;
+    size_t groups = (count + blockElements - 1) / blockElements;
+
+    if(level >= _blockSumsBufferIds.size())
+    {
+        _blockSumsBufferIds.push_back(nullptr);
+        _blockSumsCapacities.push_back(0);
+    }
+    if(groups > _blockSumsCapacities[level])
+    {
+        if(_blockSumsBufferIds[level])
+        {
+            _clContext->releaseBuffer(_blockSumsBufferIds[level]);
+        }
+        _blockSumsBufferIds[level] = _clContext->createBuffer(sizeof(int) * groups, nullptr, BufferType::READ_AND_WRITE);
+        _blockSumsCapacities[level] = _blockSumsBufferIds[level] ? groups : 0;
+    }
+
+    BufferId blockSums = _blockSumsBufferIds[level];
+    if(!blockSums)
+    {
+        return false;
+    }
+
+    NDRange range = _getRange(groups);
+    int n = static_cast<int>(count);
+
+    bool ok = _prefixSumKernel.setArg(0, input);
+    ok &= _prefixSumKernel.setArg(1, output);
+    ok &= _prefixSumKernel.setArg(2, blockSums);
+    ok &= _prefixSumKernel.setLocalArg(3, sizeof(int) * blockElements);
+    ok &= _prefixSumKernel.setArg(4, n);
+    if(!ok || !_clContext->dispatchKernel(_prefixSumKernel, range))
+    {
+        return false;
+    }
+
+    if(groups == 1)
+    {
+        return true;
+    }
+
+    // Scan the block totals and add them back
+    if(!_scanLevel(blockSums, blockSums, groups, level + 1))
+    {
+        return false;
+    }
+
+    ok = _addBlockSumsKernel.setArg(0, output);
+    ok &= _addBlockSumsKernel.setArg(1, blockSums);
+    ok &= _addBlockSumsKernel.setArg(2, n);
+    return ok && _clContext->dispatchKernel(_addBlockSumsKernel, range);
+}
+
+NDRange RadixSorter::_getRange(size_t groups) const
+{
+    NDRange range;
+    range.workDim = 1;
+    range.globalSize[0] = groups * _localSize;
+    range.localSize[0] = _localSize;
+    return range;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+
+#include <memory>
+#include <vector>
+
+// Device LSD radix sort of uint keys with int values and the exclusive scan it
+// is built on. The kernels live in prefix_sum.cl and radix_sort.cl, which must
+// be part of the program built on the context.
+class RadixSorter
+{
+public:
+    RadixSorter(std::shared_ptr<CLContextWrapper> context);
+
+    // Call after every program build
+    bool prepareKernels();
+
+    // Scratch buffers for sorting up to maxCount elements
+    bool reserve(size_t maxCount);
+
+    // Sorts in place by the lowest keyBits bits of the keys, values move along
+    bool sort(BufferId keys, BufferId values, size_t count, int keyBits = 32);
+
+    // Exclusive scan of count ints, input and output may be the same buffer
+    bool exclusiveScan(BufferId input, BufferId output, size_t count);
+
+    size_t getLocalSize() const;
+
+private:
+
+    bool _scanLevel(BufferId input, BufferId output, size_t count, size_t level);
+
+    NDRange _getRange(size_t groups) const;
+
+private:
+
+    std::shared_ptr<CLContextWrapper> _clContext;
+
+    BoundKernel _prefixSumKernel;
+    BoundKernel _addBlockSumsKernel;
+    BoundKernel _histogramKernel;
+    BoundKernel _scatterKernel;
+
+    // Shared by all sort and scan kernels, a power of two
+    size_t _localSize;
+
+    size_t _capacity;
+    BufferId _tempKeysBufferId;
+    BufferId _tempValuesBufferId;
+    BufferId _histogramBufferId;
+
+    // One buffer of block totals per scan level, they only grow
+    std::vector<BufferId> _blockSumsBufferIds;
+    std::vector<size_t> _blockSumsCapacities;
+};
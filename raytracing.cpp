@@ -1,15 +1,87 @@
 #include "raytracing.h"
 #include <iostream>
 
+#include <QDir>
 #include <QFile>
+#include <QStandardPaths>
 #include <QTextStream>
 #include <timer.h>
 
+#include <algorithm>
+#include <limits>
 
-RayTracing::RayTracing(dwg::Scene scene, unsigned int glTexture, int textureWidth, int textureHeight) : _textureWidth(textureWidth), _textureHeight(textureHeight)
+// Buffers behind INSTANCE_ARGS in instances.cl
+static const int INSTANCE_ARG_COUNT = 7;
+
+// Width of the secondary ray keys of getRayKey in raytracing.cl, six radix passes
+// instead of eight. NO_RAY_KEY has every bit set, so it still sorts last (or ties
+// with the largest real key).
+static const int RAY_KEY_BITS = 24;
+
+
+RayTracing::RayTracing(dwg::Scene scene, unsigned int glTexture, int textureWidth, int textureHeight) : _textureWidth(textureWidth), _textureHeight(textureHeight), _frameMetrics(nullptr), _needsTuning(false), _multiDeviceEnabled(false)
 {
-    localSizeX = 16;
-    localSizeY = 16;
+    _spheresBufferId = nullptr;
+    _planesBufferId = nullptr;
+    _lightsBufferId = nullptr;
+    _spheresImageId = nullptr;
+    _planesImageId = nullptr;
+    _bottomNodesBufferId = _bottomInfosBufferId = nullptr;
+    _meshVerticesBufferId = _meshTrianglesBufferId = _groupSpheresBufferId = nullptr;
+    _topNodesBufferId = _instancesBufferId = nullptr;
+    _numInstances = 0;
+    _sphereAccelerationDirty = true;
+    _tileCounterReset = 0;
+    _hasBuiltProgram = false;
+    _hasForcedSceneStorage = false;
+    _forcedSceneStorage = SceneStorage::GLOBAL;
+    _hasForcedColorFormat = false;
+    _forcedColorFormat = ColorFormat::FLOAT4;
+    _accumulationEnabled = false;
+    _accumulatedFrames = 0;
+    _accumulationBufferId = nullptr;
+    _denoiseEnabled = false;
+    _jitterEnabled = false;
+    _frameSeed = 0;
+    _renderConfig.colorFormat = _chooseColorFormat();
+    _postProcessChain = PostProcessChain::getDefault();
+
+    _reprojectionEnabled = false;
+    _reprojectionHistoryValid = false;
+    _reprojectionMaxAge = 30;
+    _reprojectionRefreshPeriod = 16;
+    _reprojectionIndex = 0;
+    _reprojectionHitsBufferIds[0] = _reprojectionHitsBufferIds[1] = nullptr;
+    _reprojectionColorsBufferIds[0] = _reprojectionColorsBufferIds[1] = nullptr;
+    _reprojectionDepthBufferId = nullptr;
+    _reprojectionSourceBufferId = nullptr;
+    _tracePixelsBufferId = nullptr;
+    _traceCountBufferId = nullptr;
+    _traceCountReset = 0;
+    _tracedPixelCount = 0;
+    _tracedPixelCountRead = nullptr;
+    for(BufferId & id : _gbufferBufferIds)
+    {
+        id = nullptr;
+    }
+    _cameraConstants = computeCameraConstants(_camera, _textureWidth, _textureHeight);
+    _readbackEnabled = false;
+    _frameIndex = 0;
+
+    _multiQueueEnabled = false;
+    _colorsBufferIds[0] = _colorsBufferIds[1] = nullptr;
+    _colorsReadEvents[0] = _colorsReadEvents[1] = nullptr;
+    _backSceneBuffers.spheres = _backSceneBuffers.planes = _backSceneBuffers.lights = nullptr;
+    _backSceneBuffers.lastUse = nullptr;
+    _frontSceneLastUse = nullptr;
+    _backSceneUploaded = nullptr;
+    _hasBackScene = false;
+    for(TraceMarkers & markers : _traceMarkers)
+    {
+        markers.frameIndex = 0;
+        markers.started = markers.ended = nullptr;
+        markers.pendingTraceTime = false;
+    }
 
     // Create OpenCL context
     _clContext = std::make_shared<CLContextWrapper>();
@@ -34,34 +106,62 @@ RayTracing::RayTracing(dwg::Scene scene, unsigned int glTexture, int textureWidt
     _glTexture = glTexture;
     _sharedTextureBufferId = _clContext->shareGLTexture(_glTexture, BufferType::WRITE_ONLY);
 
-    // Setup scene
-    _numSpheres = static_cast<int>(scene.spheres.size());
-    _numPlanes = static_cast<int>(scene.planes.size());
-    _numLights = static_cast<int>(scene.lights.size());
+    _sceneBufferPool = std::make_shared<BufferPool>(_clContext, 1 << 20, BufferType::READ_ONLY);
 
-    // Setup buffers
-    _spheresBufferId = _clContext->createBufferFromArray(scene.spheres.size(), &(scene.spheres.data()[0]), BufferType::READ_ONLY);
-    _planesBufferId  = _clContext->createBufferFromArray(scene.planes.size(),  &(scene.planes.data()[0]),  BufferType::READ_ONLY);
-    _lightsBufferId  = _clContext->createBufferFromArray(scene.lights.size(),  &(scene.lights.data()[0]),  BufferType::READ_ONLY);
+    // Temp Texture, sized for float4 so the color format can change without reallocating
+    _colorsBufferIds[0]  = _clContext->createBuffer(  4*sizeof(float) * _textureWidth*_textureHeight, nullptr, BufferType::READ_AND_WRITE);
+    _tempColorsBufferId  = _colorsBufferIds[0];
+
+    // Persistent threads tile queue
+    _tileCounterBufferId = _clContext->createBufferFromArray(1, &_tileCounterReset, BufferType::READ_AND_WRITE);
+
+    // Wavefront secondary ray queue
+    size_t numPixels = static_cast<size_t>(_textureWidth) * _textureHeight;
+    _raysBufferId         = _clContext->createBuffer(8*sizeof(float) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+    _primaryColorsBufferId = _clContext->createBuffer(4*sizeof(float) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+    _rayKeysBufferId      = _clContext->createBuffer(sizeof(unsigned int) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+    _rayIndicesBufferId   = _clContext->createBuffer(sizeof(int) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+    _bounceCountsBufferId = _clContext->createBuffer(sizeof(int) * numPixels, nullptr, BufferType::READ_AND_WRITE);
 
-    // Temp Texture
-    _tempColorsBufferId  = _clContext->createBuffer(  4*sizeof(float) * _textureWidth*_textureHeight, nullptr, BufferType::READ_AND_WRITE);
+    // Shown in buffer errors
+    _clContext->setBufferName(_sharedTextureBufferId, "shared texture");
+    _clContext->setBufferName(_colorsBufferIds[0], "colors 0");
+    _clContext->setBufferName(_tileCounterBufferId, "tile counter");
+    _clContext->setBufferName(_raysBufferId, "rays");
+    _clContext->setBufferName(_primaryColorsBufferId, "primary colors");
+    _clContext->setBufferName(_rayKeysBufferId, "ray keys");
+    _clContext->setBufferName(_rayIndicesBufferId, "ray indices");
+    _clContext->setBufferName(_bounceCountsBufferId, "bounce counts");
 
-    // Prepare program
-    QFile kernelSourceFile(":/cl_files/raytracing.cl");
+    _radixSorter = std::make_shared<RadixSorter>(_clContext);
+    _lbvhBuilder = std::make_shared<LinearBVHBuilder>(_clContext, _radixSorter);
+    _gridBuilder = std::make_shared<SphereGridBuilder>(_clContext, _radixSorter);
+    _denoiser = std::make_shared<Denoiser>(_clContext);
 
-    if(!kernelSourceFile.open(QIODevice::Text | QIODevice::ReadOnly))
+    // Prepare program, helpers first since raytracing.cl has the kernels using them.
+    // The denoiser reads colors with the helpers of raytracing.cl.
+    const char * kernelFiles[] = {":/cl_files/prefix_sum.cl", ":/cl_files/radix_sort.cl", ":/cl_files/lbvh.cl", ":/cl_files/grid.cl", ":/cl_files/instances.cl", ":/cl_files/raytracing.cl", ":/cl_files/denoise.cl"};
+    for(const char * kernelFile : kernelFiles)
     {
-        std::cout << "Failed to load cl file" << std::endl;
-        return;
+        QFile kernelSourceFile(kernelFile);
+
+        if(!kernelSourceFile.open(QIODevice::Text | QIODevice::ReadOnly))
+        {
+            std::cout << "Failed to load cl file " << kernelFile << std::endl;
+            return;
+        }
+        QTextStream kernelSourceTS(&kernelSourceFile);
+        QString clSource = kernelSourceTS.readAll();
+
+        _kernelSource += clSource.toStdString() + "\n";
     }
-    QTextStream kernelSourceTS(&kernelSourceFile);
-    QString clSource = kernelSourceTS.readAll();
 
-    _clContext->createProgramFromSource(clSource.toStdString());
+    // A previous run may already know the best local size for this device and kernel
+    QString tuningDir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    QDir().mkpath(tuningDir);
+    _workGroupTuner = std::make_shared<WorkGroupTuner>((tuningDir + "/workgroup_tuning.txt").toStdString());
 
-    _clContext->prepareKernel("rayTracingKernel");
-    _clContext->prepareKernel("drawToTextureKernel");
+    setScene(scene);
 }
 
 void testScan(CLContextWrapper * _clContext);
@@ -78,44 +178,1661 @@ void RayTracing::update()
         std::cout << "OpenCL context not created!" << std::endl;
         return;
     }
-    NDRange range;
-    range.workDim = 2;
-    range.globalOffset[0] = 0;
-    range.globalOffset[1] = 0;
-    range.globalSize[0] = _textureWidth;
-    range.globalSize[1] = _textureHeight;
-    range.localSize[0] = localSizeX;
-    range.localSize[1] = localSizeY;
+    if(_needsTuning)
+    {
+        _autotuneLocalSize();
+    }
+
+    // Hand out frames that arrived since the last update
+    if(_readbackRing)
+    {
+        _readbackRing->poll();
+    }
+
+    // The color buffer of two frames ago may still be read back
+    int colorsIndex = 0;
+    if(_multiQueueEnabled)
+    {
+        colorsIndex = static_cast<int>(_frameIndex % 2);
+        _tempColorsBufferId = _colorsBufferIds[colorsIndex];
+        if(_colorsReadEvents[colorsIndex])
+        {
+            _clContext->enqueueWaitForEvents(QueueType::COMPUTE, &_colorsReadEvents[colorsIndex], 1);
+        }
+    }
+
+    // Device trace times of earlier frames whose markers completed by now
+    _resolveTraceTimes();
+
+    TraceMarkers & traceMarkers = _traceMarkers[_frameIndex % 4];
+    _clContext->releaseEvent(traceMarkers.started);
+    _clContext->releaseEvent(traceMarkers.ended);
+    traceMarkers.frameIndex = _frameIndex;
+    traceMarkers.started = _clContext->enqueueMarker(QueueType::COMPUTE);
+    traceMarkers.pendingTraceTime = false;
+
+    util::Timer stageTimer;
 
-    int iterations = 6;
+    if(_multiDeviceEnabled && _multiDeviceTracer)
+    {
+        // Every device traces a band into host memory, the shared context only presents it
+        _multiDeviceTracer->trace(_cameraConstants, _hostColors.data());
+        _clContext->uploadArrayToBuffer(_tempColorsBufferId, _hostColors.size(), _hostColors.data());
+
+        if(_frameMetrics)
+        {
+            _frameMetrics->record(util::FrameStage::DEVICE_TRACE, stageTimer.elapsedMilliSec());
+            stageTimer.restart();
+        }
+    }
+    else
+    {
+        _traceFrame();
+
+        if(_frameMetrics)
+        {
+            _frameMetrics->record(util::FrameStage::CPU_SUBMIT, stageTimer.elapsedMilliSec());
+            stageTimer.restart();
+        }
+
+        // Recorded from the markers' timestamps once they completed, without waiting here
+        traceMarkers.pendingTraceTime = _frameMetrics != nullptr;
+    }
 
-    size_t localTempSize = sizeof(float)*16*localSizeX*localSizeY;
-    size_t localLightSize = sizeof(float)*8*_numLights;
+    traceMarkers.ended = _clContext->enqueueMarker(QueueType::COMPUTE);
 
-    _clContext->dispatchKernel("rayTracingKernel", range, {&_tempColorsBufferId,
-                                                    &_spheresBufferId, &_numSpheres,
-                                                    &_planesBufferId, &_numPlanes,
-                                                    &_lightsBufferId, &_numLights,
-                                                    KernelArg::getShared(localTempSize),
-                                                    KernelArg::getShared(localLightSize),
-                                                    &iterations,
-                                                    &_eye.x, &_eye.y, &_eye.z});
+    NDRange range = _getFrameRange();
 
+    bool accumulate = _accumulationEnabled && _accumulationBufferId;
+    float accumulationWeight = 1.0f / (_accumulatedFrames + 1);
 
-    _clContext->executeSafeAndSyncronized(&_sharedTextureBufferId, 1, [=] () mutable
+    // Filters the linear frame after accumulation, the color buffers stay unfiltered
+    bool denoise = _denoiseEnabled && !_multiDeviceEnabled;
+    BufferId denoisedBufferId = nullptr;
+
+    _clContext->executeSafeAndSyncronized(&_sharedTextureBufferId, 1, [=, &denoisedBufferId] () mutable
     {
-        _clContext->dispatchKernel("drawToTextureKernel", range, {&_sharedTextureBufferId,
-                                                                  &_tempColorsBufferId});
+        if(accumulate)
+        {
+            _accumulateKernel.setArg(0, _sharedTextureBufferId);
+            _accumulateKernel.setArg(1, _accumulationBufferId);
+            _accumulateKernel.setArg(2, _tempColorsBufferId);
+            _accumulateKernel.setArg(3, _textureWidth);
+            _accumulateKernel.setArg(4, _textureHeight);
+            _accumulateKernel.setArg(5, accumulationWeight);
+            _accumulateKernel.setArg(6, denoise ? 0 : 1);
+            _clContext->dispatchKernel(_accumulateKernel, range);
+        }
+
+        if(denoise && _denoiser->denoise(accumulate ? _accumulationBufferId : _tempColorsBufferId,
+                                         accumulate ? ColorFormat::FLOAT4 : _renderConfig.colorFormat,
+                                         getGBuffer(GBufferChannel::DEPTH), getGBuffer(GBufferChannel::NORMAL),
+                                         _textureWidth, _textureHeight, range, _denoiseParams))
+        {
+            denoisedBufferId = _denoiser->getOutput();
+        }
+
+        // The average is not presented yet when denoising was asked for but ran no pass
+        BufferId floatColors = denoisedBufferId ? denoisedBufferId : (accumulate && denoise ? _accumulationBufferId : nullptr);
+        if(floatColors)
+        {
+            _drawFloatsToTextureKernel.setArg(0, _sharedTextureBufferId);
+            _drawFloatsToTextureKernel.setArg(1, floatColors);
+            _drawFloatsToTextureKernel.setArg(2, _textureWidth);
+            _drawFloatsToTextureKernel.setArg(3, _textureHeight);
+            _clContext->dispatchKernel(_drawFloatsToTextureKernel, range);
+        }
+        else if(!accumulate)
+        {
+            _drawToTextureKernel.setArg(0, _sharedTextureBufferId);
+            _drawToTextureKernel.setArg(1, _tempColorsBufferId);
+            _drawToTextureKernel.setArg(2, _textureWidth);
+            _drawToTextureKernel.setArg(3, _textureHeight);
+            _clContext->dispatchKernel(_drawToTextureKernel, range);
+        }
     });
+
+    if(accumulate)
+    {
+        _accumulatedFrames++;
+    }
+
+    if(_frameMetrics)
+    {
+        _frameMetrics->record(util::FrameStage::INTEROP_ACQUIRE, stageTimer.elapsedMilliSec());
+    }
+
+    // After the synchronized present, so the copy overlaps with the next frame. The single
+    // accumulation buffer and the denoiser's output are rewritten every frame and are read
+    // in order on the compute queue.
+    if(_readbackEnabled && denoisedBufferId)
+    {
+        _readbackRing->enqueue(denoisedBufferId, _frameIndex, ColorFormat::FLOAT4);
+    }
+    else if(_readbackEnabled && accumulate)
+    {
+        _readbackRing->enqueue(_accumulationBufferId, _frameIndex, ColorFormat::FLOAT4);
+    }
+    else if(_readbackEnabled && _multiQueueEnabled)
+    {
+        _readbackRing->enqueue(_tempColorsBufferId, _frameIndex, _renderConfig.colorFormat, QueueType::TRANSFER, &traceMarkers.ended, 1);
+
+        _clContext->releaseEvent(_colorsReadEvents[colorsIndex]);
+        _colorsReadEvents[colorsIndex] = _clContext->enqueueMarker(QueueType::TRANSFER);
+    }
+    else if(_readbackEnabled)
+    {
+        _readbackRing->enqueue(_tempColorsBufferId, _frameIndex, _renderConfig.colorFormat);
+    }
+    _frameIndex++;
 }
 
-void RayTracing::setEye(glm::vec3 eye)
+void RayTracing::setMultiQueueEnabled(bool enabled)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || enabled == _multiQueueEnabled)
+    {
+        return;
+    }
+
+    _clContext->finish();
+
+    if(enabled && !_colorsBufferIds[1])
+    {
+        _colorsBufferIds[1] = _clContext->createBuffer(4*sizeof(float) * _textureWidth*_textureHeight, nullptr, BufferType::READ_AND_WRITE);
+        if(!_colorsBufferIds[1])
+        {
+            std::cout << "Multi queue rendering not available" << std::endl;
+            return;
+        }
+        _clContext->setBufferName(_colorsBufferIds[1], "colors 1");
+    }
+
+    _multiQueueEnabled = enabled;
+    _tempColorsBufferId = _colorsBufferIds[0];
+}
+
+bool RayTracing::isMultiQueueEnabled() const
 {
-    _eye = eye;
+    return _multiQueueEnabled;
 }
 
-glm::vec3 RayTracing::getEye() const
+void RayTracing::setAccumulationEnabled(bool enabled)
+{
+    if(!_clContext || !_clContext->hasCreatedContext())
+    {
+        return;
+    }
+
+    if(enabled && !_accumulationBufferId)
+    {
+        _accumulationBufferId = _clContext->createBuffer(4*sizeof(float) * _textureWidth*_textureHeight, nullptr, BufferType::READ_AND_WRITE);
+        if(!_accumulationBufferId)
+        {
+            std::cout << "Accumulation not available" << std::endl;
+            return;
+        }
+        _clContext->setBufferName(_accumulationBufferId, "accumulation");
+    }
+
+    // A restarted average traces the same random sequence, so averages can be compared
+    _accumulationEnabled = enabled;
+    _accumulatedFrames = 0;
+    _frameSeed = 0;
+}
+
+bool RayTracing::isAccumulationEnabled() const
+{
+    return _accumulationEnabled;
+}
+
+void RayTracing::setColorFormat(ColorFormat format)
+{
+    _hasForcedColorFormat = true;
+    _forcedColorFormat = format;
+    _updateColorFormat();
+}
+
+void RayTracing::resetColorFormat()
+{
+    _hasForcedColorFormat = false;
+    _updateColorFormat();
+}
+
+ColorFormat RayTracing::getColorFormat() const
+{
+    return _renderConfig.colorFormat;
+}
+
+bool RayTracing::isColorFormatForced() const
+{
+    return _hasForcedColorFormat;
+}
+
+void RayTracing::setReprojectionEnabled(bool enabled)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || enabled == _reprojectionEnabled)
+    {
+        return;
+    }
+
+    if(enabled && !_traceCountBufferId)
+    {
+        size_t numPixels = static_cast<size_t>(_textureWidth) * _textureHeight;
+        for(int i = 0 ; i < 2; i++)
+        {
+            _reprojectionHitsBufferIds[i]   = _clContext->createBuffer(4*sizeof(float) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+            _reprojectionColorsBufferIds[i] = _clContext->createBuffer(4*sizeof(float) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+        }
+        _reprojectionDepthBufferId  = _clContext->createBuffer(sizeof(unsigned int) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+        _reprojectionSourceBufferId = _clContext->createBuffer(sizeof(int) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+        _tracePixelsBufferId        = _clContext->createBuffer(sizeof(int) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+        _traceCountBufferId         = _clContext->createBufferFromArray(1, &_traceCountReset, BufferType::READ_AND_WRITE);
+
+        if(!_reprojectionHitsBufferIds[0] || !_reprojectionHitsBufferIds[1] ||
+           !_reprojectionColorsBufferIds[0] || !_reprojectionColorsBufferIds[1] ||
+           !_reprojectionDepthBufferId || !_reprojectionSourceBufferId || !_tracePixelsBufferId || !_traceCountBufferId)
+        {
+            std::cout << "Reprojection not available" << std::endl;
+            return;
+        }
+
+        _clContext->setBufferName(_reprojectionHitsBufferIds[0], "reprojection hits 0");
+        _clContext->setBufferName(_reprojectionHitsBufferIds[1], "reprojection hits 1");
+        _clContext->setBufferName(_reprojectionColorsBufferIds[0], "reprojection colors 0");
+        _clContext->setBufferName(_reprojectionColorsBufferIds[1], "reprojection colors 1");
+        _clContext->setBufferName(_reprojectionDepthBufferId, "reprojection depth");
+        _clContext->setBufferName(_reprojectionSourceBufferId, "reprojection source");
+        _clContext->setBufferName(_tracePixelsBufferId, "trace pixels");
+        _clContext->setBufferName(_traceCountBufferId, "trace count");
+    }
+
+    _collectReprojectionCount();
+    _reprojectionEnabled = enabled;
+    _reprojectionHistoryValid = false;
+}
+
+bool RayTracing::isReprojectionEnabled() const
+{
+    return _reprojectionEnabled;
+}
+
+void RayTracing::setReprojectionLimits(int maxAge, int refreshPeriod)
+{
+    _reprojectionMaxAge = std::max(1, maxAge);
+    _reprojectionRefreshPeriod = std::max(0, refreshPeriod);
+}
+
+ReprojectionStats RayTracing::getReprojectionStats() const
+{
+    return _reprojectionStats;
+}
+
+void RayTracing::resetReprojectionStats()
+{
+    _reprojectionStats = ReprojectionStats();
+}
+
+void RayTracing::setGBufferEnabled(bool enabled)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || enabled == _renderConfig.gbuffer)
+    {
+        return;
+    }
+
+    if(enabled && !_gbufferBufferIds[0])
+    {
+        size_t numPixels = static_cast<size_t>(_textureWidth) * _textureHeight;
+        for(int i = 0 ; i < static_cast<int>(GBufferChannel::COUNT); i++)
+        {
+            GBufferChannel channel = static_cast<GBufferChannel>(i);
+            _gbufferBufferIds[i] = _clContext->createBuffer(getGBufferChannelBytes(channel) * numPixels, nullptr, BufferType::READ_AND_WRITE);
+            if(!_gbufferBufferIds[i])
+            {
+                std::cout << "G-buffer not available" << std::endl;
+                return;
+            }
+            _clContext->setBufferName(_gbufferBufferIds[i], std::string("gbuffer ") + getGBufferChannelName(channel));
+        }
+    }
+
+    _renderConfig.gbuffer = enabled;
+    if(!enabled)
+    {
+        // Guided by the G-buffer
+        _denoiseEnabled = false;
+    }
+    if(_hasBuiltProgram)
+    {
+        _clContext->finish();
+        _buildProgram();
+    }
+}
+
+bool RayTracing::isGBufferEnabled() const
+{
+    return _renderConfig.gbuffer;
+}
+
+BufferId RayTracing::getGBuffer(GBufferChannel channel) const
+{
+    return _renderConfig.gbuffer ? _gbufferBufferIds[static_cast<int>(channel)] : BufferId();
+}
+
+bool RayTracing::downloadGBuffer(GBufferChannel channel, void * data)
+{
+    BufferId id = getGBuffer(channel);
+    if(!id)
+    {
+        return false;
+    }
+
+    size_t bytes = getGBufferChannelBytes(channel) * _textureWidth * _textureHeight;
+    return _clContext->dowloadFromBuffer(id, bytes, data);
+}
+
+int RayTracing::pickObject(int x, int y)
+{
+    BufferId id = getGBuffer(GBufferChannel::OBJECT_ID);
+    if(!id || x < 0 || y < 0 || x >= _textureWidth || y >= _textureHeight)
+    {
+        return GBUFFER_NO_OBJECT;
+    }
+
+    int objectId = GBUFFER_NO_OBJECT;
+    size_t offset = sizeof(int) * (static_cast<size_t>(y) * _textureWidth + x);
+    if(!_clContext->dowloadFromBuffer(id, sizeof(int), &objectId, offset))
+    {
+        return GBUFFER_NO_OBJECT;
+    }
+    return objectId;
+}
+
+void RayTracing::setDenoiseEnabled(bool enabled)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || enabled == _denoiseEnabled)
+    {
+        return;
+    }
+
+    if(enabled)
+    {
+        setGBufferEnabled(true);
+        if(!_renderConfig.gbuffer || !_denoiser->reserve(static_cast<size_t>(_textureWidth) * _textureHeight))
+        {
+            std::cout << "Denoising not available" << std::endl;
+            return;
+        }
+    }
+
+    // The average stays valid, it is filtered after accumulating
+    _denoiseEnabled = enabled;
+}
+
+bool RayTracing::isDenoiseEnabled() const
+{
+    return _denoiseEnabled;
+}
+
+void RayTracing::setDenoiseParams(const DenoiseParams & params)
+{
+    // Only the filtered output changes, the average keeps its samples
+    _denoiseParams = params;
+}
+
+const DenoiseParams & RayTracing::getDenoiseParams() const
+{
+    return _denoiseParams;
+}
+
+void RayTracing::setJitterEnabled(bool enabled)
+{
+    _jitterEnabled = enabled;
+    _accumulatedFrames = 0;
+}
+
+bool RayTracing::isJitterEnabled() const
+{
+    return _jitterEnabled;
+}
+
+void RayTracing::setMaxBounces(int maxBounces)
+{
+    _renderConfig.maxBounces = std::max(0, maxBounces);
+    _accumulatedFrames = 0;
+    _reprojectionHistoryValid = false;
+    _rebuildMultiDeviceTracer();
+}
+
+void RayTracing::setRussianRouletteEnabled(bool enabled)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || enabled == _renderConfig.russianRoulette)
+    {
+        return;
+    }
+
+    _renderConfig.russianRoulette = enabled;
+    _accumulatedFrames = 0;
+    _reprojectionHistoryValid = false;
+    if(_hasBuiltProgram)
+    {
+        _clContext->finish();
+        _buildProgram();
+    }
+    _rebuildMultiDeviceTracer();
+}
+
+bool RayTracing::isRussianRouletteEnabled() const
 {
-    return _eye;
+    return _renderConfig.russianRoulette;
+}
+
+void RayTracing::setSphereAcceleration(SphereAcceleration acceleration)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || acceleration == _renderConfig.sphereAcceleration)
+    {
+        return;
+    }
+
+    _renderConfig.sphereAcceleration = acceleration;
+    _scene.sphereAcceleration = acceleration;
+    _sphereAccelerationDirty = true;
+    if(_hasBuiltProgram)
+    {
+        _clContext->finish();
+        _buildProgram();
+    }
+    _rebuildMultiDeviceTracer();
+}
+
+SphereAcceleration RayTracing::getSphereAcceleration() const
+{
+    return _renderConfig.sphereAcceleration;
+}
+
+double RayTracing::measureSphereAccelerationBuildTime(int builds)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || builds <= 0 ||
+       _renderConfig.sphereAcceleration == SphereAcceleration::NONE)
+    {
+        return -1.0;
+    }
+
+    // Warm up
+    _sphereAccelerationDirty = true;
+    if(!_updateSphereAcceleration())
+    {
+        return -1.0;
+    }
+    _clContext->finish();
+
+    util::Timer timer;
+    for(int i = 0 ; i < builds; i++)
+    {
+        _sphereAccelerationDirty = true;
+        _updateSphereAcceleration();
+    }
+    _clContext->finish();
+
+    return timer.elapsedMilliSec() / builds;
+}
+
+void RayTracing::setPostProcessChain(const PostProcessChain & chain)
+{
+    if(chain == _postProcessChain)
+    {
+        return;
+    }
+
+    // Accumulated and reprojected colors are linear and stay valid, other
+    // devices only trace and keep their program
+    _postProcessChain = chain;
+    if(_hasBuiltProgram)
+    {
+        _clContext->finish();
+        _buildProgram();
+    }
+}
+
+const PostProcessChain & RayTracing::getPostProcessChain() const
+{
+    return _postProcessChain;
+}
+
+size_t RayTracing::getColorBytesPerFrame() const
+{
+    size_t pixels = static_cast<size_t>(_textureWidth) * _textureHeight;
+    size_t colorBytes = getColorFormatBytes(_renderConfig.colorFormat);
+
+    // Written by the trace, read by the present
+    size_t bytes = 2 * colorBytes * pixels;
+    if(_accumulationEnabled)
+    {
+        bytes += 2 * getColorFormatBytes(ColorFormat::FLOAT4) * pixels;
+    }
+    if(_readbackEnabled)
+    {
+        bytes += (_accumulationEnabled ? getColorFormatBytes(ColorFormat::FLOAT4) : colorBytes) * pixels;
+    }
+    return bytes;
+}
+
+ColorFormat RayTracing::_chooseColorFormat() const
+{
+    // Other devices trace into host float4 that is uploaded as is
+    if(_multiDeviceEnabled)
+    {
+        return ColorFormat::FLOAT4;
+    }
+    if(_hasForcedColorFormat)
+    {
+        return _forcedColorFormat;
+    }
+    return RenderConfig().colorFormat;
+}
+
+void RayTracing::_updateColorFormat()
+{
+    ColorFormat format = _chooseColorFormat();
+    if(format == _renderConfig.colorFormat)
+    {
+        return;
+    }
+
+    _renderConfig.colorFormat = format;
+    _accumulatedFrames = 0;
+    if(_hasBuiltProgram)
+    {
+        _clContext->finish();
+        _buildProgram();
+    }
+}
+
+void RayTracing::setQueueProfilingEnabled(bool enabled)
+{
+    if(_clContext && _clContext->hasCreatedContext())
+    {
+        _clContext->setProfilingEnabled(enabled);
+    }
+}
+
+bool RayTracing::isQueueProfilingEnabled() const
+{
+    return _clContext && _clContext->isProfilingEnabled();
+}
+
+QueueOverlapStats RayTracing::getQueueOverlapStats() const
+{
+    return _queueOverlapStats;
+}
+
+void RayTracing::resetQueueOverlapStats()
+{
+    _queueOverlapStats = QueueOverlapStats();
+}
+
+void RayTracing::_resolveTraceTimes()
+{
+    for(TraceMarkers & markers : _traceMarkers)
+    {
+        if(!markers.pendingTraceTime || !_clContext->isEventComplete(markers.ended))
+        {
+            continue;
+        }
+        markers.pendingTraceTime = false;
+
+        // Markers end when the commands before them did, fails while profiling is off
+        EventTimes started, ended;
+        if(_frameMetrics && _clContext->getEventTimes(markers.started, started) && _clContext->getEventTimes(markers.ended, ended) &&
+           ended.ended > started.ended)
+        {
+            _frameMetrics->record(util::FrameStage::DEVICE_TRACE, (ended.ended - started.ended) * 1e-6);
+        }
+    }
+}
+
+void RayTracing::_recordQueueOverlap(const ReadbackFrame & frame)
+{
+    if(!frame.hasTransferTimes)
+    {
+        return;
+    }
+
+    // Compare with the trace of the following frame, markers end when the commands before them did
+    const TraceMarkers & next = _traceMarkers[(frame.frameIndex + 1) % 4];
+    EventTimes started, ended;
+    if(next.frameIndex != frame.frameIndex + 1 || !next.started || !next.ended ||
+       !_clContext->getEventTimes(next.started, started) || !_clContext->getEventTimes(next.ended, ended))
+    {
+        return;
+    }
+
+    unsigned long long overlapStart = std::max(frame.transferTimes.started, started.ended);
+    unsigned long long overlapEnd = std::min(frame.transferTimes.ended, ended.ended);
+
+    _queueOverlapStats.frames++;
+    _queueOverlapStats.transferMilliSec += (frame.transferTimes.ended - frame.transferTimes.started) * 1e-6;
+    if(overlapEnd > overlapStart)
+    {
+        _queueOverlapStats.overlapMilliSec += (overlapEnd - overlapStart) * 1e-6;
+    }
+}
+
+void RayTracing::setReadbackCallback(ReadbackRing::FrameCallback callback)
+{
+    if(callback && !_readbackRing && _clContext && _clContext->hasCreatedContext())
+    {
+        _readbackRing = std::make_shared<ReadbackRing>(_clContext, _textureWidth, _textureHeight);
+    }
+
+    _readbackEnabled = callback && _readbackRing && _readbackRing->isValid();
+    if(_readbackRing && callback)
+    {
+        _readbackRing->setCallback([=] (const ReadbackFrame & frame)
+        {
+            _recordQueueOverlap(frame);
+            callback(frame);
+        });
+    }
+    else if(_readbackRing)
+    {
+        _readbackRing->setCallback(nullptr);
+    }
+}
+
+void RayTracing::flushReadback()
+{
+    if(_readbackRing)
+    {
+        _readbackRing->drain();
+    }
+}
+
+double RayTracing::measureTraceTime(int frames, std::function<void(int frame)> beforeFrame)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() || frames <= 0)
+    {
+        return -1.0;
+    }
+
+    // Warm up
+    if(!_traceFrame())
+    {
+        return -1.0;
+    }
+    _clContext->finish();
+
+    util::Timer timer;
+    for(int i = 0 ; i < frames; i++)
+    {
+        if(beforeFrame)
+        {
+            beforeFrame(i);
+        }
+        _traceFrame();
+    }
+    _clContext->finish();
+
+    return timer.elapsedMilliSec() / frames;
+}
+
+void RayTracing::setScene(const dwg::Scene & scene)
+{
+    if(!_clContext || !_clContext->hasCreatedContext())
+    {
+        return;
+    }
+    _accumulatedFrames = 0;
+    _reprojectionHistoryValid = false;
+
+    // Same program, upload behind the current trace and swap before the next one.
+    // Scene images and instanced geometry have no back copy and take the synchronous path.
+    if(_multiQueueEnabled && _hasBuiltProgram && _renderConfig.sceneStorage != SceneStorage::IMAGE &&
+       _chooseSceneStorage(scene) == _renderConfig.sceneStorage &&
+       scene.sphereAcceleration == _renderConfig.sphereAcceleration &&
+       scene.meshes.empty() && scene.sphereGroups.empty() && _scene.meshes.empty() && _scene.sphereGroups.empty())
+    {
+        _uploadBackScene(scene);
+        return;
+    }
+
+    // Buffers may be in use by either queue
+    _clContext->finish();
+    _releasePendingSceneBuffers();
+    _hasBackScene = false;
+
+    _scene = scene;
+    _updateSceneCounts();
+    _sphereAccelerationDirty = true;
+
+    // Setup buffers
+    _uploadSceneArray(_spheresBufferId, _scene.spheres);
+    _uploadSceneArray(_planesBufferId, _scene.planes);
+    _uploadSceneArray(_lightsBufferId, _scene.lights);
+    _uploadBottomLevels();
+    _uploadTopLevel();
+
+    // Storage may change with the scene size, instance arguments with the instances
+    // and the sphere acceleration with the scene's choice
+    SceneStorage sceneStorage = _chooseSceneStorage(_scene);
+    bool instances = _numInstances > 0;
+    if(!_hasBuiltProgram || sceneStorage != _renderConfig.sceneStorage || instances != _renderConfig.instances ||
+       _scene.sphereAcceleration != _renderConfig.sphereAcceleration)
+    {
+        _renderConfig.sceneStorage = sceneStorage;
+        _renderConfig.instances = instances;
+        _renderConfig.sphereAcceleration = _scene.sphereAcceleration;
+        _buildProgram();
+    }
+
+    if(sceneStorage == SceneStorage::IMAGE)
+    {
+        _uploadSceneImages();
+    }
+    else
+    {
+        _releaseSceneImages();
+    }
+
+    // Other devices keep their own copy of the scene
+    _rebuildMultiDeviceTracer();
+}
+
+bool RayTracing::setSceneStorage(SceneStorage storage)
+{
+    if(!_clContext || !_clContext->hasCreatedContext() ||
+       !isSceneStorageSupported(_clContext->getDeviceInfo(), _scene, storage))
+    {
+        return false;
+    }
+
+    _hasForcedSceneStorage = true;
+    _forcedSceneStorage = storage;
+    if(storage != _renderConfig.sceneStorage)
+    {
+        _clContext->finish();
+        _renderConfig.sceneStorage = storage;
+        _buildProgram();
+
+        if(storage == SceneStorage::IMAGE)
+        {
+            return _uploadSceneImages();
+        }
+        _releaseSceneImages();
+    }
+    return true;
+}
+
+void RayTracing::resetSceneStorage()
+{
+    _hasForcedSceneStorage = false;
+    if(!_clContext || !_clContext->hasCreatedContext())
+    {
+        return;
+    }
+
+    SceneStorage storage = _chooseSceneStorage(_scene);
+    if(storage != _renderConfig.sceneStorage)
+    {
+        _clContext->finish();
+        _renderConfig.sceneStorage = storage;
+        _buildProgram();
+        _releaseSceneImages();
+    }
+}
+
+SceneStorage RayTracing::getSceneStorage() const
+{
+    return _renderConfig.sceneStorage;
+}
+
+SceneStorage RayTracing::_chooseSceneStorage(const dwg::Scene & scene) const
+{
+    const DeviceInfo & device = _clContext->getDeviceInfo();
+
+    // A forced storage falls back to the automatic choice for scenes that do not fit
+    if(_hasForcedSceneStorage && isSceneStorageSupported(device, scene, _forcedSceneStorage))
+    {
+        return _forcedSceneStorage;
+    }
+    return chooseSceneStorage(device, scene);
+}
+
+void RayTracing::_updateSceneCounts()
+{
+    _numSpheres = static_cast<int>(_scene.spheres.size());
+    _numPlanes = static_cast<int>(_scene.planes.size());
+    _numLights = static_cast<int>(_scene.lights.size());
+
+    // Morton keys of secondary rays are relative to the scene box
+    glm::vec3 sceneMax;
+    getSceneBounds(_scene, _sceneMin, sceneMax);
+    _sceneInvExtent = glm::vec3(1.0f) / glm::max(sceneMax - _sceneMin, glm::vec3(1e-3f));
+}
+
+bool RayTracing::_uploadSceneImages()
+{
+    // Spheres are two texels, planes four
+    _replaceSceneImage(_spheresImageId, reinterpret_cast<const float *>(_scene.spheres.data()), 2 * _scene.spheres.size(), "scene spheres image");
+    _replaceSceneImage(_planesImageId,  reinterpret_cast<const float *>(_scene.planes.data()),  4 * _scene.planes.size(),  "scene planes image");
+    return _spheresImageId && _planesImageId;
+}
+
+void RayTracing::_releaseSceneImages()
+{
+    if(_spheresImageId)
+    {
+        _clContext->releaseBuffer(_spheresImageId);
+        _spheresImageId = nullptr;
+    }
+    if(_planesImageId)
+    {
+        _clContext->releaseBuffer(_planesImageId);
+        _planesImageId = nullptr;
+    }
+}
+
+void RayTracing::_replaceSceneImage(BufferId & imageId, const float * records, size_t texels, const char * name)
+{
+    size_t width = 0, height = 0;
+    getSceneImageSize(_clContext->getDeviceInfo(), texels, width, height);
+
+    // Zero padding up to the full rectangle, never fetched by the kernels
+    std::vector<float> rgba(4 * width * height, 0.0f);
+    std::copy(records, records + 4 * texels, rgba.begin());
+
+    const BufferInfo * info = imageId ? _clContext->getBufferInfo(imageId) : nullptr;
+    if(info && info->imageWidth == width && info->imageHeight == height)
+    {
+        _clContext->uploadToImage2D(imageId, rgba.data());
+        return;
+    }
+
+    if(imageId)
+    {
+        _clContext->releaseBuffer(imageId);
+    }
+    imageId = _clContext->createImage2D(width, height, getSceneTextureParams(), rgba.data());
+    if(imageId)
+    {
+        _clContext->setBufferName(imageId, name);
+    }
+}
+
+void RayTracing::_uploadBackScene(const dwg::Scene & scene)
+{
+    // The previous upload still reads the host copy
+    if(_backSceneUploaded)
+    {
+        _clContext->waitForEvent(_backSceneUploaded);
+        _clContext->releaseEvent(_backSceneUploaded);
+        _backSceneUploaded = nullptr;
+    }
+    _backScene = scene;
+    _releasePendingSceneBuffers();
+
+    // Nor may a trace still be reading the back buffers
+    if(_backSceneBuffers.lastUse)
+    {
+        _clContext->enqueueWaitForEvents(QueueType::TRANSFER, &_backSceneBuffers.lastUse, 1);
+        _clContext->releaseEvent(_backSceneBuffers.lastUse);
+        _backSceneBuffers.lastUse = nullptr;
+    }
+
+    _uploadSceneArray(_backSceneBuffers.spheres, _backScene.spheres, QueueType::TRANSFER);
+    _uploadSceneArray(_backSceneBuffers.planes, _backScene.planes, QueueType::TRANSFER);
+    _uploadSceneArray(_backSceneBuffers.lights, _backScene.lights, QueueType::TRANSFER);
+
+    _backSceneUploaded = _clContext->enqueueMarker(QueueType::TRANSFER);
+    _clContext->flush();
+    _hasBackScene = true;
+}
+
+void RayTracing::_applyBackScene()
+{
+    if(!_hasBackScene)
+    {
+        return;
+    }
+    _hasBackScene = false;
+
+    _clContext->enqueueWaitForEvents(QueueType::COMPUTE, &_backSceneUploaded, 1);
+
+    std::swap(_spheresBufferId, _backSceneBuffers.spheres);
+    std::swap(_planesBufferId, _backSceneBuffers.planes);
+    std::swap(_lightsBufferId, _backSceneBuffers.lights);
+    std::swap(_frontSceneLastUse, _backSceneBuffers.lastUse);
+
+    // The old front scene becomes the host copy of the back buffers
+    std::swap(_scene, _backScene);
+    _updateSceneCounts();
+    _sphereAccelerationDirty = true;
+    _reprojectionHistoryValid = false;
+
+    _rebuildMultiDeviceTracer();
+}
+
+void RayTracing::_releasePendingSceneBuffers()
+{
+    auto done = std::remove_if(_pendingSceneReleases.begin(), _pendingSceneReleases.end(), [this] (const PendingRelease & pending)
+    {
+        if(!_clContext->isEventComplete(pending.readsDone))
+        {
+            return false;
+        }
+        _sceneBufferPool->release(pending.buffer);
+        _clContext->releaseEvent(pending.readsDone);
+        return true;
+    });
+    _pendingSceneReleases.erase(done, _pendingSceneReleases.end());
+}
+
+const dwg::Scene & RayTracing::getScene() const
+{
+    return _scene;
+}
+
+int RayTracing::getTextureWidth() const
+{
+    return _textureWidth;
+}
+
+int RayTracing::getTextureHeight() const
+{
+    return _textureHeight;
+}
+
+void RayTracing::setInstances(const std::vector<dwg::Instance> & instances)
+{
+    if(!_clContext || !_clContext->hasCreatedContext())
+    {
+        return;
+    }
+    _accumulatedFrames = 0;
+    _reprojectionHistoryValid = false;
+
+    // The top level buffers may be in use by either queue
+    _clContext->finish();
+
+    _scene.instances = instances;
+    _uploadTopLevel();
+
+    bool hasInstances = _numInstances > 0;
+    if(hasInstances != _renderConfig.instances)
+    {
+        _renderConfig.instances = hasInstances;
+        _buildProgram();
+        _rebuildMultiDeviceTracer();
+    }
+}
+
+const BottomLevels & RayTracing::getBottomLevels() const
+{
+    return _bottomLevels;
+}
+
+const TopLevel & RayTracing::getTopLevel() const
+{
+    return _topLevel;
+}
+
+void RayTracing::_uploadBottomLevels()
+{
+    _bottomLevels = buildBottomLevels(_scene);
+    if(_bottomLevels.infos.empty())
+    {
+        return;
+    }
+
+    std::cout << "Built " << _bottomLevels.infos.size() << " bottom level BVHs in " << _bottomLevels.buildMilliSec << " ms, "
+              << _bottomLevels.nodes.size() << " nodes, depth " << _bottomLevels.maxDepth << ", "
+              << _bottomLevels.getBytes() / (1024 * 1024) << " MB" << std::endl;
+
+    _uploadSceneArray(_bottomNodesBufferId, _bottomLevels.nodes);
+    _uploadSceneArray(_bottomInfosBufferId, _bottomLevels.infos);
+    _uploadSceneArray(_meshVerticesBufferId, _bottomLevels.vertices);
+    _uploadSceneArray(_meshTrianglesBufferId, _bottomLevels.triangles);
+    _uploadSceneArray(_groupSpheresBufferId, _bottomLevels.spheres);
+}
+
+void RayTracing::_uploadTopLevel()
+{
+    _topLevel = buildTopLevel(getSceneInstances(_scene), _bottomLevels);
+    _numInstances = static_cast<int>(_topLevel.instances.size());
+    if(_numInstances == 0)
+    {
+        return;
+    }
+
+    _uploadSceneArray(_topNodesBufferId, _topLevel.nodes);
+    _uploadSceneArray(_instancesBufferId, _topLevel.instances);
+}
+
+void RayTracing::setDispatchMode(DispatchMode mode)
+{
+    _renderConfig.dispatchMode = mode;
+}
+
+DispatchMode RayTracing::getDispatchMode() const
+{
+    return _renderConfig.dispatchMode;
+}
+
+void RayTracing::setPersistentTileSize(int tileSizeX, int tileSizeY)
+{
+    _renderConfig.persistentTileSizeX = std::max(1, tileSizeX);
+    _renderConfig.persistentTileSizeY = std::max(1, tileSizeY);
+}
+
+void RayTracing::setSortSecondaryRays(bool enabled)
+{
+    _renderConfig.sortSecondaryRays = enabled;
+}
+
+bool RayTracing::getSecondaryBounceCounts(std::vector<int> & bounceCounts)
+{
+    if(!_clContext || !_clContext->hasCreatedContext())
+    {
+        return false;
+    }
+    bounceCounts.resize(static_cast<size_t>(_textureWidth) * _textureHeight);
+    return _clContext->dowloadArrayFromBuffer(_bounceCountsBufferId, bounceCounts.size(), bounceCounts.data());
+}
+
+size_t RayTracing::getSecondarySimdWidth() const
+{
+    return _rayTracingSecondaryKernel.getPreferredWorkGroupSizeMultiple();
+}
+
+const RenderConfig & RayTracing::getRenderConfig() const
+{
+    return _renderConfig;
+}
+
+BufferPoolStats RayTracing::getBufferPoolStats() const
+{
+    return _sceneBufferPool ? _sceneBufferPool->getStats() : BufferPoolStats();
+}
+
+template <typename T>
+void RayTracing::_uploadSceneArray(BufferId & bufferId, std::vector<T> & data, QueueType queue)
+{
+    // Empty arrays keep a buffer of one element, kernels take a valid one even
+    // though they never read it
+    size_t bytesSize = sizeof(T) * std::max<size_t>(data.size(), 1);
+    if(bytesSize > _sceneBufferPool->getCapacity(bufferId))
+    {
+        // Transfer uploads overlap traces that may still read the old region
+        if(bufferId && queue == QueueType::TRANSFER)
+        {
+            PendingRelease pending;
+            pending.buffer = bufferId;
+            pending.readsDone = _clContext->enqueueMarker(QueueType::COMPUTE);
+            _pendingSceneReleases.push_back(pending);
+        }
+        else if(bufferId)
+        {
+            _sceneBufferPool->release(bufferId);
+        }
+        bufferId = _sceneBufferPool->allocate(bytesSize);
+    }
+    if(data.empty())
+    {
+        return;
+    }
+
+    // Transfers return at once, data must outlive them
+    _clContext->uploadArrayToBuffer(bufferId, data.size(), data.data(), 0, queue == QueueType::COMPUTE, nullptr, queue);
+}
+
+std::string RayTracing::_getProgramSource() const
+{
+    return _postProcessChain.generateSource() + _kernelSource;
+}
+
+void RayTracing::_buildProgram()
+{
+    // Pick kernel variant and work group shape from what the device offers
+    const DeviceInfo & device = _clContext->getDeviceInfo();
+
+    _hasBuiltProgram = _clContext->createProgramFromSource(_getProgramSource(), _renderConfig.getBuildOptions());
+
+    _rayTracingKernel = _clContext->prepareKernel("rayTracingKernel");
+    _rayTracingPersistentKernel = _clContext->prepareKernel("rayTracingPersistentKernel");
+    _rayTracingPrimaryKernel = _clContext->prepareKernel("rayTracingPrimaryKernel");
+    _rayTracingSecondaryKernel = _clContext->prepareKernel("rayTracingSecondaryKernel");
+    _drawToTextureKernel = _clContext->prepareKernel("drawToTextureKernel");
+    _accumulateKernel = _clContext->prepareKernel("accumulateKernel");
+    _drawFloatsToTextureKernel = _clContext->prepareKernel("drawFloatsToTextureKernel");
+    _reprojectClearKernel = _clContext->prepareKernel("reprojectClearKernel");
+    _reprojectDepthKernel = _clContext->prepareKernel("reprojectDepthKernel");
+    _reprojectSourceKernel = _clContext->prepareKernel("reprojectSourceKernel");
+    _reprojectResolveKernel = _clContext->prepareKernel("reprojectResolveKernel");
+    _rayTracingListKernel = _clContext->prepareKernel("rayTracingListKernel");
+
+    if(_radixSorter->prepareKernels())
+    {
+        _radixSorter->reserve(static_cast<size_t>(_textureWidth) * _textureHeight);
+    }
+    if(_lbvhBuilder->prepareKernels())
+    {
+        _lbvhBuilder->reserve(_scene.spheres.size());
+    }
+    _gridBuilder->prepareKernels();
+    _denoiser->prepareKernels();
+
+    chooseLocalSize(device, _rayTracingKernel.getWorkGroupSize(), _renderConfig.localSizeX, _renderConfig.localSizeY);
+
+    LocalSize tuned;
+    std::string tuningKey = WorkGroupTuner::makeKey(device, "rayTracingKernel", _getProgramSource(), _renderConfig.getBuildOptions());
+    if(_workGroupTuner->lookup(tuningKey, tuned))
+    {
+        _renderConfig.localSizeX = tuned.x;
+        _renderConfig.localSizeY = tuned.y;
+        _needsTuning = false;
+    }
+    else
+    {
+        _needsTuning = true;
+    }
+
+    std::cout << "Device: " << device.name << " (" << device.computeUnits << " compute units, "
+              << device.localMemSize / 1024 << " KB local memory)" << std::endl;
+    std::cout << "Scene storage: " << RenderConfig::getSceneStorageName(_renderConfig.sceneStorage)
+              << ", colors " << getColorFormatName(_renderConfig.colorFormat)
+              << ", local size " << _renderConfig.localSizeX << "x" << _renderConfig.localSizeY << std::endl;
+}
+
+NDRange RayTracing::_getFrameRange() const
+{
+    NDRange range;
+    range.workDim = 2;
+    range.globalOffset[0] = 0;
+    range.globalOffset[1] = 0;
+    range.globalSize[0] = _textureWidth;
+    range.globalSize[1] = _textureHeight;
+    range.localSize[0] = _renderConfig.localSizeX;
+    range.localSize[1] = _renderConfig.localSizeY;
+    range.padGlobalSize();
+    return range;
+}
+
+bool RayTracing::_traceFrame()
+{
+    _applyBackScene();
+    if(!_updateSphereAcceleration())
+    {
+        return false;
+    }
+
+    // Seeds start at one. A new one every frame while anything draws from it, roulette
+    // too so its paths do not end the same way each frame. Zero jitter keeps the rays
+    // through the pixel centers.
+    float frameSeed = _jitterEnabled || _renderConfig.russianRoulette ? static_cast<float>((_frameSeed++ & 0xffff) + 1) : 0.0f;
+    _cameraConstants.eye.w = _jitterEnabled ? frameSeed : 0.0f;
+    _cameraConstants.firstPixelDir.w = frameSeed;
+
+    bool ok = false;
+    if(_reprojectionEnabled)
+    {
+        // Decides per pixel what to trace, replaces the dispatch mode
+        ok = _dispatchReprojectedTrace();
+    }
+    else
+    {
+        switch (_renderConfig.dispatchMode)
+        {
+        case DispatchMode::PERSISTENT:
+            ok = _dispatchPersistentTrace();
+            break;
+        case DispatchMode::WAVEFRONT:
+            ok = _dispatchWavefrontTrace();
+            break;
+        case DispatchMode::NDRANGE:
+        default:
+            ok = _dispatchTrace(_getFrameRange());
+            break;
+        }
+    }
+
+    // Scene uploads on the transfer queue wait for this
+    if(_multiQueueEnabled)
+    {
+        _clContext->releaseEvent(_frontSceneLastUse);
+        _frontSceneLastUse = _clContext->enqueueMarker(QueueType::COMPUTE);
+    }
+    return ok;
+}
+
+bool RayTracing::_dispatchPersistentTrace()
+{
+    const DeviceInfo & device = _clContext->getDeviceInfo();
+
+    size_t groupSize = std::min(_renderConfig.localSizeX * _renderConfig.localSizeY,
+                                _rayTracingPersistentKernel.getWorkGroupSize());
+    size_t groups = std::max<size_t>(1, device.computeUnits * _renderConfig.persistentGroupsPerComputeUnit);
+
+    NDRange range;
+    range.workDim = 1;
+    range.globalSize[0] = groups * groupSize;
+    range.localSize[0] = groupSize;
+
+    // The queue is in order, the kernel sees the reset counter
+    _clContext->uploadArrayToBuffer(_tileCounterBufferId, 1, &_tileCounterReset, 0, false);
+
+    BoundKernel & kernel = _rayTracingPersistentKernel;
+    bool ok = _setSceneArgs(kernel);
+    ok &= kernel.setArg(11, _renderConfig.maxBounces);
+    ok &= kernel.setArg(12, _cameraConstants);
+    ok &= kernel.setArg(13, _tileCounterBufferId);
+    ok &= kernel.setArg(14, _renderConfig.persistentTileSizeX);
+    ok &= kernel.setArg(15, _renderConfig.persistentTileSizeY);
+    ok &= _setOptionalArgs(kernel, 16);
+
+    return ok && _clContext->dispatchKernel(kernel, range);
+}
+
+bool RayTracing::_dispatchWavefrontTrace()
+{
+    int numRays = _textureWidth * _textureHeight;
+
+    BoundKernel & primary = _rayTracingPrimaryKernel;
+    bool ok = _setSceneArgs(primary);
+    ok &= primary.setArg(11, _cameraConstants);
+    ok &= primary.setArg(12, _raysBufferId);
+    ok &= primary.setArg(13, _primaryColorsBufferId);
+    ok &= primary.setArg(14, _rayKeysBufferId);
+    ok &= primary.setArg(15, _rayIndicesBufferId);
+    ok &= primary.setArg(16, _sceneMin.x);
+    ok &= primary.setArg(17, _sceneMin.y);
+    ok &= primary.setArg(18, _sceneMin.z);
+    ok &= primary.setArg(19, _sceneInvExtent.x);
+    ok &= primary.setArg(20, _sceneInvExtent.y);
+    ok &= primary.setArg(21, _sceneInvExtent.z);
+    ok &= _setOptionalArgs(primary, 22);
+    if(!ok || !_clContext->dispatchKernel(primary, _getFrameRange()))
+    {
+        return false;
+    }
+
+    // Pixels without a secondary ray sort to the end and leave whole groups idle
+    if(_renderConfig.sortSecondaryRays && !_radixSorter->sort(_rayKeysBufferId, _rayIndicesBufferId, numRays, RAY_KEY_BITS))
+    {
+        return false;
+    }
+
+    NDRange range;
+    range.workDim = 1;
+    range.globalSize[0] = numRays;
+    range.localSize[0] = std::min(_renderConfig.localSizeX * _renderConfig.localSizeY,
+                                  _rayTracingSecondaryKernel.getWorkGroupSize());
+    range.padGlobalSize();
+
+    BoundKernel & secondary = _rayTracingSecondaryKernel;
+    ok = _setSceneArgs(secondary);
+    ok &= secondary.setArg(11, _renderConfig.maxBounces);
+    ok &= secondary.setArg(12, _raysBufferId);
+    ok &= secondary.setArg(13, _primaryColorsBufferId);
+    ok &= secondary.setArg(14, _rayKeysBufferId);
+    ok &= secondary.setArg(15, _rayIndicesBufferId);
+    ok &= secondary.setArg(16, _bounceCountsBufferId);
+    ok &= secondary.setArg(17, numRays);
+    ok &= secondary.setArg(18, static_cast<unsigned int>(_cameraConstants.firstPixelDir.w));
+    ok &= _setAccelerationArgs(secondary, 19);
+
+    return ok && _clContext->dispatchKernel(secondary, range);
+}
+
+bool RayTracing::_dispatchReprojectedTrace()
+{
+    _collectReprojectionCount();
+
+    int numPixels = _textureWidth * _textureHeight;
+    int current = _reprojectionIndex;
+    int previous = 1 - current;
+
+    NDRange pixelRange;
+    pixelRange.workDim = 1;
+    pixelRange.globalSize[0] = numPixels;
+    pixelRange.localSize[0] = std::min(_renderConfig.localSizeX * _renderConfig.localSizeY,
+                                       _rayTracingListKernel.getWorkGroupSize());
+    pixelRange.padGlobalSize();
+
+    bool ok = _clContext->uploadArrayToBuffer(_traceCountBufferId, 1, &_traceCountReset, 0, false);
+
+    ok &= _reprojectClearKernel.setArg(0, _reprojectionDepthBufferId);
+    ok &= _reprojectClearKernel.setArg(1, _reprojectionSourceBufferId);
+    ok &= _reprojectClearKernel.setArg(2, numPixels);
+    ok = ok && _clContext->dispatchKernel(_reprojectClearKernel, pixelRange);
+
+    // Without history every pixel is left without a source and gets traced
+    if(_reprojectionHistoryValid)
+    {
+        ok &= _reprojectDepthKernel.setArg(0, _reprojectionHitsBufferIds[previous]);
+        ok &= _reprojectDepthKernel.setArg(1, _reprojectionDepthBufferId);
+        ok &= _reprojectDepthKernel.setArg(2, _textureWidth);
+        ok &= _reprojectDepthKernel.setArg(3, _textureHeight);
+        ok &= _reprojectDepthKernel.setArg(4, _cameraConstants);
+        ok = ok && _clContext->dispatchKernel(_reprojectDepthKernel, pixelRange);
+
+        ok &= _reprojectSourceKernel.setArg(0, _reprojectionHitsBufferIds[previous]);
+        ok &= _reprojectSourceKernel.setArg(1, _reprojectionDepthBufferId);
+        ok &= _reprojectSourceKernel.setArg(2, _reprojectionSourceBufferId);
+        ok &= _reprojectSourceKernel.setArg(3, _textureWidth);
+        ok &= _reprojectSourceKernel.setArg(4, _textureHeight);
+        ok &= _reprojectSourceKernel.setArg(5, _cameraConstants);
+        ok = ok && _clContext->dispatchKernel(_reprojectSourceKernel, pixelRange);
+    }
+
+    BoundKernel & resolve = _reprojectResolveKernel;
+    ok &= resolve.setArg(0, _tempColorsBufferId);
+    ok &= resolve.setArg(1, _textureWidth);
+    ok &= resolve.setArg(2, _textureHeight);
+    ok &= resolve.setArg(3, _reprojectionHitsBufferIds[previous]);
+    ok &= resolve.setArg(4, _reprojectionColorsBufferIds[previous]);
+    ok &= resolve.setArg(5, _reprojectionSourceBufferId);
+    ok &= resolve.setArg(6, _reprojectionHitsBufferIds[current]);
+    ok &= resolve.setArg(7, _reprojectionColorsBufferIds[current]);
+    ok &= resolve.setArg(8, _tracePixelsBufferId);
+    ok &= resolve.setArg(9, _traceCountBufferId);
+    ok &= resolve.setArg(10, _reprojectionMaxAge);
+    ok &= resolve.setArg(11, _reprojectionRefreshPeriod);
+    ok &= resolve.setArg(12, static_cast<int>(_frameIndex % std::max(1, _reprojectionRefreshPeriod)));
+    ok = ok && _clContext->dispatchKernel(resolve, _getFrameRange());
+
+    // Launched over every pixel, work items past the queued count leave right away
+    BoundKernel & list = _rayTracingListKernel;
+    ok &= _setSceneArgs(list);
+    ok &= list.setArg(11, _renderConfig.maxBounces);
+    ok &= list.setArg(12, _cameraConstants);
+    ok &= list.setArg(13, _tracePixelsBufferId);
+    ok &= list.setArg(14, _traceCountBufferId);
+    ok &= list.setArg(15, _reprojectionHitsBufferIds[current]);
+    ok &= list.setArg(16, _reprojectionColorsBufferIds[current]);
+    ok &= _setOptionalArgs(list, 17);
+    ok = ok && _clContext->dispatchKernel(list, pixelRange);
+
+    ok = ok && _clContext->dowloadFromBuffer(_traceCountBufferId, sizeof(int), &_tracedPixelCount, 0, false, &_tracedPixelCountRead);
+
+    _reprojectionIndex = previous;
+    _reprojectionHistoryValid = ok;
+    return ok;
+}
+
+void RayTracing::_collectReprojectionCount()
+{
+    if(!_tracedPixelCountRead)
+    {
+        return;
+    }
+
+    _clContext->waitForEvent(_tracedPixelCountRead);
+    _clContext->releaseEvent(_tracedPixelCountRead);
+    _tracedPixelCountRead = nullptr;
+
+    unsigned long long numPixels = static_cast<unsigned long long>(_textureWidth) * _textureHeight;
+    _reprojectionStats.frames++;
+    _reprojectionStats.tracedPixels += _tracedPixelCount;
+    _reprojectionStats.totalPixels += numPixels;
+    _reprojectionStats.lastTracedFraction = static_cast<double>(_tracedPixelCount) / numPixels;
+}
+
+bool RayTracing::_setGBufferArgs(BoundKernel & kernel, int firstIndex)
+{
+    if(!_renderConfig.gbuffer)
+    {
+        return true;
+    }
+
+    bool ok = true;
+    for(int i = 0 ; i < static_cast<int>(GBufferChannel::COUNT); i++)
+    {
+        ok &= kernel.setArg(firstIndex + i, _gbufferBufferIds[i]);
+    }
+    return ok;
+}
+
+bool RayTracing::_setInstanceArgs(BoundKernel & kernel, int firstIndex)
+{
+    if(!_renderConfig.instances)
+    {
+        return true;
+    }
+
+    bool ok = kernel.setArg(firstIndex, _topNodesBufferId);
+    ok &= kernel.setArg(firstIndex + 1, _instancesBufferId);
+    ok &= kernel.setArg(firstIndex + 2, _bottomNodesBufferId);
+    ok &= kernel.setArg(firstIndex + 3, _bottomInfosBufferId);
+    ok &= kernel.setArg(firstIndex + 4, _meshVerticesBufferId);
+    ok &= kernel.setArg(firstIndex + 5, _meshTrianglesBufferId);
+    ok &= kernel.setArg(firstIndex + 6, _groupSpheresBufferId);
+    return ok;
+}
+
+bool RayTracing::_setSphereAccelerationArgs(BoundKernel & kernel, int firstIndex)
+{
+    switch(_renderConfig.sphereAcceleration)
+    {
+    case SphereAcceleration::LBVH:
+        return kernel.setArg(firstIndex, _lbvhBuilder->getNodes());
+    case SphereAcceleration::GRID:
+    {
+        bool ok = kernel.setArg(firstIndex, _gridBuilder->getParams());
+        ok &= kernel.setArg(firstIndex + 1, _gridBuilder->getCellStarts());
+        ok &= kernel.setArg(firstIndex + 2, _gridBuilder->getSphereIndices());
+        return ok;
+    }
+    default:
+        return true;
+    }
+}
+
+bool RayTracing::_setAccelerationArgs(BoundKernel & kernel, int firstIndex)
+{
+    bool ok = _setInstanceArgs(kernel, firstIndex);
+    if(_renderConfig.instances)
+    {
+        firstIndex += INSTANCE_ARG_COUNT;
+    }
+    return ok && _setSphereAccelerationArgs(kernel, firstIndex);
+}
+
+bool RayTracing::_updateSphereAcceleration()
+{
+    if(!_sphereAccelerationDirty || _renderConfig.sphereAcceleration == SphereAcceleration::NONE)
+    {
+        return true;
+    }
+
+    // Both are laid out from the host copy of the spheres: the BVH quantizes
+    // centers within their box, the grid covers the sphere boxes
+    bool ok = false;
+    if(_renderConfig.sphereAcceleration == SphereAcceleration::GRID)
+    {
+        ok = _gridBuilder->build(_spheresBufferId, _numSpheres, getSphereGridParams(_scene.spheres));
+    }
+    else
+    {
+        glm::vec3 boundsMin(std::numeric_limits<float>::max());
+        glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+        for(const dwg::Sphere & sphere : _scene.spheres)
+        {
+            boundsMin = glm::min(boundsMin, sphere.position);
+            boundsMax = glm::max(boundsMax, sphere.position);
+        }
+        ok = _lbvhBuilder->build(_spheresBufferId, _numSpheres, boundsMin, boundsMax);
+    }
+
+    if(!ok)
+    {
+        return false;
+    }
+    _sphereAccelerationDirty = false;
+    return true;
+}
+
+bool RayTracing::_setOptionalArgs(BoundKernel & kernel, int firstIndex)
+{
+    bool ok = _setGBufferArgs(kernel, firstIndex);
+    if(_renderConfig.gbuffer)
+    {
+        firstIndex += static_cast<int>(GBufferChannel::COUNT);
+    }
+    return ok && _setAccelerationArgs(kernel, firstIndex);
+}
+
+bool RayTracing::_setSceneArgs(BoundKernel & kernel)
+{
+    // Global storage never touches the local arguments, they only need a valid size.
+    // Empty arrays still get one element, a zero local size is invalid.
+    bool stageScene = _renderConfig.sceneStorage == SceneStorage::LOCAL;
+    size_t localTempSize  = stageScene ? std::max(getLocalSceneBytes(_scene), sizeof(float)*16) : sizeof(float)*16;
+    size_t localLightSize = stageScene ? std::max(getLocalLightBytes(_scene), sizeof(float)*8) : sizeof(float)*8;
+
+    bool ok = kernel.setArg(0, _tempColorsBufferId);
+    ok &= kernel.setArg(1, _textureWidth);
+    ok &= kernel.setArg(2, _textureHeight);
+    bool useImages = _renderConfig.sceneStorage == SceneStorage::IMAGE;
+    ok &= kernel.setArg(3, useImages ? _spheresImageId : _spheresBufferId);
+    ok &= kernel.setArg(4, _numSpheres);
+    ok &= kernel.setArg(5, useImages ? _planesImageId : _planesBufferId);
+    ok &= kernel.setArg(6, _numPlanes);
+    ok &= kernel.setArg(7, _lightsBufferId);
+    ok &= kernel.setArg(8, _numLights);
+    ok &= kernel.setLocalArg(9, localTempSize);
+    ok &= kernel.setLocalArg(10, localLightSize);
+    return ok;
+}
+
+bool RayTracing::_dispatchTrace(const NDRange & range)
+{
+    BoundKernel & kernel = _rayTracingKernel;
+    bool ok = _setSceneArgs(kernel);
+    ok &= kernel.setArg(11, _renderConfig.maxBounces);
+    ok &= kernel.setArg(12, _cameraConstants);
+    ok &= _setOptionalArgs(kernel, 13);
+
+    return ok && _clContext->dispatchKernel(kernel, range);
+}
+
+void RayTracing::_autotuneLocalSize()
+{
+    _needsTuning = false;
+
+    const DeviceInfo & device = _clContext->getDeviceInfo();
+    std::vector<LocalSize> candidates = WorkGroupTuner::getCandidates(device,
+                                                                      _rayTracingKernel.getWorkGroupSize(),
+                                                                      _rayTracingKernel.getPreferredWorkGroupSizeMultiple());
+
+    std::cout << "Tuning rayTracingKernel over " << candidates.size() << " local sizes..." << std::endl;
+
+    std::string tuningKey = WorkGroupTuner::makeKey(device, "rayTracingKernel", _getProgramSource(), _renderConfig.getBuildOptions());
+    LocalSize best = _workGroupTuner->tune(tuningKey, candidates, [=] (LocalSize localSize) -> double
+    {
+        static const int repetitions = 3;
+
+        // Padding is part of the cost of a candidate
+        NDRange range;
+        range.workDim = 2;
+        range.globalSize[0] = _textureWidth;
+        range.globalSize[1] = _textureHeight;
+        range.localSize[0] = localSize.x;
+        range.localSize[1] = localSize.y;
+        range.padGlobalSize();
+
+        // Warm up
+        if(!_dispatchTrace(range))
+        {
+            return -1.0;
+        }
+        _clContext->finish();
+
+        double bestTime = -1.0;
+        for(int i = 0 ; i < repetitions; i++)
+        {
+            util::Timer timer;
+            _dispatchTrace(range);
+            _clContext->finish();
+            double time = timer.elapsedMilliSec();
+            bestTime = bestTime < 0.0 ? time : std::min(bestTime, time);
+        }
+        return bestTime;
+    });
+
+    if(best.x > 0)
+    {
+        _renderConfig.localSizeX = best.x;
+        _renderConfig.localSizeY = best.y;
+    }
+}
+
+void RayTracing::setEye(glm::vec3 eye)
+{
+    _camera.eye = eye;
+    _cameraConstants = computeCameraConstants(_camera, _textureWidth, _textureHeight);
+    _accumulatedFrames = 0;
+}
+
+glm::vec3 RayTracing::getEye() const
+{
+    return _camera.eye;
+}
+
+void RayTracing::setCamera(const Camera & camera)
+{
+    _camera = camera;
+    _cameraConstants = computeCameraConstants(_camera, _textureWidth, _textureHeight);
+    _accumulatedFrames = 0;
+}
+
+const Camera & RayTracing::getCamera() const
+{
+    return _camera;
+}
+
+void RayTracing::setFrameMetrics(util::FrameMetrics * metrics)
+{
+    // Device trace times come from the timestamps of the trace markers
+    _frameMetrics = metrics;
+    setQueueProfilingEnabled(metrics != nullptr);
+}
+
+void RayTracing::setMultiDeviceEnabled(bool enabled)
+{
+    // Other devices only get the sphere, plane and light arrays, meshes and instanced
+    // spheres would be missing from their bands
+    if(enabled && (_renderConfig.instances || _renderConfig.sphereAcceleration != SphereAcceleration::NONE))
+    {
+        std::cout << "Multi device rendering does not support instances or sphere acceleration" << std::endl;
+        enabled = false;
+    }
+
+    if(enabled && !_multiDeviceTracer && !_kernelSource.empty())
+    {
+        _multiDeviceTracer = std::make_shared<MultiDeviceTracer>(_scene, _getProgramSource(), _renderConfig, _textureWidth, _textureHeight);
+        _hostColors.resize(4 * _textureWidth * _textureHeight);
+    }
+
+    _multiDeviceEnabled = enabled && _multiDeviceTracer && _multiDeviceTracer->isValid();
+
+    if(enabled && !_multiDeviceEnabled)
+    {
+        std::cout << "Multi device rendering not available" << std::endl;
+    }
+    _updateColorFormat();
+}
+
+bool RayTracing::isMultiDeviceEnabled() const
+{
+    return _multiDeviceEnabled;
+}
+
+void RayTracing::_rebuildMultiDeviceTracer()
+{
+    // Other devices built their programs from the old scene or config
+    _multiDeviceTracer.reset();
+    if(_multiDeviceEnabled)
+    {
+        setMultiDeviceEnabled(true);
+    }
 }
 
@@ -1,9 +1,63 @@
 #pragma once
 
+#include <bufferpool.h>
+#include <camera.h>
 #include <clcontextwrapper.h>
+#include <denoiser.h>
+#include <framemetrics.h>
+#include <gbuffer.h>
+#include <instancing.h>
+#include <lbvh.h>
+#include <spheregrid.h>
+#include <multidevicetracer.h>
+#include <postprocess.h>
+#include <radixsort.h>
+#include <readbackring.h>
+#include <renderconfig.h>
 #include <scene.h>
+#include <workgrouptuner.h>
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
+
+// How much of the readback time ran while the next frame was tracing, from device timestamps
+struct QueueOverlapStats
+{
+    unsigned long long frames;
+    double transferMilliSec;
+    double overlapMilliSec;
+
+    QueueOverlapStats() : frames(0), transferMilliSec(0.0), overlapMilliSec(0.0)
+    {
+
+    }
+
+    double getOverlapRatio() const
+    {
+        return transferMilliSec > 0.0 ? overlapMilliSec / transferMilliSec : 0.0;
+    }
+};
+
+// Pixels traced by temporal reprojection, the rest reused the previous frame
+struct ReprojectionStats
+{
+    unsigned long long frames;
+    unsigned long long tracedPixels;
+    unsigned long long totalPixels;
+    double lastTracedFraction;
+
+    ReprojectionStats() : frames(0), tracedPixels(0), totalPixels(0), lastTracedFraction(0.0)
+    {
+
+    }
+
+    double getTracedFraction() const
+    {
+        return totalPixels > 0 ? static_cast<double>(tracedPixels) / totalPixels : 0.0;
+    }
+};
 
 class RayTracing
 {
@@ -16,8 +70,269 @@ public:
 
     glm::vec3 getEye() const;
 
+    void setCamera(const Camera & camera);
+
+    const Camera & getCamera() const;
+
+    // Turns queue profiling on while metrics are set. The device trace time of a
+    // frame is recorded from its markers' timestamps a few updates later, once
+    // they completed, so the host never waits for the device.
+    void setFrameMetrics(util::FrameMetrics * metrics);
+
+    void setMultiDeviceEnabled(bool enabled);
+
+    bool isMultiDeviceEnabled() const;
+
+    void setScene(const dwg::Scene & scene);
+
+    const dwg::Scene & getScene() const;
+
+    void setDispatchMode(DispatchMode mode);
+
+    DispatchMode getDispatchMode() const;
+
+    // Forces a scene storage while the scene supports it, rebuilds the program.
+    // False (and no change) when the current scene does not fit.
+    bool setSceneStorage(SceneStorage storage);
+
+    // Back to chooseSceneStorage
+    void resetSceneStorage();
+
+    SceneStorage getSceneStorage() const;
+
+    void setPersistentTileSize(int tileSizeX, int tileSizeY);
+
+    void setSortSecondaryRays(bool enabled);
+
+    // Rays traced per secondary queue entry of the last wavefront frame, in queue order
+    bool getSecondaryBounceCounts(std::vector<int> & bounceCounts);
+
+    // Lanes that execute in lockstep for the secondary kernel
+    size_t getSecondarySimdWidth() const;
+
+    const RenderConfig & getRenderConfig() const;
+
+    BufferPoolStats getBufferPoolStats() const;
+
+    // Every rendered frame is read back asynchronously and handed to callback
+    // from a later update (or flushReadback), in linear color before the post
+    // process chain. Nullptr stops the readback.
+    void setReadbackCallback(ReadbackRing::FrameCallback callback);
+
+    // Blocks until every frame in flight reached the readback callback
+    void flushReadback();
+
+    // Readbacks and scene uploads go to a transfer queue and overlap with tracing,
+    // frames alternate between two color buffers and scenes between two buffer sets
+    void setMultiQueueEnabled(bool enabled);
+
+    bool isMultiQueueEnabled() const;
+
+    // Averages frames while camera and scene stay unchanged. The average is
+    // presented and read back as float4. Enabling it again restarts the average
+    // and the jitter sequence.
+    void setAccumulationEnabled(bool enabled);
+
+    bool isAccumulationEnabled() const;
+
+    // Forces the format of the traced colors, rebuilds the program. Multi device
+    // rendering always traces float4.
+    void setColorFormat(ColorFormat format);
+
+    // Back to the RenderConfig default
+    void resetColorFormat();
+
+    ColorFormat getColorFormat() const;
+
+    bool isColorFormatForced() const;
+
+    // Reuses the shading of the previous frame where its primary hits reproject
+    // into the current view. Only disoccluded pixels, pixels older than maxAge
+    // frames and a rolling 1 / refreshPeriod of all pixels are traced.
+    void setReprojectionEnabled(bool enabled);
+
+    bool isReprojectionEnabled() const;
+
+    void setReprojectionLimits(int maxAge, int refreshPeriod);
+
+    // Counts arrive one frame late
+    ReprojectionStats getReprojectionStats() const;
+
+    void resetReprojectionStats();
+
+    // The primary pass also stores depth, normal, object id and material per pixel,
+    // rebuilds the program. Multi device frames and reused reprojected pixels do not update it.
+    void setGBufferEnabled(bool enabled);
+
+    bool isGBufferEnabled() const;
+
+    // Device buffer of a channel for later kernels, null while disabled
+    BufferId getGBuffer(GBufferChannel channel) const;
+
+    // Blocking copy of a whole channel, width * height * getGBufferChannelBytes(channel) bytes
+    bool downloadGBuffer(GBufferChannel channel, void * data);
+
+    // Object id under pixel (x, y), rows top to bottom. GBUFFER_NO_OBJECT without a hit or G-buffer.
+    int pickObject(int x, int y);
+
+    // Filters the traced frame, or the average when accumulating, into a separate
+    // buffer that is presented and read back, guided by depth and normals.
+    // Enables the G-buffer, which stays enabled afterwards.
+    void setDenoiseEnabled(bool enabled);
+
+    bool isDenoiseEnabled() const;
+
+    void setDenoiseParams(const DenoiseParams & params);
+
+    const DenoiseParams & getDenoiseParams() const;
+
+    // Primary rays go through a random point of their pixel, a new one every frame
+    void setJitterEnabled(bool enabled);
+
+    bool isJitterEnabled() const;
+
+    // Rays traced after the primary one at most, see RenderConfig for the current value
+    void setMaxBounces(int maxBounces);
+
+    // Ends paths at random once their throughput is low, rebuilds the program.
+    // Unbiased on average, noisy per frame without accumulation or denoising.
+    void setRussianRouletteEnabled(bool enabled);
+
+    bool isRussianRouletteEnabled() const;
+
+    // Structure traceRay finds the hit spheres with, rebuilds the program. The
+    // linear BVH or the grid is rebuilt on the device ahead of the first frame
+    // after every sphere change. Scenes set it too, see Scene::sphereAcceleration.
+    void setSphereAcceleration(SphereAcceleration acceleration);
+
+    SphereAcceleration getSphereAcceleration() const;
+
+    // Average time of rebuilding the sphere acceleration structure of the
+    // current scene on the device, -1 when there is none
+    double measureSphereAccelerationBuildTime(int builds);
+
+    // Generated into the present kernels, rebuilds the program when it changed.
+    // Read back frames stay linear, apply the chain to them on the host.
+    void setPostProcessChain(const PostProcessChain & chain);
+
+    const PostProcessChain & getPostProcessChain() const;
+
+    // Color bytes written and read per frame by tracing, presentation, accumulation and readback
+    size_t getColorBytesPerFrame() const;
+
+    // Device timestamps getQueueOverlapStats needs, off by default since they
+    // slow down every queue
+    void setQueueProfilingEnabled(bool enabled);
+
+    bool isQueueProfilingEnabled() const;
+
+    // Empty unless queue profiling is enabled
+    QueueOverlapStats getQueueOverlapStats() const;
+
+    void resetQueueOverlapStats();
+
+    int getTextureWidth() const;
+
+    int getTextureHeight() const;
+
+    // Moves, adds or removes instances of the current scene's meshes and sphere
+    // groups. Only the top level is rebuilt, the bottom levels stay on the device.
+    void setInstances(const std::vector<dwg::Instance> & instances);
+
+    // Bottom level BVHs of the current scene, rebuilt by setScene
+    const BottomLevels & getBottomLevels() const;
+
+    // Top level BVH of the current instances, rebuilt by setScene and setInstances
+    const TopLevel & getTopLevel() const;
+
+    // Average time of tracing only (no presenting) over a number of frames,
+    // beforeFrame may change the camera or scene ahead of every measured frame
+    double measureTraceTime(int frames, std::function<void(int frame)> beforeFrame = nullptr);
+
 private:
 
+    template <typename T>
+    void _uploadSceneArray(BufferId & bufferId, std::vector<T> & data, QueueType queue = QueueType::COMPUTE);
+
+    void _updateSceneCounts();
+
+    // Packs spheres and planes into float4 images for image scene storage
+    bool _uploadSceneImages();
+
+    void _releaseSceneImages();
+
+    void _replaceSceneImage(BufferId & imageId, const float * records, size_t texels, const char * name);
+
+    void _uploadBackScene(const dwg::Scene & scene);
+
+    void _applyBackScene();
+
+    // Gives regions replaced behind a trace back to the pool once it finished
+    void _releasePendingSceneBuffers();
+
+    void _resolveTraceTimes();
+
+    void _recordQueueOverlap(const ReadbackFrame & frame);
+
+    void _buildProgram();
+
+    // Post process chain followed by the kernel files
+    std::string _getProgramSource() const;
+
+    SceneStorage _chooseSceneStorage(const dwg::Scene & scene) const;
+
+    ColorFormat _chooseColorFormat() const;
+
+    // Rebuilds the program when the chosen color format changed
+    void _updateColorFormat();
+
+    // Drops the other devices' programs and scene copies, recreated when multi device is on
+    void _rebuildMultiDeviceTracer();
+
+    NDRange _getFrameRange() const;
+
+    bool _traceFrame();
+
+    // Arguments shared by the tracing kernels, indices 0 to 10
+    bool _setSceneArgs(BoundKernel & kernel);
+
+    // The four G-buffer arguments after the last regular one, only with GBUFFER builds
+    bool _setGBufferArgs(BoundKernel & kernel, int firstIndex);
+
+    // The seven instance arguments from firstIndex on, only with INSTANCES builds
+    bool _setInstanceArgs(BoundKernel & kernel, int firstIndex);
+
+    // The sphere acceleration structure's arguments from firstIndex on, only with one chosen
+    bool _setSphereAccelerationArgs(BoundKernel & kernel, int firstIndex);
+
+    // Instance then sphere acceleration arguments from firstIndex on
+    bool _setAccelerationArgs(BoundKernel & kernel, int firstIndex);
+
+    // G-buffer, instance and sphere acceleration arguments after the last regular one of a primary pass kernel
+    bool _setOptionalArgs(BoundKernel & kernel, int firstIndex);
+
+    // Rebuilds the sphere acceleration structure when the spheres changed since the last build
+    bool _updateSphereAcceleration();
+
+    // Builds the bottom levels of _scene and uploads them
+    void _uploadBottomLevels();
+
+    // Builds the top level over the instances of _scene and uploads it
+    void _uploadTopLevel();
+
+    bool _dispatchTrace(const NDRange & range);
+
+    bool _dispatchPersistentTrace();
+
+    bool _dispatchWavefrontTrace();
+
+    bool _dispatchReprojectedTrace();
+
+    // Waits for the traced pixel count of the last reprojected frame
+    void _collectReprojectionCount();
+
+    void _autotuneLocalSize();
+
     void _compactRays(BufferId rays, int count);
 
     void _prefixSum(BufferId input, BufferId output, int n);
@@ -30,6 +345,11 @@ private:
     unsigned int _glTexture;
     BufferId _sharedTextureBufferId;
 
+    dwg::Scene _scene;
+
+    // Scene buffers come from a pool so scene changes reuse device memory
+    std::shared_ptr<BufferPool> _sceneBufferPool;
+
     // Spheres
     BufferId _spheresBufferId;
     int _numSpheres;
@@ -42,18 +362,165 @@ private:
     BufferId _lightsBufferId;
     int _numLights;
 
-    // Temp buffer
+    // Meshes and sphere groups with one bottom level BVH each, built on the host
+    BottomLevels _bottomLevels;
+    BufferId _bottomNodesBufferId;
+    BufferId _bottomInfosBufferId;
+    BufferId _meshVerticesBufferId;
+    BufferId _meshTrianglesBufferId;
+    BufferId _groupSpheresBufferId;
+
+    // Instances of them under the top level BVH
+    TopLevel _topLevel;
+    BufferId _topNodesBufferId;
+    BufferId _instancesBufferId;
+    int _numInstances;
+
+    // Image scene storage only, lights stay in _lightsBufferId
+    BufferId _spheresImageId;
+    BufferId _planesImageId;
+
+    // Temp buffer, one of _colorsBufferIds
     BufferId _tempColorsBufferId;
 
-    glm::vec3 _eye;
+    // Persistent threads
+    BufferId _tileCounterBufferId;
+    int _tileCounterReset;
+
+    // Wavefront secondary ray queue, one entry per pixel
+    BufferId _raysBufferId;
+    BufferId _primaryColorsBufferId;
+    BufferId _rayKeysBufferId;
+    BufferId _rayIndicesBufferId;
+    BufferId _bounceCountsBufferId;
+    std::shared_ptr<RadixSorter> _radixSorter;
+
+    // Sphere acceleration, rebuilt before a trace when the spheres changed
+    std::shared_ptr<LinearBVHBuilder> _lbvhBuilder;
+    std::shared_ptr<SphereGridBuilder> _gridBuilder;
+    bool _sphereAccelerationDirty;
+
+    std::shared_ptr<Denoiser> _denoiser;
+    bool _denoiseEnabled;
+    DenoiseParams _denoiseParams;
+
+    // Subpixel jitter and Russian roulette draw from the frame's seed, which goes
+    // to the kernels in the camera constants
+    bool _jitterEnabled;
+    unsigned int _frameSeed;
+    glm::vec3 _sceneMin;
+    glm::vec3 _sceneInvExtent;
+
+    // Temporal reprojection, hits and colors alternate between previous and current
+    bool _reprojectionEnabled;
+    bool _reprojectionHistoryValid;
+    int _reprojectionMaxAge;
+    int _reprojectionRefreshPeriod;
+    int _reprojectionIndex; // current frame's hits and colors
+    BufferId _reprojectionHitsBufferIds[2];
+    BufferId _reprojectionColorsBufferIds[2];
+    BufferId _reprojectionDepthBufferId;
+    BufferId _reprojectionSourceBufferId;
+    BufferId _tracePixelsBufferId;
+    BufferId _traceCountBufferId;
+    int _traceCountReset;
+    int _tracedPixelCount; // download target
+    EventId _tracedPixelCountRead;
+    ReprojectionStats _reprojectionStats;
+
+    // Indexed by GBufferChannel
+    BufferId _gbufferBufferIds[static_cast<int>(GBufferChannel::COUNT)];
+
+    // Kernels only see the constants, recomputed when the camera changes
+    Camera _camera;
+    CameraConstants _cameraConstants;
 
     int _textureWidth;
     int _textureHeight;
 
-    size_t localSizeX;
-    size_t localSizeY;
+    RenderConfig _renderConfig;
+    bool _hasBuiltProgram;
+    bool _hasForcedSceneStorage;
+    SceneStorage _forcedSceneStorage;
+    bool _hasForcedColorFormat;
+    ColorFormat _forcedColorFormat;
+
+    // Accumulation
+    bool _accumulationEnabled;
+    int _accumulatedFrames;
+    BufferId _accumulationBufferId; // float4 average
+
+    BoundKernel _rayTracingKernel;
+    BoundKernel _rayTracingPersistentKernel;
+    BoundKernel _rayTracingPrimaryKernel;
+    BoundKernel _rayTracingSecondaryKernel;
+    BoundKernel _drawToTextureKernel;
+    BoundKernel _accumulateKernel;
+    BoundKernel _drawFloatsToTextureKernel;
+    BoundKernel _reprojectClearKernel;
+    BoundKernel _reprojectDepthKernel;
+    BoundKernel _reprojectSourceKernel;
+    BoundKernel _reprojectResolveKernel;
+    BoundKernel _rayTracingListKernel;
 
     std::shared_ptr<CLContextWrapper> _clContext;
 
+    util::FrameMetrics * _frameMetrics;
+
+    // Work group tuning
+    std::shared_ptr<WorkGroupTuner> _workGroupTuner;
+    bool _needsTuning;
+
+    std::string _kernelSource;
+    PostProcessChain _postProcessChain;
+
+    // Multi device
+    bool _multiDeviceEnabled;
+    std::shared_ptr<MultiDeviceTracer> _multiDeviceTracer;
+    std::vector<float> _hostColors;
+
+    // Asynchronous readback
+    std::shared_ptr<ReadbackRing> _readbackRing;
+    bool _readbackEnabled;
+    unsigned long long _frameIndex;
+
+    // Multiple queues
+    bool _multiQueueEnabled;
+    BufferId _colorsBufferIds[2];
+    EventId _colorsReadEvents[2]; // readback of the last frame in each color buffer
+
+    struct SceneBuffers
+    {
+        BufferId spheres;
+        BufferId planes;
+        BufferId lights;
+        EventId lastUse; // last trace reading them
+    };
+    SceneBuffers _backSceneBuffers;
+    EventId _frontSceneLastUse;
+    dwg::Scene _backScene; // host copy, must live until its upload finished
+
+    // Pool regions replaced on the transfer queue, a trace may still read them
+    struct PendingRelease
+    {
+        BufferId buffer;
+        EventId readsDone; // compute marker after the last trace that could
+    };
+    std::vector<PendingRelease> _pendingSceneReleases;
+    EventId _backSceneUploaded;
+    bool _hasBackScene;
+
+    // Trace markers of recent frames, to compare with readback timestamps and
+    // to time the trace for the frame metrics
+    struct TraceMarkers
+    {
+        unsigned long long frameIndex;
+        EventId started;
+        EventId ended;
+        bool pendingTraceTime;
+    };
+    TraceMarkers _traceMarkers[4];
+    QueueOverlapStats _queueOverlapStats;
+
 };
 
@@ -0,0 +1,136 @@
+#include "readbackring.h"
+
+#include <iostream>
+
+ReadbackRing::ReadbackRing(std::shared_ptr<CLContextWrapper> context, int width, int height, size_t slots) :
+    _clContext(context), _width(width), _height(height), _nextSlot(0), _oldestSlot(0), _inFlight(0), _stallCount(0)
+{
+    _slotBytes = getColorFormatBytes(ColorFormat::FLOAT4) * static_cast<size_t>(width) * height;
+
+    // Pinned buffers stay mapped for their whole life, reads land directly in them
+    for(size_t i = 0 ; i < slots; i++)
+    {
+        Slot slot;
+        slot.buffer = _clContext->createPinnedBuffer(_slotBytes, BufferType::READ_AND_WRITE);
+        slot.mapped = slot.buffer ? _clContext->mapBuffer(slot.buffer, 0, _slotBytes) : nullptr;
+        slot.event = nullptr;
+        slot.frameIndex = 0;
+        slot.format = ColorFormat::FLOAT4;
+
+        if(!slot.mapped)
+        {
+            std::cout << "Failed to create pinned readback buffer" << std::endl;
+            if(slot.buffer)
+            {
+                _clContext->releaseBuffer(slot.buffer);
+            }
+            break;
+        }
+        _slots.push_back(slot);
+    }
+}
+
+ReadbackRing::~ReadbackRing()
+{
+    _clContext->finish();
+    for(Slot & slot : _slots)
+    {
+        _clContext->releaseEvent(slot.event);
+        _clContext->unmapBuffer(slot.buffer, slot.mapped);
+    }
+    _clContext->finish();
+    for(Slot & slot : _slots)
+    {
+        _clContext->releaseBuffer(slot.buffer);
+    }
+}
+
+bool ReadbackRing::isValid() const
+{
+    return !_slots.empty();
+}
+
+void ReadbackRing::setCallback(FrameCallback callback)
+{
+    _callback = callback;
+}
+
+bool ReadbackRing::enqueue(BufferId source, unsigned long long frameIndex, ColorFormat format, QueueType queue, const EventId * waitList, unsigned int waitCount)
+{
+    if(!isValid())
+    {
+        return false;
+    }
+
+    // Back pressure, the consumer is a full ring behind
+    if(_inFlight == _slots.size())
+    {
+        _stallCount++;
+        _clContext->waitForEvent(_slots[_oldestSlot].event);
+        _deliver(_slots[_oldestSlot]);
+    }
+
+    Slot & slot = _slots[_nextSlot];
+    slot.frameIndex = frameIndex;
+    slot.format = format;
+    size_t frameBytes = getColorFormatBytes(format) * static_cast<size_t>(_width) * _height;
+    if(!_clContext->enqueueWaitForEvents(queue, waitList, waitCount) ||
+       !_clContext->dowloadFromBuffer(source, frameBytes, slot.mapped, 0, false, &slot.event, queue))
+    {
+        return false;
+    }
+    _clContext->flush();
+
+    _nextSlot = (_nextSlot + 1) % _slots.size();
+    _inFlight++;
+    return true;
+}
+
+void ReadbackRing::poll()
+{
+    while(_inFlight > 0 && _clContext->isEventComplete(_slots[_oldestSlot].event))
+    {
+        _deliver(_slots[_oldestSlot]);
+    }
+}
+
+void ReadbackRing::drain()
+{
+    while(_inFlight > 0)
+    {
+        _clContext->waitForEvent(_slots[_oldestSlot].event);
+        _deliver(_slots[_oldestSlot]);
+    }
+}
+
+unsigned long long ReadbackRing::getStallCount() const
+{
+    return _stallCount;
+}
+
+void ReadbackRing::_deliver(Slot & slot)
+{
+    EventTimes transferTimes;
+    bool hasTransferTimes = _clContext->getEventTimes(slot.event, transferTimes);
+
+    _clContext->releaseEvent(slot.event);
+    slot.event = nullptr;
+
+    _oldestSlot = (_oldestSlot + 1) % _slots.size();
+    _inFlight--;
+
+    // The callback may replace itself
+    FrameCallback callback = _callback;
+    if(callback)
+    {
+        ReadbackFrame frame;
+        frame.frameIndex = slot.frameIndex;
+        frame.width = _width;
+        frame.height = _height;
+        frame.pixels = slot.mapped;
+        frame.format = slot.format;
+        frame.hasTransferTimes = hasTransferTimes;
+        frame.transferTimes = transferTimes;
+        callback(frame);
+    }
+}
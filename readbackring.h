@@ -0,0 +1,85 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+#include <colorformat.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+// A finished readback, pixels are only valid during the callback
+struct ReadbackFrame
+{
+    unsigned long long frameIndex;
+    int width;
+    int height;
+
+    // Row major with the y axis flipped (as rayTracingKernel writes it), decode with unpackColor
+    const void * pixels;
+    ColorFormat format;
+
+    // Device timestamps of the copy when the queue profiles
+    bool hasTransferTimes;
+    EventTimes transferTimes;
+};
+
+// Ring of pinned host buffers that read frames back without stalling the host.
+// Frame k is copied while the host prepares frame k+1, finished frames are
+// handed to the callback in order from poll().
+class ReadbackRing
+{
+public:
+    typedef std::function<void(const ReadbackFrame & frame)> FrameCallback;
+
+    ReadbackRing(std::shared_ptr<CLContextWrapper> context, int width, int height, size_t slots = 3);
+
+    ~ReadbackRing();
+
+    bool isValid() const;
+
+    void setCallback(FrameCallback callback);
+
+    // Queues a non blocking copy of source on queue after the wait list,
+    // waits for the oldest slot if all are in flight. Only the bytes of format are copied.
+    bool enqueue(BufferId source, unsigned long long frameIndex, ColorFormat format = ColorFormat::FLOAT4,
+                 QueueType queue = QueueType::COMPUTE, const EventId * waitList = nullptr, unsigned int waitCount = 0);
+
+    // Delivers every finished frame, never blocks
+    void poll();
+
+    // Waits for and delivers every frame in flight
+    void drain();
+
+    // Enqueues that had to wait for a busy slot
+    unsigned long long getStallCount() const;
+
+private:
+
+    struct Slot
+    {
+        BufferId buffer;
+        void * mapped;
+        EventId event;
+        unsigned long long frameIndex;
+        ColorFormat format;
+    };
+
+    void _deliver(Slot & slot);
+
+private:
+
+    std::shared_ptr<CLContextWrapper> _clContext;
+
+    int _width;
+    int _height;
+    size_t _slotBytes; // a float4 frame, the largest format
+
+    std::vector<Slot> _slots;
+    size_t _nextSlot;   // next to enqueue
+    size_t _oldestSlot; // next to deliver
+    size_t _inFlight;
+
+    FrameCallback _callback;
+
+    unsigned long long _stallCount;
+};
@@ -0,0 +1,204 @@
+#include "renderconfig.h"
+
+#include <algorithm>
+
+// Largest side tried for the 2D work group
+static const size_t MAX_LOCAL_SIDE = 16;
+
+std::string RenderConfig::getBuildOptions() const
+{
+    std::string options;
+    switch (sceneStorage)
+    {
+    case SceneStorage::CONSTANT:
+        options += " -D SCENE_STORAGE_CONSTANT";
+        break;
+    case SceneStorage::GLOBAL:
+        options += " -D SCENE_STORAGE_GLOBAL";
+        break;
+    case SceneStorage::IMAGE:
+        options += " -D SCENE_STORAGE_IMAGE";
+        options += CLContextWrapper::getSamplerBuildOption("SCENE_SAMPLER_FLAGS", getSceneTextureParams());
+        break;
+    case SceneStorage::LOCAL:
+    default:
+        options += " -D SCENE_STORAGE_LOCAL";
+        break;
+    }
+    options += getColorFormatBuildOption(colorFormat);
+    if(gbuffer)
+    {
+        options += " -D GBUFFER";
+    }
+    if(russianRoulette)
+    {
+        options += " -D RUSSIAN_ROULETTE";
+    }
+    if(instances)
+    {
+        options += " -D INSTANCES";
+    }
+    switch (sphereAcceleration)
+    {
+    case SphereAcceleration::LBVH:
+        options += " -D SPHERE_ACCELERATION_LBVH";
+        break;
+    case SphereAcceleration::GRID:
+        options += " -D SPHERE_ACCELERATION_GRID";
+        break;
+    case SphereAcceleration::NONE:
+    default:
+        break;
+    }
+    return options;
+}
+
+const char * RenderConfig::getSceneStorageName(SceneStorage storage)
+{
+    switch (storage)
+    {
+    case SceneStorage::CONSTANT:
+        return "constant";
+    case SceneStorage::LOCAL:
+        return "local";
+    case SceneStorage::GLOBAL:
+        return "global";
+    case SceneStorage::IMAGE:
+        return "image";
+    default:
+        return "unknown";
+    }
+}
+
+const char * RenderConfig::getDispatchModeName(DispatchMode mode)
+{
+    switch (mode)
+    {
+    case DispatchMode::NDRANGE:
+        return "ndrange";
+    case DispatchMode::PERSISTENT:
+        return "persistent";
+    case DispatchMode::WAVEFRONT:
+        return "wavefront";
+    default:
+        return "unknown";
+    }
+}
+
+const char * RenderConfig::getSphereAccelerationName(SphereAcceleration acceleration)
+{
+    switch (acceleration)
+    {
+    case SphereAcceleration::NONE:
+        return "none";
+    case SphereAcceleration::LBVH:
+        return "lbvh";
+    case SphereAcceleration::GRID:
+        return "grid";
+    default:
+        return "unknown";
+    }
+}
+
+size_t getLocalSceneBytes(const dwg::Scene & scene)
+{
+    // Spheres are float8 and padded to a float16 boundary, planes are float16
+    size_t sphereSlots = (scene.spheres.size() + 1) / 2;
+    return sizeof(float) * 16 * (sphereSlots + scene.planes.size());
+}
+
+size_t getLocalLightBytes(const dwg::Scene & scene)
+{
+    return sizeof(float) * 8 * scene.lights.size();
+}
+
+size_t getConstantSceneBytes(const dwg::Scene & scene)
+{
+    return sizeof(dwg::Sphere) * scene.spheres.size() +
+           sizeof(dwg::Plane) * scene.planes.size() +
+           sizeof(dwg::Light) * scene.lights.size();
+}
+
+void getSceneImageSize(const DeviceInfo & device, size_t texels, size_t & width, size_t & height)
+{
+    // A record never straddles two rows
+    size_t maxWidth = device.image2dMaxWidth - device.image2dMaxWidth % 4;
+    size_t paddedTexels = std::max<size_t>(4, (texels + 3) / 4 * 4);
+
+    width = std::min(maxWidth, paddedTexels);
+    height = width > 0 ? (paddedTexels + width - 1) / width : 0;
+}
+
+bool isSceneStorageSupported(const DeviceInfo & device, const dwg::Scene & scene, SceneStorage storage)
+{
+    switch (storage)
+    {
+    case SceneStorage::CONSTANT:
+        // The three arrays are separate __constant arguments and share the constant buffer
+        return device.maxConstantArgs >= 3 && getConstantSceneBytes(scene) <= device.maxConstantBufferSize;
+    case SceneStorage::LOCAL:
+        return getLocalSceneBytes(scene) + getLocalLightBytes(scene) <= device.localMemSize;
+    case SceneStorage::IMAGE:
+    {
+        if(!device.imageSupport)
+        {
+            return false;
+        }
+        size_t width = 0, height = 0;
+        getSceneImageSize(device, 2 * scene.spheres.size(), width, height);
+        bool spheresFit = width > 0 && height <= device.image2dMaxHeight;
+        getSceneImageSize(device, 4 * scene.planes.size(), width, height);
+        return spheresFit && width > 0 && height <= device.image2dMaxHeight;
+    }
+    case SceneStorage::GLOBAL:
+    default:
+        return true;
+    }
+}
+
+SceneStorage chooseSceneStorage(const DeviceInfo & device, const dwg::Scene & scene)
+{
+    // Emulated local and constant memory (usually CPUs) are plain global memory
+    if(!device.hasDedicatedLocalMem)
+    {
+        return SceneStorage::GLOBAL;
+    }
+
+    if(isSceneStorageSupported(device, scene, SceneStorage::CONSTANT))
+    {
+        return SceneStorage::CONSTANT;
+    }
+    if(isSceneStorageSupported(device, scene, SceneStorage::LOCAL))
+    {
+        return SceneStorage::LOCAL;
+    }
+    return SceneStorage::GLOBAL;
+}
+
+TextureParams getSceneTextureParams()
+{
+    TextureParams params;
+    params.wrapMode = TextureWrapMode::CLAMP;
+    params.filterMode = TextureFilterMode::NEAREST;
+    return params;
+}
+
+void chooseLocalSize(const DeviceInfo & device, size_t kernelWorkGroupSize, size_t & localSizeX, size_t & localSizeY)
+{
+    size_t maxItems = device.maxWorkGroupSize;
+    if(kernelWorkGroupSize > 0)
+    {
+        maxItems = std::min(maxItems, kernelWorkGroupSize);
+    }
+
+    size_t side = MAX_LOCAL_SIDE;
+    while(side > 1 && (side * side > maxItems ||
+                       (device.maxWorkItemSizes[0] > 0 && side > device.maxWorkItemSizes[0]) ||
+                       (device.maxWorkItemSizes[1] > 0 && side > device.maxWorkItemSizes[1])))
+    {
+        side >>= 1;
+    }
+
+    localSizeX = side;
+    localSizeY = side;
+}
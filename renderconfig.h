@@ -0,0 +1,102 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+#include <colorformat.h>
+#include <scene.h>
+
+#include <string>
+
+// Where rayTracingKernel reads the scene from
+enum class SceneStorage
+{
+    CONSTANT, // Read through the __constant cache, small scenes only
+    LOCAL,    // Staged into __local memory by every work group
+    GLOBAL,   // Read straight from __global memory
+    IMAGE     // Spheres and planes fetched through the texture cache, never chosen automatically
+};
+
+// How rayTracingKernel work is distributed
+enum class DispatchMode
+{
+    NDRANGE,    // One work item per pixel
+    PERSISTENT, // Few resident groups pulling tiles from an atomic counter
+    WAVEFRONT   // Primary rays first, then the queued secondary rays (optionally sorted)
+};
+
+// Device dependent choices for building and dispatching the tracing kernels
+struct RenderConfig
+{
+    SceneStorage sceneStorage;
+
+    size_t localSizeX;
+    size_t localSizeY;
+
+    DispatchMode dispatchMode;
+    int persistentTileSizeX;
+    int persistentTileSizeY;
+    int persistentGroupsPerComputeUnit;
+
+    // Wavefront mode orders secondary rays by direction octant and origin Morton code
+    bool sortSecondaryRays;
+
+    // Layout of the traced colors between the tracing kernels, presentation and readback.
+    // Half4 by default: the colors are linear until presented, half4 keeps the values
+    // above one that exposure and tone mapping work on and the precision gamma needs
+    // in the darks. Accumulated frames are averaged in float4 from them.
+    ColorFormat colorFormat;
+
+    // Primary pass kernels also store the G-buffer channels (see gbuffer.h)
+    bool gbuffer;
+
+    // Rays traced after the primary one at most, a kernel argument
+    int maxBounces;
+
+    // Paths past the first bounces end at random with a probability following their throughput
+    bool russianRoulette;
+
+    // The scene has instanced meshes or sphere groups, the tracing kernels take the instance arguments
+    bool instances;
+
+    // The scene's choice, anything but NONE adds the structure's arguments after the instance ones
+    SphereAcceleration sphereAcceleration;
+
+    RenderConfig() : sceneStorage(SceneStorage::LOCAL), localSizeX(16), localSizeY(16),
+                     dispatchMode(DispatchMode::NDRANGE), persistentTileSizeX(16), persistentTileSizeY(16),
+                     persistentGroupsPerComputeUnit(1), sortSecondaryRays(true), colorFormat(ColorFormat::HALF4),
+                     gbuffer(false), maxBounces(6), russianRoulette(false), instances(false),
+                     sphereAcceleration(SphereAcceleration::NONE)
+    {
+
+    }
+
+    std::string getBuildOptions() const;
+
+    static const char * getSceneStorageName(SceneStorage storage);
+
+    static const char * getDispatchModeName(DispatchMode mode);
+
+    static const char * getSphereAccelerationName(SphereAcceleration acceleration);
+};
+
+// Bytes of __local memory needed to stage spheres and planes
+size_t getLocalSceneBytes(const dwg::Scene & scene);
+
+// Bytes of __local memory needed to stage lights
+size_t getLocalLightBytes(const dwg::Scene & scene);
+
+// Bytes of the three scene arrays as uploaded
+size_t getConstantSceneBytes(const dwg::Scene & scene);
+
+// Image storage packs records as float4 texels in rows of a multiple of four texels
+void getSceneImageSize(const DeviceInfo & device, size_t texels, size_t & width, size_t & height);
+
+bool isSceneStorageSupported(const DeviceInfo & device, const dwg::Scene & scene, SceneStorage storage);
+
+// Constant when the scene fits the constant buffer, then local, then global
+SceneStorage chooseSceneStorage(const DeviceInfo & device, const dwg::Scene & scene);
+
+// Image scene storage fetches whole records texel by texel: nearest, clamped texel coordinates
+TextureParams getSceneTextureParams();
+
+// Largest square power of two local size accepted by both device and kernel
+void chooseLocalSize(const DeviceInfo & device, size_t kernelWorkGroupSize, size_t & localSizeX, size_t & localSizeY);
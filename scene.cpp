@@ -2,6 +2,11 @@
 #include <drawables.hpp>
 #include <vector>
 #include <scene.h>
+#include <bvh.h>
+
+#include <cmath>
+#include <limits>
+#include <random>
 
 std::vector<dwg::Sphere> getDefaultSceneSpheres()
 {
@@ -126,3 +131,143 @@ std::vector<dwg::Plane> getDefaultScenePlanes()
 
     return planes;
 }
+
+std::vector<dwg::Sphere> getDivergentSceneSpheres()
+{
+    std::vector<dwg::Sphere> spheres;
+    dwg::Sphere s;
+
+    // Grid of alternating mirror and glass spheres on the left
+    for(int i = 0 ; i < 4; i++)
+    {
+        for(int j = 0 ; j < 4; j++)
+        {
+            s.position = glm::vec3(-12.0f + 2.5f*i, -3.0f + 2.5f*j, 5.0f + 2.0f*((i+j)%2));
+            s.radius = 1.1f;
+            s.color = (i+j) % 2 == 0 ? glm::vec4(0.9f, 0.9f, 0.9f, 1.0f) : glm::vec4(1, 1, 1, -1.4f);
+            spheres.push_back(s);
+        }
+    }
+
+    // Diffuse sphere on the right, cheap pixels
+    s.position = glm::vec3(8,-1,20);
+    s.radius = 4.0f;
+    s.color = glm::vec4(1, 0.5f, 0, 0.0f);
+    spheres.push_back(s);
+
+    return spheres;
+}
+
+std::vector<dwg::Sphere> getRandomSceneSpheres(int count, unsigned int seed)
+{
+    std::vector<dwg::Sphere> spheres;
+    if(count <= 0)
+    {
+        return spheres;
+    }
+
+    // Inside the walls, floor and ceiling of getDefaultScenePlanes, in front of the camera
+    const glm::vec3 boundsMin(-14.0f, -4.0f, 5.0f);
+    const glm::vec3 boundsMax(14.0f, 19.0f, 48.0f);
+    glm::vec3 extent = boundsMax - boundsMin;
+    float spacing = std::cbrt(extent.x * extent.y * extent.z / count);
+
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    spheres.reserve(count);
+    dwg::Sphere s;
+    for(int i = 0 ; i < count; i++)
+    {
+        s.position = boundsMin + extent * glm::vec3(unit(generator), unit(generator), unit(generator));
+        s.radius = spacing * (0.15f + 0.15f * unit(generator));
+        s.color = glm::vec4(unit(generator), unit(generator), unit(generator), 0.0f);
+        spheres.push_back(s);
+    }
+    return spheres;
+}
+
+void getSceneBounds(const dwg::Scene & scene, glm::vec3 & boundsMin, glm::vec3 & boundsMax)
+{
+    boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+    for(const dwg::Sphere & s : scene.spheres)
+    {
+        boundsMin = glm::min(boundsMin, s.position - glm::vec3(s.radius));
+        boundsMax = glm::max(boundsMax, s.position + glm::vec3(s.radius));
+    }
+    for(const dwg::Plane & p : scene.planes)
+    {
+        boundsMin = glm::min(boundsMin, p.position);
+        boundsMax = glm::max(boundsMax, p.position);
+    }
+    for(const dwg::Light & l : scene.lights)
+    {
+        boundsMin = glm::min(boundsMin, l.position);
+        boundsMax = glm::max(boundsMax, l.position);
+    }
+
+    // Object space boxes of the geometry, moved by every instance
+    std::vector<BVHBounds> meshBounds(scene.meshes.size());
+    for(size_t i = 0 ; i < scene.meshes.size(); i++)
+    {
+        for(const glm::vec3 & v : scene.meshes[i].vertices)
+        {
+            meshBounds[i].grow(v);
+        }
+    }
+    std::vector<BVHBounds> groupBounds(scene.sphereGroups.size());
+    for(size_t i = 0 ; i < scene.sphereGroups.size(); i++)
+    {
+        for(const dwg::Sphere & s : scene.sphereGroups[i].spheres)
+        {
+            groupBounds[i].grow(s.position - glm::vec3(s.radius));
+            groupBounds[i].grow(s.position + glm::vec3(s.radius));
+        }
+    }
+    for(const dwg::Instance & instance : getSceneInstances(scene))
+    {
+        const std::vector<BVHBounds> & bounds = instance.type == dwg::GeometryType::MESH ? meshBounds : groupBounds;
+        if(instance.geometry < 0 || instance.geometry >= static_cast<int>(bounds.size()) ||
+           bounds[instance.geometry].isEmpty())
+        {
+            continue;
+        }
+        BVHBounds moved = bounds[instance.geometry].getTransformed(instance.transform);
+        boundsMin = glm::min(boundsMin, moved.boundsMin);
+        boundsMax = glm::max(boundsMax, moved.boundsMax);
+    }
+
+    if(boundsMin.x > boundsMax.x)
+    {
+        boundsMin = boundsMax = glm::vec3(0.0f);
+    }
+}
+
+std::vector<dwg::Instance> getSceneInstances(const dwg::Scene & scene)
+{
+    std::vector<dwg::Instance> instances = scene.instances;
+
+    std::vector<bool> referenced(scene.meshes.size(), false);
+    for(const dwg::Instance & instance : scene.instances)
+    {
+        if(instance.type == dwg::GeometryType::MESH && instance.geometry >= 0 &&
+           instance.geometry < static_cast<int>(referenced.size()))
+        {
+            referenced[instance.geometry] = true;
+        }
+    }
+
+    for(size_t i = 0 ; i < scene.meshes.size(); i++)
+    {
+        if(!referenced[i])
+        {
+            dwg::Instance instance;
+            instance.type = dwg::GeometryType::MESH;
+            instance.geometry = static_cast<int>(i);
+            instances.push_back(instance);
+        }
+    }
+    return instances;
+}
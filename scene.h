@@ -1,20 +1,81 @@
 #pragma once
 
 #include <drawables.hpp>
+#include <mesh.h>
+
 #include <vector>
 
+// How traceRay finds the spheres a ray hits, both structures are rebuilt on the
+// device whenever the spheres change
+enum class SphereAcceleration
+{
+    NONE, // Every sphere is tested
+    LBVH, // Linear BVH, for large scenes
+    GRID  // Uniform grid, cheapest to rebuild for scenes where everything moves
+};
+
 namespace dwg
 {
-    typedef struct
+    // Spheres in object space, only drawn through instances
+    struct SphereGroup
+    {
+        std::vector<dwg::Sphere> spheres;
+    };
+
+    enum class GeometryType
+    {
+        MESH,
+        SPHERE_GROUP
+    };
+
+    // Places a mesh or sphere group of the scene with an affine transform,
+    // the geometry itself is stored once however many instances use it
+    struct Instance
+    {
+        GeometryType type;
+        int geometry; // index into meshes or sphereGroups
+        glm::mat4 transform; // object to world
+
+        Instance() : type(GeometryType::MESH), geometry(0), transform(1.0f)
+        {
+
+        }
+    };
+
+    // Meshes no instance refers to are drawn once as they are
+    struct Scene
     {
         std::vector<dwg::Sphere> spheres;
         std::vector<dwg::Plane> planes;
         std::vector<dwg::Light> lights;
-    } Scene;
+        std::vector<dwg::Mesh> meshes;
+        std::vector<dwg::SphereGroup> sphereGroups;
+        std::vector<dwg::Instance> instances;
+
+        // Applied by RayTracing::setScene
+        SphereAcceleration sphereAcceleration;
+
+        Scene() : sphereAcceleration(SphereAcceleration::NONE)
+        {
+
+        }
+    };
 }
 
+// Explicit instances followed by one identity instance per mesh no instance refers to
+std::vector<dwg::Instance> getSceneInstances(const dwg::Scene & scene);
+
 std::vector<dwg::Sphere> getDefaultSceneSpheres();
 
 std::vector<dwg::Light> getDefaultSceneLights();
 
 std::vector<dwg::Plane> getDefaultScenePlanes();
+
+// Box around spheres, instances, lights and plane anchors (planes themselves are unbounded)
+void getSceneBounds(const dwg::Scene & scene, glm::vec3 & boundsMin, glm::vec3 & boundsMax);
+
+// Mirrors and glass packed on one side of the view, so a few tiles take most of the bounces
+std::vector<dwg::Sphere> getDivergentSceneSpheres();
+
+// Diffuse spheres of random colors spread evenly through the default room, smaller the more there are
+std::vector<dwg::Sphere> getRandomSceneSpheres(int count, unsigned int seed = 1);
@@ -0,0 +1,410 @@
+#include "spheregrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+
+// One dimensional groups of the build kernels at most
+static const size_t MAX_LOCAL_SIZE = 256;
+
+// Grids grow their cells rather than go past this many cells
+static const int64_t MAX_GRID_CELLS = int64_t(1) << 24;
+
+// Cells never get smaller than this, keeps points and tiny spheres finite
+static const float MIN_CELL_SIZE = 1e-3f;
+
+// A sphere spans 2 cells per axis at most as cells are at least its diameter
+static const size_t MAX_CELLS_PER_SPHERE = 8;
+
+glm::ivec3 SphereGridParams::getCell(const glm::vec3 & p) const
+{
+    glm::vec3 cell = glm::floor((p - gridMin) / cellSize);
+    return glm::clamp(glm::ivec3(cell), glm::ivec3(0), resolution - glm::ivec3(1));
+}
+
+SphereGridParams getSphereGridParams(const std::vector<dwg::Sphere> & spheres, float cellsPerSphere)
+{
+    SphereGridParams params;
+    if(spheres.empty())
+    {
+        params.gridMin = glm::vec3(0.0f);
+        return params;
+    }
+
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+    float maxRadius = 0.0f;
+    for(const dwg::Sphere & sphere : spheres)
+    {
+        boundsMin = glm::min(boundsMin, sphere.position - glm::vec3(sphere.radius));
+        boundsMax = glm::max(boundsMax, sphere.position + glm::vec3(sphere.radius));
+        maxRadius = std::max(maxRadius, sphere.radius);
+    }
+
+    glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(MIN_CELL_SIZE));
+    float volume = extent.x * extent.y * extent.z;
+    float targetCells = std::max(cellsPerSphere, 1e-3f) * static_cast<float>(spheres.size());
+    float cellSize = std::max({std::cbrt(volume / targetCells), 2.0f * maxRadius, MIN_CELL_SIZE});
+
+    glm::ivec3 resolution;
+    for(;;)
+    {
+        int64_t numCells = 1;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            resolution[axis] = std::max(1, static_cast<int>(std::ceil(extent[axis] / cellSize)));
+            numCells *= resolution[axis];
+        }
+        if(numCells <= MAX_GRID_CELLS)
+        {
+            break;
+        }
+        cellSize *= 1.25f;
+    }
+
+    params.gridMin = boundsMin;
+    params.cellSize = cellSize;
+    params.resolution = resolution;
+    return params;
+}
+
+SphereGrid buildSphereGrid(const std::vector<dwg::Sphere> & spheres, float cellsPerSphere)
+{
+    SphereGrid grid;
+    grid.params = getSphereGridParams(spheres, cellsPerSphere);
+    const SphereGridParams & params = grid.params;
+
+    // Counts, then an exclusive scan of them into the starts
+    std::vector<int> counts(params.getNumCells() + 1, 0);
+    for(const dwg::Sphere & sphere : spheres)
+    {
+        glm::ivec3 first = params.getCell(sphere.position - glm::vec3(sphere.radius));
+        glm::ivec3 last = params.getCell(sphere.position + glm::vec3(sphere.radius));
+        for(int z = first.z; z <= last.z; z++)
+        {
+            for(int y = first.y; y <= last.y; y++)
+            {
+                for(int x = first.x; x <= last.x; x++)
+                {
+                    counts[params.getCellIndex(glm::ivec3(x, y, z))]++;
+                }
+            }
+        }
+    }
+
+    grid.cellStarts.resize(counts.size());
+    int total = 0;
+    for(size_t i = 0; i < counts.size(); i++)
+    {
+        grid.cellStarts[i] = total;
+        total += counts[i];
+    }
+
+    // Scatter, the cursors count up here so cells keep the scene order
+    grid.sphereIndices.resize(static_cast<size_t>(total));
+    std::vector<int> cursors(grid.cellStarts.begin(), grid.cellStarts.end() - 1);
+    for(size_t i = 0; i < spheres.size(); i++)
+    {
+        const dwg::Sphere & sphere = spheres[i];
+        glm::ivec3 first = params.getCell(sphere.position - glm::vec3(sphere.radius));
+        glm::ivec3 last = params.getCell(sphere.position + glm::vec3(sphere.radius));
+        for(int z = first.z; z <= last.z; z++)
+        {
+            for(int y = first.y; y <= last.y; y++)
+            {
+                for(int x = first.x; x <= last.x; x++)
+                {
+                    grid.sphereIndices[cursors[params.getCellIndex(glm::ivec3(x, y, z))]++] = static_cast<int>(i);
+                }
+            }
+        }
+    }
+    return grid;
+}
+
+// Distance to the first hit in front of origin, as hasInterceptedSphere in raytracing.cl
+static bool intersectSphere(const dwg::Sphere & sphere, const glm::vec3 & origin, const glm::vec3 & dir, float & distance)
+{
+    glm::vec3 L = origin - sphere.position;
+    float a = glm::dot(dir, dir);
+    float b = 2.0f * glm::dot(L, dir);
+    float c = glm::dot(L, L) - sphere.radius * sphere.radius;
+    float discr = b * b - 4.0f * a * c;
+    if(discr < 0.0f)
+    {
+        return false;
+    }
+
+    float q = (b > 0.0f) ? -0.5f * (b + std::sqrt(discr)) : -0.5f * (b - std::sqrt(discr));
+    float t0 = q / a;
+    float t1 = (q != 0.0f) ? c / q : t0;
+    if(t0 > t1)
+    {
+        std::swap(t0, t1);
+    }
+    if(t0 < 0.0f)
+    {
+        t0 = t1;
+        if(t0 < 0.0f)
+        {
+            return false;
+        }
+    }
+
+    distance = t0 * std::sqrt(a);
+    return true;
+}
+
+int traceSphereGrid(const SphereGrid & grid, const std::vector<dwg::Sphere> & spheres,
+                    const glm::vec3 & origin, const glm::vec3 & dir, float maxDist, float & distance)
+{
+    const float dirLength = glm::length(dir);
+    if(spheres.empty() || dirLength == 0.0f)
+    {
+        return -1;
+    }
+
+    // Clip the ray to the grid box, ray parameters are in units of dir
+    const SphereGridParams & params = grid.params;
+    const glm::vec3 gridMax = params.gridMin + glm::vec3(params.resolution) * params.cellSize;
+    const glm::vec3 invDir = glm::vec3(1.0f) / dir;
+    const glm::vec3 t0 = (params.gridMin - origin) * invDir;
+    const glm::vec3 t1 = (gridMax - origin) * invDir;
+    const glm::vec3 tNear = glm::min(t0, t1);
+    const glm::vec3 tFar = glm::max(t0, t1);
+    const float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDist / dirLength));
+    if(tEnter > tExit)
+    {
+        return -1;
+    }
+
+    glm::ivec3 cell = params.getCell(origin + dir * tEnter);
+    glm::ivec3 step;
+    glm::vec3 tNext;
+    glm::vec3 tDelta;
+    for(int axis = 0; axis < 3; axis++)
+    {
+        step[axis] = dir[axis] >= 0.0f ? 1 : -1;
+        float nextBoundary = params.gridMin[axis] + static_cast<float>(cell[axis] + std::max(step[axis], 0)) * params.cellSize;
+        tNext[axis] = dir[axis] == 0.0f ? std::numeric_limits<float>::max() : (nextBoundary - origin[axis]) * invDir[axis];
+        tDelta[axis] = std::fabs(params.cellSize * invDir[axis]);
+    }
+
+    float closest = maxDist;
+    int closestIdx = -1;
+    for(;;)
+    {
+        const int cellIdx = params.getCellIndex(cell);
+        for(int i = grid.cellStarts[cellIdx]; i < grid.cellStarts[cellIdx + 1]; i++)
+        {
+            const int sphereIdx = grid.sphereIndices[i];
+            float dist;
+            if(intersectSphere(spheres[sphereIdx], origin, dir, dist) && dist < closest)
+            {
+                closest = dist;
+                closestIdx = sphereIdx;
+            }
+        }
+
+        // Later cells only hold hits past this cell's exit
+        const float cellExit = std::min(tNext.x, std::min(tNext.y, tNext.z));
+        if(cellExit > tExit || (closestIdx >= 0 && closest <= cellExit * dirLength))
+        {
+            break;
+        }
+
+        int axis = (tNext.x <= tNext.y && tNext.x <= tNext.z) ? 0 : (tNext.y <= tNext.z ? 1 : 2);
+        cell[axis] += step[axis];
+        tNext[axis] += tDelta[axis];
+        if(cell[axis] < 0 || cell[axis] >= params.resolution[axis])
+        {
+            break;
+        }
+    }
+
+    if(closestIdx >= 0)
+    {
+        distance = closest;
+    }
+    return closestIdx;
+}
+
+int traceSpheresLinear(const std::vector<dwg::Sphere> & spheres,
+                       const glm::vec3 & origin, const glm::vec3 & dir, float maxDist, float & distance)
+{
+    float closest = maxDist;
+    int closestIdx = -1;
+    for(size_t i = 0; i < spheres.size(); i++)
+    {
+        float dist;
+        if(intersectSphere(spheres[i], origin, dir, dist) && dist < closest)
+        {
+            closest = dist;
+            closestIdx = static_cast<int>(i);
+        }
+    }
+
+    if(closestIdx >= 0)
+    {
+        distance = closest;
+    }
+    return closestIdx;
+}
+
+SphereGridBuilder::SphereGridBuilder(std::shared_ptr<CLContextWrapper> context, std::shared_ptr<RadixSorter> sorter) :
+    _clContext(context), _radixSorter(sorter), _localSize(0), _cellCapacity(0), _sphereCapacity(0),
+    _paramsBufferId(nullptr), _countsBufferId(nullptr), _cellStartsBufferId(nullptr), _sphereIndicesBufferId(nullptr)
+{
+
+}
+
+bool SphereGridBuilder::prepareKernels()
+{
+    _clearKernel = _clContext->prepareKernel("gridClearKernel");
+    _countKernel = _clContext->prepareKernel("gridCountKernel");
+    _scatterKernel = _clContext->prepareKernel("gridScatterKernel");
+
+    _localSize = std::min(MAX_LOCAL_SIZE, _clContext->getDeviceInfo().maxWorkGroupSize);
+    for(const BoundKernel * kernel : {&_clearKernel, &_countKernel, &_scatterKernel})
+    {
+        if(!kernel->isValid())
+        {
+            _localSize = 0;
+            return false;
+        }
+        _localSize = std::min(_localSize, kernel->getWorkGroupSize());
+    }
+    return _localSize > 0;
+}
+
+bool SphereGridBuilder::reserve(size_t maxCells, size_t maxSpheres)
+{
+    if(!_paramsBufferId)
+    {
+        _paramsBufferId = _clContext->createBuffer(sizeof(float) * 8, nullptr, BufferType::READ_AND_WRITE);
+        if(!_paramsBufferId)
+        {
+            std::cout << "Failed to create sphere grid buffers" << std::endl;
+            return false;
+        }
+    }
+
+    // One more count than cells so the scan also yields the end of the last cell
+    maxCells = std::max<size_t>(maxCells, 1);
+    if(maxCells > _cellCapacity)
+    {
+        for(BufferId * bufferId : {&_countsBufferId, &_cellStartsBufferId})
+        {
+            if(*bufferId)
+            {
+                _clContext->releaseBuffer(*bufferId);
+                *bufferId = nullptr;
+            }
+        }
+
+        _countsBufferId     = _clContext->createBuffer(sizeof(int) * (maxCells + 1), nullptr, BufferType::READ_AND_WRITE);
+        _cellStartsBufferId = _clContext->createBuffer(sizeof(int) * (maxCells + 1), nullptr, BufferType::READ_AND_WRITE);
+        if(!_countsBufferId || !_cellStartsBufferId || !_radixSorter->reserve(maxCells + 1))
+        {
+            std::cout << "Failed to create sphere grid buffers" << std::endl;
+            _cellCapacity = 0;
+            return false;
+        }
+        _cellCapacity = maxCells;
+    }
+
+    maxSpheres = std::max<size_t>(maxSpheres, 1);
+    if(maxSpheres > _sphereCapacity)
+    {
+        if(_sphereIndicesBufferId)
+        {
+            _clContext->releaseBuffer(_sphereIndicesBufferId);
+        }
+
+        _sphereIndicesBufferId = _clContext->createBuffer(sizeof(int) * MAX_CELLS_PER_SPHERE * maxSpheres, nullptr, BufferType::READ_AND_WRITE);
+        if(!_sphereIndicesBufferId)
+        {
+            std::cout << "Failed to create sphere grid buffers" << std::endl;
+            _sphereCapacity = 0;
+            return false;
+        }
+        _sphereCapacity = maxSpheres;
+    }
+    return true;
+}
+
+bool SphereGridBuilder::build(BufferId spheres, int numSpheres, const SphereGridParams & params)
+{
+    const int numCells = params.getNumCells();
+    if(_localSize == 0 || !reserve(static_cast<size_t>(numCells), static_cast<size_t>(std::max(numSpheres, 1))))
+    {
+        return false;
+    }
+
+    bool ok = _clearKernel.setArg(0, _countsBufferId);
+    ok &= _clearKernel.setArg(1, _paramsBufferId);
+    ok &= _clearKernel.setArg(2, params.gridMin.x);
+    ok &= _clearKernel.setArg(3, params.gridMin.y);
+    ok &= _clearKernel.setArg(4, params.gridMin.z);
+    ok &= _clearKernel.setArg(5, params.cellSize);
+    ok &= _clearKernel.setArg(6, params.resolution.x);
+    ok &= _clearKernel.setArg(7, params.resolution.y);
+    ok &= _clearKernel.setArg(8, params.resolution.z);
+    ok = ok && _clContext->dispatchKernel(_clearKernel, _getRange(numCells + 1));
+
+    if(ok && numSpheres > 0)
+    {
+        ok &= _countKernel.setArg(0, spheres);
+        ok &= _countKernel.setArg(1, _paramsBufferId);
+        ok &= _countKernel.setArg(2, _countsBufferId);
+        ok &= _countKernel.setArg(3, numSpheres);
+        ok = ok && _clContext->dispatchKernel(_countKernel, _getRange(numSpheres));
+    }
+
+    ok = ok && _radixSorter->exclusiveScan(_countsBufferId, _cellStartsBufferId, static_cast<size_t>(numCells) + 1);
+
+    if(ok && numSpheres > 0)
+    {
+        ok &= _scatterKernel.setArg(0, spheres);
+        ok &= _scatterKernel.setArg(1, _paramsBufferId);
+        ok &= _scatterKernel.setArg(2, _cellStartsBufferId);
+        ok &= _scatterKernel.setArg(3, _countsBufferId);
+        ok &= _scatterKernel.setArg(4, _sphereIndicesBufferId);
+        ok &= _scatterKernel.setArg(5, numSpheres);
+        ok = ok && _clContext->dispatchKernel(_scatterKernel, _getRange(numSpheres));
+    }
+
+    if(!ok)
+    {
+        std::cout << "Sphere grid build failed" << std::endl;
+    }
+    return ok;
+}
+
+BufferId SphereGridBuilder::getParams() const
+{
+    return _paramsBufferId;
+}
+
+BufferId SphereGridBuilder::getCellStarts() const
+{
+    return _cellStartsBufferId;
+}
+
+BufferId SphereGridBuilder::getSphereIndices() const
+{
+    return _sphereIndicesBufferId;
+}
+
+NDRange SphereGridBuilder::_getRange(int count) const
+{
+    NDRange range;
+    range.workDim = 1;
+    range.globalSize[0] = static_cast<size_t>(count);
+    range.localSize[0] = _localSize;
+    range.padGlobalSize();
+    return range;
+}
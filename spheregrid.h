@@ -0,0 +1,116 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+#include <drawables.hpp>
+#include <radixsort.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Cubic cells over the sphere boxes, never smaller than the largest sphere so
+// a sphere overlaps eight cells at most
+struct SphereGridParams
+{
+    glm::vec3 gridMin;
+    float cellSize;
+    glm::ivec3 resolution;
+
+    SphereGridParams() : cellSize(1.0f), resolution(1, 1, 1)
+    {
+
+    }
+
+    int getNumCells() const
+    {
+        return resolution.x * resolution.y * resolution.z;
+    }
+
+    // Cell of a point, points outside are moved to the nearest cell
+    glm::ivec3 getCell(const glm::vec3 & p) const;
+
+    int getCellIndex(const glm::ivec3 & cell) const
+    {
+        return (cell.z * resolution.y + cell.y) * resolution.x + cell.x;
+    }
+};
+
+// Grids aim at about cellsPerSphere cells per sphere
+SphereGridParams getSphereGridParams(const std::vector<dwg::Sphere> & spheres, float cellsPerSphere = 2.0f);
+
+// Host copy of a grid, laid out as in grid.cl: the spheres of cell c are
+// sphereIndices[cellStarts[c]] up to cellStarts[c + 1]
+struct SphereGrid
+{
+    SphereGridParams params;
+    std::vector<int> cellStarts;
+    std::vector<int> sphereIndices;
+
+    size_t getBytes() const
+    {
+        return sizeof(int) * (cellStarts.size() + sphereIndices.size());
+    }
+};
+
+// Counting sort on the host, the same count, scan and scatter passes as on the device
+SphereGrid buildSphereGrid(const std::vector<dwg::Sphere> & spheres, float cellsPerSphere = 2.0f);
+
+// Closest sphere hit along origin + t * dir nearer than maxDist, -1 for none,
+// distance gets its distance from origin. 3D-DDA through the cells as in traceRay.
+int traceSphereGrid(const SphereGrid & grid, const std::vector<dwg::Sphere> & spheres,
+                    const glm::vec3 & origin, const glm::vec3 & dir, float maxDist, float & distance);
+
+// Same answer testing every sphere, as the linear loop of traceRay
+int traceSpheresLinear(const std::vector<dwg::Sphere> & spheres,
+                       const glm::vec3 & origin, const glm::vec3 & dir, float maxDist, float & distance);
+
+// Builds the grid on the device: counts per cell, an exclusive scan of them
+// with the RadixSorter and a scatter, without any host round trip. The kernels
+// live in grid.cl, which must be part of the program built on the context
+// together with the sorter's kernels.
+class SphereGridBuilder
+{
+public:
+    SphereGridBuilder(std::shared_ptr<CLContextWrapper> context, std::shared_ptr<RadixSorter> sorter);
+
+    // Call after every program build, after the sorter's
+    bool prepareKernels();
+
+    // Buffers for grids of up to maxCells cells over up to maxSpheres spheres
+    bool reserve(size_t maxCells, size_t maxSpheres);
+
+    // Builds the grid of numSpheres float8 spheres (as uploaded for the scene)
+    // on the compute queue, params usually come from getSphereGridParams
+    bool build(BufferId spheres, int numSpheres, const SphereGridParams & params);
+
+    // Float8 parameters, cell starts and sphere indices as read by traceRay
+    BufferId getParams() const;
+
+    BufferId getCellStarts() const;
+
+    BufferId getSphereIndices() const;
+
+private:
+
+    NDRange _getRange(int count) const;
+
+private:
+
+    std::shared_ptr<CLContextWrapper> _clContext;
+    std::shared_ptr<RadixSorter> _radixSorter;
+
+    BoundKernel _clearKernel;
+    BoundKernel _countKernel;
+    BoundKernel _scatterKernel;
+
+    size_t _localSize;
+
+    size_t _cellCapacity;
+    size_t _sphereCapacity;
+    BufferId _paramsBufferId;
+    BufferId _countsBufferId;
+    BufferId _cellStartsBufferId;
+    BufferId _sphereIndicesBufferId;
+};
@@ -0,0 +1,164 @@
+#include "workgrouptuner.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+static const size_t CANDIDATE_SIDES[] = {1, 2, 4, 8, 16, 32, 64};
+
+// Keys are stored as the first field of a tab separated line
+static std::string sanitize(const std::string & text)
+{
+    std::string result = text;
+    for(char & c : result)
+    {
+        if(c == '\t' || c == '\n' || c == '\r')
+        {
+            c = ' ';
+        }
+    }
+    return result;
+}
+
+// 64 bit FNV-1a, the cache outlives builds so std::hash (implementation defined) will not do
+static uint64_t hashFNV1a(const std::string & text, uint64_t hash = 14695981039346656037ull)
+{
+    for(unsigned char c : text)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+WorkGroupTuner::WorkGroupTuner(const std::string & cachePath) : _cachePath(cachePath)
+{
+    _load();
+}
+
+bool WorkGroupTuner::lookup(const std::string & key, LocalSize & localSize) const
+{
+    auto it = _results.find(key);
+    if(it == _results.end())
+    {
+        return false;
+    }
+    localSize = it->second;
+    return true;
+}
+
+LocalSize WorkGroupTuner::tune(const std::string & key, const std::vector<LocalSize> & candidates, MeasureFunction measure)
+{
+    LocalSize best;
+    double bestTime = std::numeric_limits<double>::max();
+
+    for(const LocalSize & candidate : candidates)
+    {
+        double time = measure(candidate);
+        if(time < 0.0)
+        {
+            continue;
+        }
+
+        std::cout << "Local size " << candidate.x << "x" << candidate.y << ": " << time << " ms" << std::endl;
+        if(time < bestTime)
+        {
+            bestTime = time;
+            best = candidate;
+        }
+    }
+
+    if(best.x == 0)
+    {
+        std::cout << "Work group tuning failed for all candidates" << std::endl;
+        return best;
+    }
+
+    std::cout << "Best local size " << best.x << "x" << best.y << " (" << bestTime << " ms)" << std::endl;
+
+    _results[key] = best;
+    if(!_save())
+    {
+        std::cout << "Failed to save work group tuning to " << _cachePath << std::endl;
+    }
+    return best;
+}
+
+std::string WorkGroupTuner::makeKey(const DeviceInfo & device, const std::string & kernelName, const std::string & kernelSource, const std::string & buildOptions)
+{
+    std::stringstream ss;
+    ss << sanitize(device.name) << "|" << sanitize(device.driverVersion) << "|" << kernelName << "|"
+       << std::hex << hashFNV1a(buildOptions, hashFNV1a(kernelSource + '\0'));
+    return ss.str();
+}
+
+std::vector<LocalSize> WorkGroupTuner::getCandidates(const DeviceInfo & device, size_t kernelWorkGroupSize, size_t preferredMultiple)
+{
+    size_t maxItems = device.maxWorkGroupSize;
+    if(kernelWorkGroupSize > 0)
+    {
+        maxItems = std::min(maxItems, kernelWorkGroupSize);
+    }
+
+    std::vector<LocalSize> candidates;
+    for(size_t x : CANDIDATE_SIDES)
+    {
+        for(size_t y : CANDIDATE_SIDES)
+        {
+            size_t items = x * y;
+            if(items > maxItems || items < 16)
+            {
+                continue;
+            }
+            if(x > device.maxWorkItemSizes[0] || y > device.maxWorkItemSizes[1])
+            {
+                continue;
+            }
+            // Partial hardware threads are wasted lanes
+            if(preferredMultiple > 1 && items % preferredMultiple != 0 && items > preferredMultiple)
+            {
+                continue;
+            }
+            candidates.push_back(LocalSize(x, y));
+        }
+    }
+    return candidates;
+}
+
+void WorkGroupTuner::_load()
+{
+    std::ifstream file(_cachePath);
+    if(!file.is_open())
+    {
+        return;
+    }
+
+    for(std::string line; std::getline(file, line);)
+    {
+        std::istringstream fields(line);
+        std::string key;
+        LocalSize localSize;
+        if(std::getline(fields, key, '\t') && (fields >> localSize.x >> localSize.y) && localSize.x > 0 && localSize.y > 0)
+        {
+            _results[key] = localSize;
+        }
+    }
+}
+
+bool WorkGroupTuner::_save() const
+{
+    std::ofstream file(_cachePath, std::ios::trunc);
+    if(!file.is_open())
+    {
+        return false;
+    }
+
+    for(const auto & result : _results)
+    {
+        file << result.first << "\t" << result.second.x << "\t" << result.second.y << std::endl;
+    }
+    return file.good();
+}
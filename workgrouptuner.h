@@ -0,0 +1,55 @@
+#pragma once
+
+#include <clcontextwrapper.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct LocalSize
+{
+    size_t x;
+    size_t y;
+
+    LocalSize() : x(0), y(0)
+    {
+
+    }
+
+    LocalSize(size_t aX, size_t aY) : x(aX), y(aY)
+    {
+
+    }
+};
+
+// Finds the fastest 2D local size of a kernel by timing candidates and
+// remembers the winner per device, driver and kernel source in a text file.
+class WorkGroupTuner
+{
+public:
+    // Measure returns the time of one dispatch in ms, or a negative value on failure
+    typedef std::function<double(LocalSize localSize)> MeasureFunction;
+
+    WorkGroupTuner(const std::string & cachePath);
+
+    bool lookup(const std::string & key, LocalSize & localSize) const;
+
+    LocalSize tune(const std::string & key, const std::vector<LocalSize> & candidates, MeasureFunction measure);
+
+    static std::string makeKey(const DeviceInfo & device, const std::string & kernelName, const std::string & kernelSource, const std::string & buildOptions);
+
+    static std::vector<LocalSize> getCandidates(const DeviceInfo & device, size_t kernelWorkGroupSize, size_t preferredMultiple);
+
+private:
+
+    void _load();
+
+    bool _save() const;
+
+private:
+
+    std::string _cachePath;
+
+    std::unordered_map<std::string, LocalSize> _results;
+};